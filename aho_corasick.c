@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aho_corasick.h"
+
+// After construction, transitions hold the offset of the target state's
+// row rather than its number, with this bit set if the target state
+// reports a pattern.  That keeps the matching loop down to a load, an
+// add and a test per byte.
+#define AC_MATCH ((uint32_t)1 << 31)
+
+int ac_init(struct ac *ac, const char *const *patterns, size_t n)
+{
+  memset(ac, 0, sizeof(struct ac));
+
+  // Give every byte that occurs in a pattern its own column.  Column 0
+  // is shared by all other bytes.
+  size_t maxstates = 1;
+  ac->nclasses = 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (patterns[i] == NULL)
+    {
+      continue;
+    }
+    const unsigned char *first = (const unsigned char *)patterns[i];
+    if (*first != '\0' && !ac->starts[*first])
+    {
+      ac->starts[*first] = 1;
+      ac->nstarts++;
+      ac->first = *first;
+    }
+    for (const unsigned char *p = first; *p != '\0'; p++)
+    {
+      if (ac->classes[*p] == 0)
+      {
+        ac->classes[*p] = (unsigned char)ac->nclasses++;
+      }
+      maxstates++;
+    }
+  }
+
+  if (maxstates > (AC_MATCH - 1) / ac->nclasses)
+  {
+    return -1;
+  }
+
+  ac->npatterns = n;
+  ac->next = calloc(maxstates * ac->nclasses, sizeof(uint32_t));
+  ac->out = malloc(maxstates * sizeof(int));
+  ac->lens = calloc(n > 0 ? n : 1, sizeof(size_t));
+  uint32_t *fail = malloc(maxstates * sizeof(uint32_t));
+  uint32_t *queue = malloc(maxstates * sizeof(uint32_t));
+  if (ac->next == NULL || ac->out == NULL || ac->lens == NULL
+      || fail == NULL || queue == NULL)
+  {
+    free(fail);
+    free(queue);
+    ac_destroy(ac);
+    return -1;
+  }
+
+  // Build the trie.  State 0 is the root; since it is never a child, a
+  // 0 transition means "no child" until the failure links are filled in.
+  for (size_t s = 0; s < maxstates; s++)
+  {
+    ac->out[s] = -1;
+  }
+  ac->nstates = 1;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    if (patterns[i] == NULL)
+    {
+      continue;
+    }
+
+    uint32_t s = 0;
+    const unsigned char *p = (const unsigned char *)patterns[i];
+    for (; *p != '\0'; p++)
+    {
+      uint32_t *t = &ac->next[s * ac->nclasses + ac->classes[*p]];
+      if (*t == 0)
+      {
+        *t = (uint32_t)ac->nstates++;
+      }
+      s = *t;
+    }
+    ac->lens[i] = (size_t)(p - (const unsigned char *)patterns[i]);
+    if (ac->out[s] < 0)
+    {
+      ac->out[s] = (int)i;
+    }
+  }
+
+  // Shared prefixes usually leave the table much larger than needed.
+  uint32_t *smaller = realloc(ac->next, ac->nstates * ac->nclasses * sizeof(uint32_t));
+  if (smaller != NULL)
+  {
+    ac->next = smaller;
+  }
+
+  // Breadth-first, turn missing transitions into the transition of the
+  // failure state (which is shallower, so already complete), and let
+  // states without a pattern of their own report the longest pattern
+  // that is a suffix of them.
+  size_t head = 0;
+  size_t tail = 0;
+  for (size_t c = 0; c < ac->nclasses; c++)
+  {
+    uint32_t t = ac->next[c];
+    if (t != 0)
+    {
+      fail[t] = 0;
+      queue[tail++] = t;
+    }
+  }
+
+  while (head < tail)
+  {
+    uint32_t s = queue[head++];
+    uint32_t *row = &ac->next[s * ac->nclasses];
+    const uint32_t *frow = &ac->next[fail[s] * ac->nclasses];
+
+    if (ac->out[s] < 0)
+    {
+      ac->out[s] = ac->out[fail[s]];
+    }
+
+    for (size_t c = 0; c < ac->nclasses; c++)
+    {
+      if (row[c] != 0)
+      {
+        fail[row[c]] = frow[c];
+        queue[tail++] = row[c];
+      }
+      else
+      {
+        row[c] = frow[c];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < ac->nstates * ac->nclasses; i++)
+  {
+    uint32_t t = ac->next[i];
+    ac->next[i] = t * (uint32_t)ac->nclasses | (ac->out[t] >= 0 ? AC_MATCH : 0);
+  }
+
+  free(fail);
+  free(queue);
+  return 0;
+}
+
+void ac_destroy(struct ac *ac)
+{
+  free(ac->next);
+  free(ac->out);
+  free(ac->lens);
+  memset(ac, 0, sizeof(struct ac));
+}
+
+const char *ac_find(const struct ac *ac, const char *buf, size_t len,
+                    int *pattern)
+{
+  // The empty pattern matches before the first byte.
+  if (ac->out[0] >= 0)
+  {
+    *pattern = ac->out[0];
+    return buf;
+  }
+
+  const uint32_t *next = ac->next;
+  const unsigned char *classes = ac->classes;
+  const unsigned char *starts = ac->starts;
+  const unsigned char *u = (const unsigned char *)buf;
+  uint32_t s = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s == 0)
+    {
+      // Nothing is under way, so skip to the next byte that can begin
+      // a pattern.
+      if (ac->nstarts == 1)
+      {
+        const unsigned char *q = memchr(u + i, ac->first, len - i);
+        if (q == NULL)
+        {
+          break;
+        }
+        i = (size_t)(q - u);
+      }
+      else
+      {
+        while (i < len && !starts[u[i]])
+        {
+          i++;
+        }
+        if (i == len)
+        {
+          break;
+        }
+      }
+    }
+    s = next[s + classes[u[i]]];
+    if (s & AC_MATCH)
+    {
+      int p = ac->out[(s & ~AC_MATCH) / ac->nclasses];
+      *pattern = p;
+      return buf + i + 1 - ac->lens[p];
+    }
+  }
+
+  return NULL;
+}
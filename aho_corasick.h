@@ -0,0 +1,49 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ac
+ *
+ * Aho-Corasick automaton for finding any of a set of literal patterns
+ * in one pass over the data.  The trie and its failure links are
+ * compiled into a dense transition table, so matching costs one table
+ * lookup per input byte regardless of the number of patterns.  To keep
+ * the table small, bytes that occur in no pattern share a single
+ * column ('classes' maps each byte to its column).  While in the root
+ * state, bytes that cannot begin a pattern are skipped without walking
+ * the table.
+ */
+struct ac
+{
+  unsigned char classes[256];
+  unsigned char starts[256];  /* non-zero for bytes that begin a pattern */
+  int nstarts;                /* number of such bytes */
+  unsigned char first;        /* one of them */
+  size_t nclasses;
+  size_t nstates;
+  uint32_t *next;      /* nstates * nclasses transitions (see .c) */
+  int *out;            /* longest pattern ending in each state, or -1 */
+  size_t *lens;        /* length of each pattern */
+  size_t npatterns;
+};
+
+// Build an automaton for patterns[0..n).  NULL entries are skipped (and
+// will never be reported).  If the same pattern occurs twice, the first
+// index is reported.  The patterns are not referenced after this
+// returns.  Returns non-zero on allocation failure.
+int ac_init(struct ac *ac, const char *const *patterns, size_t n);
+
+// Free the memory of an automaton.
+void ac_destroy(struct ac *ac);
+
+// Find the match in buf[0..len) that ends first, preferring the longest
+// pattern among those ending at the same byte.  Returns a pointer to
+// the start of the match and stores the index of the pattern in
+// *pattern, or returns NULL.
+const char *ac_find(const struct ac *ac, const char *buf, size_t len,
+                    int *pattern);
+
+#endif
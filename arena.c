@@ -0,0 +1,115 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+// Alignment of objects, and size of the header in front of each.
+#define ARENA_ALIGN 16
+
+// While a chunk is current, 'live' only counts frees (downwards from
+// zero), so it cannot return to zero; retiring the chunk adds the
+// number of objects allocated.  Whoever brings it to zero then frees it.
+struct arena_chunk
+{
+  long live;            /* atomic */
+  long allocated;       /* owner only */
+  size_t used, cap;
+  unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static size_t round_up(size_t n)
+{
+  return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static struct arena_chunk *chunk_new(size_t cap)
+{
+  struct arena_chunk *c = malloc(sizeof(struct arena_chunk) + cap);
+  if (c == NULL)
+  {
+    return NULL;
+  }
+  c->live = 0;
+  c->allocated = 0;
+  c->used = 0;
+  c->cap = cap;
+  return c;
+}
+
+// Hand the owner's count of a chunk over to 'live'.
+static void chunk_retire(struct arena_chunk *c)
+{
+  if (__atomic_add_fetch(&c->live, c->allocated, __ATOMIC_ACQ_REL) == 0)
+  {
+    free(c);
+  }
+}
+
+// Carve an object from a chunk that has room for it.
+static void *chunk_alloc(struct arena_chunk *c, size_t need)
+{
+  unsigned char *p = c->data + c->used;
+  *(struct arena_chunk **)p = c;
+  c->used += need;
+  c->allocated++;
+  return p + ARENA_ALIGN;
+}
+
+void arena_init(struct arena *a, size_t chunk_size)
+{
+  a->cur = NULL;
+  a->chunk_size = chunk_size > 0 ? chunk_size : ARENA_DEFAULT_CHUNK;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+  size_t need = ARENA_ALIGN + round_up(size);
+
+  if (need > a->chunk_size / 4)
+  {
+    struct arena_chunk *c = chunk_new(need);
+    if (c == NULL)
+    {
+      return NULL;
+    }
+    void *p = chunk_alloc(c, need);
+    chunk_retire(c);
+    return p;
+  }
+
+  if (a->cur == NULL || a->cur->cap - a->cur->used < need)
+  {
+    struct arena_chunk *c = chunk_new(a->chunk_size);
+    if (c == NULL)
+    {
+      return NULL;
+    }
+    if (a->cur != NULL)
+    {
+      chunk_retire(a->cur);
+    }
+    a->cur = c;
+  }
+  return chunk_alloc(a->cur, need);
+}
+
+void arena_free(void *p)
+{
+  if (p == NULL)
+  {
+    return;
+  }
+  struct arena_chunk *c = *(struct arena_chunk **)((unsigned char *)p - ARENA_ALIGN);
+  if (__atomic_sub_fetch(&c->live, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    free(c);
+  }
+}
+
+void arena_destroy(struct arena *a)
+{
+  if (a->cur != NULL)
+  {
+    chunk_retire(a->cur);
+    a->cur = NULL;
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Default size of the chunks allocations are carved from.
+#define ARENA_DEFAULT_CHUNK (64 * 1024)
+
+struct arena_chunk;
+
+/*
+ * arena
+ *
+ * An allocator for small per-job objects (a job and the path it
+ * carries) that are made by one thread and freed by another.  Objects
+ * are carved from large chunks by bumping a pointer, so allocating
+ * takes no lock and no atomic operation, and freeing is a single atomic
+ * decrement of the chunk's count.  A chunk goes back to malloc() as a
+ * whole once it is full and all of its objects have been freed, so
+ * objects made together are released together.
+ *
+ * Only one thread may allocate from an arena at a time (typically each
+ * producer thread has its own); arena_free() may be called from any
+ * thread.
+ */
+struct arena
+{
+  struct arena_chunk *cur;  /* allocated from, or NULL */
+  size_t chunk_size;
+};
+
+// Start an arena with chunks of 'chunk_size' bytes (0 for
+// ARENA_DEFAULT_CHUNK).  Nothing is allocated until the first object.
+void arena_init(struct arena *a, size_t chunk_size);
+
+// Allocate 'size' bytes, aligned for any type.  Objects larger than a
+// quarter of a chunk get a chunk of their own.  Returns NULL if out of
+// memory.
+void *arena_alloc(struct arena *a, size_t size);
+
+// Free an object from any arena.  NULL is ignored.
+void arena_free(void *p);
+
+// Stop allocating from the arena.  Its last chunk is freed once its
+// objects are, which may be right away.
+void arena_destroy(struct arena *a);
+
+#endif
@@ -0,0 +1,197 @@
+// Micro-benchmark of job_queue throughput: producers push a fixed
+// number of elements in total and consumers pop them, for both queue
+// kinds, single and batched operations, and a range of capacities and
+// thread counts.  Every element is checked to arrive exactly once.
+// Results are printed as CSV, one configuration per line.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "job_queue.h"
+
+// Elements moved per configuration, and elements per batched push/pop.
+#define ITEMS (1 << 18)
+#define BATCH 32
+
+static const int capacities[] = {4, 64, 1024};
+static const int thread_counts[][2] = {{1, 1}, {1, 4}, {4, 1}, {4, 4}, {8, 8}};
+static const int batches[] = {1, BATCH};
+
+struct producer
+{
+  struct job_queue *q;
+  uintptr_t first, count;   /* pushes first+1 .. first+count */
+  int batch;
+};
+
+struct consumer
+{
+  struct job_queue *q;
+  int batch;
+  uintptr_t count, sum;
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *producer_main(void *arg)
+{
+  struct producer *p = arg;
+  void *buf[BATCH];
+  uintptr_t v = p->first + 1, end = p->first + p->count + 1;
+
+  while (v < end)
+  {
+    int n = 0;
+    while (n < p->batch && v < end)
+    {
+      buf[n++] = (void *)v++;
+    }
+    if (p->batch == 1 ? job_queue_push(p->q, buf[0]) != 0
+                      : job_queue_push_many(p->q, buf, n) != n)
+    {
+      errx(1, "push failed");
+    }
+  }
+  return NULL;
+}
+
+static void *consumer_main(void *arg)
+{
+  struct consumer *c = arg;
+  void *buf[BATCH];
+
+  for (;;)
+  {
+    int n;
+    if (c->batch == 1)
+    {
+      n = job_queue_pop(c->q, &buf[0]) == 0 ? 1 : -1;
+    }
+    else
+    {
+      n = job_queue_pop_many(c->q, buf, c->batch);
+    }
+    if (n < 0)
+    {
+      break;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      c->sum += (uintptr_t)buf[i];
+    }
+    c->count += (uintptr_t)n;
+  }
+  return NULL;
+}
+
+// Time one configuration, from the first push until the queue has been
+// drained and destroyed.  Returns non-zero if elements were lost.
+static int run(const char *kind_name, enum job_queue_kind kind, int capacity,
+               int producers, int consumers, int batch)
+{
+  struct job_queue q;
+  if (job_queue_init_kind(&q, capacity, kind) != 0)
+  {
+    errx(1, "job_queue_init_kind() failed");
+  }
+
+  pthread_t threads[16];
+  struct producer ps[8];
+  struct consumer cs[8];
+
+  for (int i = 0; i < consumers; i++)
+  {
+    cs[i] = (struct consumer){&q, batch, 0, 0};
+    if (pthread_create(&threads[producers + i], NULL, consumer_main, &cs[i]) != 0)
+    {
+      err(1, "pthread_create() failed");
+    }
+  }
+
+  double start = now();
+  uintptr_t per = ITEMS / (uintptr_t)producers;
+  for (int i = 0; i < producers; i++)
+  {
+    ps[i] = (struct producer){&q, per * (uintptr_t)i, per, batch};
+    if (pthread_create(&threads[i], NULL, producer_main, &ps[i]) != 0)
+    {
+      err(1, "pthread_create() failed");
+    }
+  }
+  for (int i = 0; i < producers; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  // Waits for the consumers to empty the queue, then releases them.
+  job_queue_destroy(&q);
+  double t = now() - start;
+
+  uintptr_t count = 0, sum = 0;
+  for (int i = 0; i < consumers; i++)
+  {
+    pthread_join(threads[producers + i], NULL);
+    count += cs[i].count;
+    sum += cs[i].sum;
+  }
+
+  uintptr_t items = per * (uintptr_t)producers;
+  printf("job_queue,%s,%d,%d,%d,%d,%lu,%.6f,%.0f\n", kind_name, capacity, producers,
+         consumers, batch, (unsigned long)items, t, (double)items / t);
+  fflush(stdout);
+
+  if (count != items || sum != items * (items + 1) / 2)
+  {
+    warnx("%s: %lu of %lu elements arrived", kind_name, (unsigned long)count,
+          (unsigned long)items);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  static const struct
+  {
+    const char *name;
+    enum job_queue_kind kind;
+  } kinds[] = {
+    {"locked", JOB_QUEUE_LOCKED},
+    {"lockfree", JOB_QUEUE_LOCKFREE},
+  };
+
+  int status = 0;
+  printf("bench,kind,capacity,producers,consumers,batch,items,seconds,ops_per_s\n");
+
+  for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+  {
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++)
+    {
+      for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
+      {
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+        {
+          status |= run(kinds[k].name, kinds[k].kind, capacities[c],
+                        thread_counts[t][0], thread_counts[t][1], batches[b]);
+        }
+      }
+    }
+  }
+  return status;
+}
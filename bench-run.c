@@ -0,0 +1,273 @@
+// End-to-end benchmark of the programs on a corpus made by gen-corpus:
+// every program is run on the whole corpus (fibs on its fibs.in), the
+// multi-threaded ones at 1, 2, 4, ... threads.  Output is discarded,
+// the best of several runs is kept, and the results are printed as
+// CSV, one run configuration per line, with throughput and the speedup
+// and scaling efficiency relative to one thread.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fts.h>
+#include <getopt.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+extern char **environ;
+
+// The needle gen-corpus plants by default.
+#define DEFAULT_NEEDLE "QuuxZebra"
+
+// A program to benchmark.  Multi-threaded programs take -n.
+struct program
+{
+  const char *name;
+  int threaded;
+  int fibs;           /* reads CORPUS/fibs.in instead of the tree */
+};
+
+static const struct program programs[] = {
+  {"fauxgrep", 0, 0},
+  {"fauxgrep-mt", 1, 0},
+  {"fhistogram", 0, 0},
+  {"fhistogram-mt", 1, 0},
+  {"fibs", 1, 1},
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Count the regular files under 'dir' and their bytes.
+static void measure_tree(const char *dir, unsigned long long *files,
+                         unsigned long long *bytes)
+{
+  char *paths[] = {(char *)dir, NULL};
+  FTS *ftsp = fts_open(paths, FTS_LOGICAL | FTS_NOCHDIR, NULL);
+  if (ftsp == NULL)
+  {
+    err(1, "fts_open() failed");
+  }
+
+  *files = *bytes = 0;
+  FTSENT *p;
+  while ((p = fts_read(ftsp)) != NULL)
+  {
+    if (p->fts_info == FTS_F)
+    {
+      (*files)++;
+      *bytes += (unsigned long long)p->fts_statp->st_size;
+    }
+  }
+  fts_close(ftsp);
+}
+
+// Count the lines of a file and its bytes.
+static void measure_lines(const char *path, unsigned long long *lines,
+                          unsigned long long *bytes)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    err(1, "failed to open %s", path);
+  }
+  *lines = *bytes = 0;
+  int c;
+  while ((c = getc(f)) != EOF)
+  {
+    (*bytes)++;
+    *lines += c == '\n';
+  }
+  fclose(f);
+}
+
+// Run argv[] with stdin from 'input' (or /dev/null) and stdout and
+// stderr discarded.  Returns the wall-clock time, or -1 if the program
+// could not be run or failed.
+static double run_once(char *const argv[], const char *input)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                   input != NULL ? input : "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+  double start = now();
+  pid_t pid;
+  int r = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (r != 0)
+  {
+    return -1;
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    return -1;
+  }
+  return now() - start;
+}
+
+#define USAGE "usage: [-r REPEATS] [-n MAX_THREADS] [--bin DIR] [--needle STRING] CORPUS"
+
+int main(int argc, char *const *argv)
+{
+  int repeats = 3;
+  long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *bin = ".";
+  const char *needle = DEFAULT_NEEDLE;
+
+  static const struct option long_options[] = {
+      {"bin", required_argument, NULL, 'b'},
+      {"needle", required_argument, NULL, 'N'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "r:n:", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      repeats = atoi(optarg);
+      if (repeats < 1)
+      {
+        err(1, "invalid repeat count: %s", optarg);
+      }
+      break;
+    case 'n':
+      max_threads = atoi(optarg);
+      if (max_threads < 1)
+      {
+        err(1, "invalid thread count: %s", optarg);
+      }
+      break;
+    case 'b':
+      bin = optarg;
+      break;
+    case 'N':
+      needle = optarg;
+      break;
+    default:
+      err(1, USAGE);
+    }
+  }
+  if (optind != argc - 1)
+  {
+    err(1, USAGE);
+  }
+  if (max_threads < 1)
+  {
+    max_threads = 1;
+  }
+
+  const char *corpus = argv[optind];
+  char fibs_input[4096];
+  snprintf(fibs_input, sizeof(fibs_input), "%s/fibs.in", corpus);
+
+  unsigned long long tree_files, tree_bytes, fibs_lines, fibs_bytes;
+  measure_tree(corpus, &tree_files, &tree_bytes);
+  measure_lines(fibs_input, &fibs_lines, &fibs_bytes);
+
+  // 1, 2, 4, ... threads, ending with max_threads.
+  long threads[64];
+  int nthreads = 0;
+  for (long t = 1; t < max_threads && nthreads < 63; t *= 2)
+  {
+    threads[nthreads++] = t;
+  }
+  threads[nthreads++] = max_threads;
+
+  int status = 0;
+  printf("bench,program,threads,seconds,bytes,items,mb_per_s,items_per_s,speedup,efficiency\n");
+
+  for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++)
+  {
+    const struct program *p = &programs[i];
+    char path[4096], nbuf[32];
+    snprintf(path, sizeof(path), "%s/%s", bin, p->name);
+
+    // Items are files, or numbers for fibs.
+    unsigned long long bytes = p->fibs ? fibs_bytes : tree_bytes;
+    unsigned long long items = p->fibs ? fibs_lines : tree_files;
+    double base = 0;
+
+    for (int t = 0; t < (p->threaded ? nthreads : 1); t++)
+    {
+      char *args[8];
+      int n = 0;
+      args[n++] = path;
+      if (p->threaded)
+      {
+        snprintf(nbuf, sizeof(nbuf), "%ld", threads[t]);
+        args[n++] = "-n";
+        args[n++] = nbuf;
+      }
+      if (strcmp(p->name, "fhistogram-mt") == 0)
+      {
+        args[n++] = "--no-cache";
+      }
+      if (strncmp(p->name, "fauxgrep", 8) == 0)
+      {
+        args[n++] = (char *)needle;
+      }
+      if (!p->fibs)
+      {
+        args[n++] = (char *)corpus;
+      }
+      args[n] = NULL;
+
+      // A first, untimed run warms the page cache.
+      double best = -1;
+      for (int r = t == 0 ? -1 : 0; r < repeats; r++)
+      {
+        double s = run_once(args, p->fibs ? fibs_input : NULL);
+        if (s < 0)
+        {
+          warnx("%s failed", path);
+          status = 1;
+          best = -1;
+          break;
+        }
+        if (r >= 0 && (best < 0 || s < best))
+        {
+          best = s;
+        }
+      }
+      if (best < 0)
+      {
+        break;
+      }
+
+      long nt = p->threaded ? threads[t] : 1;
+      if (t == 0)
+      {
+        base = best;
+      }
+      double speedup = base / best;
+      printf("e2e,%s,%ld,%.6f,%llu,%llu,%.2f,%.1f,%.3f,%.3f\n", p->name, nt, best,
+             bytes, items, (double)bytes / best / 1e6, (double)items / best,
+             speedup, speedup / (double)nt);
+      fflush(stdout);
+    }
+  }
+  return status;
+}
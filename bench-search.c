@@ -0,0 +1,207 @@
+// Micro-benchmark of substring search: strstr() and memmem() against
+// the memsearch implementations, on an in-memory buffer of generated
+// text.  Every method counts all occurrences of the needle, and the
+// counts are checked against each other.  Results are printed as CSV,
+// one method and needle per line.
+
+// Setting _GNU_SOURCE is necessary for memmem() on GNU/Linux systems.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "memsearch.h"
+
+#define BUF_SIZE (64 * 1024 * 1024)
+#define REPEATS 5
+
+static const char *words[] = {
+  "the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+  "with", "was", "on", "be", "at", "by", "this", "had", "not", "are",
+  "int", "char", "return", "if", "else", "while", "struct", "void",
+  "size_t", "NULL", "0", "1", "i++", "{", "}", "(x);", "buf[i]", "=",
+};
+
+static const char *needles[] = {
+  "e",              // very common single byte
+  "return",         // common word
+  "Zebra",          // rare first byte, not present
+  "struct thread_pool",
+  "while (pos < end && (p = memchr(buf, c, len)) != NULL)",
+};
+
+// Deterministic pseudo-random words separated by spaces and newlines,
+// NUL-terminated so that strstr() can run on it too.
+static char *make_text(size_t size)
+{
+  char *buf = malloc(size + 1);
+  if (buf == NULL)
+  {
+    err(1, "malloc failed");
+  }
+
+  uint64_t x = 88172645463325252ULL;
+  size_t nwords = sizeof(words) / sizeof(words[0]);
+  size_t p = 0;
+  int col = 0;
+
+  while (p < size)
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const char *w = words[x % nwords];
+    size_t n = strlen(w);
+    for (size_t i = 0; i < n && p < size; i++)
+    {
+      buf[p++] = w[i];
+    }
+    col += (int)n + 1;
+    if (p < size)
+    {
+      int newline = col > 60 || (x >> 32) % 16 == 0;
+      buf[p++] = newline ? '\n' : ' ';
+      if (newline)
+      {
+        col = 0;
+      }
+    }
+  }
+  buf[size] = '\0';
+  return buf;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t count_strstr(const char *buf, size_t len, const char *needle)
+{
+  (void)len;
+  size_t n = 0;
+  for (const char *p = buf; (p = strstr(p, needle)) != NULL; p++)
+  {
+    n++;
+  }
+  return n;
+}
+
+static size_t count_memmem(const char *buf, size_t len, const char *needle)
+{
+  size_t n = 0;
+  size_t nlen = strlen(needle);
+  const char *end = buf + len;
+  for (const char *p = buf; (p = memmem(p, (size_t)(end - p), needle, nlen)) != NULL; p++)
+  {
+    n++;
+  }
+  return n;
+}
+
+static size_t count_memsearch(const struct memsearch *s, const char *buf, size_t len)
+{
+  size_t n = 0;
+  const char *end = buf + len;
+  for (const char *p = buf; (p = memsearch_find(s, p, (size_t)(end - p))) != NULL; p++)
+  {
+    n++;
+  }
+  return n;
+}
+
+// Print 's' as a quoted CSV field, since needles may contain commas.
+static void print_csv_string(const char *s)
+{
+  putchar('"');
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '"')
+    {
+      putchar('"');
+    }
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+// Run one method REPEATS times and report the best throughput.
+static size_t run(const char *name, const char *needle, const char *buf, size_t len,
+                  size_t (*libc)(const char *, size_t, const char *),
+                  const struct memsearch *s)
+{
+  double best = 0;
+  size_t count = 0;
+
+  for (int r = 0; r < REPEATS; r++)
+  {
+    double start = now();
+    count = libc != NULL ? libc(buf, len, needle) : count_memsearch(s, buf, len);
+    double t = now() - start;
+    if (r == 0 || t < best)
+    {
+      best = t;
+    }
+  }
+
+  printf("memsearch,%s,", name);
+  print_csv_string(needle);
+  printf(",%zu,%zu,%.6f,%.2f\n", len, count, best, (double)len / best / 1e9);
+  fflush(stdout);
+  return count;
+}
+
+int main(void)
+{
+  char *buf = make_text(BUF_SIZE);
+
+  static const struct
+  {
+    const char *name;
+    int impl;
+  } impls[] = {
+    {"scalar", MEMSEARCH_SCALAR},
+    {"sse2", MEMSEARCH_SSE2},
+    {"avx2", MEMSEARCH_AVX2},
+  };
+
+  int status = 0;
+  printf("bench,method,needle,bytes,matches,seconds,gb_per_s\n");
+
+  for (size_t i = 0; i < sizeof(needles) / sizeof(needles[0]); i++)
+  {
+    const char *needle = needles[i];
+    size_t expect = run("strstr", needle, buf, BUF_SIZE, count_strstr, NULL);
+    if (run("memmem", needle, buf, BUF_SIZE, count_memmem, NULL) != expect)
+    {
+      status = 1;
+    }
+
+    for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++)
+    {
+      struct memsearch s;
+      if (memsearch_init_impl(&s, needle, strlen(needle), impls[j].impl) != 0)
+      {
+        warnx("%s: not supported by this CPU", impls[j].name);
+        continue;
+      }
+      if (run(impls[j].name, needle, buf, BUF_SIZE, NULL, &s) != expect)
+      {
+        warnx("%s: wrong match count", impls[j].name);
+        status = 1;
+      }
+    }
+  }
+
+  free(buf);
+  return status;
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "bitcount.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BITCOUNT_X86 1
+#include <immintrin.h>
+#endif
+
+// Below this many bytes, testing the bits of each byte is cheaper than
+// building and folding a byte table.
+#define TABLE_MIN 1024
+
+static void count_bits_bytewise(const unsigned char *buf, size_t len,
+                                uint64_t counts[8])
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    for (int b = 0; b < 8; b++)
+    {
+      counts[b] += (buf[i] >> b) & 1;
+    }
+  }
+}
+
+// Count byte values, in four tables so that runs of equal bytes do not
+// serialise on one counter, then fold the byte counts into bit counts.
+static void count_bits_table(const unsigned char *buf, size_t len,
+                             uint64_t counts[8])
+{
+  if (len < TABLE_MIN)
+  {
+    count_bits_bytewise(buf, len, counts);
+    return;
+  }
+
+  uint64_t tab[4][256];
+  memset(tab, 0, sizeof(tab));
+
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4)
+  {
+    tab[0][buf[i]]++;
+    tab[1][buf[i + 1]]++;
+    tab[2][buf[i + 2]]++;
+    tab[3][buf[i + 3]]++;
+  }
+  for (; i < len; i++)
+  {
+    tab[0][buf[i]]++;
+  }
+
+  for (int v = 0; v < 256; v++)
+  {
+    uint64_t n = tab[0][v] + tab[1][v] + tab[2][v] + tab[3][v];
+    for (int b = 0; b < 8; b++)
+    {
+      if (v & (1 << b))
+      {
+        counts[b] += n;
+      }
+    }
+  }
+}
+
+#ifdef BITCOUNT_X86
+
+// Bit plane 7 is the sign bit that movemask collects; adding a vector
+// to itself shifts every byte left by one, bringing the next plane up.
+__attribute__((target("avx2,popcnt")))
+static void count_bits_avx2(const unsigned char *buf, size_t len,
+                            uint64_t counts[8])
+{
+  uint64_t c[8] = {0};
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+#pragma GCC unroll 8
+    for (int b = 7; b >= 0; b--)
+    {
+      c[b] += (uint64_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(v));
+      v = _mm256_add_epi8(v, v);
+    }
+  }
+
+  for (int b = 0; b < 8; b++)
+  {
+    counts[b] += c[b];
+  }
+  count_bits_bytewise(buf + i, len - i, counts);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static void count_bits_avx512(const unsigned char *buf, size_t len,
+                              uint64_t counts[8])
+{
+  uint64_t c[8] = {0};
+  size_t i = 0;
+
+  for (; i + 64 <= len; i += 64)
+  {
+    __m512i v = _mm512_loadu_si512((const void *)(buf + i));
+#pragma GCC unroll 8
+    for (int b = 0; b < 8; b++)
+    {
+      __mmask64 m = _mm512_test_epi8_mask(v, _mm512_set1_epi8((char)(1 << b)));
+      c[b] += (uint64_t)__builtin_popcountll(m);
+    }
+  }
+
+  for (int b = 0; b < 8; b++)
+  {
+    counts[b] += c[b];
+  }
+  count_bits_bytewise(buf + i, len - i, counts);
+}
+
+#endif
+
+typedef void (*count_bits_fn)(const unsigned char *, size_t, uint64_t[8]);
+
+static count_bits_fn pick(void)
+{
+#ifdef BITCOUNT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+  {
+    return count_bits_avx512;
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return count_bits_avx2;
+  }
+#endif
+  return count_bits_table;
+}
+
+void count_bits(const unsigned char *buf, size_t len, uint64_t counts[8])
+{
+  static count_bits_fn impl = NULL;
+
+  count_bits_fn fn = __atomic_load_n(&impl, __ATOMIC_RELAXED);
+  if (fn == NULL)
+  {
+    fn = pick();
+    __atomic_store_n(&impl, fn, __ATOMIC_RELAXED);
+  }
+  fn(buf, len, counts);
+}
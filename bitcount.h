@@ -0,0 +1,13 @@
+#ifndef BITCOUNT_H
+#define BITCOUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Add to counts[i] the number of bytes in buf[0..len) that have bit i
+// set.  Large buffers are processed with AVX-512BW or AVX2 when the CPU
+// supports it (checked once, at the first call), and with a 256-entry
+// byte count folded into bits otherwise.
+void count_bits(const unsigned char *buf, size_t len, uint64_t counts[8]);
+
+#endif
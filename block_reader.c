@@ -0,0 +1,117 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "block_reader.h"
+
+int block_reader_open(struct block_reader *r, const char *path,
+                      off_t offset, off_t length, size_t block_size,
+                      struct buf_pool *bufs)
+{
+  r->path = path;
+  r->offset = offset;
+  r->left = length;
+  r->buf = NULL;
+  r->bufs = bufs;
+
+  r->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (r->fd < 0)
+  {
+    fflush(stdout);
+    warn("failed to open %s", path);
+    return -1;
+  }
+
+  // No point in a buffer larger than what will be read.
+  off_t want = length;
+  struct stat st;
+  if (want < 0 && fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    want = st.st_size > offset ? st.st_size - offset : 1;
+  }
+  r->cap = block_size > 0 ? block_size : BLOCK_READER_DEFAULT_SIZE;
+  if (bufs != NULL && r->cap > bufs->size)
+  {
+    r->cap = bufs->size;
+  }
+  if (want > 0 && want < (off_t)r->cap)
+  {
+    r->cap = (size_t)want;
+  }
+
+  // A hint only; failure does not matter.
+  (void)posix_fadvise(r->fd, offset, length < 0 ? 0 : length, POSIX_FADV_SEQUENTIAL);
+
+  r->buf = bufs != NULL ? buf_pool_get(bufs) : malloc(r->cap);
+  if (r->buf == NULL)
+  {
+    fflush(stdout);
+    warn("failed to allocate buffer for %s", path);
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+ssize_t block_reader_next(struct block_reader *r, const unsigned char **block)
+{
+  size_t want = r->cap;
+  if (r->left >= 0 && (off_t)want > r->left)
+  {
+    want = (size_t)r->left;
+  }
+  if (want == 0)
+  {
+    return 0;
+  }
+
+  ssize_t n;
+  while ((n = pread(r->fd, r->buf, want, r->offset)) < 0 && errno == EINTR)
+  {
+  }
+  if (n < 0)
+  {
+    fflush(stdout);
+    warn("failed to read %s", r->path);
+    return -1;
+  }
+
+  r->offset += n;
+  if (r->left >= 0)
+  {
+    r->left -= n;
+  }
+  *block = r->buf;
+  return n;
+}
+
+void block_reader_close(struct block_reader *r)
+{
+  if (r->fd >= 0)
+  {
+    close(r->fd);
+  }
+  if (r->bufs != NULL)
+  {
+    buf_pool_put(r->bufs, r->buf);
+  }
+  else
+  {
+    free(r->buf);
+  }
+  r->fd = -1;
+  r->buf = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef BLOCK_READER_H
+#define BLOCK_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "buf_pool.h"
+
+// Default size of the blocks read at a time.
+#define BLOCK_READER_DEFAULT_SIZE (1024 * 1024)
+
+/*
+ * block_reader
+ *
+ * Reads a file, or a byte range of it, in large blocks with a plain
+ * read loop (pread(), so ranges of one file can be read concurrently
+ * through separate readers).  The kernel is told the range will be
+ * read sequentially, so it reads ahead aggressively.  The buffer may
+ * come from a buf_pool shared with other readers.
+ */
+struct block_reader
+{
+  const char *path;     /* for warnings; not copied */
+  int fd;
+  off_t offset;         /* next byte to read */
+  off_t left;           /* bytes left in the range, or -1 for "to EOF" */
+  unsigned char *buf;
+  size_t cap;
+  struct buf_pool *bufs; /* 'buf' came from here, or NULL */
+};
+
+// Open 'path' for reading 'length' bytes from 'offset', or everything
+// from 'offset' to the end of the file if 'length' is -1, in blocks of
+// at most 'block_size' bytes.  If 'bufs' is not NULL, the buffer is
+// taken from it (and given back on close), and 'block_size' must not
+// exceed its buffer size.  Returns non-zero (after a warning) on error.
+int block_reader_open(struct block_reader *r, const char *path,
+                      off_t offset, off_t length, size_t block_size,
+                      struct buf_pool *bufs);
+
+// Read the next block and point *block at it.  Returns its size, 0 at
+// the end of the range, or -1 (after a warning) on a read error.
+ssize_t block_reader_next(struct block_reader *r, const unsigned char **block);
+
+// Close the file and free (or give back) the buffer.
+void block_reader_close(struct block_reader *r);
+
+#endif
@@ -0,0 +1,64 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+
+#include "buf_pool.h"
+
+void buf_pool_init(struct buf_pool *p, size_t size, size_t max_bytes)
+{
+  p->size = size < sizeof(void *) ? sizeof(void *) : size;
+  p->max_free = max_bytes / p->size > 0 ? max_bytes / p->size : 1;
+  pthread_mutex_init(&p->mutex, NULL);
+  p->free_list = NULL;
+  p->nfree = 0;
+}
+
+void *buf_pool_get(struct buf_pool *p)
+{
+  pthread_mutex_lock(&p->mutex);
+  void *buf = p->free_list;
+  if (buf != NULL)
+  {
+    p->free_list = *(void **)buf;
+    p->nfree--;
+  }
+  pthread_mutex_unlock(&p->mutex);
+
+  if (buf == NULL && posix_memalign(&buf, BUF_POOL_ALIGN, p->size) != 0)
+  {
+    return NULL;
+  }
+  return buf;
+}
+
+void buf_pool_put(struct buf_pool *p, void *buf)
+{
+  if (buf == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&p->mutex);
+  if (p->nfree < p->max_free)
+  {
+    *(void **)buf = p->free_list;
+    p->free_list = buf;
+    p->nfree++;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&p->mutex);
+  free(buf);
+}
+
+void buf_pool_destroy(struct buf_pool *p)
+{
+  while (p->free_list != NULL)
+  {
+    void *next = *(void **)p->free_list;
+    free(p->free_list);
+    p->free_list = next;
+  }
+  pthread_mutex_destroy(&p->mutex);
+}
@@ -0,0 +1,43 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Alignment of the buffers: a page, as direct I/O would want.
+#define BUF_POOL_ALIGN 4096
+
+/*
+ * buf_pool
+ *
+ * A pool of I/O buffers of one fixed size, shared by the readers of a
+ * program so that a buffer freed after one file is reused for the next
+ * instead of going back to malloc().  Up to 'max_bytes' of free buffers
+ * are kept; beyond that they are freed.  May be used from any thread.
+ */
+struct buf_pool
+{
+  size_t size;
+  size_t max_free;            /* free buffers kept */
+
+  pthread_mutex_t mutex;
+  void *free_list;            /* linked through the first word */
+  size_t nfree;
+};
+
+// Start an empty pool of buffers of 'size' bytes, keeping at most
+// 'max_bytes' worth (and at least one) of free ones.
+void buf_pool_init(struct buf_pool *p, size_t size, size_t max_bytes);
+
+// Take a buffer of p->size bytes, aligned to BUF_POOL_ALIGN.  Returns
+// NULL if out of memory.
+void *buf_pool_get(struct buf_pool *p);
+
+// Give back a buffer taken from the pool.  NULL is ignored.
+void buf_pool_put(struct buf_pool *p, void *buf);
+
+// Free the pool and its free buffers.  Every buffer must have been
+// given back.
+void buf_pool_destroy(struct buf_pool *p);
+
+#endif
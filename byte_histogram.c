@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "byte_histogram.h"
+
+// Bytes counted into 32-bit stripe counters before they are folded
+// into the histogram, small enough that no stripe can overflow.
+#define STRIPE_SPAN ((size_t)1 << 31)
+
+void byte_histogram_init(struct byte_histogram *h, uint64_t *words)
+{
+  memset(h->bytes, 0, sizeof(h->bytes));
+  h->words = words;
+  h->odd = 0;
+  h->carry = 0;
+}
+
+// Count bytes in four tables so that runs of equal bytes do not
+// serialise on one counter.
+static void count_bytes(uint64_t bytes[256], const unsigned char *buf, size_t len)
+{
+  uint32_t tab[4][256];
+  memset(tab, 0, sizeof(tab));
+
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4)
+  {
+    tab[0][buf[i]]++;
+    tab[1][buf[i + 1]]++;
+    tab[2][buf[i + 2]]++;
+    tab[3][buf[i + 3]]++;
+  }
+  for (; i < len; i++)
+  {
+    tab[0][buf[i]]++;
+  }
+
+  for (int v = 0; v < 256; v++)
+  {
+    bytes[v] += (uint64_t)tab[0][v] + tab[1][v] + tab[2][v] + tab[3][v];
+  }
+}
+
+// As count_bytes(), but also count the words of buf[0..len) (len even).
+static void count_bytes_words(uint64_t bytes[256], uint64_t *words,
+                              const unsigned char *buf, size_t len)
+{
+  uint32_t tab[4][256];
+  memset(tab, 0, sizeof(tab));
+
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4)
+  {
+    tab[0][buf[i]]++;
+    tab[1][buf[i + 1]]++;
+    tab[2][buf[i + 2]]++;
+    tab[3][buf[i + 3]]++;
+    words[buf[i] | buf[i + 1] << 8]++;
+    words[buf[i + 2] | buf[i + 3] << 8]++;
+  }
+  for (; i < len; i += 2)
+  {
+    tab[0][buf[i]]++;
+    tab[1][buf[i + 1]]++;
+    words[buf[i] | buf[i + 1] << 8]++;
+  }
+
+  for (int v = 0; v < 256; v++)
+  {
+    bytes[v] += (uint64_t)tab[0][v] + tab[1][v] + tab[2][v] + tab[3][v];
+  }
+}
+
+void byte_histogram_update(struct byte_histogram *h,
+                           const unsigned char *buf, size_t len)
+{
+  if (h->words == NULL)
+  {
+    while (len > 0)
+    {
+      size_t n = len < STRIPE_SPAN ? len : STRIPE_SPAN;
+      count_bytes(h->bytes, buf, n);
+      buf += n;
+      len -= n;
+    }
+    return;
+  }
+
+  if (len == 0)
+  {
+    return;
+  }
+
+  // Complete the word left open by the previous piece.
+  if (h->odd)
+  {
+    h->bytes[buf[0]]++;
+    h->words[h->carry | buf[0] << 8]++;
+    h->odd = 0;
+    buf++;
+    len--;
+  }
+
+  while (len > 1)
+  {
+    size_t n = len < STRIPE_SPAN ? len : STRIPE_SPAN;
+    n &= ~(size_t)1;
+    count_bytes_words(h->bytes, h->words, buf, n);
+    buf += n;
+    len -= n;
+  }
+
+  if (len == 1)
+  {
+    h->bytes[buf[0]]++;
+    h->carry = buf[0];
+    h->odd = 1;
+  }
+}
+
+void byte_histogram_merge(struct byte_histogram *h, uint64_t to[256])
+{
+  for (int v = 0; v < 256; v++)
+  {
+    to[v] += h->bytes[v];
+    h->bytes[v] = 0;
+  }
+}
+
+void byte_histogram_bits(const uint64_t bytes[256], int64_t bits[8])
+{
+  for (int v = 0; v < 256; v++)
+  {
+    for (int b = 0; b < 8; b++)
+    {
+      if (v & (1 << b))
+      {
+        bits[b] += (int64_t)bytes[v];
+      }
+    }
+  }
+}
+
+double byte_histogram_entropy(const uint64_t bytes[256])
+{
+  uint64_t total = 0;
+  for (int v = 0; v < 256; v++)
+  {
+    total += bytes[v];
+  }
+
+  double entropy = 0;
+  for (int v = 0; v < 256; v++)
+  {
+    if (bytes[v] > 0)
+    {
+      double p = bytes[v] / (double)total;
+      entropy -= p * log2(p);
+    }
+  }
+  // Avoid printing "-0.0000" for a stream of one byte value.
+  return entropy > 0 ? entropy : 0;
+}
+
+// Print the non-zero entries of counts[0..n) with 'digits' hex digits.
+static void print_counts(const char *what, const uint64_t *counts, size_t n,
+                         int digits)
+{
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    total += counts[i];
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    if (counts[i] > 0)
+    {
+      printf("%s 0x%0*zx: %llu (%.4f%%)\n", what, digits, i,
+             (unsigned long long)counts[i], 100.0 * counts[i] / total);
+    }
+  }
+}
+
+void byte_histogram_print_bytes(const uint64_t bytes[256])
+{
+  print_counts("Byte", bytes, 256, 2);
+}
+
+void byte_histogram_print_words(const uint64_t words[BYTE_HISTOGRAM_WORDS])
+{
+  print_counts("Word", words, BYTE_HISTOGRAM_WORDS, 4);
+}
@@ -0,0 +1,58 @@
+#ifndef BYTE_HISTOGRAM_H
+#define BYTE_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of bins of a 16-bit word histogram.
+#define BYTE_HISTOGRAM_WORDS 65536
+
+/*
+ * byte_histogram
+ *
+ * Histogram of the byte values of a stream and, optionally, of its
+ * 16-bit words (little-endian, at even offsets from the start of the
+ * stream), both counted in the same pass over the data.  The per-bit
+ * histogram and the Shannon entropy follow from the byte counts, so
+ * nothing needs to be read twice.
+ *
+ * The word table is large, so it is supplied by the caller and may be
+ * shared by the histograms of several streams processed by one thread.
+ * The stream may arrive in pieces of any length; an odd byte at the end
+ * of a piece is paired with the first byte of the next.
+ */
+struct byte_histogram
+{
+  uint64_t bytes[256];
+  uint64_t *words;      /* BYTE_HISTOGRAM_WORDS counts, or NULL */
+  int odd;              /* an odd number of bytes has been seen */
+  unsigned char carry;  /* the last of them, if so */
+};
+
+// Start an empty histogram.  If 'words' is not NULL, words are counted
+// into it (it is not cleared).
+void byte_histogram_init(struct byte_histogram *h, uint64_t *words);
+
+// Count the bytes (and words) of the next buf[0..len) of the stream.
+void byte_histogram_update(struct byte_histogram *h,
+                           const unsigned char *buf, size_t len);
+
+// Add the byte counts of 'h' to 'to' and clear them, leaving the rest
+// of the stream state as it is.
+void byte_histogram_merge(struct byte_histogram *h, uint64_t to[256]);
+
+// Add to bits[i] the number of counted bytes that have bit i set.
+void byte_histogram_bits(const uint64_t bytes[256], int64_t bits[8]);
+
+// Shannon entropy of the byte counts, in bits per byte (0 to 8).
+double byte_histogram_entropy(const uint64_t bytes[256]);
+
+// Print the non-zero byte counts, one per line, with their share of
+// the total.
+void byte_histogram_print_bytes(const uint64_t bytes[256]);
+
+// Print the non-zero word counts, one per line, with their share of
+// the total.
+void byte_histogram_print_words(const uint64_t words[BYTE_HISTOGRAM_WORDS]);
+
+#endif
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -16,140 +18,540 @@
 #include <err.h>
 
 #include <pthread.h>
+#include <getopt.h>
+
+#include "thread_pool.h"
+#include "walk.h"
+#include "path_filter.h"
+#include "scan.h"
+#include "output.h"
+#include "trigram_index.h"
+#include "uring_reader.h"
+#include "arena.h"
+#include "buf_pool.h"
+#include "stats.h"
+
+// A job: grep one file.
+struct grep_job
+{
+  const struct matcher *m;
+  unsigned long seq;        /* output sequence number (--sorted) */
+  struct output_buf local;  /* output with --sorted and --io-uring */
+  char path[];
+};
+
+// Where matches go.  Each worker appends to its own buffer, or with
+// --sorted, each file to a buffer of its own that is committed in the
+// order the files were found.
+static struct output out;
+static int sorted = 0;
+
+// Jobs whose output may be held back waiting for an earlier file, with
+// --sorted.  Must exceed PATH_BATCH (see submit_fts()).
+#define SORT_WINDOW 4096
+
+// With --index, files that the index shows cannot match are skipped
+// without being opened.  New and changed files are always searched.
+static struct trigram_index trigram_idx;
+static int use_index = 0;
+
+// Files larger than this many bytes are split into chunks that are
+// searched as separate jobs (--chunk-size).
+static size_t chunk_size = 16 * 1024 * 1024;
+
+// What is printed for each file (-c, -l, -q), and after how many
+// matching lines a file is given up (-m, 0 for no limit).  With -q the
+// first match cancels the pool, so the files still queued are dropped
+// without being read.
+static enum scan_mode mode = SCAN_LINES;
+static unsigned long max_count = 0;
+static int matched = 0;   /* some file matched, with -q (atomic) */
+
+// What is done with files that look binary (-a, -I): by default, their
+// matching lines are not printed, only that the file matches.
+static enum scan_binary binary = SCAN_BINARY_REPORT;
+
+// With --io-uring, files of up to chunk_size bytes (and at most
+// URING_READER_MAX_BYTES) are read whole by the reader's thread and
+// searched by the workers (see uring_reader.h).  Larger files are still
+// mapped and split into chunks.
+static struct uring_reader uring;
+static struct buf_pool uring_bufs;
+static int use_uring = 0;
+
+// Files and directories to leave out of the traversal.
+static struct path_filter filter;
+
+// Jobs are allocated from an arena of the thread that finds the file:
+// one per worker (for the parallel walk), and a last one for the main
+// thread.  Whichever worker finishes a job frees it.
+static struct arena *job_arenas;
+static int num_arenas;
+
+// A matching line found by a chunk job.  'lineno' counts from 0 at the
+// start of the chunk; 'line' points into the mapping of the file.
+struct grep_match
+{
+  unsigned long lineno;
+  int pattern;
+  const char *line;
+  size_t len;
+};
 
-#include "job_queue.h"
+struct grep_big;
 
-// worker function and args
-struct worker_args
+// A job: grep one line-aligned byte range of a large file, recording
+// the matches until the line numbers are known.
+struct grep_chunk
 {
-  struct job_queue *q;
-  const char *needle;
+  struct grep_big *big;
+  const char *data;
+  size_t len;
+  unsigned long newlines;   /* lines ending in this chunk */
+  struct grep_match *matches;
+  size_t nmatches, cap;
+  int failed;
 };
 
-int fauxgrep_file(char const *needle, char const *path)
+// A large file being searched in chunks.  The last chunk to finish
+// turns the per-chunk newline counts into starting line numbers and
+// prints all matches in file order.
+struct grep_big
 {
-  FILE *f = fopen(path, "r");
+  const struct matcher *m;
+  unsigned long seq;
+  struct scan_map map;
+  int remaining;            /* chunks not yet finished */
+  int decided;              /* a chunk found what -l or -q need (atomic) */
+  int binary;               /* only whether it matches is printed */
+  int nchunks;
+  struct grep_chunk *chunks;
+  char path[];
+};
+
+// The file being scanned, passed to print_line().
+struct grep_file
+{
+  const struct matcher *m;
+  const char *path;
+  struct output_buf *buf;
+  unsigned long count;      /* matching lines so far */
+};
 
-  if (f == NULL)
+// Append a matching line to 'buf', prefixed by the path and the line
+// number, and by the pattern that was found if there are several.
+// Returns non-zero if out of memory.
+static int print_match(struct output_buf *buf, const struct matcher *m,
+                       const char *path, unsigned long lineno, int pattern,
+                       const char *line, size_t len)
+{
+  int r;
+  if (m->npatterns > 1)
   {
-    warn("failed to open %s", path);
-    return -1;
+    r = output_buf_printf(buf, "%s:%lu:%s: ", path, lineno, m->patterns[pattern]);
+  }
+  else
+  {
+    r = output_buf_printf(buf, "%s:%lu: ", path, lineno);
+  }
+  return r != 0 ? r : output_buf_write(buf, line, len);
+}
+
+// Append the line that stands for the matches of a binary file.
+// Returns non-zero if out of memory.
+static int print_binary(struct output_buf *buf, const char *path)
+{
+  return output_buf_printf(buf, "Binary file %s matches\n", path);
+}
+
+// scan_line_fn printing one match, or with -c, -l or -q only counting
+// it.  In a binary file, the first match is reported instead.  Stops
+// the scan once the file has given what 'mode' needs.
+static int print_line(void *ctx, unsigned long lineno, int pattern,
+                      const char *line, size_t len)
+{
+  struct grep_file *f = ctx;
+  if (mode == SCAN_LINES && line == NULL)
+  {
+    f->count++;
+    (void)print_binary(f->buf, f->path);
+    return 1;
   }
+  if (mode == SCAN_LINES && print_match(f->buf, f->m, f->path, lineno, pattern,
+                                        line, len) != 0)
+  {
+    return 1;
+  }
+  return scan_enough(mode, ++f->count, max_count);
+}
 
-  char *line = NULL;
-  size_t linelen = 0;
-  int lineno = 1;
+// Search the file f->path, adding its matching lines to f->count.
+// Returns -1 on error.
+int fauxgrep_file(struct grep_file *f)
+{
+  return scan_file(f->m, f->path, print_line, f) < 0 ? -1 : 0;
+}
 
-  while (getline(&line, &linelen, f) != -1)
+// Finish the output of a file with 'count' matching lines: the count
+// with -c, the path with -l if it matched.  With -q a match ends the
+// whole run.  Returns non-zero if out of memory.
+static int grep_report(struct thread_pool *pool, struct output_buf *buf,
+                       const char *path, unsigned long count)
+{
+  switch (mode)
   {
-    if (strstr(line, needle) != NULL)
+  case SCAN_COUNT:
+    return output_buf_printf(buf, "%s:%lu\n", path, count);
+  case SCAN_LIST:
+    return count > 0 ? output_buf_printf(buf, "%s\n", path) : 0;
+  case SCAN_QUIET:
+    if (count > 0)
     {
-      printf("%s:%d: %s", path, lineno, line);
+      __atomic_store_n(&matched, 1, __ATOMIC_RELAXED);
+      thread_pool_cancel(pool);
     }
-
-    lineno++;
+    return 0;
+  default:
+    return 0;
   }
+}
 
-  free(line);
-  fclose(f);
+// The buffer a job running on 'pool' prints into: 'local' with
+// --sorted, otherwise that of the worker.
+static struct output_buf *grep_output(struct thread_pool *pool,
+                                      struct output_buf *local)
+{
+  return sorted ? local : output_worker_buf(&out, thread_pool_worker_id(pool));
+}
 
-  return 0;
+// Hand over the output of a file: commit it in sequence with --sorted,
+// otherwise write the worker buffer out once it is full.
+static void grep_output_done(unsigned long seq, struct output_buf *buf)
+{
+  if (sorted)
+  {
+    output_commit(&out, seq, buf);
+  }
+  else
+  {
+    output_maybe_flush(&out, buf);
+  }
 }
 
-// Worker thread: pop file paths from the queue and process them.
-static void *worker_thread(void *vargs)
+static struct grep_job *grep_job_new(struct thread_pool *pool, const struct matcher *m,
+                                     const char *path)
 {
-  struct worker_args *args = vargs;
-  struct job_queue *q = args->q;
-  const char *needle = args->needle;
+  int id = thread_pool_worker_id(pool);
+  struct arena *a = &job_arenas[id < 0 ? num_arenas - 1 : id];
+  size_t pathlen = strlen(path);
+  struct grep_job *job = arena_alloc(a, sizeof(struct grep_job) + pathlen + 1);
+  if (job == NULL)
+  {
+    return NULL;
+  }
+  job->m = m;
+  job->seq = 0;
+  job->local = (struct output_buf){0};
+  memcpy(job->path, path, pathlen + 1);
+  return job;
+}
 
-  for (;;)
+// scan_line_fn recording a match of a chunk (only counting it with -c,
+// -l or -q, or in a binary file).
+static int record_match(void *ctx, unsigned long lineno, int pattern,
+                        const char *line, size_t len)
+{
+  struct grep_chunk *c = ctx;
+
+  if (mode == SCAN_LINES && !c->big->binary)
   {
-    void *data = NULL;
-    int r = job_queue_pop(q, &data);
-    if (r != 0)
+    if (c->nmatches == c->cap)
     {
-      // queue was destroyed and empty -> exit worker
-      break;
+      size_t cap = c->cap == 0 ? 64 : c->cap * 2;
+      struct grep_match *bigger = realloc(c->matches, cap * sizeof(struct grep_match));
+      if (bigger == NULL)
+      {
+        c->failed = 1;
+        return 1;
+      }
+      c->matches = bigger;
+      c->cap = cap;
+    }
+    c->matches[c->nmatches] = (struct grep_match){lineno, pattern, line, len};
+  }
+  else if (mode != SCAN_COUNT)
+  {
+    __atomic_store_n(&c->big->decided, 1, __ATOMIC_RELAXED);
+    if (mode == SCAN_LINES)
+    {
+      c->nmatches++;
+      return 1;
     }
+  }
+  return scan_enough(mode, ++c->nmatches, max_count);
+}
 
-    char *path = data;
-    // process file and free the duplicated path
-    (void)fauxgrep_file(needle, path);
-    free(path);
+// Print the matches of every chunk, numbering lines from the prefix sum
+// of the newline counts of the chunks before them, and free the file.
+static void grep_big_finish(struct thread_pool *pool, struct grep_big *big)
+{
+  struct output_buf local = {0};
+  struct output_buf *buf = grep_output(pool, &local);
+  unsigned long base = 1, count = 0;
+  int failed = 0;
+
+  // Each chunk stopped after max_count matches; of those, the first
+  // max_count in the file count.
+  for (int i = 0; i < big->nchunks; i++)
+  {
+    struct grep_chunk *c = &big->chunks[i];
+    size_t n = c->nmatches;
+    if (max_count != 0 && n > max_count - count)
+    {
+      n = max_count - count;
+    }
+    for (size_t j = 0; mode == SCAN_LINES && !big->binary && j < n && !failed; j++)
+    {
+      struct grep_match *match = &c->matches[j];
+      failed = print_match(buf, big->m, big->path, base + match->lineno,
+                           match->pattern, match->line, match->len) != 0;
+    }
+    count += n;
+    base += c->newlines;
+    failed = failed || c->failed;
+    free(c->matches);
   }
+  if (mode == SCAN_LINES && big->binary && count > 0)
+  {
+    failed = print_binary(buf, big->path) != 0 || failed;
+  }
+  failed = grep_report(pool, buf, big->path, count) != 0 || failed;
+  grep_output_done(big->seq, buf);
+  stats_count(1, 0);
 
-  return NULL;
+  if (failed)
+  {
+    warnx("out of memory while searching %s; output is incomplete", big->path);
+  }
+  scan_map_close(&big->map);
+  free(big->chunks);
+  free(big);
 }
 
-int main(int argc, char *const *argv)
+// Pool job: search one chunk of a large file.
+static void grep_chunk_run(struct thread_pool *pool, void *arg)
 {
-  if (argc < 2)
+  struct grep_chunk *c = arg;
+  struct grep_big *big = c->big;
+
+  // Once another chunk has found what -l or -q need, or another file
+  // has answered -q, there is nothing left to find.  Newlines are only
+  // counted when lines are printed.
+  if (!thread_pool_cancelled(pool) && !__atomic_load_n(&big->decided, __ATOMIC_RELAXED))
   {
-    err(1, "usage: [-n INT] STRING paths...");
-    exit(1);
+    if (mode == SCAN_LINES && !big->binary)
+    {
+      c->newlines = count_newlines(c->data, c->len);
+    }
+    (void)scan_buffer(big->m, c->data, c->len, 0, record_match, c);
+    stats_count(0, c->len);
   }
 
-  int num_threads = 1;
-  char const *needle = argv[1];
-  char *const *paths = &argv[2];
+  if (__atomic_sub_fetch(&big->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    grep_big_finish(pool, big);
+  }
+}
 
-  if (argc > 3 && strcmp(argv[1], "-n") == 0)
+// Split the mapped file of 'job' into chunks of about chunk_size bytes,
+// each ending just after a newline, and submit them.  Returns non-zero
+// (leaving the mapping to the caller) if out of memory.
+static int grep_big_start(struct thread_pool *pool, const struct grep_job *job,
+                          const struct scan_map *map)
+{
+  size_t pathlen = strlen(job->path);
+  size_t max_chunks = (map->len + chunk_size - 1) / chunk_size;
+  struct grep_big *big = malloc(sizeof(struct grep_big) + pathlen + 1);
+  struct grep_chunk *chunks = calloc(max_chunks, sizeof(struct grep_chunk));
+  if (big == NULL || chunks == NULL)
   {
-    // Since atoi() simply returns zero on syntax errors, we cannot
-    // distinguish between the user entering a zero, or some
-    // non-numeric garbage.  In fact, we cannot even tell whether the
-    // given option is suffixed by garbage, i.e. '123foo' returns
-    // '123'.  A more robust solution would use strtol(), but its
-    // interface is more complicated, so here we are.
-    num_threads = atoi(argv[2]);
+    free(big);
+    free(chunks);
+    return -1;
+  }
 
-    if (num_threads < 1)
+  big->m = job->m;
+  big->seq = job->seq;
+  big->map = *map;
+  big->decided = 0;
+  big->binary = job->m->binary == SCAN_BINARY_REPORT
+                && scan_looks_binary(map->data, map->len);
+  big->chunks = chunks;
+  memcpy(big->path, job->path, pathlen + 1);
+
+  // Lines are never split, so a match cannot straddle two chunks and
+  // the chunks need not overlap.
+  int n = 0;
+  size_t start = 0;
+  while (start < map->len)
+  {
+    size_t end = start + chunk_size;
+    if (end >= map->len)
     {
-      err(1, "invalid thread count: %s", argv[2]);
+      end = map->len;
+    }
+    else
+    {
+      const char *nl = memchr(map->data + end - 1, '\n', map->len - (end - 1));
+      end = nl == NULL ? map->len : (size_t)(nl - map->data) + 1;
     }
 
-    needle = argv[3];
-    paths = &argv[4];
+    chunks[n] = (struct grep_chunk){.big = big, .data = map->data + start,
+                                    .len = end - start};
+    n++;
+    start = end;
   }
-  else
+  big->nchunks = n;
+  big->remaining = n;
+
+  // 'big' is freed by whichever chunk finishes last, which cannot happen
+  // before the last one is submitted.  Chunks that cannot be queued run
+  // right here.
+  for (int i = 0; i < n; i++)
   {
-    needle = argv[1];
-    paths = &argv[2];
+    if (thread_pool_submit(pool, grep_chunk_run, &chunks[i]) != 0)
+    {
+      grep_chunk_run(pool, &chunks[i]);
+    }
   }
+  return 0;
+}
 
-  // Initialise job queue and spawn worker threads.
-  struct job_queue q;
-  const int q_capacity = 64;
-  if (job_queue_init(&q, q_capacity) != 0)
+// Free a job that could not be submitted, or is not wanted any more.
+static void grep_job_drop(struct grep_job *job)
+{
+  if (sorted)
   {
-    err(1, "failed to init job queue");
+    // Its sequence number must still be used up.
+    struct output_buf empty = {0};
+    output_commit(&out, job->seq, &empty);
   }
+  arena_free(job);
+}
+
+// Pool job: process one file and free the job.  Files above chunk_size
+// are split into chunk jobs.
+static void grep_job_run(struct thread_pool *pool, void *arg)
+{
+  struct grep_job *job = arg;
+  struct scan_map map;
 
-  pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)num_threads);
-  if (threads == NULL)
+  if (thread_pool_cancelled(pool))
   {
-    err(1, "failed to allocate threads array");
+    grep_job_drop(job);
+    return;
   }
 
-  // Create per-thread args array so each thread gets its own args struct.
-  struct worker_args *targs = malloc(sizeof(struct worker_args) * (size_t)num_threads);
-  if (targs == NULL)
+  // A binary file skipped with -I is not worth splitting up; it is
+  // left to scan_whole().
+  int r = scan_map_open(&map, job->path);
+  if (r == 0 && map.len > chunk_size
+      && !(job->m->binary == SCAN_BINARY_SKIP && scan_looks_binary(map.data, map.len))
+      && grep_big_start(pool, job, &map) == 0)
   {
-    free(threads);
-    err(1, "failed to allocate thread args");
+    // The last chunk hands over the output.
+    arena_free(job);
+    return;
   }
 
-  for (int i = 0; i < num_threads; i++)
+  struct output_buf local = {0};
+  struct grep_file f = {job->m, job->path, grep_output(pool, &local), 0};
+  if (r == 0)
   {
-    targs[i].q = &q;
-    targs[i].needle = needle;
-    if (pthread_create(&threads[i], NULL, worker_thread, &targs[i]) != 0)
-    {
-      err(1, "failed to create worker thread");
-    }
+    (void)scan_whole(job->m, map.data, map.len, print_line, &f);
+    stats_count(1, map.len);
+    scan_map_close(&map);
+  }
+  else if (r > 0)
+  {
+    r = fauxgrep_file(&f);
+    stats_count(1, 0);
+  }
+  if (r >= 0)
+  {
+    (void)grep_report(pool, f.buf, job->path, f.count);
+  }
+  grep_output_done(job->seq, f.buf);
+
+  arena_free(job);
+}
+
+// uring_reader callback: search a whole file, which is read as a
+// single block.
+static void grep_uring_block(struct thread_pool *pool, void *ctx,
+                             const unsigned char *buf, size_t len, off_t offset)
+{
+  struct grep_job *job = ctx;
+  struct grep_file f = {job->m, job->path, grep_output(pool, &job->local), 0};
+  (void)offset;
+
+  if (!thread_pool_cancelled(pool))
+  {
+    (void)scan_whole(job->m, (const char *)buf, len, print_line, &f);
+    stats_count(1, len);
+    (void)grep_report(pool, f.buf, job->path, f.count);
   }
+  if (!sorted)
+  {
+    output_maybe_flush(&out, f.buf);
+  }
+}
+
+// uring_reader callback: the file has been searched (or could not be
+// read, which has been reported).
+static void grep_uring_done(struct thread_pool *pool, void *ctx, int error)
+{
+  struct grep_job *job = ctx;
+  (void)pool;
+  (void)error;
+
+  if (sorted)
+  {
+    output_commit(&out, job->seq, &job->local);
+  }
+  arena_free(job);
+}
+
+// Start a job for a file of 'size' bytes: on the reader with --io-uring
+// if the file fits in one of its blocks, otherwise on the pool.
+// Returns non-zero (leaving the job to the caller) on error.
+static int grep_submit(struct thread_pool *pool, struct grep_job *job, off_t size)
+{
+  if (use_uring && size > 0 && (size_t)size <= uring.block_size)
+  {
+    return uring_reader_submit(&uring, job->path, size, job);
+  }
+  return thread_pool_submit(pool, grep_job_run, job);
+}
+
+// Number of files handed to the pool per submission.
+#define PATH_BATCH 32
 
+// Submit a batch of jobs, freeing any that could not be submitted.
+static void submit_jobs(struct thread_pool *pool, void **batch, int n)
+{
+  int submitted = thread_pool_submit_many(pool, grep_job_run, batch, n);
+  for (int i = submitted; i < n; i++)
+  {
+    grep_job_drop(batch[i]);
+  }
+}
+
+// Walk 'paths' with fts on the calling thread and submit a job per
+// regular file.
+static void submit_fts(struct thread_pool *pool, char *const *paths,
+                       const struct matcher *m)
+{
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
   //
@@ -161,31 +563,65 @@ int main(int argc, char *const *argv)
   if ((ftsp = fts_open(paths, fts_options, NULL)) == NULL)
   {
     err(1, "fts_open() failed");
-    return -1;
   }
 
+  // Jobs are submitted in batches so that one lock acquisition and one
+  // wakeup on the queue is shared by many files.
+  void *batch[PATH_BATCH];
+  int batch_len = 0;
+
+  // A cancelled pool (-q) wants no more files.
   FTSENT *p;
-  while ((p = fts_read(ftsp)) != NULL)
+  while (!thread_pool_cancelled(pool) && (p = fts_read(ftsp)) != NULL)
   {
     switch (p->fts_info)
     {
     case FTS_D:
+      // An excluded directory is not entered at all.
+      if (p->fts_level > 0 && !path_filter_dir(&filter, p->fts_path))
+      {
+        fts_set(ftsp, p, FTS_SKIP);
+      }
       break;
     case FTS_F:
     {
-      // Duplicate the path because the FTS library may reuse buffers.
-      char *pathcopy = strdup(p->fts_path);
-      if (pathcopy == NULL)
+      if (!path_filter_file(&filter, p->fts_path, p->fts_statp)
+          || (use_index && !trigram_index_may_match(&trigram_idx, p->fts_statp)))
+      {
+        break;
+      }
+
+      // Copy the path because the FTS library may reuse buffers.
+      struct grep_job *job = grep_job_new(pool, m, p->fts_path);
+      if (job == NULL)
       {
-        warn("strdup failed for %s", p->fts_path);
+        warn("malloc failed for %s", p->fts_path);
         break;
       }
 
-      // Push the duplicated path onto the job queue. Worker frees it.
-      if (job_queue_push(&q, pathcopy) != 0)
+      // With --sorted, files are numbered in traversal order.  This
+      // blocks while SORT_WINDOW files are waiting to be written, which
+      // cannot include the whole batch, so it cannot deadlock.
+      if (sorted)
       {
-        // If push fails (e.g., queue destroyed), free and continue.
-        free(pathcopy);
+        job->seq = output_reserve(&out);
+      }
+
+      if (use_uring)
+      {
+        if (grep_submit(pool, job, p->fts_statp->st_size) != 0)
+        {
+          grep_job_drop(job);
+        }
+        break;
+      }
+
+      // Queue the job; it is submitted with its batch and frees itself.
+      batch[batch_len++] = job;
+      if (batch_len == PATH_BATCH)
+      {
+        submit_jobs(pool, batch, batch_len);
+        batch_len = 0;
       }
     }
     break;
@@ -195,20 +631,336 @@ int main(int argc, char *const *argv)
   }
 
   fts_close(ftsp);
+  submit_jobs(pool, batch, batch_len);
+}
 
-  // No more files will be pushed. Destroy the queue which blocks until all
-  // queued jobs are processed. This wakes blocked poppers so they can exit.
-  if (job_queue_destroy(&q) != 0)
+// walk_parallel() callback: submit a job for a file found by a worker.
+static void grep_found_file(struct thread_pool *pool, const char *path,
+                            const struct stat *st, void *ctx)
+{
+  if (thread_pool_cancelled(pool) || !path_filter_file(&filter, path, st)
+      || (use_index && !trigram_index_may_match(&trigram_idx, st)))
   {
-    err(1, "failed to destroy job queue");
+    return;
   }
 
-  // Join worker threads and free resources.
-  for (int i = 0; i < num_threads; i++)
+  struct grep_job *job = grep_job_new(pool, ctx, path);
+  if (job != NULL && grep_submit(pool, job, st->st_size) != 0)
   {
-    pthread_join(threads[i], NULL);
+    arena_free(job);
   }
-  free(threads);
-  free(targs);
-  return 0;
-}
\ No newline at end of file
+}
+
+// walk_parallel() callback: whether to enter a directory.
+static int grep_enter_dir(const char *name, void *ctx)
+{
+  (void)ctx;
+  return path_filter_dir(&filter, name);
+}
+
+#define USAGE "usage: [-n INT] [-E] [-i] [-a | -I] [-c | -l | -q] [-m NUM] [--lock-free] [--parallel-walk] " \
+  "[--chunk-size BYTES] [--sorted] [--io-uring] [--io-depth INT] [--stats] [--stats-interval MS] [--index INDEX] " PATH_FILTER_USAGE " {STRING | -e PATTERN... | -f FILE...} paths..."
+
+int main(int argc, char *const *argv)
+{
+  struct pattern_list patterns = {0};
+  int num_threads = 1;
+  enum job_queue_kind q_kind = JOB_QUEUE_LOCKED;
+  int parallel_walk = 0;
+  int io_uring = 0;
+  unsigned io_depth = URING_READER_DEFAULT_DEPTH;
+  int stats = 0;
+  unsigned stats_interval = 0;
+  int flags = REGEX_DFA_LITERAL;
+
+  static const struct option long_options[] = {
+      {"lock-free", no_argument, NULL, 'L'},
+      {"parallel-walk", no_argument, NULL, 'W'},
+      {"chunk-size", required_argument, NULL, 'C'},
+      {"sorted", no_argument, NULL, 'S'},
+      {"index", required_argument, NULL, 'X'},
+      {"io-uring", no_argument, NULL, 'U'},
+      {"io-depth", required_argument, NULL, 'D'},
+      {"stats", no_argument, NULL, 'T'},
+      {"stats-interval", required_argument, NULL, 'R'},
+      PATH_FILTER_LONG_OPTIONS,
+      {NULL, 0, NULL, 0}};
+  const char *index_path = NULL;
+
+  // '+' stops option parsing at the first operand, so paths are never
+  // mistaken for options.
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+n:e:f:EiaIclm:q", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      mode = SCAN_COUNT;
+      break;
+    case 'l':
+      mode = SCAN_LIST;
+      break;
+    case 'q':
+      mode = SCAN_QUIET;
+      break;
+    case 'm':
+    {
+      char *end;
+      max_count = strtoul(optarg, &end, 10);
+      if (*optarg == '-' || *end != '\0' || max_count == 0)
+      {
+        err(1, "invalid max count: %s", optarg);
+      }
+    }
+    break;
+    case 'E':
+      flags &= ~REGEX_DFA_LITERAL;
+      break;
+    case 'i':
+      flags |= REGEX_DFA_ICASE;
+      break;
+    case 'a':
+      binary = SCAN_BINARY_TEXT;
+      break;
+    case 'I':
+      binary = SCAN_BINARY_SKIP;
+      break;
+    case 'n':
+      // Since atoi() simply returns zero on syntax errors, we cannot
+      // distinguish between the user entering a zero, or some
+      // non-numeric garbage.  In fact, we cannot even tell whether the
+      // given option is suffixed by garbage, i.e. '123foo' returns
+      // '123'.  A more robust solution would use strtol(), but its
+      // interface is more complicated, so here we are.
+      num_threads = atoi(optarg);
+
+      if (num_threads < 1)
+      {
+        err(1, "invalid thread count: %s", optarg);
+      }
+      break;
+    case 'L':
+      q_kind = JOB_QUEUE_LOCKFREE;
+      break;
+    case 'W':
+      parallel_walk = 1;
+      break;
+    case 'S':
+      sorted = 1;
+      break;
+    case 'X':
+      index_path = optarg;
+      break;
+    case 'U':
+      io_uring = 1;
+      break;
+    case 'T':
+      stats = 1;
+      break;
+    case 'R':
+    {
+      int ms = atoi(optarg);
+      if (ms < 1)
+      {
+        err(1, "invalid stats interval: %s", optarg);
+      }
+      stats = 1;
+      stats_interval = (unsigned)ms;
+    }
+    break;
+    case 'D':
+    {
+      int depth = atoi(optarg);
+      if (depth < 1 || depth > 4096)
+      {
+        err(1, "invalid I/O depth: %s", optarg);
+      }
+      io_depth = (unsigned)depth;
+    }
+    break;
+    case 'C':
+    {
+      char *end;
+      unsigned long long bytes = strtoull(optarg, &end, 10);
+      if (*optarg == '-' || *end != '\0' || bytes == 0 || bytes > SIZE_MAX)
+      {
+        err(1, "invalid chunk size: %s", optarg);
+      }
+      chunk_size = (size_t)bytes;
+    }
+    break;
+    case 'e':
+      if (pattern_list_add(&patterns, optarg) != 0)
+      {
+        err(1, "failed to store pattern");
+      }
+      break;
+    case 'f':
+      if (pattern_list_read(&patterns, optarg) != 0)
+      {
+        exit(1);
+      }
+      break;
+    default:
+      if (path_filter_option(&filter, opt, optarg) != 0)
+      {
+        err(1, USAGE);
+      }
+    }
+  }
+
+  // Without -e or -f, the first operand is the needle.
+  if (patterns.n == 0)
+  {
+    if (optind >= argc)
+    {
+      err(1, USAGE);
+    }
+    if (pattern_list_add(&patterns, argv[optind++]) != 0)
+    {
+      err(1, "failed to store pattern");
+    }
+  }
+
+  char *const *paths = &argv[optind];
+
+  struct matcher m;
+  if (matcher_init_regex(&m, (const char *const *)patterns.patterns, patterns.n,
+                         flags) != 0)
+  {
+    exit(1);
+  }
+  m.binary = binary;
+
+  // An unusable index only costs time: everything is searched.  The
+  // index only narrows the search if every pattern yields a trigram to
+  // look up.  Plain strings are looked up as they are; regular
+  // expressions and -i (the index holds exact bytes) by the literal
+  // that every match contains.  If any string is shorter than three
+  // bytes, or no such literal can be extracted (e.g. '-E a.b|c'), all
+  // files are still searched in full.
+  const char *const *wanted = (const char *const *)patterns.patterns;
+  size_t nwanted = patterns.n;
+  const char *literal = m.re != NULL ? m.re->literal : NULL;
+  if (literal != NULL)
+  {
+    wanted = &literal;
+    nwanted = 1;
+  }
+  if (index_path != NULL && trigram_index_open(&trigram_idx, index_path) == 0)
+  {
+    if (trigram_index_select(&trigram_idx, wanted, nwanted) != 0)
+    {
+      err(1, "failed to query index %s", index_path);
+    }
+    use_index = 1;
+  }
+
+  if (output_init(&out, STDOUT_FILENO, num_threads, sorted ? SORT_WINDOW : 0) != 0)
+  {
+    err(1, "failed to set up output");
+  }
+
+  if (stats && stats_enable(stats_interval) != 0)
+  {
+    err(1, "failed to start stats reporter");
+  }
+
+  num_arenas = num_threads + 1;
+  job_arenas = malloc(num_arenas * sizeof(struct arena));
+  if (job_arenas == NULL)
+  {
+    err(1, "failed to allocate arenas");
+  }
+  for (int i = 0; i < num_arenas; i++)
+  {
+    arena_init(&job_arenas[i], 0);
+  }
+
+  // Start the worker pool.  Files are submitted through the pool's
+  // injection queue, which grows from q_capacity to q_max_capacity
+  // jobs if the workers keep running out of files (locked queue only).
+  struct thread_pool pool;
+  const int q_capacity = 64;
+  const int q_max_capacity = 64 * 1024;
+  if (thread_pool_init(&pool, num_threads, q_capacity, q_kind) != 0)
+  {
+    err(1, "failed to start thread pool");
+  }
+  if (q_kind == JOB_QUEUE_LOCKED)
+  {
+    (void)job_queue_set_max_capacity(&pool.injection, q_max_capacity);
+  }
+
+  // Files are read whole, so the block size is the largest file the
+  // reader takes.
+  if (io_uring)
+  {
+    size_t max_file = chunk_size < URING_READER_MAX_BYTES ? chunk_size : URING_READER_MAX_BYTES;
+    buf_pool_init(&uring_bufs, max_file, URING_READER_MAX_BYTES);
+    if (uring_reader_init(&uring, &pool, io_depth, &uring_bufs,
+                          grep_uring_block, grep_uring_done) == 0)
+    {
+      use_uring = 1;
+    }
+    else
+    {
+      warnx("io_uring is not available; reading files synchronously");
+      buf_pool_destroy(&uring_bufs);
+    }
+  }
+
+  // The parallel walk has no traversal order, so --sorted always walks
+  // with fts.  The walk is used by its jobs until the pool is idle.
+  struct walk walk;
+  if (parallel_walk && !sorted)
+  {
+    walk_parallel(&walk, &pool, paths, grep_found_file, grep_enter_dir, &m);
+  }
+  else
+  {
+    submit_fts(&pool, paths, &m);
+  }
+
+  // Once the walk is done, no more files will be submitted; the reader
+  // then hands over the files it has left.
+  if (use_uring)
+  {
+    thread_pool_wait(&pool);
+    uring_reader_finish(&uring);
+  }
+
+  // Destroying the pool waits for all jobs to finish and then joins the
+  // workers.
+  if (thread_pool_destroy(&pool) != 0)
+  {
+    err(1, "failed to destroy thread pool");
+  }
+  if (use_uring)
+  {
+    uring_reader_destroy(&uring);
+    buf_pool_destroy(&uring_bufs);
+  }
+  for (int i = 0; i < num_arenas; i++)
+  {
+    arena_destroy(&job_arenas[i]);
+  }
+  free(job_arenas);
+
+  if (output_destroy(&out) != 0)
+  {
+    err(1, "failed to write output");
+  }
+  stats_finish();
+
+  if (use_index)
+  {
+    trigram_index_close(&trigram_idx);
+  }
+  matcher_destroy(&m);
+  pattern_list_free(&patterns);
+  path_filter_free(&filter);
+
+  // As for grep -q, the exit status tells whether anything matched.
+  return mode == SCAN_QUIET && !matched;
+}
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -15,40 +17,226 @@
 // very handy.
 #include <err.h>
 
-int fauxgrep_file(char const *needle, char const *path) {
-  FILE *f = fopen(path, "r");
+#include "path_filter.h"
+#include "scan.h"
+#include "trigram_index.h"
+#include "stats.h"
 
-  if (f == NULL) {
-    warn("failed to open %s", path);
+// What is printed for each file (-c, -l, -q), and after how many
+// matching lines a file is given up (-m, 0 for no limit).
+static enum scan_mode mode = SCAN_LINES;
+static unsigned long max_count = 0;
+
+// Which files are searched (--include, --exclude, ...), as in
+// fauxgrep-mt.
+static struct path_filter filter;
+
+// What is done with files that look binary (-a, -I): by default, their
+// matching lines are not printed, only that the file matches.
+static enum scan_binary binary = SCAN_BINARY_REPORT;
+
+// The file being scanned, passed to print_line().
+struct grep_file {
+  const struct matcher *m;
+  const char *path;
+  unsigned long count;  /* matching lines so far */
+};
+
+// Print a matching line, prefixed by the path and the line number, and
+// by the pattern that was found if there are several.  In a binary
+// file, the first match is reported instead.  Stops the scan once the
+// file has given what 'mode' needs.
+static int print_line(void *ctx, unsigned long lineno, int pattern,
+                      const char *line, size_t len) {
+  struct grep_file *f = ctx;
+  if (mode == SCAN_LINES && line == NULL) {
+    printf("Binary file %s matches\n", f->path);
+    f->count++;
+    return 1;
+  }
+  if (mode == SCAN_LINES) {
+    if (f->m->npatterns > 1) {
+      printf("%s:%lu:%s: ", f->path, lineno, f->m->patterns[pattern]);
+    } else {
+      printf("%s:%lu: ", f->path, lineno);
+    }
+    fwrite(line, 1, len, stdout);
+  }
+  return scan_enough(mode, ++f->count, max_count);
+}
+
+// Search one file, printing its matching lines, or with -c their count
+// and with -l its path if there are any.  Returns -1 on error, 1 if a
+// line matched, otherwise 0.
+int fauxgrep_file(const struct matcher *m, char const *path) {
+  struct grep_file f = { m, path, 0 };
+  if (scan_file(m, path, print_line, &f) < 0) {
     return -1;
   }
+  if (mode == SCAN_COUNT) {
+    printf("%s:%lu\n", path, f.count);
+  } else if (mode == SCAN_LIST && f.count > 0) {
+    printf("%s\n", path);
+  }
+  return f.count > 0;
+}
+
+// Index the trigrams of every regular file under 'paths' into
+// 'index_path', for fauxgrep-mt --index.  Files that cannot be read are
+// left out, so they are always searched.
+int build_index(const char *index_path, char * const *paths) {
+  struct trigram_builder b;
+  if (trigram_builder_init(&b) != 0) {
+    err(1, "failed to allocate index");
+  }
 
-  char *line = NULL;
-  size_t linelen = 0;
-  int lineno = 1;
+  int fts_options = FTS_LOGICAL | FTS_NOCHDIR;
 
-  while (getline(&line, &linelen, f) != -1) {
-    if (strstr(line, needle) != NULL) {
-      printf("%s:%d: %s", path, lineno, line);
+  FTS *ftsp;
+  if ((ftsp = fts_open(paths, fts_options, NULL)) == NULL) {
+    err(1, "fts_open() failed");
+  }
+
+  // The stamp is taken from the stat() made before the file is read, so
+  // a file changed while being indexed looks stale afterwards.
+  FTSENT *p;
+  while ((p = fts_read(ftsp)) != NULL) {
+    if (p->fts_info != FTS_F) {
+      continue;
     }
 
-    lineno++;
+    struct scan_map map;
+    int r = scan_map_open(&map, p->fts_path);
+    if (r == 0) {
+      r = trigram_builder_add(&b, p->fts_statp, map.data, map.len);
+      scan_map_close(&map);
+    } else if (r == 1 && p->fts_statp->st_size == 0) {
+      r = trigram_builder_add(&b, p->fts_statp, NULL, 0);
+    } else {
+      continue;
+    }
+    if (r != 0) {
+      err(1, "failed to index %s", p->fts_path);
+    }
   }
 
-  free(line);
-  fclose(f);
+  fts_close(ftsp);
 
-  return 0;
+  int ret = trigram_builder_write(&b, index_path);
+  trigram_builder_free(&b);
+  return ret;
 }
 
+#define USAGE "usage: [-E] [-i] [-a | -I] [-c | -l | -q] [-m NUM] [--stats] [--stats-interval MS] " \
+  PATH_FILTER_USAGE " {STRING | -e PATTERN... | -f FILE...} paths...\n" \
+  "       --build-index INDEX paths..."
+
 int main(int argc, char * const *argv) {
-  if (argc < 2) {
-    err(1, "usage: STRING paths...");
-    exit(1);
+  struct pattern_list patterns = { 0 };
+  const char *index_path = NULL;
+  int stats = 0;
+  unsigned stats_interval = 0;
+  int flags = REGEX_DFA_LITERAL;
+
+  static const struct option long_options[] = {
+    { "build-index", required_argument, NULL, 'X' },
+    { "stats", no_argument, NULL, 'T' },
+    { "stats-interval", required_argument, NULL, 'R' },
+    PATH_FILTER_LONG_OPTIONS,
+    { NULL, 0, NULL, 0 }
+  };
+
+  // '+' stops option parsing at the first operand, so paths are never
+  // mistaken for options.
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+e:f:EiaIclm:q", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'c':
+      mode = SCAN_COUNT;
+      break;
+    case 'l':
+      mode = SCAN_LIST;
+      break;
+    case 'q':
+      mode = SCAN_QUIET;
+      break;
+    case 'm': {
+      char *end;
+      max_count = strtoul(optarg, &end, 10);
+      if (*optarg == '-' || *end != '\0' || max_count == 0) {
+        err(1, "invalid max count: %s", optarg);
+      }
+    }
+      break;
+    case 'E':
+      flags &= ~REGEX_DFA_LITERAL;
+      break;
+    case 'i':
+      flags |= REGEX_DFA_ICASE;
+      break;
+    case 'a':
+      binary = SCAN_BINARY_TEXT;
+      break;
+    case 'I':
+      binary = SCAN_BINARY_SKIP;
+      break;
+    case 'X':
+      index_path = optarg;
+      break;
+    case 'T':
+      stats = 1;
+      break;
+    case 'R': {
+      int ms = atoi(optarg);
+      if (ms < 1) {
+        err(1, "invalid stats interval: %s", optarg);
+      }
+      stats = 1;
+      stats_interval = (unsigned)ms;
+    }
+      break;
+    case 'e':
+      if (pattern_list_add(&patterns, optarg) != 0) {
+        err(1, "failed to store pattern");
+      }
+      break;
+    case 'f':
+      if (pattern_list_read(&patterns, optarg) != 0) {
+        exit(1);
+      }
+      break;
+    default:
+      if (path_filter_option(&filter, opt, optarg) != 0) {
+        err(1, USAGE);
+      }
+    }
+  }
+
+  if (index_path != NULL) {
+    if (patterns.n > 0 || optind >= argc) {
+      err(1, USAGE);
+    }
+    return build_index(index_path, &argv[optind]) != 0;
+  }
+
+  // Without -e or -f, the first operand is the needle.
+  if (patterns.n == 0) {
+    if (optind >= argc) {
+      err(1, USAGE);
+    }
+    if (pattern_list_add(&patterns, argv[optind++]) != 0) {
+      err(1, "failed to store pattern");
+    }
   }
 
-  char const *needle = argv[1];
-  char * const *paths = &argv[2];
+  char * const *paths = &argv[optind];
+
+  struct matcher m;
+  if (matcher_init_regex(&m, (const char * const *)patterns.patterns, patterns.n,
+                         flags) != 0) {
+    exit(1);
+  }
+  m.binary = binary;
 
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
@@ -63,13 +251,33 @@ int main(int argc, char * const *argv) {
     return -1;
   }
 
+  // Each file counts as one job of the (only) thread.
+  if (stats && stats_enable(stats_interval) != 0) {
+    err(1, "failed to start stats reporter");
+  }
+
+  // With -q, the first match answers the question.
+  int matched = 0;
   FTSENT *p;
-  while ((p = fts_read(ftsp)) != NULL) {
+  while (!(matched && mode == SCAN_QUIET) && (p = fts_read(ftsp)) != NULL) {
     switch (p->fts_info) {
     case FTS_D:
+      // An excluded directory is not entered at all.
+      if (p->fts_level > 0 && !path_filter_dir(&filter, p->fts_path)) {
+        fts_set(ftsp, p, FTS_SKIP);
+      }
       break;
-    case FTS_F:
-      fauxgrep_file(needle, p->fts_path);
+    case FTS_F: {
+      if (!path_filter_file(&filter, p->fts_path, p->fts_statp)) {
+        break;
+      }
+      uint64_t start = stats_job_begin();
+      if (fauxgrep_file(&m, p->fts_path) > 0) {
+        matched = 1;
+      }
+      stats_count(1, (uint64_t)p->fts_statp->st_size);
+      stats_job_end(start);
+    }
       break;
     default:
       break;
@@ -78,5 +286,13 @@ int main(int argc, char * const *argv) {
 
   fts_close(ftsp);
 
-  return 0;
+  matcher_destroy(&m);
+  pattern_list_free(&patterns);
+  path_filter_free(&filter);
+
+  fflush(stdout);
+  stats_finish();
+
+  // As for grep -q, the exit status tells whether anything matched.
+  return mode == SCAN_QUIET && !matched;
 }
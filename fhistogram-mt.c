@@ -7,12 +7,23 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fts.h>
-
-#include "job_queue.h"
+#include <getopt.h>
+
+#include "thread_pool.h"
+#include "walk.h"
+#include "path_filter.h"
+#include "block_reader.h"
+#include "byte_histogram.h"
+#include "hist_cache.h"
+#include "uring_reader.h"
+#include "arena.h"
+#include "buf_pool.h"
+#include "stats.h"
 
 pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -22,130 +33,540 @@ pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #include "histogram.h"
 
-// Global histogram updated by workers. Protected by hist_mutex.
-static int global_histogram[8] = {0};
-static pthread_mutex_t hist_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Each worker adds to its own histogram, padded to a cache line so
+// that workers never share one.  The reporter thread only reads the
+// bits; the byte and word counts are only read once the workers are
+// done.  The last entry is for jobs run outside the pool.
+struct worker_histogram
+{
+  int64_t bits[8];
+  uint64_t bytes[256];
+  uint64_t *words;
+} __attribute__((aligned(64)));
+
+static struct worker_histogram *worker_histograms;
+static int num_histograms;
+
+// Files and jobs are allocated from an arena of the thread that creates
+// them, indexed like worker_histograms, and freed by whichever worker
+// finishes them.
+static struct arena *job_arenas;
+
+// Extra modes: byte (-B) and word (-w) histograms of all files, and the
+// entropy of each file (-E).  In any of them, byte values are counted
+// and the bit histogram is derived from them, still in one pass.
+static int bytes_mode = 0, words_mode = 0, entropy_mode = 0;
+
+// Bit histograms of files seen on earlier runs (see hist_cache.h).
+// Files whose dev/inode/size/mtime/ctime are unchanged are counted
+// from the cache without being opened.  Off for the extra modes, whose
+// counts are not cached.
+static struct hist_cache cache;
+static int use_cache = 0;
+
+// The reporter redraws the histogram this often.
+#define REPORT_INTERVAL_NS (100 * 1000 * 1000)
+
+// Reporter thread state.  'stop' is protected by report_mutex.
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t report_cond = PTHREAD_COND_INITIALIZER;
+static int report_stop = 0;
+
+// Entropy lines of finished files (-E), in the order the files were
+// finished, waiting for the reporter to print them above the histogram.
+struct entropy_line
+{
+  struct entropy_line *next;
+  double entropy;
+  char path[];
+};
+
+static pthread_mutex_t entropy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct entropy_line *entropy_lines = NULL, **entropy_tail = &entropy_lines;
+
+// Files larger than this are split into chunk jobs of this size, so a
+// single huge file is spread over all workers.
+#define CHUNK_SIZE ((off_t)64 * 1024 * 1024)
+
+// Bytes read (and histogrammed) at a time (-b).
+static size_t block_size = BLOCK_READER_DEFAULT_SIZE;
+
+// Read buffers, shared by the block readers of all jobs and the
+// io_uring reader.
+static struct buf_pool block_bufs;
+
+// With --io-uring, whole files are read by the reader's thread and
+// their blocks handed to the workers (see uring_reader.h).
+static struct uring_reader uring;
+static int use_uring = 0;
 
-// Worker args for fhistogram workers
-struct fhist_worker_args
+// A file being histogrammed, shared by its jobs.  The last job to
+// finish reports the entropy of the file, adds its histogram to the
+// cache and frees it.
+struct fhist_file
 {
-  struct job_queue *q;
+  int jobs;            /* unfinished jobs (atomic) */
+  int error;           /* a job failed to read its range (atomic) */
+  struct hist_cache_key key;
+  int64_t bits[8];     /* bit counts for the cache (atomic adds) */
+  uint64_t *bytes;     /* byte counts for -E (atomic adds), or NULL */
+  char path[];
 };
 
-// Top-level worker function. Pops file paths, computes local histogram,
-// merges into the global histogram and prints the global histogram.
-static void *fhist_worker_thread(void *v)
+// A job: histogram 'length' bytes of the file starting at 'offset'.  A
+// job with length -1 covers a whole file of 'size' bytes and may split
+// itself into chunk jobs.
+struct fhist_job
 {
-  struct fhist_worker_args *a = v;
-  struct job_queue *qq = a->q;
+  struct fhist_file *file;
+  off_t size;
+  off_t offset;
+  off_t length;
+};
 
-  for (;;)
+// The arena of the thread running on 'pool'.
+static struct arena *job_arena(struct thread_pool *pool)
+{
+  int id = thread_pool_worker_id(pool);
+  return &job_arenas[id < 0 ? num_histograms - 1 : id];
+}
+
+static struct fhist_job *fhist_job_new(struct thread_pool *pool, struct fhist_file *file,
+                                       off_t size, off_t offset, off_t length)
+{
+  struct fhist_job *job = arena_alloc(job_arena(pool), sizeof(struct fhist_job));
+  if (job == NULL)
   {
-    void *data = NULL;
-    int r = job_queue_pop(qq, &data);
-    if (r != 0)
-    {
-      /* queue destroyed and empty -> exit */
-      break;
-    }
+    return NULL;
+  }
+  job->file = file;
+  job->size = size;
+  job->offset = offset;
+  job->length = length;
+  __atomic_add_fetch(&file->jobs, 1, __ATOMIC_RELAXED);
+  return job;
+}
 
-    char *path = data;
-    int local_histogram[8] = {0};
+// Start a file and its whole-file job.
+static struct fhist_job *fhist_file_new(struct thread_pool *pool, const char *path,
+                                        const struct stat *st)
+{
+  struct arena *a = job_arena(pool);
+  size_t pathlen = strlen(path);
+  struct fhist_file *file = arena_alloc(a, sizeof(struct fhist_file) + pathlen + 1);
+  if (file == NULL)
+  {
+    return NULL;
+  }
+  file->jobs = 0;
+  file->error = 0;
+  hist_cache_key_init(&file->key, st);
+  memset(file->bits, 0, sizeof(file->bits));
+  file->bytes = NULL;
+  memcpy(file->path, path, pathlen + 1);
+
+  if (entropy_mode && (file->bytes = arena_alloc(a, 256 * sizeof(uint64_t))) != NULL)
+  {
+    memset(file->bytes, 0, 256 * sizeof(uint64_t));
+  }
+  struct fhist_job *job = NULL;
+  if (!entropy_mode || file->bytes != NULL)
+  {
+    job = fhist_job_new(pool, file, st->st_size, 0, -1);
+  }
+  if (job == NULL)
+  {
+    arena_free(file->bytes);
+    arena_free(file);
+  }
+  return job;
+}
+
+// Add bit and byte counts (if any) to a file.  NULL bits mark the file
+// as incomplete.
+static void fhist_file_add(struct fhist_file *file, const int64_t bits[8],
+                           const uint64_t bytes[256])
+{
+  if (bits == NULL)
+  {
+    __atomic_store_n(&file->error, 1, __ATOMIC_RELAXED);
+  }
+  for (int i = 0; bits != NULL && i < 8; i++)
+  {
+    __atomic_add_fetch(&file->bits[i], bits[i], __ATOMIC_RELAXED);
+  }
 
-    // Read the file byte-by-byte and update local histogram.
-    FILE *f = fopen(path, "r");
-    if (f != NULL)
+  if (file->bytes != NULL && bytes != NULL)
+  {
+    for (int v = 0; v < 256; v++)
     {
-      unsigned char c;
-      while (fread(&c, sizeof(c), 1, f) == 1)
+      if (bytes[v] != 0)
       {
-        update_histogram(local_histogram, c);
+        __atomic_add_fetch(&file->bytes[v], bytes[v], __ATOMIC_RELAXED);
       }
-      fclose(f);
     }
-    else
+  }
+}
+
+// Queue the entropy line of 'file' for the reporter.
+static void queue_entropy(const struct fhist_file *file)
+{
+  size_t len = strlen(file->path) + 1;
+  struct entropy_line *line = malloc(sizeof(struct entropy_line) + len);
+  if (line == NULL)
+  {
+    warn("malloc failed for %s", file->path);
+    return;
+  }
+  line->next = NULL;
+  line->entropy = byte_histogram_entropy(file->bytes);
+  memcpy(line->path, file->path, len);
+
+  pthread_mutex_lock(&entropy_mutex);
+  *entropy_tail = line;
+  entropy_tail = &line->next;
+  pthread_mutex_unlock(&entropy_mutex);
+}
+
+// Print and free the queued entropy lines, each in place of the first
+// line of the histogram, which must then be redrawn below them.  The
+// caller holds stdout_mutex.
+static void print_entropy_lines(void)
+{
+  pthread_mutex_lock(&entropy_mutex);
+  struct entropy_line *line = entropy_lines;
+  entropy_lines = NULL;
+  entropy_tail = &entropy_lines;
+  pthread_mutex_unlock(&entropy_mutex);
+
+  while (line != NULL)
+  {
+    struct entropy_line *next = line->next;
+    clear_line();
+    printf("%s: %.4f bits/byte\n", line->path, line->entropy);
+    free(line);
+    line = next;
+  }
+}
+
+// Finish a job, adding its bit and byte counts (if any) to its file.
+// A job that did not run passes NULL for both, which marks the file as
+// incomplete.  If it was the last job of the file, queue the entropy of
+// the file for the reporter and cache its histogram.
+static void fhist_job_free(struct fhist_job *job, const int64_t bits[8],
+                           const uint64_t bytes[256])
+{
+  struct fhist_file *file = job->file;
+  arena_free(job);
+
+  fhist_file_add(file, bits, bytes);
+  if (__atomic_sub_fetch(&file->jobs, 1, __ATOMIC_ACQ_REL) != 0)
+  {
+    return;
+  }
+  stats_count(1, 0);
+
+  if (file->bytes != NULL)
+  {
+    queue_entropy(file);
+  }
+  if (use_cache && !file->error)
+  {
+    hist_cache_add(&cache, &file->key, file->bits);
+  }
+  arena_free(file->bytes);
+  arena_free(file);
+}
+
+static void fhist_job_run(struct thread_pool *pool, void *arg);
+
+// Submit one chunk job per CHUNK_SIZE bytes of a large file.  If a
+// chunk cannot be submitted, 'job' is narrowed to the remaining bytes
+// and non-zero is returned so the caller processes them itself.
+static int fhist_split(struct thread_pool *pool, struct fhist_job *job)
+{
+  for (off_t off = 0; off < job->size; off += CHUNK_SIZE)
+  {
+    off_t len = job->size - off < CHUNK_SIZE ? job->size - off : CHUNK_SIZE;
+    struct fhist_job *chunk = fhist_job_new(pool, job->file, job->size, off, len);
+    if (chunk != NULL && thread_pool_submit(pool, fhist_job_run, chunk) != 0)
     {
-      fflush(stdout);
-      warn("failed to open %s", path);
+      // The remaining bytes, this chunk's included, are left to the
+      // caller, so this does not make the file incomplete.
+      int64_t none[8] = {0};
+      fhist_job_free(chunk, none, NULL);
+      chunk = NULL;
     }
+    if (chunk == NULL)
+    {
+      job->offset = off;
+      job->length = job->size - off;
+      return -1;
+    }
+  }
+  return 0;
+}
 
-    // Merge local histogram into global and PRINT while holding the lock
-    // so the multi-line, multi-printf print_histogram() can't interleave.
-    pthread_mutex_lock(&hist_mutex);
-    merge_histogram(local_histogram, global_histogram);
-    print_histogram(global_histogram);
-    fflush(stdout); // ensure the printed block is flushed to the terminal
-    pthread_mutex_unlock(&hist_mutex);
+// The histogram of the calling worker.
+static struct worker_histogram *worker_histogram(struct thread_pool *pool)
+{
+  int id = thread_pool_worker_id(pool);
+  return &worker_histograms[id < 0 ? num_histograms - 1 : id];
+}
 
-    free(path);
+// Add 'counts' to the histogram of the calling worker and clear it.
+static void publish_histogram(struct thread_pool *pool, int64_t counts[8])
+{
+  struct worker_histogram *h = worker_histogram(pool);
+
+  for (int i = 0; i < 8; i++)
+  {
+    __atomic_add_fetch(&h->bits[i], counts[i], __ATOMIC_RELAXED);
+    counts[i] = 0;
   }
+}
+
+// Sum of all worker histograms.
+static void snapshot_histogram(int64_t total[8])
+{
+  for (int i = 0; i < 8; i++)
+  {
+    total[i] = 0;
+  }
+  for (int w = 0; w < num_histograms; w++)
+  {
+    int64_t bits[8];
+    for (int i = 0; i < 8; i++)
+    {
+      bits[i] = __atomic_load_n(&worker_histograms[w].bits[i], __ATOMIC_RELAXED);
+    }
+    merge_histogram(bits, total);
+  }
+}
 
+// Reporter thread: print the entropy lines queued since the last tick
+// and redraw the histogram from a snapshot every REPORT_INTERVAL_NS
+// until told to stop.  Workers never touch stdout.
+static void *reporter_thread(void *arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&report_mutex);
+  while (!report_stop)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += REPORT_INTERVAL_NS;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!report_stop
+           && pthread_cond_timedwait(&report_cond, &report_mutex, &deadline) == 0)
+    {
+    }
+    if (report_stop)
+    {
+      break;
+    }
+
+    pthread_mutex_unlock(&report_mutex);
+    int64_t total[8];
+    snapshot_histogram(total);
+    pthread_mutex_lock(&stdout_mutex);
+    print_entropy_lines();
+    print_histogram(total);
+    fflush(stdout);
+    pthread_mutex_unlock(&stdout_mutex);
+    pthread_mutex_lock(&report_mutex);
+  }
+  pthread_mutex_unlock(&report_mutex);
   return NULL;
 }
 
-int main(int argc, char *const *argv)
+// Add the counts of one block to 'bits', and in the extra modes to
+// 'bytes' (and the word table of 'h').
+static void fhist_count(struct byte_histogram *h, const unsigned char *block, size_t n,
+                        int64_t bits[8], uint64_t bytes[256])
 {
-  if (argc < 2)
+  if (bytes_mode || words_mode || entropy_mode)
   {
-    err(1, "usage: paths...");
-    exit(1);
+    byte_histogram_update(h, block, n);
+    byte_histogram_bits(h->bytes, bits);
+    byte_histogram_merge(h, bytes);
+  }
+  else
+  {
+    update_histogram_buf(bits, block, n);
   }
+}
 
-  int num_threads = 1;
-  char *const *paths = &argv[1];
+// Pool job.  Computes the histogram of the job's byte range, publishing
+// it to the worker's histogram after every block.
+static void fhist_job_run(struct thread_pool *pool, void *arg)
+{
+  struct fhist_job *job = arg;
 
-  if (argc > 3 && strcmp(argv[1], "-n") == 0)
+  if (job->length < 0 && job->size > CHUNK_SIZE)
   {
-    // Since atoi() simply returns zero on syntax errors, we cannot
-    // distinguish between the user entering a zero, or some
-    // non-numeric garbage.  In fact, we cannot even tell whether the
-    // given option is suffixed by garbage, i.e. '123foo' returns
-    // '123'.  A more robust solution would use strtol(), but its
-    // interface is more complicated, so here we are.
-    num_threads = atoi(argv[2]);
-
-    if (num_threads < 1)
+    if (fhist_split(pool, job) == 0)
     {
-      err(1, "invalid thread count: %s", argv[2]);
+      int64_t none[8] = {0};
+      fhist_job_free(job, none, NULL);
+      return;
     }
+  }
 
-    paths = &argv[3];
+  int64_t local_histogram[8] = {0};
+  int64_t job_bits[8] = {0};
+  int ok = 0;
+
+  // Chunks start at multiples of CHUNK_SIZE, which is even, so words
+  // are counted at even file offsets no matter how the file is split.
+  struct worker_histogram *w = worker_histogram(pool);
+  struct byte_histogram h;
+  uint64_t job_bytes[256] = {0};
+  byte_histogram_init(&h, w->words);
+
+  // Read the range in blocks and update the local histogram a block at
+  // a time.  A whole-file job reads to the end even if the file has
+  // grown since it was stat'ed.
+  struct block_reader r;
+  if (block_reader_open(&r, job->file->path, job->offset, job->length, block_size,
+                        &block_bufs) == 0)
+  {
+    const unsigned char *block;
+    ssize_t n;
+    while ((n = block_reader_next(&r, &block)) > 0)
+    {
+      fhist_count(&h, block, (size_t)n, local_histogram, job_bytes);
+      stats_count(0, (uint64_t)n);
+      for (int i = 0; i < 8; i++)
+      {
+        job_bits[i] += local_histogram[i];
+      }
+      publish_histogram(pool, local_histogram);
+    }
+    block_reader_close(&r);
+    ok = n == 0;
   }
-  else
+
+  for (int v = 0; v < 256; v++)
   {
-    paths = &argv[1];
+    w->bytes[v] += job_bytes[v];
   }
+  fhist_job_free(job, ok ? job_bits : NULL, job_bytes);
+}
 
-  // Initialise job queue and spawn worker threads.
-  struct job_queue q;
-  const int q_capacity = 64; /* tuneable */
-  if (job_queue_init(&q, q_capacity) != 0)
+// uring_reader callback: count one block of a whole-file job.  Blocks
+// arrive in any order and on any worker.
+static void fhist_uring_block(struct thread_pool *pool, void *ctx,
+                              const unsigned char *buf, size_t len, off_t offset)
+{
+  struct fhist_job *job = ctx;
+  struct worker_histogram *w = worker_histogram(pool);
+  int64_t bits[8] = {0};
+  uint64_t bytes[256] = {0};
+  (void)offset;
+
+  // Blocks start at multiples of the (even) block size, so every block
+  // starts a new word.
+  struct byte_histogram h;
+  byte_histogram_init(&h, w->words);
+  fhist_count(&h, buf, len, bits, bytes);
+  stats_count(0, len);
+
+  for (int v = 0; v < 256; v++)
   {
-    err(1, "failed to init job queue");
+    w->bytes[v] += bytes[v];
   }
+  fhist_file_add(job->file, bits, bytes);
+  publish_histogram(pool, bits);
+}
+
+// uring_reader callback: the whole file has been counted.
+static void fhist_uring_done(struct thread_pool *pool, void *ctx, int error)
+{
+  int64_t none[8] = {0};
+  (void)pool;
+  fhist_job_free(ctx, error ? NULL : none, NULL);
+}
 
-  pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)num_threads);
-  if (threads == NULL)
+// Start a whole-file job: on the reader with --io-uring, otherwise on
+// the pool.  Returns non-zero (leaving the job to the caller) on error.
+static int fhist_submit(struct thread_pool *pool, struct fhist_job *job)
+{
+  if (use_uring)
   {
-    err(1, "failed to allocate threads array");
+    return uring_reader_submit(&uring, job->file->path, job->size, job);
   }
+  return thread_pool_submit(pool, fhist_job_run, job);
+}
 
-  struct fhist_worker_args *targs = malloc(sizeof(struct fhist_worker_args) * (size_t)num_threads);
-  if (targs == NULL)
+// If the cache has the histogram of the file, count it from there.
+static int fhist_cached(struct thread_pool *pool, const struct stat *st)
+{
+  int64_t bits[8] = {0};
+  if (use_cache && hist_cache_lookup(&cache, st, bits))
   {
-    free(threads);
-    err(1, "failed to allocate thread args");
+    publish_histogram(pool, bits);
+    stats_count(1, 0);
+    return 1;
   }
+  return 0;
+}
+
+// The default cache file: $XDG_CACHE_HOME/fhistogram-mt.cache, or
+// ~/.cache/fhistogram-mt.cache.  Returns NULL if neither is known.
+static char *default_cache_path(void)
+{
+  const char *dir = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  const char *sub = "";
 
-  for (int i = 0; i < num_threads; i++)
+  if (dir == NULL || *dir == '\0')
   {
-    targs[i].q = &q;
-    if (pthread_create(&threads[i], NULL, fhist_worker_thread, &targs[i]) != 0)
+    if (home == NULL || *home == '\0')
     {
-      err(1, "failed to create worker thread");
+      return NULL;
     }
+    dir = home;
+    sub = "/.cache";
+  }
+
+  size_t len = strlen(dir) + strlen(sub) + sizeof("/fhistogram-mt.cache");
+  char *path = malloc(len);
+  if (path == NULL)
+  {
+    return NULL;
+  }
+  snprintf(path, len, "%s%s", dir, sub);
+  mkdir(path, 0755); // ~/.cache may not exist yet
+  snprintf(path, len, "%s%s/fhistogram-mt.cache", dir, sub);
+  return path;
+}
+
+// Number of files handed to the pool per submission.
+#define PATH_BATCH 32
+
+// Submit a batch of jobs, freeing any that could not be submitted.
+static void submit_jobs(struct thread_pool *pool, void **batch, int n)
+{
+  int submitted = thread_pool_submit_many(pool, fhist_job_run, batch, n);
+  for (int i = submitted; i < n; i++)
+  {
+    fhist_job_free(batch[i], NULL, NULL);
   }
+}
+
+// Files and directories to leave out of the traversal.
+static struct path_filter filter;
 
+// Walk 'paths' with fts on the calling thread and submit a job per
+// regular file.
+static void submit_fts(struct thread_pool *pool, char *const *paths)
+{
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
   //
@@ -157,31 +578,56 @@ int main(int argc, char *const *argv)
   if ((ftsp = fts_open(paths, fts_options, NULL)) == NULL)
   {
     err(1, "fts_open() failed");
-    return -1;
   }
 
+  // Jobs are submitted in batches so that one lock acquisition and one
+  // wakeup on the queue is shared by many files.
+  void *batch[PATH_BATCH];
+  int batch_len = 0;
+
   FTSENT *p;
   while ((p = fts_read(ftsp)) != NULL)
   {
     switch (p->fts_info)
     {
     case FTS_D:
+      // An excluded directory is not entered at all.
+      if (p->fts_level > 0 && !path_filter_dir(&filter, p->fts_path))
+      {
+        fts_set(ftsp, p, FTS_SKIP);
+      }
       break;
     case FTS_F:
     {
-      // Duplicate the path because FTS may reuse internal buffers.
-      char *pathcopy = strdup(p->fts_path);
-      if (pathcopy == NULL)
+      if (!path_filter_file(&filter, p->fts_path, p->fts_statp)
+          || fhist_cached(pool, p->fts_statp))
+      {
+        break;
+      }
+
+      // Copy the path because FTS may reuse internal buffers.
+      struct fhist_job *job = fhist_file_new(pool, p->fts_path, p->fts_statp);
+      if (job == NULL)
       {
-        warn("strdup failed for %s", p->fts_path);
+        warn("malloc failed for %s", p->fts_path);
         break;
       }
 
-      // Push the duplicated path onto the job queue. Worker will free it.
-      if (job_queue_push(&q, pathcopy) != 0)
+      if (use_uring)
       {
-        // If push fails (e.g. queue was destroyed), free and continue.
-        free(pathcopy);
+        if (fhist_submit(pool, job) != 0)
+        {
+          fhist_job_free(job, NULL, NULL);
+        }
+        break;
+      }
+
+      // Queue the job; it is submitted with its batch and frees itself.
+      batch[batch_len++] = job;
+      if (batch_len == PATH_BATCH)
+      {
+        submit_jobs(pool, batch, batch_len);
+        batch_len = 0;
       }
     }
     break;
@@ -191,23 +637,325 @@ int main(int argc, char *const *argv)
   }
 
   fts_close(ftsp);
+  submit_jobs(pool, batch, batch_len);
+}
 
-  // No more files will be pushed. Destroy the queue which blocks until all
-  // queued jobs have been consumed. This wakes blocked poppers so they can exit.
-  if (job_queue_destroy(&q) != 0)
+// walk_parallel() callback: submit a job for a file found by a worker.
+static void fhist_found_file(struct thread_pool *pool, const char *path,
+                             const struct stat *st, void *ctx)
+{
+  (void)ctx;
+  if (!path_filter_file(&filter, path, st) || fhist_cached(pool, st))
   {
-    err(1, "failed to destroy job queue");
+    return;
   }
 
-  // Join worker threads and free resources.
-  for (int i = 0; i < num_threads; i++)
+  struct fhist_job *job = fhist_file_new(pool, path, st);
+  if (job != NULL && fhist_submit(pool, job) != 0)
   {
-    pthread_join(threads[i], NULL);
+    fhist_job_free(job, NULL, NULL);
   }
-  free(threads);
-  free(targs);
+}
+
+// walk_parallel() callback: whether to enter a directory.
+static int fhist_enter_dir(const char *name, void *ctx)
+{
+  (void)ctx;
+  return path_filter_dir(&filter, name);
+}
+
+#define USAGE "usage: [-n INT] [-b BYTES] [-B] [-w] [-E] [--lock-free] " \
+  "[--parallel-walk] [--io-uring] [--io-depth INT] [--cache FILE | --no-cache] " \
+  "[--compact-cache] [--stats] [--stats-interval MS] " PATH_FILTER_USAGE " paths..."
+
+int main(int argc, char *const *argv)
+{
+  int num_threads = 1;
+  int io_uring = 0;
+  unsigned io_depth = URING_READER_DEFAULT_DEPTH;
+  int stats = 0;
+  unsigned stats_interval = 0;
+  enum job_queue_kind q_kind = JOB_QUEUE_LOCKED;
+  int parallel_walk = 0;
+
+  static const struct option long_options[] = {
+      {"lock-free", no_argument, NULL, 'L'},
+      {"parallel-walk", no_argument, NULL, 'W'},
+      {"cache", required_argument, NULL, 'K'},
+      {"no-cache", no_argument, NULL, 'N'},
+      {"compact-cache", no_argument, NULL, 'P'},
+      {"io-uring", no_argument, NULL, 'U'},
+      {"io-depth", required_argument, NULL, 'D'},
+      {"stats", no_argument, NULL, 'T'},
+      {"stats-interval", required_argument, NULL, 'R'},
+      PATH_FILTER_LONG_OPTIONS,
+      {NULL, 0, NULL, 0}};
+
+  const char *cache_path = NULL;
+  int no_cache = 0;
+  int compact_cache = 0;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+n:b:BwE", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      // Since atoi() simply returns zero on syntax errors, we cannot
+      // distinguish between the user entering a zero, or some
+      // non-numeric garbage.  In fact, we cannot even tell whether the
+      // given option is suffixed by garbage, i.e. '123foo' returns
+      // '123'.  A more robust solution would use strtol(), but its
+      // interface is more complicated, so here we are.
+      num_threads = atoi(optarg);
+
+      if (num_threads < 1)
+      {
+        err(1, "invalid thread count: %s", optarg);
+      }
+      break;
+    case 'L':
+      q_kind = JOB_QUEUE_LOCKFREE;
+      break;
+    case 'W':
+      parallel_walk = 1;
+      break;
+    case 'b':
+    {
+      char *end;
+      unsigned long long bytes = strtoull(optarg, &end, 10);
+      if (*optarg == '-' || *end != '\0' || bytes == 0 || bytes > SIZE_MAX)
+      {
+        err(1, "invalid block size: %s", optarg);
+      }
+      block_size = (size_t)bytes;
+    }
+    break;
+    case 'B':
+      bytes_mode = 1;
+      break;
+    case 'w':
+      words_mode = 1;
+      break;
+    case 'E':
+      entropy_mode = 1;
+      break;
+    case 'K':
+      cache_path = optarg;
+      break;
+    case 'N':
+      no_cache = 1;
+      break;
+    case 'P':
+      compact_cache = 1;
+      break;
+    case 'U':
+      io_uring = 1;
+      break;
+    case 'D':
+    {
+      int depth = atoi(optarg);
+      if (depth < 1 || depth > 4096)
+      {
+        err(1, "invalid I/O depth: %s", optarg);
+      }
+      io_depth = (unsigned)depth;
+    }
+    break;
+    case 'T':
+      stats = 1;
+      break;
+    case 'R':
+    {
+      int ms = atoi(optarg);
+      if (ms < 1)
+      {
+        err(1, "invalid stats interval: %s", optarg);
+      }
+      stats = 1;
+      stats_interval = (unsigned)ms;
+    }
+    break;
+    default:
+      if (path_filter_option(&filter, opt, optarg) != 0)
+      {
+        err(1, USAGE);
+      }
+    }
+  }
+
+  if (optind >= argc)
+  {
+    err(1, USAGE);
+    exit(1);
+  }
+
+  if (!no_cache && !bytes_mode && !words_mode && !entropy_mode)
+  {
+    char *path = cache_path != NULL ? strdup(cache_path) : default_cache_path();
+    if (path != NULL && hist_cache_open(&cache, path) == 0)
+    {
+      use_cache = 1;
+    }
+    free(path);
+  }
+
+  char *const *paths = &argv[optind];
+
+  num_histograms = num_threads + 1;
+  if (posix_memalign((void **)&worker_histograms, 64,
+                     num_histograms * sizeof(struct worker_histogram)) != 0)
+  {
+    err(1, "failed to allocate histograms");
+  }
+  memset(worker_histograms, 0, num_histograms * sizeof(struct worker_histogram));
+  for (int i = 0; words_mode && i < num_histograms; i++)
+  {
+    worker_histograms[i].words = calloc(BYTE_HISTOGRAM_WORDS, sizeof(uint64_t));
+    if (worker_histograms[i].words == NULL)
+    {
+      err(1, "failed to allocate word histograms");
+    }
+  }
+
+  job_arenas = malloc(num_histograms * sizeof(struct arena));
+  if (job_arenas == NULL)
+  {
+    err(1, "failed to allocate arenas");
+  }
+  for (int i = 0; i < num_histograms; i++)
+  {
+    arena_init(&job_arenas[i], 0);
+  }
+
+  // Blocks are rounded up to an even size so that, with --io-uring,
+  // words never straddle two of them.
+  buf_pool_init(&block_bufs, (block_size + 1) & ~(size_t)1, URING_READER_MAX_BYTES);
+
+  pthread_t reporter;
+  if (pthread_create(&reporter, NULL, reporter_thread, NULL) != 0)
+  {
+    err(1, "pthread_create() failed");
+  }
+
+  // Start the worker pool.  Files are submitted through the pool's
+  // injection queue, which grows from q_capacity to q_max_capacity
+  // jobs if the workers keep running out of files (locked queue only).
+  struct thread_pool pool;
+  const int q_capacity = 64; /* tuneable */
+  const int q_max_capacity = 64 * 1024;
+  if (stats && stats_enable(stats_interval) != 0)
+  {
+    err(1, "failed to start stats reporter");
+  }
+  if (thread_pool_init(&pool, num_threads, q_capacity, q_kind) != 0)
+  {
+    err(1, "failed to start thread pool");
+  }
+  if (q_kind == JOB_QUEUE_LOCKED)
+  {
+    (void)job_queue_set_max_capacity(&pool.injection, q_max_capacity);
+  }
+
+  if (io_uring)
+  {
+    if (uring_reader_init(&uring, &pool, io_depth, &block_bufs,
+                          fhist_uring_block, fhist_uring_done) == 0)
+    {
+      use_uring = 1;
+    }
+    else
+    {
+      warnx("io_uring is not available; reading files synchronously");
+    }
+  }
+
+  // The walk is used by its jobs until the pool is idle.
+  struct walk walk;
+  if (parallel_walk)
+  {
+    walk_parallel(&walk, &pool, paths, fhist_found_file, fhist_enter_dir, NULL);
+  }
+  else
+  {
+    submit_fts(&pool, paths);
+  }
+
+  // Once the walk is done, no more files will be submitted; the reader
+  // then hands over the blocks it has left.
+  if (use_uring)
+  {
+    thread_pool_wait(&pool);
+    uring_reader_finish(&uring);
+  }
+
+  // Destroying the pool waits for all jobs (including chunk jobs) to
+  // finish and then joins the workers.
+  if (thread_pool_destroy(&pool) != 0)
+  {
+    err(1, "failed to destroy thread pool");
+  }
+  if (use_uring)
+  {
+    uring_reader_destroy(&uring);
+  }
+  buf_pool_destroy(&block_bufs);
+  for (int i = 0; i < num_histograms; i++)
+  {
+    arena_destroy(&job_arenas[i]);
+  }
+  free(job_arenas);
+  path_filter_free(&filter);
+
+  // Stop the reporter and draw the exact final totals.
+  pthread_mutex_lock(&report_mutex);
+  report_stop = 1;
+  pthread_cond_signal(&report_cond);
+  pthread_mutex_unlock(&report_mutex);
+  if (pthread_join(reporter, NULL) != 0)
+  {
+    err(1, "pthread_join() failed");
+  }
+
+  int64_t total[8];
+  snapshot_histogram(total);
+  print_entropy_lines();
+  print_histogram(total);
 
   move_lines(9);
 
+  if (use_cache)
+  {
+    fflush(stdout);
+    hist_cache_close(&cache, compact_cache);
+  }
+
+  // The workers have been joined, so their byte and word counts can be
+  // summed without atomics.
+  for (int i = 1; i < num_histograms; i++)
+  {
+    for (int v = 0; v < 256; v++)
+    {
+      worker_histograms[0].bytes[v] += worker_histograms[i].bytes[v];
+    }
+    for (int v = 0; words_mode && v < BYTE_HISTOGRAM_WORDS; v++)
+    {
+      worker_histograms[0].words[v] += worker_histograms[i].words[v];
+    }
+    free(worker_histograms[i].words);
+  }
+  if (bytes_mode)
+  {
+    byte_histogram_print_bytes(worker_histograms[0].bytes);
+  }
+  if (words_mode)
+  {
+    byte_histogram_print_words(worker_histograms[0].words);
+  }
+  free(worker_histograms[0].words);
+  free(worker_histograms);
+
+  fflush(stdout);
+  stats_finish();
   return 0;
 }
\ No newline at end of file
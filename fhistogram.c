@@ -7,6 +7,8 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -17,33 +19,80 @@
 #include <err.h>
 
 #include "histogram.h"
+#include "block_reader.h"
+#include "byte_histogram.h"
+#include "stats.h"
 
-int global_histogram[8] = { 0 };
+int64_t global_histogram[8] = { 0 };
+
+// Extra modes: byte (-B) and word (-w) histograms of all files, and the
+// entropy of each file (-E).  In any of them, byte values are counted
+// and the bit histogram is derived from them, still in one pass.
+int bytes_mode = 0, words_mode = 0, entropy_mode = 0;
+uint64_t global_bytes[256] = { 0 };
+uint64_t *global_words = NULL;
+
+// Bytes read (and histogrammed) at a time (-b).
+size_t block_size = BLOCK_READER_DEFAULT_SIZE;
+
+// The histogram is redrawn whenever at least this many bytes have been
+// counted since the last time, however small the blocks are.
+#define REDRAW_BYTES 100000
 
 int fhistogram(char const *path) {
-  FILE *f = fopen(path, "r");
+  struct block_reader r;
 
-  int local_histogram[8] = { 0 };
+  int64_t local_histogram[8] = { 0 };
 
-  if (f == NULL) {
-    fflush(stdout);
-    warn("failed to open %s", path);
+  int count_bytes = bytes_mode || words_mode || entropy_mode;
+  struct byte_histogram h;
+  uint64_t file_bytes[256] = { 0 };
+  byte_histogram_init(&h, global_words);
+
+  if (block_reader_open(&r, path, 0, -1, block_size, NULL) != 0) {
     return -1;
   }
 
-  int i = 0;
-
-  char c;
-  while (fread(&c, sizeof(c), 1, f) == 1) {
-    i++;
-    update_histogram(local_histogram, c);
-    if ((i % 100000) == 0) {
+  // Update the histogram a block at a time, and print it every
+  // REDRAW_BYTES.  Byte counts are only turned into bits when printing.
+  const unsigned char *block;
+  ssize_t n;
+  size_t undrawn = 0;
+  while ((n = block_reader_next(&r, &block)) > 0) {
+    if (count_bytes) {
+      byte_histogram_update(&h, block, (size_t)n);
+    } else {
+      update_histogram_buf(local_histogram, block, (size_t)n);
+    }
+    undrawn += (size_t)n;
+    if (undrawn >= REDRAW_BYTES) {
+      if (count_bytes) {
+        byte_histogram_bits(h.bytes, local_histogram);
+        byte_histogram_merge(&h, file_bytes);
+      }
       merge_histogram(local_histogram, global_histogram);
       print_histogram(global_histogram);
+      undrawn = 0;
     }
   }
 
-  fclose(f);
+  block_reader_close(&r);
+
+  if (count_bytes) {
+    byte_histogram_bits(h.bytes, local_histogram);
+    byte_histogram_merge(&h, file_bytes);
+  }
+
+  for (int v = 0; v < 256; v++) {
+    global_bytes[v] += file_bytes[v];
+  }
+
+  // The entropy line takes the place of the first line of the
+  // histogram, which is then redrawn below it.
+  if (entropy_mode) {
+    clear_line();
+    printf("%s: %.4f bits/byte\n", path, byte_histogram_entropy(file_bytes));
+  }
 
   merge_histogram(local_histogram, global_histogram);
   print_histogram(global_histogram);
@@ -51,13 +100,69 @@ int fhistogram(char const *path) {
   return 0;
 }
 
+#define USAGE "usage: [-b BYTES] [-B] [-w] [-E] [--stats] [--stats-interval MS] paths..."
+
 int main(int argc, char * const *argv) {
-  if (argc < 2) {
-    err(1, "usage: paths...");
+  int stats = 0;
+  unsigned stats_interval = 0;
+
+  static const struct option long_options[] = {
+    { "stats", no_argument, NULL, 'T' },
+    { "stats-interval", required_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+b:BwE", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'b': {
+      char *end;
+      unsigned long long bytes = strtoull(optarg, &end, 10);
+      if (*optarg == '-' || *end != '\0' || bytes == 0 || bytes > SIZE_MAX) {
+        err(1, "invalid block size: %s", optarg);
+      }
+      block_size = (size_t)bytes;
+      break;
+    }
+    case 'B':
+      bytes_mode = 1;
+      break;
+    case 'w':
+      words_mode = 1;
+      break;
+    case 'E':
+      entropy_mode = 1;
+      break;
+    case 'T':
+      stats = 1;
+      break;
+    case 'R': {
+      int ms = atoi(optarg);
+      if (ms < 1) {
+        err(1, "invalid stats interval: %s", optarg);
+      }
+      stats = 1;
+      stats_interval = (unsigned)ms;
+      break;
+    }
+    default:
+      err(1, USAGE);
+    }
+  }
+
+  if (optind >= argc) {
+    err(1, USAGE);
     exit(1);
   }
 
-  char * const *paths = &argv[1];
+  if (words_mode) {
+    global_words = calloc(BYTE_HISTOGRAM_WORDS, sizeof(uint64_t));
+    if (global_words == NULL) {
+      err(1, "failed to allocate word histogram");
+    }
+  }
+
+  char * const *paths = &argv[optind];
 
   // FTS_LOGICAL = follow symbolic links
   // FTS_NOCHDIR = do not change the working directory of the process
@@ -72,14 +177,23 @@ int main(int argc, char * const *argv) {
     return -1;
   }
 
+  // Each file counts as one job of the (only) thread.
+  if (stats && stats_enable(stats_interval) != 0) {
+    err(1, "failed to start stats reporter");
+  }
+
   FTSENT *p;
   while ((p = fts_read(ftsp)) != NULL) {
     switch (p->fts_info) {
     case FTS_D:
       break;
-    case FTS_F:
+    case FTS_F: {
+      uint64_t start = stats_job_begin();
       fhistogram(p->fts_path);
+      stats_count(1, (uint64_t)p->fts_statp->st_size);
+      stats_job_end(start);
       break;
+    }
     default:
       break;
     }
@@ -89,5 +203,15 @@ int main(int argc, char * const *argv) {
 
   move_lines(9);
 
+  if (bytes_mode) {
+    byte_histogram_print_bytes(global_bytes);
+  }
+  if (words_mode) {
+    byte_histogram_print_words(global_words);
+    free(global_words);
+  }
+
+  fflush(stdout);
+  stats_finish();
   return 0;
 }
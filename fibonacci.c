@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "fibonacci.h"
+
+// Numbers are kept in base 10^9, so printing them is a matter of
+// printing the limbs, and a limb product (< 10^18) plus two limbs still
+// fits in 64 bits.
+#define BASE 1000000000u
+
+// Below this many limbs, schoolbook multiplication beats Karatsuba.
+#define KARATSUBA_CUTOFF 40
+
+// The 128-bit fast path.  __extension__ keeps -pedantic quiet.
+__extension__ typedef unsigned __int128 u128;
+
+// Buckets of the memo's hash table.
+#define MEMO_BUCKETS (1u << 16)
+
+// A non-negative number, least significant limb first, without leading
+// zero limbs (so zero has none).
+struct big
+{
+  uint32_t *d;
+  size_t len, cap;
+};
+
+// A remembered pair (F(k), F(k+1)); the limbs follow the struct.
+struct fib_entry
+{
+  uint64_t k;
+  struct fib_entry *next;
+  size_t alen, blen;
+  uint32_t *a, *b;
+};
+
+static void *xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if (p == NULL)
+  {
+    err(1, "out of memory");
+  }
+  return p;
+}
+
+// Limb arrays.
+
+// a[0..na) += b[0..nb), nb <= na.  Returns the carry out of a.
+static uint32_t limbs_add(uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+  uint32_t carry = 0;
+  size_t i = 0;
+  for (; i < nb; i++)
+  {
+    uint32_t t = a[i] + b[i] + carry;
+    carry = t >= BASE;
+    a[i] = carry ? t - BASE : t;
+  }
+  for (; carry && i < na; i++)
+  {
+    uint32_t t = a[i] + 1;
+    carry = t == BASE;
+    a[i] = carry ? 0 : t;
+  }
+  return carry;
+}
+
+// a[0..na) -= b[0..nb), nb <= na and a >= b.
+static void limbs_sub(uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+  uint32_t borrow = 0;
+  size_t i = 0;
+  for (; i < nb; i++)
+  {
+    uint32_t s = b[i] + borrow;
+    borrow = a[i] < s;
+    a[i] = borrow ? a[i] + BASE - s : a[i] - s;
+  }
+  for (; borrow && i < na; i++)
+  {
+    borrow = a[i] == 0;
+    a[i] = borrow ? BASE - 1 : a[i] - 1;
+  }
+}
+
+// r[0..na+nb) = a[0..na) * b[0..nb), by rows.
+static void mul_basecase(uint32_t *r, const uint32_t *a, size_t na,
+                         const uint32_t *b, size_t nb)
+{
+  memset(r, 0, (na + nb) * sizeof(uint32_t));
+  for (size_t i = 0; i < na; i++)
+  {
+    uint64_t ai = a[i], carry = 0;
+    if (ai == 0)
+    {
+      continue;
+    }
+    for (size_t j = 0; j < nb; j++)
+    {
+      uint64_t t = ai * b[j] + r[i + j] + carry;
+      r[i + j] = (uint32_t)(t % BASE);
+      carry = t / BASE;
+    }
+    r[i + nb] = (uint32_t)carry;
+  }
+}
+
+// r[0..2n) = a[0..n) * b[0..n), by Karatsuba: with a = a1 B^m + a0 and
+// b = b1 B^m + b0, the middle product a0 b1 + a1 b0 is
+// (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, so three half-size products do.
+static void mul_n(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n)
+{
+  if (n < KARATSUBA_CUTOFF)
+  {
+    mul_basecase(r, a, n, b, n);
+    return;
+  }
+
+  size_t m = n / 2, h = n - m;
+  mul_n(r, a, b, m);                   // a0 b0 in r[0..2m)
+  mul_n(r + 2 * m, a + m, b + m, h);   // a1 b1 in r[2m..2n)
+
+  uint32_t *t = xmalloc(4 * (h + 1) * sizeof(uint32_t));
+  uint32_t *sa = t, *sb = t + h + 1, *mid = t + 2 * (h + 1);
+  memcpy(sa, a + m, h * sizeof(uint32_t));
+  sa[h] = limbs_add(sa, h, a, m);
+  memcpy(sb, b + m, h * sizeof(uint32_t));
+  sb[h] = limbs_add(sb, h, b, m);
+
+  mul_n(mid, sa, sb, h + 1);
+  limbs_sub(mid, 2 * h + 2, r, 2 * m);
+  limbs_sub(mid, 2 * h + 2, r + 2 * m, 2 * h);
+
+  // The middle product is below 2 B^n, so it fits above B^m.
+  size_t room = 2 * n - m;
+  limbs_add(r + m, room, mid, 2 * h + 2 < room ? 2 * h + 2 : room);
+  free(t);
+}
+
+// r[0..na+nb) = a[0..na) * b[0..nb).  Operands of different lengths
+// (which in fast doubling differ by a limb at most) are padded.
+static void mul(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+  if (na < KARATSUBA_CUTOFF || nb < KARATSUBA_CUTOFF)
+  {
+    mul_basecase(r, a, na, b, nb);
+    return;
+  }
+  if (na == nb)
+  {
+    mul_n(r, a, b, na);
+    return;
+  }
+
+  size_t n = na > nb ? na : nb;
+  uint32_t *t = xmalloc(4 * n * sizeof(uint32_t));
+  uint32_t *pa = t, *pb = t + n, *pr = t + 2 * n;
+  memcpy(pa, a, na * sizeof(uint32_t));
+  memset(pa + na, 0, (n - na) * sizeof(uint32_t));
+  memcpy(pb, b, nb * sizeof(uint32_t));
+  memset(pb + nb, 0, (n - nb) * sizeof(uint32_t));
+  mul_n(pr, pa, pb, n);
+  memcpy(r, pr, (na + nb) * sizeof(uint32_t));
+  free(t);
+}
+
+// Numbers.
+
+static void big_reserve(struct big *x, size_t cap)
+{
+  if (cap > x->cap)
+  {
+    cap += cap / 4;
+    uint32_t *d = realloc(x->d, cap * sizeof(uint32_t));
+    if (d == NULL)
+    {
+      err(1, "out of memory");
+    }
+    x->d = d;
+    x->cap = cap;
+  }
+}
+
+static void big_trim(struct big *x)
+{
+  while (x->len > 0 && x->d[x->len - 1] == 0)
+  {
+    x->len--;
+  }
+}
+
+static void big_set(struct big *x, const uint32_t *d, size_t len)
+{
+  big_reserve(x, len);
+  memcpy(x->d, d, len * sizeof(uint32_t));
+  x->len = len;
+}
+
+static void big_swap(struct big *x, struct big *y)
+{
+  struct big t = *x;
+  *x = *y;
+  *y = t;
+}
+
+// r = x + y.  'r' may be 'x' or 'y'.
+static void big_add(struct big *r, const struct big *x, const struct big *y)
+{
+  if (x->len < y->len)
+  {
+    const struct big *t = x;
+    x = y;
+    y = t;
+  }
+  size_t len = x->len;
+  big_reserve(r, len + 1);
+  if (r == y)
+  {
+    // Add the longer x to the shorter r, zero-extended.
+    memset(r->d + y->len, 0, (len - y->len) * sizeof(uint32_t));
+    r->d[len] = limbs_add(r->d, len, x->d, len);
+  }
+  else
+  {
+    if (r != x)
+    {
+      memcpy(r->d, x->d, len * sizeof(uint32_t));
+    }
+    r->d[len] = limbs_add(r->d, len, y->d, y->len);
+  }
+  r->len = len + 1;
+  big_trim(r);
+}
+
+// r = x - y, where x >= y.  'r' may be 'x'.
+static void big_sub(struct big *r, const struct big *x, const struct big *y)
+{
+  if (r != x)
+  {
+    big_set(r, x->d, x->len);
+  }
+  limbs_sub(r->d, r->len, y->d, y->len);
+  big_trim(r);
+}
+
+// r = x * y.  'r' must be neither 'x' nor 'y'.
+static void big_mul(struct big *r, const struct big *x, const struct big *y)
+{
+  if (x->len == 0 || y->len == 0)
+  {
+    r->len = 0;
+    return;
+  }
+  big_reserve(r, x->len + y->len);
+  mul(r->d, x->d, x->len, y->d, y->len);
+  r->len = x->len + y->len;
+  big_trim(r);
+}
+
+// Memo.
+
+int fib_memo_init(struct fib_memo *memo, size_t max_bytes)
+{
+  memo->table = calloc(MEMO_BUCKETS, sizeof(struct fib_entry *));
+  if (memo->table == NULL)
+  {
+    return -1;
+  }
+  if (pthread_mutex_init(&memo->mutex, NULL) != 0)
+  {
+    free(memo->table);
+    return -1;
+  }
+  memo->table_mask = MEMO_BUCKETS - 1;
+  memo->bytes = 0;
+  memo->max_bytes = max_bytes != 0 ? max_bytes : FIB_MEMO_DEFAULT_BYTES;
+  return 0;
+}
+
+void fib_memo_destroy(struct fib_memo *memo)
+{
+  for (size_t i = 0; i <= memo->table_mask; i++)
+  {
+    struct fib_entry *e = memo->table[i];
+    while (e != NULL)
+    {
+      struct fib_entry *next = e->next;
+      free(e);
+      e = next;
+    }
+  }
+  free(memo->table);
+  pthread_mutex_destroy(&memo->mutex);
+}
+
+static struct fib_entry **memo_bucket(struct fib_memo *memo, uint64_t k)
+{
+  return &memo->table[(k * 0x9E3779B97F4A7C15ULL >> 40) & memo->table_mask];
+}
+
+// The entry for k, or NULL.  Called with the lock held.
+static const struct fib_entry *memo_find(struct fib_memo *memo, uint64_t k)
+{
+  for (const struct fib_entry *e = *memo_bucket(memo, k); e != NULL; e = e->next)
+  {
+    if (e->k == k)
+    {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// Remember (F(k), F(k+1)) = (a, b), unless it is known already or the
+// memo is full.
+static void memo_add(struct fib_memo *memo, uint64_t k, const struct big *a,
+                     const struct big *b)
+{
+  size_t bytes = sizeof(struct fib_entry) + (a->len + b->len) * sizeof(uint32_t);
+
+  pthread_mutex_lock(&memo->mutex);
+  if (memo->bytes + bytes > memo->max_bytes || memo_find(memo, k) != NULL)
+  {
+    pthread_mutex_unlock(&memo->mutex);
+    return;
+  }
+  pthread_mutex_unlock(&memo->mutex);
+
+  // Copy outside the lock; another thread may add k meanwhile, in which
+  // case this copy is dropped.
+  struct fib_entry *e = xmalloc(bytes);
+  e->k = k;
+  e->alen = a->len;
+  e->blen = b->len;
+  e->a = (uint32_t *)(e + 1);
+  e->b = e->a + a->len;
+  memcpy(e->a, a->d, a->len * sizeof(uint32_t));
+  memcpy(e->b, b->d, b->len * sizeof(uint32_t));
+
+  pthread_mutex_lock(&memo->mutex);
+  if (memo->bytes + bytes > memo->max_bytes || memo_find(memo, k) != NULL)
+  {
+    pthread_mutex_unlock(&memo->mutex);
+    free(e);
+    return;
+  }
+  struct fib_entry **bucket = memo_bucket(memo, k);
+  e->next = *bucket;
+  *bucket = e;
+  memo->bytes += bytes;
+  pthread_mutex_unlock(&memo->mutex);
+}
+
+// Find where to start computing F(k): a pair within FIB_STEP_MAX of k
+// (*dist is then the signed distance to step), or else the pair of the
+// longest prefix k >> s (*shift is then s).  Returns NULL if nothing
+// useful is remembered.
+static const struct fib_entry *memo_start(struct fib_memo *memo, uint64_t k,
+                                          long *dist, int *shift)
+{
+  const struct fib_entry *e = NULL;
+  *dist = 0;
+  *shift = 0;
+
+  pthread_mutex_lock(&memo->mutex);
+  e = memo_find(memo, k);
+  for (long d = 1; e == NULL && d <= FIB_STEP_MAX; d++)
+  {
+    if (k - (uint64_t)d >= FIB_MEMO_MIN && (e = memo_find(memo, k - (uint64_t)d)) != NULL)
+    {
+      *dist = d;
+    }
+    else if ((e = memo_find(memo, k + (uint64_t)d)) != NULL)
+    {
+      *dist = -d;
+    }
+  }
+  for (int s = 1; e == NULL && k >> s >= FIB_MEMO_MIN; s++)
+  {
+    if ((e = memo_find(memo, k >> s)) != NULL)
+    {
+      *shift = s;
+    }
+  }
+  pthread_mutex_unlock(&memo->mutex);
+  return e;
+}
+
+// Fast doubling: with (a, b) = (F(j), F(j+1)),
+//   F(2j)   = F(j) (2 F(j+1) - F(j))
+//   F(2j+1) = F(j)^2 + F(j+1)^2
+// and (a, b) becomes the pair of 2j + bit.  t, c and d are scratch.
+static void fib_double(struct big *a, struct big *b, int bit,
+                       struct big *t, struct big *c, struct big *d)
+{
+  big_add(t, b, b);
+  big_sub(t, t, a);
+  big_mul(c, a, t);
+  big_mul(d, a, a);
+  big_mul(t, b, b);
+  big_add(d, d, t);
+  if (bit)
+  {
+    big_add(c, c, d);
+    big_swap(a, d);
+    big_swap(b, c);
+  }
+  else
+  {
+    big_swap(a, c);
+    big_swap(b, d);
+  }
+}
+
+// Set (a, b) to (F(k), F(k+1)).
+static void fib_pair(struct fib_memo *memo, uint64_t k, struct big *a, struct big *b)
+{
+  const struct fib_entry *e = NULL;
+  long dist = 0;
+  int shift = 0;
+  if (memo != NULL && k >= FIB_MEMO_MIN)
+  {
+    e = memo_start(memo, k, &dist, &shift);
+  }
+
+  if (e != NULL && shift == 0)
+  {
+    // A pair close by: step from it.
+    big_set(a, e->a, e->alen);
+    big_set(b, e->b, e->blen);
+    for (; dist > 0; dist--)
+    {
+      big_add(a, a, b);
+      big_swap(a, b);
+    }
+    for (; dist < 0; dist++)
+    {
+      big_sub(b, b, a);
+      big_swap(a, b);
+    }
+    if (e->k != k)
+    {
+      memo_add(memo, k, a, b);
+    }
+    return;
+  }
+
+  // Double from the remembered prefix, or from (F(0), F(1)).
+  uint64_t j;
+  if (e != NULL)
+  {
+    big_set(a, e->a, e->alen);
+    big_set(b, e->b, e->blen);
+    j = e->k;
+  }
+  else
+  {
+    static const uint32_t one = 1;
+    a->len = 0;
+    big_set(b, &one, 1);
+    j = 0;
+    shift = 64 - __builtin_clzll(k);
+  }
+
+  struct big t = {0}, c = {0}, d = {0};
+  for (int s = shift - 1; s >= 0; s--)
+  {
+    int bit = (int)(k >> s & 1);
+    fib_double(a, b, bit, &t, &c, &d);
+    j = 2 * j + (uint64_t)bit;
+    if (memo != NULL && j >= FIB_MEMO_MIN)
+    {
+      memo_add(memo, j, a, b);
+    }
+  }
+  free(t.d);
+  free(c.d);
+  free(d.d);
+}
+
+// Output.
+
+static char *out_buf(char *buf, size_t size, size_t need)
+{
+  return need <= size ? buf : xmalloc(need);
+}
+
+// F(n) for n <= FIB_SMALL_MAX, in 128 bits.
+static char *fib_small(unsigned n, char *buf, size_t size)
+{
+  u128 a = 0, b = 1;
+  for (unsigned i = 0; i < n; i++)
+  {
+    u128 t = a + b;
+    a = b;
+    b = t;
+  }
+
+  char digits[40];
+  size_t len = 0;
+  do
+  {
+    digits[sizeof(digits) - ++len] = (char)('0' + (int)(a % 10));
+    a /= 10;
+  } while (a != 0);
+
+  char *s = out_buf(buf, size, len + 1);
+  memcpy(s, digits + sizeof(digits) - len, len);
+  s[len] = '\0';
+  return s;
+}
+
+char *fib_decimal(struct fib_memo *memo, uint64_t n, char *buf, size_t size)
+{
+  if (n <= FIB_SMALL_MAX)
+  {
+    return fib_small((unsigned)n, buf, size);
+  }
+
+  struct big a = {0}, b = {0};
+  fib_pair(memo, n, &a, &b);
+
+  // The top limb without leading zeros, then nine digits per limb.
+  char top[16];
+  int top_len = snprintf(top, sizeof(top), "%u", a.d[a.len - 1]);
+  size_t len = (size_t)top_len + 9 * (a.len - 1);
+  char *s = out_buf(buf, size, len + 1);
+  memcpy(s, top, (size_t)top_len);
+  char *p = s + top_len;
+  for (size_t i = a.len - 1; i-- > 0;)
+  {
+    uint32_t v = a.d[i];
+    for (int k = 8; k >= 0; k--)
+    {
+      p[k] = (char)('0' + v % 10);
+      v /= 10;
+    }
+    p += 9;
+  }
+  *p = '\0';
+
+  free(a.d);
+  free(b.d);
+  return s;
+}
@@ -0,0 +1,60 @@
+#ifndef FIBONACCI_H
+#define FIBONACCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Largest n whose Fibonacci number is computed in 128-bit arithmetic,
+// without touching the memo: F(186) < 2^128 <= F(187).
+#define FIB_SMALL_MAX 186
+
+// Pairs below this index are not remembered, since they are cheaper to
+// recompute than to look up.
+#define FIB_MEMO_MIN 4096
+
+// How far a remembered pair may be from the wanted index for it to be
+// stepped there by additions (or subtractions) rather than doubled.
+#define FIB_STEP_MAX 64
+
+// Default memory budget of the memo.
+#define FIB_MEMO_DEFAULT_BYTES ((size_t)256 << 20)
+
+struct fib_entry;
+
+/*
+ * fib_memo
+ *
+ * Fibonacci pairs (F(k), F(k+1)) computed so far, shared by every
+ * thread computing Fibonacci numbers.  Besides the pairs that were
+ * asked for, the memo keeps the pairs fast doubling passed through on
+ * the way (the indices k >> s), so a later index that starts with the
+ * same bits resumes from the longest remembered prefix, and an index
+ * within FIB_STEP_MAX of a remembered pair is stepped there.  Entries
+ * are never changed or freed before the memo is destroyed, so they can
+ * be read without the lock once found.  Once 'max_bytes' are in use
+ * nothing more is remembered.
+ */
+struct fib_memo
+{
+  pthread_mutex_t mutex;
+  struct fib_entry **table;  /* chained hash on k */
+  size_t table_mask;
+  size_t bytes, max_bytes;
+};
+
+// Start an empty memo using at most 'max_bytes' (0 for
+// FIB_MEMO_DEFAULT_BYTES).  Returns non-zero on error.
+int fib_memo_init(struct fib_memo *memo, size_t max_bytes);
+
+void fib_memo_destroy(struct fib_memo *memo);
+
+// The decimal digits of F(n), the n'th Fibonacci number (F(0) = 0,
+// F(1) = 1), as a NUL-terminated string in 'buf' if it fits in 'size'
+// bytes, and otherwise in a malloc()ed string the caller frees.  Small
+// n are computed directly; larger ones by fast doubling in base 10^9,
+// with Karatsuba multiplication, remembering results in 'memo' (which
+// may be NULL).  Exits if memory runs out.
+char *fib_decimal(struct fib_memo *memo, uint64_t n, char *buf, size_t size);
+
+#endif
@@ -12,102 +12,348 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fts.h>
+#include <getopt.h>
 
 // err.h contains various nonstandard BSD extensions, but they are
 // very handy.
 #include <err.h>
 
 #include "job_queue.h"
+#include "fibonacci.h"
+#include "stats.h"
+#include "output.h"
+#include "arena.h"
+#include "lineparse.h"
 
 // Whenever we print to the screen, we will first lock this mutex.
 // This ensures that multiple threads do not try to print
 // concurrently.
 pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// A simple recursive (inefficient) implementation of the Fibonacci
-// function.
-int fib (int n) {
-  if (n < 2) {
-    return 1;
-  } else {
-    return fib(n-1) + fib(n-2);
-  }
-}
+// Fibonacci numbers computed so far, shared by the workers, so that
+// repeated and nearby inputs are answered from earlier results.
+struct fib_memo memo;
 
 // This function converts a line to an integer, computes the
 // corresponding Fibonacci number, then prints the result to the
-// screen.
+// screen.  fib(0) = fib(1) = 1, i.e. fib(n) is F(n+1), and so is every
+// n below 0.
 void fib_line(const char *line) {
   int n = atoi(line);
-  int fibn = fib(n);
+  char buf[64];
+  char *fibn = fib_decimal(&memo, n < 0 ? 1 : (uint64_t)n + 1, buf, sizeof(buf));
   assert(pthread_mutex_lock(&stdout_mutex) == 0);
-  printf("fib(%d) = %d\n", n, fibn);
+  printf("fib(%d) = %s\n", n, fibn);
   assert(pthread_mutex_unlock(&stdout_mutex) == 0);
+  if (fibn != buf) {
+    free(fibn);
+  }
+}
+
+// Number of lines moved through the job queue per push or pop.
+#define LINE_BATCH 32
+
+// With --bulk, stdin is read in blocks of (at least) BULK_READ_SIZE
+// bytes and parsed straight into batches of NUM_BATCH numbers, each of
+// which is one job, and results go through per-worker output buffers
+// instead of a locked printf() per line.  With --ordered, batches are
+// also numbered, and at most ORDER_WINDOW of them wait for an earlier
+// one before the reader is held back.
+#define BULK_READ_SIZE (1 << 20)
+#define NUM_BATCH 1024
+#define ORDER_WINDOW 256
+
+int bulk = 0, ordered = 0;
+struct output out;
+
+// Batches are made by the reading thread and freed by the workers.
+struct arena batch_arena;
+
+struct num_batch {
+  unsigned long seq;        /* with --ordered */
+  size_t bytes;             /* input bytes, for --stats */
+  int count;
+  int n[NUM_BATCH];
+};
+
+// Append the results of a batch to 'b'.
+static void fib_batch(const struct num_batch *batch, struct output_buf *b) {
+  for (int i = 0; i < batch->count; i++) {
+    int n = batch->n[i];
+    char buf[64];
+    char *fibn = fib_decimal(&memo, n < 0 ? 1 : (uint64_t)n + 1, buf, sizeof(buf));
+    if (output_buf_printf(b, "fib(%d) = ", n) != 0 ||
+        output_buf_write(b, fibn, strlen(fibn)) != 0 ||
+        output_buf_write(b, "\n", 1) != 0) {
+      err(1, "failed to buffer output");
+    }
+    if (fibn != buf) {
+      free(fibn);
+    }
+  }
 }
 
+// Run a batch job on worker 'id'.
+static void run_batch(struct num_batch *batch, int id) {
+  uint64_t start = stats_job_begin();
+  if (ordered) {
+    struct output_buf local = {0};
+    fib_batch(batch, &local);
+    output_commit(&out, batch->seq, &local);
+  } else {
+    struct output_buf *b = output_worker_buf(&out, id);
+    fib_batch(batch, b);
+    output_maybe_flush(&out, b);
+  }
+  stats_count(0, batch->bytes);
+  stats_job_end(start);
+  arena_free(batch);
+}
+
+// A worker thread: the queue it pops lines from, and its number for
+// --stats.
+struct worker {
+  struct job_queue *jq;
+  int id;
+};
+
 // Each thread will run this function.  The thread argument is a
-// pointer to a job queue.
+// pointer to a struct worker.
 void* worker(void *arg) {
-  struct job_queue *jq = arg;
+  struct job_queue *jq = ((struct worker *)arg)->jq;
+  int id = ((struct worker *)arg)->id;
+  void *lines[LINE_BATCH];
+
+  stats_thread_begin(id);
 
   while (1) {
-    char *line;
-    if (job_queue_pop(jq, (void**)&line) == 0) {
-      fib_line(line);
-      free(line);
+    int n = job_queue_pop_many(jq, lines, LINE_BATCH);
+    if (n > 0) {
+      for (int i = 0; bulk && i < n; i++) {
+        run_batch(lines[i], id);
+      }
+      for (int i = 0; !bulk && i < n; i++) {
+        uint64_t start = stats_job_begin();
+        fib_line(lines[i]);
+        stats_count(0, strlen(lines[i]));
+        stats_job_end(start);
+        free(lines[i]);
+      }
     } else {
-      // If job_queue_pop() returned non-zero, that means the queue is
+      // If job_queue_pop_many() returned -1, that means the queue is
       // being killed (or some other error occured).  In any case,
       // that means it's time for this thread to die.
       break;
     }
   }
 
+  stats_thread_end();
   return NULL;
 }
 
+// Push a batch of lines, freeing any that the queue did not accept.
+static void push_lines(struct job_queue *jq, void **lines, int n) {
+  int pushed = job_queue_push_many(jq, lines, n);
+  for (int i = pushed < 0 ? 0 : pushed; i < n; i++) {
+    free(lines[i]);
+  }
+}
+
+// Push a batch of numbers, numbering it first with --ordered.
+static void push_batch(struct job_queue *jq, struct num_batch *batch) {
+  if (ordered) {
+    batch->seq = output_reserve(&out);
+  }
+  if (job_queue_push(jq, batch) != 0) {
+    if (ordered) {
+      struct output_buf empty = {0};
+      output_commit(&out, batch->seq, &empty);
+    }
+    arena_free(batch);
+  }
+}
+
+// --bulk: read stdin in large blocks, parse the complete lines of each
+// into batches, and push every full batch.  A line longer than the
+// buffer makes it grow.
+static void read_bulk(struct job_queue *jq) {
+  size_t cap = BULK_READ_SIZE, have = 0;
+  char *buf = malloc(cap);
+  if (buf == NULL) {
+    err(1, "failed to allocate input buffer");
+  }
+
+  struct num_batch *batch = NULL;
+  int eof = 0;
+  while (!eof) {
+    if (have == cap) {
+      cap *= 2;
+      if ((buf = realloc(buf, cap)) == NULL) {
+        err(1, "failed to allocate input buffer");
+      }
+    }
+    ssize_t r = read(STDIN_FILENO, buf + have, cap - have);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err(1, "failed to read standard input");
+    }
+    eof = r == 0;
+    have += (size_t)r;
+
+    // At EOF, a last line without a newline is parsed too.
+    size_t pos = 0;
+    while (1) {
+      if (batch == NULL) {
+        if ((batch = arena_alloc(&batch_arena, sizeof(struct num_batch))) == NULL) {
+          err(1, "failed to allocate batch");
+        }
+        batch->count = 0;
+        batch->bytes = 0;
+      }
+      size_t used;
+      batch->count += (int)lineparse_ints(buf + pos, have - pos, eof,
+                                          batch->n + batch->count,
+                                          NUM_BATCH - batch->count, &used);
+      batch->bytes += used;
+      pos += used;
+      if (batch->count < NUM_BATCH) {
+        break;
+      }
+      push_batch(jq, batch);
+      batch = NULL;
+    }
+    memmove(buf, buf + pos, have - pos);
+    have -= pos;
+  }
+
+  if (batch != NULL && batch->count > 0) {
+    push_batch(jq, batch);
+  } else {
+    arena_free(batch);
+  }
+  free(buf);
+}
+
 int main(int argc, char * const *argv) {
   int num_threads = 1;
+  enum job_queue_kind q_kind = JOB_QUEUE_LOCKED;
+  int stats = 0;
+  unsigned stats_interval = 0;
+
+  static const struct option long_options[] = {
+    {"lock-free", no_argument, NULL, 'L'},
+    {"stats", no_argument, NULL, 'T'},
+    {"stats-interval", required_argument, NULL, 'R'},
+    {"bulk", no_argument, NULL, 'B'},
+    {"ordered", no_argument, NULL, 'O'},
+    {NULL, 0, NULL, 0}
+  };
 
-  if (argc == 3 && strcmp(argv[1], "-n") == 0) {
-    // Since atoi() simply returns zero on syntax errors, we cannot
-    // distinguish between the user entering a zero, or some
-    // non-numeric garbage.  In fact, we cannot even tell whether the
-    // given option is suffixed by garbage, i.e. '123foo' returns
-    // '123'.  A more robust solution would use strtol(), but its
-    // interface is more complicated, so here we are.
-    num_threads = atoi(argv[2]);
-
-    if (num_threads < 1) {
-      err(1, "invalid thread count: %s", argv[2]);
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'n':
+      // Since atoi() simply returns zero on syntax errors, we cannot
+      // distinguish between the user entering a zero, or some
+      // non-numeric garbage.  In fact, we cannot even tell whether the
+      // given option is suffixed by garbage, i.e. '123foo' returns
+      // '123'.  A more robust solution would use strtol(), but its
+      // interface is more complicated, so here we are.
+      num_threads = atoi(optarg);
+
+      if (num_threads < 1) {
+        err(1, "invalid thread count: %s", optarg);
+      }
+      break;
+    case 'L':
+      q_kind = JOB_QUEUE_LOCKFREE;
+      break;
+    case 'T':
+      stats = 1;
+      break;
+    case 'R': {
+      int ms = atoi(optarg);
+      if (ms < 1) {
+        err(1, "invalid stats interval: %s", optarg);
+      }
+      stats = 1;
+      stats_interval = (unsigned)ms;
+      break;
     }
+    case 'B':
+      bulk = 1;
+      break;
+    case 'O':
+      bulk = ordered = 1;
+      break;
+    default:
+      err(1, "usage: [-n INT] [--lock-free] [--bulk] [--ordered] [--stats] "
+          "[--stats-interval MS]");
+    }
+  }
+
+  if (stats && stats_enable(stats_interval) != 0) {
+    err(1, "failed to start stats reporter");
   }
 
-  // Create job queue.
+  if (fib_memo_init(&memo, 0) != 0) {
+    err(1, "failed to allocate Fibonacci memo");
+  }
+
+  if (bulk) {
+    arena_init(&batch_arena, 0);
+    if (output_init(&out, STDOUT_FILENO, num_threads, ordered ? ORDER_WINDOW : 0) != 0) {
+      err(1, "failed to set up output");
+    }
+  }
+
+  // Create job queue.  A locked queue grows from 64 up to 64K lines
+  // (or 1K batches) while the workers keep emptying it.
   struct job_queue jq;
-  job_queue_init(&jq, 64);
+  job_queue_init_kind(&jq, 64, q_kind);
+  if (q_kind == JOB_QUEUE_LOCKED) {
+    (void)job_queue_set_max_capacity(&jq, bulk ? 1024 : 64 * 1024);
+  }
 
   // Start up the worker threads.
   pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  struct worker *workers = calloc(num_threads, sizeof(struct worker));
   for (int i = 0; i < num_threads; i++) {
-    if (pthread_create(&threads[i], NULL, &worker, &jq) != 0) {
+    workers[i] = (struct worker){ &jq, i };
+    if (pthread_create(&threads[i], NULL, &worker, &workers[i]) != 0) {
       err(1, "pthread_create() failed");
     }
   }
 
 
-  // Now read lines from stdin until EOF.
-  char *line = NULL;
-  ssize_t line_len;
-  size_t buf_len = 0;
-  while ((line_len = getline(&line, &buf_len, stdin)) != -1) {
-    job_queue_push(&jq, (void*)strdup(line));
+  // Now read lines from stdin until EOF, handing them to the workers
+  // in batches.
+  if (bulk) {
+    read_bulk(&jq);
+  } else {
+    void *batch[LINE_BATCH];
+    int batch_len = 0;
+    char *line = NULL;
+    ssize_t line_len;
+    size_t buf_len = 0;
+    while ((line_len = getline(&line, &buf_len, stdin)) != -1) {
+      batch[batch_len++] = strdup(line);
+      if (batch_len == LINE_BATCH) {
+        push_lines(&jq, batch, batch_len);
+        batch_len = 0;
+      }
+    }
+    push_lines(&jq, batch, batch_len);
+    free(line);
   }
-  free(line);
 
   // Destroy the queue.
   job_queue_destroy(&jq);
@@ -120,4 +366,15 @@ int main(int argc, char * const *argv) {
     }
   }
   free(threads);
+  free(workers);
+  fib_memo_destroy(&memo);
+  if (bulk) {
+    arena_destroy(&batch_arena);
+    if (output_destroy(&out) != 0) {
+      err(1, "failed to write output");
+    }
+  }
+
+  fflush(stdout);
+  stats_finish();
 }
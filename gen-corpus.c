@@ -0,0 +1,274 @@
+// Writes a deterministic synthetic corpus for the end-to-end
+// benchmarks (see bench-run.c): many tiny files, a few huge ones, a
+// deep chain of directories, and an input file for fibs.  Files are
+// lines of pseudo-random words, and a given share of the lines contain
+// the needle the benchmarks search for.  The same options (and seed)
+// always produce the same bytes.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#include <getopt.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+// The needle placed in matching lines unless --needle is given.  It is
+// made of bytes that never occur in the generated words.
+#define DEFAULT_NEEDLE "QuuxZebra"
+
+// Tiny files per directory of the tiny part.
+#define TINY_PER_DIR 100
+
+// Numbers in the fibs input, and their range.
+#define FIBS_COUNT 256
+#define FIBS_MIN 20
+#define FIBS_MAX 30
+
+static const char *words[] = {
+  "the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+  "with", "was", "on", "be", "at", "by", "this", "had", "not", "are",
+  "int", "char", "return", "if", "else", "while", "struct", "void",
+  "size_t", "NULL", "0", "1", "i++", "{", "}", "(x);", "buf[i]", "=",
+};
+
+// Generator state: the xorshift64 state, the needle and how many lines
+// per million contain it, and totals for the summary.
+struct gen
+{
+  uint64_t x;
+  const char *needle;
+  unsigned density;
+  unsigned long long files, bytes, lines, matches;
+};
+
+static uint64_t next(struct gen *g)
+{
+  g->x ^= g->x << 13;
+  g->x ^= g->x >> 7;
+  g->x ^= g->x << 17;
+  return g->x;
+}
+
+// A number in [lo, hi].
+static uint64_t uniform(struct gen *g, uint64_t lo, uint64_t hi)
+{
+  return lo + next(g) % (hi - lo + 1);
+}
+
+static void make_dir(const char *path)
+{
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+  {
+    err(1, "failed to create %s", path);
+  }
+}
+
+// Write a file of about 'size' bytes of text, always ending a line.
+static void write_text(struct gen *g, const char *path, uint64_t size)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+  {
+    err(1, "failed to create %s", path);
+  }
+
+  size_t nwords = sizeof(words) / sizeof(words[0]);
+  uint64_t written = 0;
+  while (written < size)
+  {
+    // Lines of 4 to 15 words, the needle replacing one of them.
+    int n = (int)uniform(g, 4, 15);
+    int match = next(g) % 1000000 < g->density ? (int)uniform(g, 0, (uint64_t)n - 1) : -1;
+    for (int i = 0; i < n; i++)
+    {
+      const char *w = i == match ? g->needle : words[next(g) % nwords];
+      if (i > 0)
+      {
+        putc(' ', f);
+        written++;
+      }
+      fputs(w, f);
+      written += strlen(w);
+    }
+    putc('\n', f);
+    written++;
+    g->lines++;
+    g->matches += match >= 0;
+  }
+
+  if (fclose(f) != 0)
+  {
+    err(1, "failed to write %s", path);
+  }
+  g->files++;
+  g->bytes += written;
+}
+
+static void write_fibs_input(struct gen *g, const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+  {
+    err(1, "failed to create %s", path);
+  }
+  for (int i = 0; i < FIBS_COUNT; i++)
+  {
+    fprintf(f, "%d\n", (int)uniform(g, FIBS_MIN, FIBS_MAX));
+  }
+  if (fclose(f) != 0)
+  {
+    err(1, "failed to write %s", path);
+  }
+}
+
+static unsigned long long parse_count(const char *arg, const char *what)
+{
+  char *end;
+  unsigned long long n = strtoull(arg, &end, 10);
+  if (*arg == '-' || *end != '\0')
+  {
+    err(1, "invalid %s: %s", what, arg);
+  }
+  return n;
+}
+
+#define USAGE "usage: [--seed INT] [--tiny INT] [--tiny-size BYTES] [--huge INT] " \
+  "[--huge-size BYTES] [--depth INT] [--density PER_MILLION] [--needle STRING] DIR"
+
+int main(int argc, char *const *argv)
+{
+  unsigned long long seed = 1;
+  unsigned long long tiny = 20000, tiny_size = 4096;
+  unsigned long long huge = 2, huge_size = 128 * 1024 * 1024;
+  unsigned long long depth = 64;
+  struct gen g = {0};
+  g.needle = DEFAULT_NEEDLE;
+  g.density = 1000;
+
+  static const struct option long_options[] = {
+      {"seed", required_argument, NULL, 's'},
+      {"tiny", required_argument, NULL, 't'},
+      {"tiny-size", required_argument, NULL, 'T'},
+      {"huge", required_argument, NULL, 'h'},
+      {"huge-size", required_argument, NULL, 'H'},
+      {"depth", required_argument, NULL, 'd'},
+      {"density", required_argument, NULL, 'm'},
+      {"needle", required_argument, NULL, 'N'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      seed = parse_count(optarg, "seed");
+      break;
+    case 't':
+      tiny = parse_count(optarg, "file count");
+      break;
+    case 'T':
+      tiny_size = parse_count(optarg, "size");
+      break;
+    case 'h':
+      huge = parse_count(optarg, "file count");
+      break;
+    case 'H':
+      huge_size = parse_count(optarg, "size");
+      break;
+    case 'd':
+      depth = parse_count(optarg, "depth");
+      break;
+    case 'm':
+      g.density = (unsigned)parse_count(optarg, "density");
+      if (g.density > 1000000)
+      {
+        err(1, "invalid density: %s", optarg);
+      }
+      break;
+    case 'N':
+      g.needle = optarg;
+      if (*g.needle == '\0' || strchr(g.needle, '\n') != NULL)
+      {
+        err(1, "invalid needle");
+      }
+      break;
+    default:
+      err(1, USAGE);
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    err(1, USAGE);
+  }
+  const char *dir = argv[optind];
+
+  // xorshift must not start from zero.
+  g.x = seed * 0x9E3779B97F4A7C15ULL + 88172645463325252ULL;
+  if (g.x == 0)
+  {
+    g.x = 1;
+  }
+
+  size_t cap = strlen(dir) + 64 + depth * 4;
+  char *path = malloc(cap);
+  if (path == NULL)
+  {
+    err(1, "malloc failed");
+  }
+  make_dir(dir);
+
+  // Many tiny files, TINY_PER_DIR per directory.
+  snprintf(path, cap, "%s/tiny", dir);
+  make_dir(path);
+  for (unsigned long long i = 0; i < tiny; i++)
+  {
+    if (i % TINY_PER_DIR == 0)
+    {
+      snprintf(path, cap, "%s/tiny/%llu", dir, i / TINY_PER_DIR);
+      make_dir(path);
+    }
+    snprintf(path, cap, "%s/tiny/%llu/%llu.txt", dir, i / TINY_PER_DIR, i);
+    write_text(&g, path, uniform(&g, 0, tiny_size));
+  }
+
+  // A few huge files.
+  snprintf(path, cap, "%s/huge", dir);
+  make_dir(path);
+  for (unsigned long long i = 0; i < huge; i++)
+  {
+    snprintf(path, cap, "%s/huge/%llu.txt", dir, i);
+    write_text(&g, path, huge_size);
+  }
+
+  // A chain of 'depth' directories, each with a small file.
+  size_t len = (size_t)snprintf(path, cap, "%s/deep", dir);
+  make_dir(path);
+  for (unsigned long long i = 0; i < depth; i++)
+  {
+    len += (size_t)snprintf(path + len, cap - len, "/d");
+    make_dir(path);
+    snprintf(path + len, cap - len, "/f.txt");
+    write_text(&g, path, uniform(&g, 0, tiny_size));
+    path[len] = '\0';
+  }
+
+  snprintf(path, cap, "%s/fibs.in", dir);
+  write_fibs_input(&g, path);
+  free(path);
+
+  printf("files=%llu bytes=%llu lines=%llu matches=%llu needle=%s\n",
+         g.files, g.bytes, g.lines, g.matches, g.needle);
+  return 0;
+}
@@ -0,0 +1,369 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "hist_cache.h"
+
+#define HIST_CACHE_MAGIC "FHCACHE\n"
+#define HIST_CACHE_VERSION 1
+
+// Values of hist_cache.used[].
+#define ENTRY_HIT 1         /* looked up in this run */
+#define ENTRY_REPLACED 2    /* the file has a new entry from this run */
+
+struct hist_cache_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;  /* sizeof(struct hist_cache_entry) */
+};
+
+void hist_cache_key_init(struct hist_cache_key *key, const struct stat *st)
+{
+  memset(key, 0, sizeof(struct hist_cache_key));
+  key->dev = (uint64_t)st->st_dev;
+  key->ino = (uint64_t)st->st_ino;
+  key->size = (int64_t)st->st_size;
+  key->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+  key->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+  key->ctime_sec = (int64_t)st->st_ctim.tv_sec;
+  key->ctime_nsec = (int64_t)st->st_ctim.tv_nsec;
+}
+
+static size_t hash_file(uint64_t dev, uint64_t ino)
+{
+  // splitmix64 finaliser.
+  uint64_t h = ino * 0x9e3779b97f4a7c15ULL ^ dev;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return (size_t)(h ^ (h >> 31));
+}
+
+// The table slot for the file with the given dev/inode: either the one
+// holding its entry or the empty one where it would go.
+static uint32_t *find_slot(const struct hist_cache *c, uint64_t dev, uint64_t ino)
+{
+  size_t i = hash_file(dev, ino) & c->table_mask;
+  while (c->table[i] != 0)
+  {
+    const struct hist_cache_key *k = &c->entries[c->table[i] - 1].key;
+    if (k->dev == dev && k->ino == ino)
+    {
+      break;
+    }
+    i = (i + 1) & c->table_mask;
+  }
+  return &c->table[i];
+}
+
+// Map the entries of the file and index them.  Returns non-zero if the
+// file is not a valid cache.
+static int load(struct hist_cache *c, off_t size)
+{
+  struct hist_cache_header header;
+  if ((size_t)size < sizeof(header))
+  {
+    return -1;
+  }
+
+  c->map_len = (size_t)size;
+  c->map = mmap(NULL, c->map_len, PROT_READ, MAP_PRIVATE, c->fd, 0);
+  if (c->map == MAP_FAILED)
+  {
+    c->map = NULL;
+    return -1;
+  }
+
+  memcpy(&header, c->map, sizeof(header));
+  if (memcmp(header.magic, HIST_CACHE_MAGIC, sizeof(header.magic)) != 0
+      || header.version != HIST_CACHE_VERSION
+      || header.entry_size != sizeof(struct hist_cache_entry))
+  {
+    return -1;
+  }
+
+  size_t body = c->map_len - sizeof(header);
+  c->entries = (const struct hist_cache_entry *)((const char *)c->map + sizeof(header));
+  c->nentries = body / sizeof(struct hist_cache_entry);
+  if (c->nentries > UINT32_MAX - 1)
+  {
+    return -1;
+  }
+
+  // A run that died while appending leaves a partial entry at the end;
+  // appending after it would misalign everything that follows.
+  if (body % sizeof(struct hist_cache_entry) != 0)
+  {
+    c->rewrite = 1;
+  }
+
+  size_t table_size = 16;
+  while (table_size < 2 * c->nentries)
+  {
+    table_size *= 2;
+  }
+  c->table = calloc(table_size, sizeof(uint32_t));
+  c->used = calloc(c->nentries > 0 ? c->nentries : 1, 1);
+  if (c->table == NULL || c->used == NULL)
+  {
+    return -1;
+  }
+  c->table_mask = table_size - 1;
+
+  for (size_t i = 0; i < c->nentries; i++)
+  {
+    const struct hist_cache_key *k = &c->entries[i].key;
+    uint32_t *slot = find_slot(c, k->dev, k->ino);
+    if (*slot == 0)
+    {
+      c->nlive++;
+    }
+    *slot = (uint32_t)i + 1;
+  }
+  return 0;
+}
+
+int hist_cache_open(struct hist_cache *c, const char *path)
+{
+  memset(c, 0, sizeof(struct hist_cache));
+
+  c->path = strdup(path);
+  if (c->path == NULL)
+  {
+    warn("failed to open cache %s", path);
+    return -1;
+  }
+
+  c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st;
+  if (c->fd < 0 || fstat(c->fd, &st) != 0)
+  {
+    warn("failed to open cache %s", path);
+    if (c->fd >= 0)
+    {
+      close(c->fd);
+    }
+    free(c->path);
+    return -1;
+  }
+
+  if (st.st_size > 0 && load(c, st.st_size) != 0)
+  {
+    warnx("ignoring invalid cache %s", path);
+    if (c->map != NULL)
+    {
+      munmap(c->map, c->map_len);
+    }
+    free(c->table);
+    free(c->used);
+    c->map = NULL;
+    c->entries = NULL;
+    c->table = NULL;
+    c->used = NULL;
+    c->nentries = c->nlive = 0;
+    c->rewrite = 1;
+  }
+
+  pthread_mutex_init(&c->mutex, NULL);
+  return 0;
+}
+
+int hist_cache_lookup(struct hist_cache *c, const struct stat *st, int64_t bits[8])
+{
+  if (c->table == NULL)
+  {
+    return 0;
+  }
+
+  struct hist_cache_key key;
+  hist_cache_key_init(&key, st);
+
+  uint32_t i = *find_slot(c, key.dev, key.ino);
+  if (i == 0 || memcmp(&c->entries[i - 1].key, &key, sizeof(key)) != 0)
+  {
+    return 0;
+  }
+
+  const struct hist_cache_entry *e = &c->entries[i - 1];
+  for (int b = 0; b < 8; b++)
+  {
+    bits[b] += e->bits[b];
+  }
+  __atomic_store_n(&c->used[i - 1], ENTRY_HIT, __ATOMIC_RELAXED);
+  return 1;
+}
+
+void hist_cache_add(struct hist_cache *c, const struct hist_cache_key *key,
+                    const int64_t bits[8])
+{
+  pthread_mutex_lock(&c->mutex);
+  if (c->nadded == c->cap)
+  {
+    size_t cap = c->cap == 0 ? 1024 : 2 * c->cap;
+    struct hist_cache_entry *added = realloc(c->added, cap * sizeof(struct hist_cache_entry));
+    if (added == NULL)
+    {
+      // Not caching a result only costs time on the next run.
+      pthread_mutex_unlock(&c->mutex);
+      return;
+    }
+    c->added = added;
+    c->cap = cap;
+  }
+  c->added[c->nadded].key = *key;
+  memcpy(c->added[c->nadded].bits, bits, sizeof(c->added[c->nadded].bits));
+  c->nadded++;
+  pthread_mutex_unlock(&c->mutex);
+}
+
+// Write all of buf[0..len) to fd.  Returns non-zero on error.
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static int write_header(int fd)
+{
+  struct hist_cache_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HIST_CACHE_MAGIC, sizeof(header.magic));
+  header.version = HIST_CACHE_VERSION;
+  header.entry_size = sizeof(struct hist_cache_entry);
+  return write_all(fd, &header, sizeof(header));
+}
+
+// Write the live entries, and the new ones, to a new file and move it
+// into place.  If 'prune', only entries hit in this run are kept.
+static int compact(struct hist_cache *c, int prune)
+{
+  size_t len = strlen(c->path);
+  char *tmp = malloc(len + sizeof(".tmp"));
+  if (tmp == NULL)
+  {
+    return -1;
+  }
+  memcpy(tmp, c->path, len);
+  memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    free(tmp);
+    return -1;
+  }
+
+  int ret = write_header(fd);
+
+  // Entries are written in runs of consecutive kept entries, straight
+  // from the mapping.
+  size_t run = 0;
+  for (size_t i = 0; ret == 0 && i <= c->nentries; i++)
+  {
+    int keep = 0;
+    if (i < c->nentries)
+    {
+      const struct hist_cache_key *k = &c->entries[i].key;
+      keep = *find_slot(c, k->dev, k->ino) == i + 1 && c->used[i] != ENTRY_REPLACED
+             && (!prune || c->used[i] == ENTRY_HIT);
+    }
+    if (!keep)
+    {
+      if (i > run)
+      {
+        ret = write_all(fd, &c->entries[run], (i - run) * sizeof(struct hist_cache_entry));
+      }
+      run = i + 1;
+    }
+  }
+  if (ret == 0)
+  {
+    ret = write_all(fd, c->added, c->nadded * sizeof(struct hist_cache_entry));
+  }
+
+  if (close(fd) != 0 || ret != 0 || rename(tmp, c->path) != 0)
+  {
+    unlink(tmp);
+    ret = -1;
+  }
+  free(tmp);
+  return ret;
+}
+
+int hist_cache_close(struct hist_cache *c, int compact_now)
+{
+  int ret = 0;
+
+  // Entries superseded by a later one for the same file, plus those
+  // superseded by this run's additions.
+  size_t stale = c->nentries - c->nlive;
+  for (size_t i = 0; c->table != NULL && i < c->nadded; i++)
+  {
+    uint32_t e = *find_slot(c, c->added[i].key.dev, c->added[i].key.ino);
+    if (e != 0 && c->used[e - 1] != ENTRY_REPLACED)
+    {
+      c->used[e - 1] = ENTRY_REPLACED;
+      stale++;
+    }
+  }
+  size_t live = c->nentries - stale + c->nadded;
+
+  if (compact_now || c->rewrite || stale > live)
+  {
+    ret = compact(c, compact_now);
+  }
+  else if (c->nadded > 0)
+  {
+    // Append with a single write() at the end of the file.
+    if (lseek(c->fd, 0, SEEK_END) < 0
+        || (c->map_len == 0 && write_header(c->fd) != 0)
+        || write_all(c->fd, c->added, c->nadded * sizeof(struct hist_cache_entry)) != 0)
+    {
+      ret = -1;
+    }
+  }
+  if (ret != 0)
+  {
+    warn("failed to update cache %s", c->path);
+  }
+
+  if (c->map != NULL)
+  {
+    munmap(c->map, c->map_len);
+  }
+  close(c->fd);
+  free(c->table);
+  free(c->used);
+  free(c->added);
+  free(c->path);
+  pthread_mutex_destroy(&c->mutex);
+  return ret;
+}
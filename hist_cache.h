@@ -0,0 +1,88 @@
+#ifndef HIST_CACHE_H
+#define HIST_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Identifies one version of a file: if any of these change, the file
+// is histogrammed again.
+struct hist_cache_key
+{
+  uint64_t dev, ino;
+  int64_t size;
+  int64_t mtime_sec, mtime_nsec;
+  int64_t ctime_sec, ctime_nsec;
+};
+
+// A cached result, exactly as stored in the cache file.
+struct hist_cache_entry
+{
+  struct hist_cache_key key;
+  int64_t bits[8];
+};
+
+/*
+ * hist_cache
+ *
+ * A persistent cache of per-file bit histograms.  The cache file is a
+ * short header followed by fixed-size entries.  New results are only
+ * ever appended, and of several entries for the same file (dev/inode)
+ * the last one wins, so a run never rewrites what is already there.
+ * The file is mmap()ed when the cache is opened, and an in-memory hash
+ * table on dev/inode points into the mapping, so a lookup touches no
+ * file data at all.
+ *
+ * Once entries for files that have since changed outnumber the live
+ * ones, the file is compacted: the live entries are written to a new
+ * file, which replaces the old one.  Compaction can also be requested
+ * explicitly, in which case only entries looked up or added during
+ * this run are kept (dropping files that no longer exist).
+ *
+ * Lookups and additions may be made concurrently from any thread.
+ * Additions are collected in memory and written out by
+ * hist_cache_close().
+ */
+struct hist_cache
+{
+  char *path;
+  int fd;
+  int rewrite;                            /* the file must be rewritten */
+
+  void *map;
+  size_t map_len;
+  const struct hist_cache_entry *entries; /* in the mapping */
+  size_t nentries;
+  size_t nlive;                           /* entries not superseded */
+  uint32_t *table;                        /* entry index + 1, or 0 */
+  size_t table_mask;
+  unsigned char *used;                    /* per entry: hit this run */
+
+  pthread_mutex_t mutex;                  /* protects 'added' */
+  struct hist_cache_entry *added;
+  size_t nadded, cap;
+};
+
+// Fill in the key of the file described by 'st'.
+void hist_cache_key_init(struct hist_cache_key *key, const struct stat *st);
+
+// Open (creating if necessary) the cache file at 'path'.  A file that
+// is not a valid cache is replaced when the cache is closed.  Returns
+// non-zero (after a warning) if the file cannot be opened at all.
+int hist_cache_open(struct hist_cache *c, const char *path);
+
+// Look up the histogram of the file described by 'st'.  Returns 1 and
+// adds the cached counts to bits[] on a hit, 0 on a miss.
+int hist_cache_lookup(struct hist_cache *c, const struct stat *st, int64_t bits[8]);
+
+// Record the histogram of a file.
+void hist_cache_add(struct hist_cache *c, const struct hist_cache_key *key,
+                    const int64_t bits[8]);
+
+// Write out new entries, compacting the file if it has grown too
+// stale or if 'compact' is non-zero, and free the cache.  Returns
+// non-zero (after a warning) if the file could not be updated.
+int hist_cache_close(struct hist_cache *c, int compact);
+
+#endif
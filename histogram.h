@@ -1,12 +1,18 @@
 // This header file contains not just function prototypes, but also
 // the definitions.  This means it does not need to be compiled
-// separately.
+// separately, except that update_histogram_buf() needs bitcount.o.
 //
 // You should not need to modify this file.
 
 #ifndef HISTOGRAM_H
 #define HISTOGRAM_H
 
+#include "bitcount.h"
+
+// A histogram is eight counters, one per bit position, of the bytes
+// that have that bit set.  They are 64-bit because an int overflows
+// after 2^31 such bytes, which can be as little as 2 GiB of input.
+
 // Move the cursor down 'n' lines.  Negative 'n' supported.
 static void move_lines(int n) {
   if (n < 0) {
@@ -25,7 +31,7 @@ static void clear_line() {
 // printing, the cursor is moved back to the beginning of the output.
 // This means that next time print_histogram() is called, the previous
 // output will be overwritten.
-static void print_histogram(int histogram[8]) {
+static void print_histogram(int64_t histogram[8]) {
   int64_t bits_seen = 0;
 
   for (int i = 0; i < 8; i++) {
@@ -50,7 +56,7 @@ static void print_histogram(int histogram[8]) {
 
 // Merge the former histogram into the latter, setting the former to
 // zero in the process.
-static void merge_histogram(int from[8], int to[8]) {
+static void merge_histogram(int64_t from[8], int64_t to[8]) {
   for (int i = 0; i < 8; i++) {
     to[i] += from[i];
     from[i] = 0;
@@ -58,7 +64,7 @@ static void merge_histogram(int from[8], int to[8]) {
 }
 
 // Update the histogram with the bits of a byte.
-static void update_histogram(int histogram[8], unsigned char byte) {
+static void update_histogram(int64_t histogram[8], unsigned char byte) {
   // For all bits in a byte...
   for (int i = 0; i < 8; i++) {
     // count if bit 'i' is set.
@@ -68,4 +74,21 @@ static void update_histogram(int histogram[8], unsigned char byte) {
   }
 }
 
+// Update the histogram with the bits of every byte in buf[0..len).
+// Much faster than calling update_histogram() per byte.
+static void update_histogram_buf(int64_t histogram[8], const unsigned char *buf, size_t len) {
+  if (len < 64) {
+    for (size_t i = 0; i < len; i++) {
+      update_histogram(histogram, buf[i]);
+    }
+    return;
+  }
+
+  uint64_t counts[8] = { 0 };
+  count_bits(buf, len, counts);
+  for (int i = 0; i < 8; i++) {
+    histogram[i] += (int64_t)counts[i];
+  }
+}
+
 #endif
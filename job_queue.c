@@ -1,10 +1,233 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <sched.h>
+#include <time.h>
 
 #include "job_queue.h"
 
+// Number of failed attempts a lock-free push/pop makes on a full or
+// empty ring before parking on the condition variables.  The first
+// JOB_QUEUE_PAUSE_LIMIT attempts busy-wait, the rest yield the CPU so
+// the thread we are waiting for gets to run.
+#define JOB_QUEUE_SPIN_LIMIT 128
+#define JOB_QUEUE_PAUSE_LIMIT 64
+
+static inline void backoff(int spins)
+{
+  if (spins >= JOB_QUEUE_PAUSE_LIMIT)
+  {
+    sched_yield();
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Statistics (job_queue_stats_enable()).  Each thread's counters are
+// allocated on its first counted operation, linked into 'all_stats' and
+// never freed, so they can still be collected after the thread exits.
+// Only the owning thread writes them; relaxed stores let other threads
+// read them while they change.
+struct stats_block
+{
+  struct job_queue_stats s;
+  struct stats_block *next;
+};
+
+static int stats_on = 0;
+static __thread struct stats_block *my_stats = NULL;
+static struct stats_block *all_stats = NULL;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct job_queue_stats *thread_stats(void)
+{
+  if (my_stats == NULL)
+  {
+    struct stats_block *b = calloc(1, sizeof(struct stats_block));
+    if (b == NULL)
+    {
+      return NULL;
+    }
+    pthread_mutex_lock(&stats_mutex);
+    b->next = all_stats;
+    all_stats = b;
+    pthread_mutex_unlock(&stats_mutex);
+    my_stats = b;
+  }
+  return &my_stats->s;
+}
+
+static inline void stat_add(uint64_t *c, uint64_t n)
+{
+  __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Start timing a wait.  Returns 0 when not counting.
+static inline uint64_t wait_begin(void)
+{
+  return stats_on ? now_ns() : 0;
+}
+
+// Count 'n' pushes that waited since 'wait_start' (0 for no wait).  The
+// caller of a locked queue holds the mutex.
+static void count_push(struct job_queue *job_queue, int n, uint64_t wait_start)
+{
+  struct job_queue_stats *s;
+  if (!stats_on || (s = thread_stats()) == NULL)
+  {
+    return;
+  }
+  stat_add(&s->pushes, (uint64_t)n);
+  if (wait_start != 0)
+  {
+    stat_add(&s->push_waits, 1);
+    stat_add(&s->push_wait_ns, now_ns() - wait_start);
+  }
+
+  uint64_t size;
+  if (job_queue->kind == JOB_QUEUE_LOCKFREE)
+  {
+    size = __atomic_load_n(&job_queue->enqueue_pos, __ATOMIC_RELAXED)
+           - __atomic_load_n(&job_queue->dequeue_pos, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    size = (uint64_t)job_queue->size;
+  }
+  if (size > s->peak && size <= (uint64_t)job_queue->max_capacity)
+  {
+    __atomic_store_n(&s->peak, size, __ATOMIC_RELAXED);
+  }
+}
+
+// Count a resize of a locked ring.
+static void count_resize(int grew)
+{
+  struct job_queue_stats *s;
+  if (!stats_on || (s = thread_stats()) == NULL)
+  {
+    return;
+  }
+  stat_add(grew ? &s->grows : &s->shrinks, 1);
+}
+
+// Count 'n' pops that waited since 'wait_start' (0 for no wait).
+static void count_pop(int n, uint64_t wait_start)
+{
+  struct job_queue_stats *s;
+  if (!stats_on || (s = thread_stats()) == NULL)
+  {
+    return;
+  }
+  stat_add(&s->pops, (uint64_t)n);
+  if (wait_start != 0)
+  {
+    stat_add(&s->pop_waits, 1);
+    stat_add(&s->pop_wait_ns, now_ns() - wait_start);
+  }
+}
+
+void job_queue_stats_enable(void)
+{
+  stats_on = 1;
+}
+
+void job_queue_stats_collect(struct job_queue_stats *total)
+{
+  memset(total, 0, sizeof(*total));
+  pthread_mutex_lock(&stats_mutex);
+  for (struct stats_block *b = all_stats; b != NULL; b = b->next)
+  {
+    total->pushes += __atomic_load_n(&b->s.pushes, __ATOMIC_RELAXED);
+    total->pops += __atomic_load_n(&b->s.pops, __ATOMIC_RELAXED);
+    total->push_waits += __atomic_load_n(&b->s.push_waits, __ATOMIC_RELAXED);
+    total->pop_waits += __atomic_load_n(&b->s.pop_waits, __ATOMIC_RELAXED);
+    total->push_wait_ns += __atomic_load_n(&b->s.push_wait_ns, __ATOMIC_RELAXED);
+    total->pop_wait_ns += __atomic_load_n(&b->s.pop_wait_ns, __ATOMIC_RELAXED);
+    total->grows += __atomic_load_n(&b->s.grows, __ATOMIC_RELAXED);
+    total->shrinks += __atomic_load_n(&b->s.shrinks, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&b->s.peak, __ATOMIC_RELAXED);
+    if (peak > total->peak)
+    {
+      total->peak = peak;
+    }
+  }
+  pthread_mutex_unlock(&stats_mutex);
+}
+
+// Every push and pop registers in the gate for as long as it touches
+// the ring, the mutex or the condvars, so that job_queue_destroy() never
+// frees them under someone's feet.  Once 'torn_down' is set the queue
+// only answers -1.  Each thread uses one counter of the gate, picked
+// round-robin on its first call, so registering costs an atomic add on
+// a cache line that usually stays with the thread rather than one
+// shared by all of them.
+static int next_gate_stripe = 0;
+static __thread int my_gate_stripe = -1;
+
+static struct job_queue_gate *gate_stripe(struct job_queue *job_queue)
+{
+  if (my_gate_stripe < 0)
+  {
+    my_gate_stripe = __atomic_fetch_add(&next_gate_stripe, 1, __ATOMIC_RELAXED)
+                     % JOB_QUEUE_GATE_STRIPES;
+  }
+  return &job_queue->gate[my_gate_stripe];
+}
+
+// The add and the load of 'torn_down' are both seq_cst, as are the
+// store and the loads in gate_close(): either the destroyer sees this
+// thread's count, or this thread sees 'torn_down'.
+static int gate_enter(struct job_queue *job_queue)
+{
+  struct job_queue_gate *g = gate_stripe(job_queue);
+  __atomic_add_fetch(&g->users, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&job_queue->torn_down, __ATOMIC_SEQ_CST))
+  {
+    __atomic_sub_fetch(&g->users, 1, __ATOMIC_RELEASE);
+    return -1;
+  }
+  return 0;
+}
+
+static void gate_leave(struct job_queue *job_queue)
+{
+  __atomic_sub_fetch(&gate_stripe(job_queue)->users, 1, __ATOMIC_RELEASE);
+}
+
+// Called by the destroyer (not registered in the gate) once the queue
+// is drained: refuse new users and wait for the current ones to leave.
+static void gate_close(struct job_queue *job_queue)
+{
+  __atomic_store_n(&job_queue->torn_down, 1, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < JOB_QUEUE_GATE_STRIPES; i++)
+  {
+    while (__atomic_load_n(&job_queue->gate[i].users, __ATOMIC_SEQ_CST) > 0)
+    {
+      sched_yield();
+    }
+  }
+}
+
 int job_queue_init(struct job_queue *job_queue, int capacity)
+{
+  return job_queue_init_kind(job_queue, capacity, JOB_QUEUE_LOCKED);
+}
+
+int job_queue_init_kind(struct job_queue *job_queue, int capacity,
+                        enum job_queue_kind kind)
 {
   if (job_queue == NULL || capacity <= 0)
   {
@@ -12,24 +235,66 @@ int job_queue_init(struct job_queue *job_queue, int capacity)
   }
 
   // Allocate buffer first so we can bail out without touching pthread objects.
-  job_queue->buffer = malloc(sizeof(void *) * (size_t)capacity);
-  if (job_queue->buffer == NULL)
+  job_queue->buffer = NULL;
+  job_queue->slots = NULL;
+  if (kind == JOB_QUEUE_LOCKFREE)
   {
-    return -1;
+    // The sequence numbers cannot tell a full one-slot ring from an
+    // empty one, so the lock-free ring always has at least two slots.
+    if (capacity < 2)
+    {
+      capacity = 2;
+    }
+    job_queue->slots = malloc(sizeof(struct job_queue_slot) * (size_t)capacity);
+    if (job_queue->slots == NULL)
+    {
+      return -1;
+    }
+    // Slot i is first used by the push holding ticket i.
+    for (int i = 0; i < capacity; i++)
+    {
+      job_queue->slots[i].seq = (size_t)i;
+      job_queue->slots[i].data = NULL;
+    }
+  }
+  else
+  {
+    job_queue->buffer = malloc(sizeof(void *) * (size_t)capacity);
+    if (job_queue->buffer == NULL)
+    {
+      return -1;
+    }
   }
 
   // Initialize core fields
+  job_queue->kind = kind;
   job_queue->capacity = capacity;
+  job_queue->min_capacity = capacity;
+  job_queue->max_capacity = capacity;
+  job_queue->starved = 0;
+  job_queue->window_pops = 0;
+  job_queue->window_peak = 0;
   job_queue->size = 0;
   job_queue->head = 0;
   job_queue->tail = 0;
   job_queue->destroyed = 0;
+  job_queue->enqueue_pos = 0;
+  job_queue->dequeue_pos = 0;
+  job_queue->push_waiters = 0;
+  job_queue->pop_waiters = 0;
+  for (int i = 0; i < JOB_QUEUE_GATE_STRIPES; i++)
+  {
+    job_queue->gate[i].users = 0;
+  }
+  job_queue->torn_down = 0;
 
   // Initialize mutex and condvars. If any init fails we must clean up.
   if (pthread_mutex_init(&job_queue->mutex, NULL) != 0)
   {
     free(job_queue->buffer);
+    free(job_queue->slots);
     job_queue->buffer = NULL;
+    job_queue->slots = NULL;
     return -1;
   }
 
@@ -37,7 +302,9 @@ int job_queue_init(struct job_queue *job_queue, int capacity)
   {
     pthread_mutex_destroy(&job_queue->mutex);
     free(job_queue->buffer);
+    free(job_queue->slots);
     job_queue->buffer = NULL;
+    job_queue->slots = NULL;
     return -1;
   }
 
@@ -46,7 +313,9 @@ int job_queue_init(struct job_queue *job_queue, int capacity)
     pthread_cond_destroy(&job_queue->not_empty);
     pthread_mutex_destroy(&job_queue->mutex);
     free(job_queue->buffer);
+    free(job_queue->slots);
     job_queue->buffer = NULL;
+    job_queue->slots = NULL;
     return -1;
   }
 
@@ -56,13 +325,324 @@ int job_queue_init(struct job_queue *job_queue, int capacity)
     pthread_cond_destroy(&job_queue->not_empty);
     pthread_mutex_destroy(&job_queue->mutex);
     free(job_queue->buffer);
+    free(job_queue->slots);
     job_queue->buffer = NULL;
+    job_queue->slots = NULL;
     return -1;
   }
 
   return 0;
 }
 
+// Lock-free ring (JOB_QUEUE_LOCKFREE).
+//
+// This is the classic bounded MPMC queue with sequence-numbered slots:
+// a push holding ticket 'pos' may use slot pos % capacity once the
+// slot's seq equals pos, and publishes the job by setting seq to
+// pos + 1.  A pop holding ticket 'pos' waits for seq == pos + 1 and
+// hands the slot back to the pusher one lap later by setting seq to
+// pos + capacity.  Tickets are claimed with a CAS on enqueue_pos or
+// dequeue_pos, which live on separate cache lines.
+
+static inline size_t lf_load(size_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline int lf_destroyed(struct job_queue *job_queue)
+{
+  return __atomic_load_n(&job_queue->destroyed, __ATOMIC_ACQUIRE);
+}
+
+static inline struct job_queue_slot *lf_slot(struct job_queue *job_queue,
+                                             size_t pos)
+{
+  return &job_queue->slots[pos % (size_t)job_queue->capacity];
+}
+
+// Returns 0 on success, 1 if the ring is full.
+static int lf_try_push(struct job_queue *job_queue, void *data)
+{
+  size_t pos = lf_load(&job_queue->enqueue_pos);
+
+  for (;;)
+  {
+    struct job_queue_slot *slot = lf_slot(job_queue, pos);
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    long dif = (long)(seq - pos);
+
+    if (dif == 0)
+    {
+      if (__atomic_compare_exchange_n(&job_queue->enqueue_pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        slot->data = data;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+      }
+      // CAS failure reloaded 'pos'.
+    }
+    else if (dif < 0)
+    {
+      return 1;
+    }
+    else
+    {
+      pos = lf_load(&job_queue->enqueue_pos);
+    }
+  }
+}
+
+// Returns 0 on success, 1 if the ring is empty.
+static int lf_try_pop(struct job_queue *job_queue, void **data)
+{
+  size_t pos = lf_load(&job_queue->dequeue_pos);
+
+  for (;;)
+  {
+    struct job_queue_slot *slot = lf_slot(job_queue, pos);
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    long dif = (long)(seq - (pos + 1));
+
+    if (dif == 0)
+    {
+      if (__atomic_compare_exchange_n(&job_queue->dequeue_pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+        *data = slot->data;
+        __atomic_store_n(&slot->seq, pos + (size_t)job_queue->capacity,
+                         __ATOMIC_RELEASE);
+        return 0;
+      }
+    }
+    else if (dif < 0)
+    {
+      return 1;
+    }
+    else
+    {
+      pos = lf_load(&job_queue->dequeue_pos);
+    }
+  }
+}
+
+static int lf_full(struct job_queue *job_queue)
+{
+  size_t pos = lf_load(&job_queue->enqueue_pos);
+  size_t seq = __atomic_load_n(&lf_slot(job_queue, pos)->seq, __ATOMIC_ACQUIRE);
+  return (long)(seq - pos) < 0;
+}
+
+static int lf_empty(struct job_queue *job_queue)
+{
+  size_t pos = lf_load(&job_queue->dequeue_pos);
+  size_t seq = __atomic_load_n(&lf_slot(job_queue, pos)->seq, __ATOMIC_ACQUIRE);
+  return (long)(seq - (pos + 1)) < 0;
+}
+
+// True when every pushed job has been popped and no thread is still in
+// the middle of handing a slot back.
+static int lf_drained(struct job_queue *job_queue)
+{
+  size_t pos = lf_load(&job_queue->dequeue_pos);
+
+  if (lf_load(&job_queue->enqueue_pos) != pos)
+  {
+    return 0;
+  }
+  for (size_t i = 0; i < (size_t)job_queue->capacity; i++)
+  {
+    if (__atomic_load_n(&lf_slot(job_queue, pos + i)->seq, __ATOMIC_ACQUIRE) != pos + i)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Wake threads parked on 'cond' after a successful push or pop.  The
+// fence pairs with the one in lf_park(): either the parked thread sees
+// our update to the ring, or we see its waiter count.  Like everything
+// below, called from inside the gate.
+static void lf_wake(struct job_queue *job_queue, int *waiters, pthread_cond_t *cond)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0)
+  {
+    pthread_mutex_lock(&job_queue->mutex);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&job_queue->mutex);
+  }
+}
+
+// Sleep on 'cond' while 'blocked' holds and the queue is not destroyed.
+static void lf_park(struct job_queue *job_queue, int *waiters, pthread_cond_t *cond,
+                    int (*blocked)(struct job_queue *))
+{
+  pthread_mutex_lock(&job_queue->mutex);
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (!lf_destroyed(job_queue) && blocked(job_queue))
+  {
+    pthread_cond_wait(cond, &job_queue->mutex);
+  }
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&job_queue->mutex);
+}
+
+// Push data[0..n-1] in order, waking parked poppers once per batch
+// rather than once per element.  Returns the number of elements pushed,
+// which is less than 'n' only if the queue was destroyed.
+static int lf_push_many(struct job_queue *job_queue, void **data, int n)
+{
+  int pushed = 0;
+  int unannounced = 0;
+  int spins = 0;
+  uint64_t wait_start = 0;
+
+  while (pushed < n)
+  {
+    if (lf_destroyed(job_queue))
+    {
+      break;
+    }
+
+    if (lf_try_push(job_queue, data[pushed]) == 0)
+    {
+      pushed++;
+      unannounced++;
+      spins = 0;
+      count_push(job_queue, 1, wait_start);
+      wait_start = 0;
+      continue;
+    }
+
+    if (spins == 0 && wait_start == 0)
+    {
+      wait_start = wait_begin();
+    }
+
+    // Let poppers at what we have pushed so far before waiting for room.
+    if (unannounced > 0)
+    {
+      lf_wake(job_queue, &job_queue->pop_waiters, &job_queue->not_empty);
+      unannounced = 0;
+    }
+
+    if (++spins < JOB_QUEUE_SPIN_LIMIT)
+    {
+      backoff(spins);
+      continue;
+    }
+
+    // The ring has been full for a while: park until a pop frees a slot.
+    spins = 0;
+    lf_park(job_queue, &job_queue->push_waiters, &job_queue->not_full, lf_full);
+  }
+
+  if (unannounced > 0)
+  {
+    lf_wake(job_queue, &job_queue->pop_waiters, &job_queue->not_empty);
+  }
+  return pushed;
+}
+
+// Pop between 1 and 'max' elements into data[].  Returns the number
+// popped, or -1 once the queue is destroyed and drained.
+static int lf_pop_many(struct job_queue *job_queue, void **data, int max)
+{
+  int spins = 0;
+  uint64_t wait_start = 0;
+
+  for (;;)
+  {
+    if (lf_destroyed(job_queue) &&
+        lf_load(&job_queue->enqueue_pos) == lf_load(&job_queue->dequeue_pos))
+    {
+      return -1;
+    }
+
+    int popped = 0;
+    while (popped < max && lf_try_pop(job_queue, &data[popped]) == 0)
+    {
+      popped++;
+    }
+
+    if (popped > 0)
+    {
+      count_pop(popped, wait_start);
+      lf_wake(job_queue, &job_queue->push_waiters, &job_queue->not_full);
+      return popped;
+    }
+
+    if (wait_start == 0)
+    {
+      wait_start = wait_begin();
+    }
+    if (++spins < JOB_QUEUE_SPIN_LIMIT)
+    {
+      backoff(spins);
+      continue;
+    }
+
+    // The ring has been empty for a while: park until a push arrives.
+    spins = 0;
+    lf_park(job_queue, &job_queue->pop_waiters, &job_queue->not_empty, lf_empty);
+  }
+}
+
+// job_queue_try_push() on the lock-free ring.
+static int lf_try_push_one(struct job_queue *job_queue, void *data)
+{
+  if (lf_destroyed(job_queue) || lf_try_push(job_queue, data) != 0)
+  {
+    return -1;
+  }
+  count_push(job_queue, 1, 0);
+  lf_wake(job_queue, &job_queue->pop_waiters, &job_queue->not_empty);
+  return 0;
+}
+
+static int lf_destroy(struct job_queue *job_queue)
+{
+  if (pthread_mutex_lock(&job_queue->mutex) != 0)
+  {
+    return -1;
+  }
+
+  // Refuse further pushes and let parked poppers drain the ring.
+  __atomic_store_n(&job_queue->destroyed, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&job_queue->not_empty);
+  pthread_cond_broadcast(&job_queue->not_full);
+  pthread_mutex_unlock(&job_queue->mutex);
+
+  // Poppers do not signal the destroyer on their fast path, so poll
+  // (with backoff) until the ring is drained.
+  struct timespec delay = { 0, 1000 };
+  while (!lf_drained(job_queue))
+  {
+    nanosleep(&delay, NULL);
+    if (delay.tv_nsec < 1000000)
+    {
+      delay.tv_nsec *= 2;
+    }
+  }
+
+  // Wait for threads still spinning on the slots, or woken from the
+  // condition variables, to leave.
+  gate_close(job_queue);
+
+  pthread_cond_destroy(&job_queue->empty);
+  pthread_cond_destroy(&job_queue->not_full);
+  pthread_cond_destroy(&job_queue->not_empty);
+  pthread_mutex_destroy(&job_queue->mutex);
+
+  free(job_queue->slots);
+  job_queue->slots = NULL;
+
+  return 0;
+}
+
 int job_queue_destroy(struct job_queue *job_queue)
 {
   if (job_queue == NULL)
@@ -70,6 +650,11 @@ int job_queue_destroy(struct job_queue *job_queue)
     return -1;
   }
 
+  if (job_queue->kind == JOB_QUEUE_LOCKFREE)
+  {
+    return lf_destroy(job_queue);
+  }
+
   if (pthread_mutex_lock(&job_queue->mutex) != 0)
   {
     return -1;
@@ -88,8 +673,10 @@ int job_queue_destroy(struct job_queue *job_queue)
   }
 
   // We can now release the mutex and safely destroy synchronization objects.
-  // Unlock first, then destroy condvars and mutex.
+  // Unlock first, wait for woken poppers to get out of the mutex, then
+  // destroy condvars and mutex.
   pthread_mutex_unlock(&job_queue->mutex);
+  gate_close(job_queue);
 
   pthread_cond_destroy(&job_queue->empty);
   pthread_cond_destroy(&job_queue->not_full);
@@ -102,13 +689,115 @@ int job_queue_destroy(struct job_queue *job_queue)
   return 0;
 }
 
-int job_queue_push(struct job_queue *job_queue, void *data)
+// Adaptive capacity of the locked ring (job_queue_set_max_capacity()).
+// All of these are called with the mutex held.
+
+// Move the elements into a new ring of 'capacity' slots, which must
+// hold them all.  Returns non-zero, leaving the ring as it was, if
+// memory runs out.
+static int locked_resize(struct job_queue *job_queue, int capacity)
 {
-  if (job_queue == NULL)
+  void **buffer = malloc(sizeof(void *) * (size_t)capacity);
+  if (buffer == NULL)
+  {
+    return -1;
+  }
+  for (int i = 0; i < job_queue->size; i++)
+  {
+    buffer[i] = job_queue->buffer[(job_queue->head + i) % job_queue->capacity];
+  }
+  count_resize(capacity > job_queue->capacity);
+
+  free(job_queue->buffer);
+  job_queue->buffer = buffer;
+  job_queue->capacity = capacity;
+  job_queue->head = 0;
+  job_queue->tail = job_queue->size % capacity;
+  job_queue->window_pops = 0;
+  job_queue->window_peak = job_queue->size;
+  return 0;
+}
+
+// A push found the ring full.  Doubling it only pays off if consumers
+// have been idle for lack of elements since it last grew; otherwise
+// they are the bottleneck and the producer may as well wait.  Returns 0
+// if the ring grew.
+static int locked_grow(struct job_queue *job_queue)
+{
+  if (!job_queue->starved || job_queue->capacity >= job_queue->max_capacity)
+  {
+    return -1;
+  }
+  int capacity = job_queue->capacity > job_queue->max_capacity / 2
+                     ? job_queue->max_capacity
+                     : job_queue->capacity * 2;
+  if (locked_resize(job_queue, capacity) != 0)
+  {
+    return -1;
+  }
+  job_queue->starved = 0;
+  return 0;
+}
+
+// Note the size after a push.
+static inline void locked_pushed(struct job_queue *job_queue)
+{
+  if (job_queue->size > job_queue->window_peak)
+  {
+    job_queue->window_peak = job_queue->size;
+  }
+}
+
+// Note 'n' pops.  Every 'capacity' pops, halve a grown ring that has
+// not been more than a quarter full meanwhile.
+static void locked_popped(struct job_queue *job_queue, int n)
+{
+  job_queue->window_pops += n;
+  if (job_queue->window_pops < job_queue->capacity)
+  {
+    return;
+  }
+  if (job_queue->capacity > job_queue->min_capacity &&
+      job_queue->window_peak <= job_queue->capacity / 4)
+  {
+    int capacity = job_queue->capacity / 2;
+    if (capacity < job_queue->min_capacity)
+    {
+      capacity = job_queue->min_capacity;
+    }
+    if (locked_resize(job_queue, capacity) == 0)
+    {
+      return;
+    }
+  }
+  job_queue->window_pops = 0;
+  job_queue->window_peak = job_queue->size;
+}
+
+int job_queue_set_max_capacity(struct job_queue *job_queue, int max_capacity)
+{
+  if (job_queue == NULL || job_queue->kind == JOB_QUEUE_LOCKFREE ||
+      max_capacity < job_queue->min_capacity)
+  {
+    return -1;
+  }
+  if (gate_enter(job_queue) != 0)
   {
     return -1;
   }
+  pthread_mutex_lock(&job_queue->mutex);
+  job_queue->max_capacity = max_capacity;
+  if (job_queue->capacity > max_capacity && job_queue->size <= max_capacity)
+  {
+    (void)locked_resize(job_queue, max_capacity);
+  }
+  pthread_mutex_unlock(&job_queue->mutex);
+  gate_leave(job_queue);
+  return 0;
+}
 
+static int locked_push(struct job_queue *job_queue, void *data)
+{
   if (pthread_mutex_lock(&job_queue->mutex) != 0)
   {
     return -1;
@@ -121,7 +810,13 @@ int job_queue_push(struct job_queue *job_queue, void *data)
     return -1;
   }
 
-  // Wait while full. If destroyed while waiting, return error.
+  // Wait while full (unless the ring can grow). If destroyed while
+  // waiting, return error.
+  uint64_t wait_start = 0;
+  if (job_queue->size == job_queue->capacity && locked_grow(job_queue) != 0)
+  {
+    wait_start = wait_begin();
+  }
   while (job_queue->size == job_queue->capacity && !job_queue->destroyed)
   {
     pthread_cond_wait(&job_queue->not_full, &job_queue->mutex);
@@ -137,6 +832,8 @@ int job_queue_push(struct job_queue *job_queue, void *data)
   job_queue->buffer[job_queue->tail] = data;
   job_queue->tail = (job_queue->tail + 1) % job_queue->capacity;
   job_queue->size++;
+  locked_pushed(job_queue);
+  count_push(job_queue, 1, wait_start);
 
   // Signal that queue is not empty (wake waiting poppers)
   if (job_queue->size == 1)
@@ -148,19 +845,20 @@ int job_queue_push(struct job_queue *job_queue, void *data)
   return 0;
 }
 
-int job_queue_pop(struct job_queue *job_queue, void **data)
+static int locked_pop(struct job_queue *job_queue, void **data)
 {
-  if (job_queue == NULL || data == NULL)
-  {
-    return -1;
-  }
-
   if (pthread_mutex_lock(&job_queue->mutex) != 0)
   {
     return -1;
   }
 
   // Wait while empty. If destroyed while waiting and still empty, return -1.
+  uint64_t wait_start = 0;
+  if (job_queue->size == 0 && !job_queue->destroyed)
+  {
+    job_queue->starved = 1;
+    wait_start = wait_begin();
+  }
   while (job_queue->size == 0 && !job_queue->destroyed)
   {
     pthread_cond_wait(&job_queue->not_empty, &job_queue->mutex);
@@ -177,6 +875,7 @@ int job_queue_pop(struct job_queue *job_queue, void **data)
   *data = job_queue->buffer[job_queue->head];
   job_queue->head = (job_queue->head + 1) % job_queue->capacity;
   job_queue->size--;
+  count_pop(1, wait_start);
 
   // Signal that queue has space for pushers
   if (job_queue->size == job_queue->capacity - 1)
@@ -190,6 +889,232 @@ int job_queue_pop(struct job_queue *job_queue, void **data)
     pthread_cond_broadcast(&job_queue->empty);
   }
 
+  locked_popped(job_queue, 1);
   pthread_mutex_unlock(&job_queue->mutex);
   return 0;
 }
+
+// Batched variants of locked_push()/locked_pop(): one lock acquisition
+// and at most one broadcast per batch (plus one per wait for room).
+static int locked_push_many(struct job_queue *job_queue, void **data, int n)
+{
+  if (pthread_mutex_lock(&job_queue->mutex) != 0)
+  {
+    return 0;
+  }
+
+  int pushed = 0;
+  while (pushed < n)
+  {
+    // Wait while full (unless the ring can grow). If destroyed while
+    // waiting, stop.
+    uint64_t wait_start = 0;
+    if (job_queue->size == job_queue->capacity && locked_grow(job_queue) != 0)
+    {
+      wait_start = wait_begin();
+    }
+    while (job_queue->size == job_queue->capacity && !job_queue->destroyed)
+    {
+      pthread_cond_wait(&job_queue->not_full, &job_queue->mutex);
+    }
+
+    if (job_queue->destroyed)
+    {
+      break;
+    }
+
+    // Insert as many elements as fit at the tail.
+    int was_empty = job_queue->size == 0;
+    int round = pushed;
+    while (pushed < n && job_queue->size < job_queue->capacity)
+    {
+      job_queue->buffer[job_queue->tail] = data[pushed++];
+      job_queue->tail = (job_queue->tail + 1) % job_queue->capacity;
+      job_queue->size++;
+    }
+    locked_pushed(job_queue);
+    count_push(job_queue, pushed - round, wait_start);
+
+    // Poppers can only be waiting if the queue was empty.
+    if (was_empty)
+    {
+      pthread_cond_broadcast(&job_queue->not_empty);
+    }
+  }
+
+  pthread_mutex_unlock(&job_queue->mutex);
+  return pushed;
+}
+
+static int locked_try_push(struct job_queue *job_queue, void *data)
+{
+  if (pthread_mutex_lock(&job_queue->mutex) != 0)
+  {
+    return -1;
+  }
+
+  if (job_queue->destroyed || job_queue->size == job_queue->capacity)
+  {
+    pthread_mutex_unlock(&job_queue->mutex);
+    return -1;
+  }
+
+  job_queue->buffer[job_queue->tail] = data;
+  job_queue->tail = (job_queue->tail + 1) % job_queue->capacity;
+  job_queue->size++;
+  locked_pushed(job_queue);
+  count_push(job_queue, 1, 0);
+
+  if (job_queue->size == 1)
+  {
+    pthread_cond_broadcast(&job_queue->not_empty);
+  }
+
+  pthread_mutex_unlock(&job_queue->mutex);
+  return 0;
+}
+
+static int locked_pop_many(struct job_queue *job_queue, void **data, int max)
+{
+  if (pthread_mutex_lock(&job_queue->mutex) != 0)
+  {
+    return -1;
+  }
+
+  // Wait while empty. If destroyed while waiting and still empty, return -1.
+  uint64_t wait_start = 0;
+  if (job_queue->size == 0 && !job_queue->destroyed)
+  {
+    job_queue->starved = 1;
+    wait_start = wait_begin();
+  }
+  while (job_queue->size == 0 && !job_queue->destroyed)
+  {
+    pthread_cond_wait(&job_queue->not_empty, &job_queue->mutex);
+  }
+
+  if (job_queue->size == 0 && job_queue->destroyed)
+  {
+    pthread_mutex_unlock(&job_queue->mutex);
+    return -1;
+  }
+
+  // Remove up to 'max' elements from the head.
+  int was_full = job_queue->size == job_queue->capacity;
+  int popped = 0;
+  while (popped < max && job_queue->size > 0)
+  {
+    data[popped++] = job_queue->buffer[job_queue->head];
+    job_queue->head = (job_queue->head + 1) % job_queue->capacity;
+    job_queue->size--;
+  }
+  count_pop(popped, wait_start);
+
+  // Pushers can only be waiting if the queue was full.
+  if (was_full)
+  {
+    pthread_cond_broadcast(&job_queue->not_full);
+  }
+
+  // If queue became empty, signal destroyer waiting on empty.
+  if (job_queue->size == 0)
+  {
+    pthread_cond_broadcast(&job_queue->empty);
+  }
+
+  locked_popped(job_queue, popped);
+  pthread_mutex_unlock(&job_queue->mutex);
+  return popped;
+}
+
+int job_queue_push(struct job_queue *job_queue, void *data)
+{
+  if (job_queue == NULL)
+  {
+    return -1;
+  }
+
+  if (gate_enter(job_queue) != 0)
+  {
+    return -1;
+  }
+  int r = job_queue->kind == JOB_QUEUE_LOCKFREE
+              ? (lf_push_many(job_queue, &data, 1) == 1 ? 0 : -1)
+              : locked_push(job_queue, data);
+  gate_leave(job_queue);
+  return r;
+}
+
+int job_queue_pop(struct job_queue *job_queue, void **data)
+{
+  if (job_queue == NULL || data == NULL)
+  {
+    return -1;
+  }
+
+  if (gate_enter(job_queue) != 0)
+  {
+    return -1;
+  }
+  int r = job_queue->kind == JOB_QUEUE_LOCKFREE
+              ? (lf_pop_many(job_queue, data, 1) == 1 ? 0 : -1)
+              : locked_pop(job_queue, data);
+  gate_leave(job_queue);
+  return r;
+}
+
+int job_queue_try_push(struct job_queue *job_queue, void *data)
+{
+  if (job_queue == NULL)
+  {
+    return -1;
+  }
+
+  if (gate_enter(job_queue) != 0)
+  {
+    return -1;
+  }
+  int r = job_queue->kind == JOB_QUEUE_LOCKFREE ? lf_try_push_one(job_queue, data)
+                                                 : locked_try_push(job_queue, data);
+  gate_leave(job_queue);
+  return r;
+}
+
+int job_queue_push_many(struct job_queue *job_queue, void **data, int n)
+{
+  if (job_queue == NULL || data == NULL || n < 0)
+  {
+    return -1;
+  }
+
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  if (gate_enter(job_queue) != 0)
+  {
+    return 0;
+  }
+  int r = job_queue->kind == JOB_QUEUE_LOCKFREE ? lf_push_many(job_queue, data, n)
+                                                 : locked_push_many(job_queue, data, n);
+  gate_leave(job_queue);
+  return r;
+}
+
+int job_queue_pop_many(struct job_queue *job_queue, void **data, int max)
+{
+  if (job_queue == NULL || data == NULL || max <= 0)
+  {
+    return -1;
+  }
+
+  if (gate_enter(job_queue) != 0)
+  {
+    return -1;
+  }
+  int r = job_queue->kind == JOB_QUEUE_LOCKFREE ? lf_pop_many(job_queue, data, max)
+                                                 : locked_pop_many(job_queue, data, max);
+  gate_leave(job_queue);
+  return r;
+}
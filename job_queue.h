@@ -2,6 +2,45 @@
 #define JOB_QUEUE_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size used to keep the hot lock-free counters on separate cache
+// lines.
+#define JOB_QUEUE_CACHE_LINE 64
+
+// The two queue implementations.  JOB_QUEUE_LOCKED is the classic
+// mutex/condvar ring.  JOB_QUEUE_LOCKFREE is a bounded
+// multi-producer/multi-consumer ring (sequence-numbered slots) that
+// only falls back to parking on the condvars after spinning for a
+// while on a full or empty ring.
+enum job_queue_kind
+{
+  JOB_QUEUE_LOCKED,
+  JOB_QUEUE_LOCKFREE
+};
+
+// Number of counters the threads inside a queue are spread over (see
+// struct job_queue_gate).
+#define JOB_QUEUE_GATE_STRIPES 16
+
+// One slot of the lock-free ring.  'seq' tells producers and consumers
+// whose turn it is to use the slot.
+struct job_queue_slot
+{
+  size_t seq;
+  void *data;
+};
+
+// One counter of threads inside a queue, on a cache line of its own.
+// Each thread always registers in the same counter, so its entering and
+// leaving does not move cache lines between cores; job_queue_destroy()
+// sums them all.
+struct job_queue_gate
+{
+  int users;
+  char pad[JOB_QUEUE_CACHE_LINE - sizeof(int)];
+};
 
 /*
  * job_queue
@@ -12,12 +51,20 @@
  *
  * Fields:
  *  - buffer/capacity/head/tail/size : circular buffer implementation
+ *  - min/max_capacity, starved,    : adaptive ring size (locked kind,
+ *    window_pops/window_peak         see job_queue_set_max_capacity())
  *  - mutex/not_empty/not_full     : synchronization primitives
  *  - empty                        : optional condvar to let destroy wait until empty
  *  - destroyed                    : flag set by job_queue_destroy()
+ *  - slots/enqueue_pos/dequeue_pos : lock-free ring (JOB_QUEUE_LOCKFREE)
+ *  - push_waiters/pop_waiters     : threads parked on not_full/not_empty
+ *  - gate/torn_down               : let destroy wait for threads still
+ *                                   inside the queue before tearing down
  *
- * Implementations should use the mutex to protect all fields and use
- * condition variables for blocking push/pop/destroy semantics.
+ * The locked implementation uses the mutex to protect all fields and
+ * condition variables for blocking push/pop/destroy semantics.  The
+ * lock-free implementation only touches the mutex and condvars when a
+ * thread has to park.
  */
 struct job_queue {
   /* circular buffer of void* */
@@ -26,6 +73,11 @@ struct job_queue {
   int size;          /* current number of elements stored */
   int head;          /* index of next element to pop */
   int tail;          /* index where next push will store */
+  int min_capacity;  /* the ring resizes between these two */
+  int max_capacity;
+  int starved;       /* a pop found the ring empty since it last grew */
+  int window_pops;   /* pops, and most elements held, since the last */
+  int window_peak;   /* check for shrinking */
 
   /* synchronization */
   pthread_mutex_t mutex;
@@ -35,12 +87,59 @@ struct job_queue {
 
   /* state flags */
   int destroyed;      /* set to 1 when job_queue_destroy() is called */
+
+  enum job_queue_kind kind;
+
+  /* lock-free ring; head and tail live on their own cache lines */
+  struct job_queue_slot *slots;
+  char pad_enqueue[JOB_QUEUE_CACHE_LINE];
+  size_t enqueue_pos;       /* ticket of the next push */
+  char pad_dequeue[JOB_QUEUE_CACHE_LINE];
+  size_t dequeue_pos;       /* ticket of the next pop */
+  char pad_waiters[JOB_QUEUE_CACHE_LINE];
+  int push_waiters;         /* pushers parked on not_full */
+  int pop_waiters;          /* poppers parked on not_empty */
+
+  /* teardown */
+  char pad_teardown[JOB_QUEUE_CACHE_LINE];
+  int torn_down;            /* set once destroy starts tearing down */
+  char pad_gate[JOB_QUEUE_CACHE_LINE];
+  struct job_queue_gate gate[JOB_QUEUE_GATE_STRIPES];  /* threads inside */
+};
+
+// Counters of job_queue operations (see job_queue_stats_enable()).
+// Times are in nanoseconds; 'peak' is the largest number of elements
+// a push left in its queue.
+struct job_queue_stats
+{
+  uint64_t pushes, pops;
+  uint64_t push_waits, pop_waits;      /* operations that had to wait */
+  uint64_t push_wait_ns, pop_wait_ns;  /* time waiting on not_full/not_empty */
+  uint64_t peak;
+  uint64_t grows, shrinks;             /* ring resizes */
 };
 
 // Initialise a job queue with the given capacity.  The queue starts out
 // empty.  Returns non-zero on error.
 int job_queue_init(struct job_queue *job_queue, int capacity);
 
+// Like job_queue_init(), but selects the implementation.  Both kinds
+// have the same push/pop/destroy semantics, except that a lock-free
+// queue always has room for at least two elements.
+int job_queue_init_kind(struct job_queue *job_queue, int capacity,
+                        enum job_queue_kind kind);
+
+// Let a locked queue adapt its capacity to the producers and consumers
+// using it, between the capacity it was initialised with and
+// 'max_capacity'.  The ring doubles when a push finds it full, but only
+// if consumers have run dry since it last grew; producers that are
+// steadily faster than the consumers keep getting back-pressure.  It
+// halves again, not below its initial capacity, after a stretch of pops
+// during which it stayed at most a quarter full.  May be called at any
+// time.  Returns non-zero for a lock-free queue, whose ring cannot be
+// resized, or if 'max_capacity' is less than the initial capacity.
+int job_queue_set_max_capacity(struct job_queue *job_queue, int max_capacity);
+
 // Destroy the job queue.  Blocks until the queue is empty before it
 // is destroyed.
 int job_queue_destroy(struct job_queue *job_queue);
@@ -57,4 +156,32 @@ int job_queue_push(struct job_queue *job_queue, void *data);
 // job_queue_pop() blocked), this function will return -1.
 int job_queue_pop(struct job_queue *job_queue, void **data);
 
+// Like job_queue_push(), but never blocks: returns non-zero if the
+// queue is full or has been destroyed.
+int job_queue_try_push(struct job_queue *job_queue, void *data);
+
+// Push data[0..n-1] onto the end of the job queue, in order.  Takes the
+// lock once per batch (plus once per wait for room) and wakes poppers
+// at most once per batch.  Blocks while the queue is full.  Returns the
+// number of elements pushed, which is less than 'n' only if the queue
+// was destroyed; the caller still owns the elements that were not
+// pushed.  Returns -1 on invalid arguments.
+int job_queue_push_many(struct job_queue *job_queue, void **data, int n);
+
+// Pop between 1 and 'max' elements from the front of the job queue
+// into data[], in queue order.  Blocks while the queue is empty.
+// Returns the number of elements popped, or -1 under the same
+// conditions as job_queue_pop().
+int job_queue_pop_many(struct job_queue *job_queue, void **data, int max);
+
+// Start counting operations on all queues, in per-thread counters that
+// only their thread writes, so counting adds no shared writes to push
+// and pop.  Off by default; call before any thread uses a queue.
+void job_queue_stats_enable(void);
+
+// Sum the counters of every thread (the maximum, for 'peak').  May be
+// called while other threads use queues; the result is then a recent
+// snapshot.
+void job_queue_stats_collect(struct job_queue_stats *total);
+
 #endif
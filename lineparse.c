@@ -0,0 +1,134 @@
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "lineparse.h"
+
+static const uint64_t pow10[9] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+// The eight bytes at p, the first in the lowest byte.
+static inline uint64_t load8(const char *p)
+{
+  uint64_t x;
+  memcpy(&x, p, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  x = __builtin_bswap64(x);
+#endif
+  return x;
+}
+
+// The number of ASCII digits x starts with (in its lowest bytes).  A
+// byte is a digit if adding 0x46 leaves its top bit clear (it is at
+// most '9') and subtracting '0' does too (it is at least '0').  Carries
+// and borrows only cross from a non-digit byte, above the digits.
+static inline int digit_run(uint64_t x)
+{
+  uint64_t bad = ((x + 0x4646464646464646ULL) | (x - 0x3030303030303030ULL))
+                 & 0x8080808080808080ULL;
+  return bad == 0 ? 8 : __builtin_ctzll(bad) / 8;
+}
+
+// The value of the 1 to 8 digits in the lowest bytes of x.  Shifting
+// them to the top leaves zero digits in front; then neighbouring digits
+// are combined into pairs, and pairs into the whole number, with a few
+// multiplications.
+static inline uint32_t digits_value(uint64_t x, int n)
+{
+  x = (x - 0x3030303030303030ULL) << (8 * (8 - n));
+  x = x * 10 + (x >> 8);
+  return (uint32_t)((((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+                     (((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32);
+}
+
+// Parse the line [p, e) like atoi(), which glibc defines as
+// (int)strtol(p, NULL, 10): leading white space, a sign, and digits up
+// to the first non-digit, with values beyond a long clamped.  Up to
+// 'limit' (which is at least e) bytes may be read.
+static int parse_int(const char *p, const char *e, const char *limit)
+{
+  while (p < e && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+  {
+    p++;
+  }
+  int neg = 0;
+  if (p < e && (*p == '-' || *p == '+'))
+  {
+    neg = *p++ == '-';
+  }
+
+  uint64_t v = 0;
+  int overflow = 0;
+  for (;;)
+  {
+    int n;
+    uint32_t chunk;
+    if (limit - p >= 8)
+    {
+      uint64_t x = load8(p);
+      n = digit_run(x);
+      if (n > e - p)
+      {
+        n = (int)(e - p);
+      }
+      if (n == 0)
+      {
+        break;
+      }
+      chunk = digits_value(x, n);
+    }
+    else
+    {
+      chunk = 0;
+      for (n = 0; p + n < e && p[n] >= '0' && p[n] <= '9'; n++)
+      {
+        chunk = chunk * 10 + (uint32_t)(p[n] - '0');
+      }
+      if (n == 0)
+      {
+        break;
+      }
+    }
+    overflow |= __builtin_mul_overflow(v, pow10[n], &v);
+    overflow |= __builtin_add_overflow(v, (uint64_t)chunk, &v);
+    p += n;
+    if (n < 8)
+    {
+      break;
+    }
+  }
+
+  long r;
+  if (neg)
+  {
+    r = overflow || v > (uint64_t)LONG_MAX + 1 ? LONG_MIN : (long)(0 - v);
+  }
+  else
+  {
+    r = overflow || v > (uint64_t)LONG_MAX ? LONG_MAX : (long)v;
+  }
+  return (int)r;
+}
+
+size_t lineparse_ints(const char *buf, size_t len, int final, int *out, size_t max,
+                      size_t *used)
+{
+  const char *p = buf, *end = buf + len;
+  size_t n = 0;
+
+  while (n < max && p < end)
+  {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    if (nl == NULL && !final)
+    {
+      break;
+    }
+    const char *e = nl != NULL ? nl : end;
+    out[n++] = parse_int(p, e, end);
+    p = nl != NULL ? nl + 1 : end;
+  }
+
+  *used = (size_t)(p - buf);
+  return n;
+}
@@ -0,0 +1,19 @@
+#ifndef LINEPARSE_H
+#define LINEPARSE_H
+
+#include <stddef.h>
+
+// Parse the newline-terminated lines at the start of buf[0..len) into
+// out[], one value per line, exactly as atoi() would parse each line,
+// until 'max' values are stored or no complete line is left.  If
+// 'final' is set, a last line without a newline counts too.  Sets
+// *used to the number of bytes consumed and returns the number of
+// values stored.
+//
+// Lines are found with memchr() and runs of digits are converted eight
+// at a time in a 64-bit register, so a typical line costs a handful of
+// operations rather than one per byte.
+size_t lineparse_ints(const char *buf, size_t len, int final, int *out, size_t max,
+                      size_t *used);
+
+#endif
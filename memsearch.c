@@ -0,0 +1,373 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "memsearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MEMSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Bytes in roughly decreasing order of frequency in source code and
+// English text.  Anything not listed (control characters, most
+// punctuation, non-ASCII) is assumed to be rare.
+static const char common_bytes[] =
+  " etaoinsrhldcumfpgwybvkxjqz\n"
+  "ETAOINSRHLDCUMFPGWYBVKXJQZ"
+  "0123456789"
+  "\t.,;:-_()/'\"=*{}<>[]#";
+
+// The first this many entries of common_bytes are too frequent for
+// memchr() on them to beat the vector filter.
+#define FREQUENT_BYTES 28
+
+// memchr() on the rarest byte is abandoned for the vector filter once
+// it has produced more than PREFILTER_MIN candidates, at an average of
+// more than one per PREFILTER_GAP bytes.
+#define PREFILTER_MIN 16
+#define PREFILTER_GAP 256
+
+static int byte_rank(unsigned char c)
+{
+  const char *p = c == '\0' ? NULL : strchr(common_bytes, c);
+  return p == NULL ? 0 : (int)(sizeof(common_bytes) - (size_t)(p - common_bytes));
+}
+
+// Pick the two rarest positions of the needle.  Ties go to the earliest
+// position for the rarest byte and the latest one for the second, which
+// keeps them apart and makes the pair more selective.
+static void pick_rare_bytes(struct memsearch *s)
+{
+  const unsigned char *n = (const unsigned char *)s->needle;
+  size_t best = 0;
+
+  for (size_t i = 1; i < s->len; i++)
+  {
+    if (byte_rank(n[i]) < byte_rank(n[best]))
+    {
+      best = i;
+    }
+  }
+
+  size_t second = best == s->len - 1 ? 0 : s->len - 1;
+  for (size_t i = s->len; i-- > 0;)
+  {
+    if (i != best && byte_rank(n[i]) < byte_rank(n[second]))
+    {
+      second = i;
+    }
+  }
+
+  s->i1 = best;
+  s->i2 = second;
+  s->b1 = n[best];
+  s->b2 = n[second];
+  s->rare = byte_rank(s->b1) <= (int)sizeof(common_bytes) - FREQUENT_BYTES;
+}
+
+// Search the starting positions *pos..len-s->len by jumping between
+// occurrences of the rarest byte with memchr().  If 'give_up' is set,
+// stop early when candidates turn out to be frequent.  Returns the
+// match, or NULL with *pos set to the first position not yet searched.
+static const char *find_memchr(const struct memsearch *s, const char *buf,
+                               size_t len, size_t *pos, int give_up)
+{
+  size_t last = len - s->len;
+  size_t p = *pos;
+  size_t candidates = 0;
+
+  while (p <= last)
+  {
+    const char *q = memchr(buf + p + s->i1, s->b1, last - p + 1);
+    if (q == NULL)
+    {
+      p = last + 1;
+      break;
+    }
+
+    size_t start = (size_t)(q - buf) - s->i1;
+    if ((unsigned char)buf[start + s->i2] == s->b2
+        && memcmp(buf + start, s->needle, s->len) == 0)
+    {
+      return buf + start;
+    }
+    p = start + 1;
+
+    if (give_up && ++candidates > PREFILTER_MIN
+        && candidates * PREFILTER_GAP > p - *pos)
+    {
+      break;
+    }
+  }
+
+  *pos = p;
+  return NULL;
+}
+
+static const char *find_empty(const struct memsearch *s, const char *buf, size_t len)
+{
+  (void)s;
+  (void)len;
+  return buf;
+}
+
+static const char *find_byte(const struct memsearch *s, const char *buf, size_t len)
+{
+  return memchr(buf, s->b1, len);
+}
+
+static const char *find_scalar(const struct memsearch *s, const char *buf, size_t len)
+{
+  size_t p = 0;
+  return len < s->len ? NULL : find_memchr(s, buf, len, &p, 0);
+}
+
+#ifdef MEMSEARCH_X86
+
+// Report the candidate starting positions in 'mask' (bit k = start p+k)
+// that match the whole needle.
+static inline const char *verify(const struct memsearch *s, const char *buf,
+                                 size_t p, uint64_t mask)
+{
+  while (mask != 0)
+  {
+    size_t start = p + (size_t)__builtin_ctzll(mask);
+    if (memcmp(buf + start, s->needle, s->len) == 0)
+    {
+      return buf + start;
+    }
+    mask &= mask - 1;
+  }
+  return NULL;
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const struct memsearch *s, const char *buf, size_t len)
+{
+  if (len < s->len)
+  {
+    return NULL;
+  }
+
+  const __m128i v1 = _mm_set1_epi8((char)s->b1);
+  const __m128i v2 = _mm_set1_epi8((char)s->b2);
+  const char *p1 = buf + s->i1;
+  const char *p2 = buf + s->i2;
+  size_t starts = len - s->len + 1;
+  size_t p = 0;
+  const char *hit;
+
+  if (s->rare && ((hit = find_memchr(s, buf, len, &p, 1)) != NULL || p == starts))
+  {
+    return hit;
+  }
+
+  // Every block of 16 starting positions is valid, so both loads stay
+  // within the buffer.
+  for (; p + 16 <= starts; p += 16)
+  {
+    __m128i m = _mm_and_si128(
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p1 + p)), v1),
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p2 + p)), v2));
+    unsigned mask = (unsigned)_mm_movemask_epi8(m);
+    if (mask != 0 && (hit = verify(s, buf, p, mask)) != NULL)
+    {
+      return hit;
+    }
+  }
+
+  return find_memchr(s, buf, len, &p, 0);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const struct memsearch *s, const char *buf, size_t len)
+{
+  if (len < s->len)
+  {
+    return NULL;
+  }
+
+  const __m256i v1 = _mm256_set1_epi8((char)s->b1);
+  const __m256i v2 = _mm256_set1_epi8((char)s->b2);
+  const char *p1 = buf + s->i1;
+  const char *p2 = buf + s->i2;
+  size_t starts = len - s->len + 1;
+  size_t p = 0;
+  const char *hit;
+
+  if (s->rare && ((hit = find_memchr(s, buf, len, &p, 1)) != NULL || p == starts))
+  {
+    return hit;
+  }
+
+  // Four vectors per iteration; the masks are only taken apart when
+  // one of them has a candidate.
+  for (; p + 128 <= starts; p += 128)
+  {
+    __m256i m[4];
+    for (int k = 0; k < 4; k++)
+    {
+      m[k] = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p1 + p + 32 * k)), v1),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p2 + p + 32 * k)), v2));
+    }
+    __m256i any = _mm256_or_si256(_mm256_or_si256(m[0], m[1]),
+                                  _mm256_or_si256(m[2], m[3]));
+    if (_mm256_testz_si256(any, any))
+    {
+      continue;
+    }
+
+    for (int k = 0; k < 4; k += 2)
+    {
+      uint64_t mask = (uint32_t)_mm256_movemask_epi8(m[k])
+        | (uint64_t)(uint32_t)_mm256_movemask_epi8(m[k + 1]) << 32;
+      if ((hit = verify(s, buf, p + 32 * (size_t)k, mask)) != NULL)
+      {
+        return hit;
+      }
+    }
+  }
+
+  for (; p + 32 <= starts; p += 32)
+  {
+    __m256i m = _mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p1 + p)), v1),
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p2 + p)), v2));
+    if ((hit = verify(s, buf, p, (uint32_t)_mm256_movemask_epi8(m))) != NULL)
+    {
+      return hit;
+    }
+  }
+
+  return find_memchr(s, buf, len, &p, 0);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_byte_avx2(const char *buf, size_t len, unsigned char c)
+{
+  const __m256i v = _mm256_set1_epi8((char)c);
+  size_t n = 0;
+  size_t p = 0;
+
+  for (; p + 32 <= len; p += 32)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(buf + p));
+    n += (size_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v)));
+  }
+  for (; p < len; p++)
+  {
+    n += (unsigned char)buf[p] == c;
+  }
+  return n;
+}
+
+#endif
+
+static size_t count_byte_scalar(const char *buf, size_t len, unsigned char c)
+{
+  size_t n = 0;
+  const char *end = buf + len;
+  const char *p;
+
+  while (buf < end && (p = memchr(buf, c, (size_t)(end - buf))) != NULL)
+  {
+    n++;
+    buf = p + 1;
+  }
+  return n;
+}
+
+static int cpu_has(int impl)
+{
+  switch (impl)
+  {
+  case MEMSEARCH_SCALAR:
+    return 1;
+#ifdef MEMSEARCH_X86
+  case MEMSEARCH_SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+  case MEMSEARCH_AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return 0;
+  }
+}
+
+int memsearch_init_impl(struct memsearch *s, const char *needle, size_t len,
+                        int impl)
+{
+  s->needle = needle;
+  s->len = len;
+  s->i1 = s->i2 = 0;
+  s->b1 = s->b2 = len > 0 ? (unsigned char)needle[0] : 0;
+  s->rare = 0;
+  s->find = NULL;
+
+  if (impl == MEMSEARCH_AUTO)
+  {
+    impl = cpu_has(MEMSEARCH_AVX2) ? MEMSEARCH_AVX2
+      : cpu_has(MEMSEARCH_SSE2) ? MEMSEARCH_SSE2
+      : MEMSEARCH_SCALAR;
+  }
+  if (!cpu_has(impl))
+  {
+    return -1;
+  }
+
+  // Needles of zero or one byte need no filtering.
+  if (len == 0)
+  {
+    s->find = find_empty;
+    return 0;
+  }
+  if (len == 1)
+  {
+    s->find = find_byte;
+    return 0;
+  }
+
+  pick_rare_bytes(s);
+
+  switch (impl)
+  {
+#ifdef MEMSEARCH_X86
+  case MEMSEARCH_AVX2:
+    s->find = find_avx2;
+    break;
+  case MEMSEARCH_SSE2:
+    s->find = find_sse2;
+    break;
+#endif
+  default:
+    s->find = find_scalar;
+    break;
+  }
+  return 0;
+}
+
+void memsearch_init(struct memsearch *s, const char *needle, size_t len)
+{
+  (void)memsearch_init_impl(s, needle, len, MEMSEARCH_AUTO);
+}
+
+size_t memsearch_count_byte(const char *buf, size_t len, unsigned char c)
+{
+#ifdef MEMSEARCH_X86
+  static int avx2 = -1;
+  int has = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+  if (has < 0)
+  {
+    has = cpu_has(MEMSEARCH_AVX2);
+    __atomic_store_n(&avx2, has, __ATOMIC_RELAXED);
+  }
+  if (has)
+  {
+    return count_byte_avx2(buf, len, c);
+  }
+#endif
+  return count_byte_scalar(buf, len, c);
+}
@@ -0,0 +1,65 @@
+#ifndef MEMSEARCH_H
+#define MEMSEARCH_H
+
+#include <stddef.h>
+
+struct memsearch;
+
+typedef const char *(*memsearch_fn)(const struct memsearch *s,
+                                    const char *buf, size_t len);
+
+/*
+ * memsearch
+ *
+ * A prepared substring search over arbitrary byte buffers (no NUL
+ * termination needed).  Two bytes of the needle, chosen to be rare in
+ * typical text, are compared against 16 or 32 haystack positions at a
+ * time; only positions where both agree are verified with memcmp().
+ * If the rarest byte is unusual enough (not a lower-case letter, space
+ * or newline) the search first skips between its occurrences with
+ * memchr(), and switches to the vector filter if they prove frequent.
+ *
+ * The vector width is picked at run time from what the CPU supports
+ * (AVX2, then SSE2, then a scalar loop built on memchr()).  Initialise
+ * with memsearch_init(); the struct is then read-only and may be shared
+ * between threads.
+ */
+struct memsearch
+{
+  const char *needle;
+  size_t len;
+  size_t i1, i2;        /* offsets of the rarest and second rarest byte */
+  unsigned char b1, b2; /* needle[i1], needle[i2] */
+  int rare;             /* b1 is rare enough to try memchr() on it first */
+  memsearch_fn find;
+};
+
+// Names of the available implementations, for memsearch_init_impl().
+#define MEMSEARCH_AUTO   0
+#define MEMSEARCH_SCALAR 1
+#define MEMSEARCH_SSE2   2
+#define MEMSEARCH_AVX2   3
+
+// Prepare a search for needle[0..len).  The needle is not copied and
+// must outlive the struct.  An empty needle matches at every position.
+void memsearch_init(struct memsearch *s, const char *needle, size_t len);
+
+// As memsearch_init(), but force a particular implementation.  Returns
+// non-zero (and leaves the struct unusable) if the CPU does not support
+// it.  Mostly useful for benchmarking.
+int memsearch_init_impl(struct memsearch *s, const char *needle, size_t len,
+                        int impl);
+
+// Return a pointer to the first occurrence of the needle in
+// buf[0..len), or NULL.
+static inline const char *memsearch_find(const struct memsearch *s,
+                                         const char *buf, size_t len)
+{
+  return s->find(s, buf, len);
+}
+
+// Number of occurrences of byte 'c' in buf[0..len), using the same
+// vector width as the searches.
+size_t memsearch_count_byte(const char *buf, size_t len, unsigned char c);
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "output.h"
+
+// Smallest block allocated.  Blocks grow with the buffer up to
+// OUTPUT_BLOCK_SIZE, so the many small per-job buffers of ordered mode
+// stay small.
+#define OUTPUT_MIN_BLOCK 4096
+
+// iovecs passed to one writev() call.
+#define OUTPUT_IOV 64
+
+// Make sure the tail block has room for 'len' more bytes.
+static int reserve(struct output_buf *b, size_t len)
+{
+  if (b->tail != NULL && b->tail->cap - b->tail->len >= len)
+  {
+    return 0;
+  }
+
+  size_t cap = b->len < OUTPUT_MIN_BLOCK ? OUTPUT_MIN_BLOCK : b->len;
+  if (cap > OUTPUT_BLOCK_SIZE)
+  {
+    cap = OUTPUT_BLOCK_SIZE;
+  }
+  if (cap < len)
+  {
+    cap = len;
+  }
+
+  struct output_block *block = malloc(sizeof(struct output_block) + cap);
+  if (block == NULL)
+  {
+    return -1;
+  }
+  block->next = NULL;
+  block->len = 0;
+  block->cap = cap;
+
+  if (b->tail == NULL)
+  {
+    b->head = block;
+  }
+  else
+  {
+    b->tail->next = block;
+  }
+  b->tail = block;
+  return 0;
+}
+
+int output_buf_write(struct output_buf *b, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    size_t room = b->tail == NULL ? 0 : b->tail->cap - b->tail->len;
+    if (room == 0)
+    {
+      if (reserve(b, 1) != 0)
+      {
+        return -1;
+      }
+      room = b->tail->cap - b->tail->len;
+    }
+
+    size_t n = len < room ? len : room;
+    memcpy(b->tail->data + b->tail->len, data, n);
+    b->tail->len += n;
+    b->len += n;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int output_buf_printf(struct output_buf *b, const char *fmt, ...)
+{
+  va_list ap;
+
+  // Try to format straight into the tail block; only if that does not
+  // fit, make room for the exact length and format again.
+  size_t room = b->tail == NULL ? 0 : b->tail->cap - b->tail->len;
+  va_start(ap, fmt);
+  int n = vsnprintf(room == 0 ? NULL : b->tail->data + b->tail->len, room, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+  {
+    return -1;
+  }
+
+  if ((size_t)n >= room)
+  {
+    if (reserve(b, (size_t)n + 1) != 0)
+    {
+      return -1;
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->tail->data + b->tail->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+  }
+
+  b->tail->len += (size_t)n;
+  b->len += (size_t)n;
+  return 0;
+}
+
+void output_buf_free(struct output_buf *b)
+{
+  struct output_block *block = b->head;
+  while (block != NULL)
+  {
+    struct output_block *next = block->next;
+    free(block);
+    block = next;
+  }
+  b->head = b->tail = NULL;
+  b->len = 0;
+}
+
+// Empty a buffer after it has been written, keeping its first block
+// for reuse.
+static void reset(struct output_buf *b)
+{
+  if (b->head == NULL)
+  {
+    return;
+  }
+
+  struct output_block *rest = b->head->next;
+  b->head->next = NULL;
+  b->head->len = 0;
+  b->tail = b->head;
+  b->len = 0;
+
+  struct output_buf tmp = {rest, NULL, 0};
+  output_buf_free(&tmp);
+}
+
+// Write every block of 'b', OUTPUT_IOV at a time.  Caller holds
+// write_mutex.
+static void write_blocks(struct output *out, const struct output_buf *b)
+{
+  const struct output_block *block = b->head;
+
+  while (block != NULL && !out->error)
+  {
+    struct iovec iov[OUTPUT_IOV];
+    int n = 0;
+    for (; block != NULL && n < OUTPUT_IOV; block = block->next)
+    {
+      if (block->len > 0)
+      {
+        iov[n].iov_base = (void *)block->data;
+        iov[n].iov_len = block->len;
+        n++;
+      }
+    }
+
+    // Finish partial writes.
+    struct iovec *v = iov;
+    while (n > 0)
+    {
+      ssize_t w = writev(out->fd, v, n);
+      if (w < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        out->error = 1;
+        break;
+      }
+      while (n > 0 && (size_t)w >= v->iov_len)
+      {
+        w -= (ssize_t)v->iov_len;
+        v++;
+        n--;
+      }
+      if (n > 0)
+      {
+        v->iov_base = (char *)v->iov_base + w;
+        v->iov_len -= (size_t)w;
+      }
+    }
+  }
+}
+
+void output_flush(struct output *out, struct output_buf *b)
+{
+  if (b->len == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&out->write_mutex);
+  write_blocks(out, b);
+  pthread_mutex_unlock(&out->write_mutex);
+  reset(b);
+}
+
+void output_maybe_flush(struct output *out, struct output_buf *b)
+{
+  if (b->len >= OUTPUT_FLUSH_SIZE)
+  {
+    output_flush(out, b);
+  }
+}
+
+int output_init(struct output *out, int fd, int num_workers, unsigned long window)
+{
+  if (num_workers < 0)
+  {
+    return -1;
+  }
+
+  memset(out, 0, sizeof(struct output));
+  out->fd = fd;
+  out->num_workers = num_workers;
+  out->worker_bufs = calloc((size_t)num_workers + 1, sizeof(struct output_buf));
+  if (out->worker_bufs == NULL)
+  {
+    return -1;
+  }
+
+  if (window > 0)
+  {
+    out->ordered = 1;
+    out->window = window;
+    out->pending = calloc(window, sizeof(struct output_buf));
+    out->ready = calloc(window, 1);
+    if (out->pending == NULL || out->ready == NULL)
+    {
+      free(out->pending);
+      free(out->ready);
+      free(out->worker_bufs);
+      return -1;
+    }
+    pthread_mutex_init(&out->order_mutex, NULL);
+    pthread_cond_init(&out->order_cond, NULL);
+  }
+
+  pthread_mutex_init(&out->write_mutex, NULL);
+  return 0;
+}
+
+int output_destroy(struct output *out)
+{
+  for (int i = 0; i <= out->num_workers; i++)
+  {
+    output_flush(out, &out->worker_bufs[i]);
+    output_buf_free(&out->worker_bufs[i]);
+  }
+  free(out->worker_bufs);
+
+  if (out->ordered)
+  {
+    output_flush(out, &out->staged);
+    output_buf_free(&out->staged);
+
+    // Anything still pending belongs to a job that was never committed;
+    // it cannot be written in order, so it is dropped.
+    for (unsigned long i = 0; i < out->window; i++)
+    {
+      output_buf_free(&out->pending[i]);
+    }
+    free(out->pending);
+    free(out->ready);
+    pthread_mutex_destroy(&out->order_mutex);
+    pthread_cond_destroy(&out->order_cond);
+  }
+
+  pthread_mutex_destroy(&out->write_mutex);
+  return out->error ? -1 : 0;
+}
+
+struct output_buf *output_worker_buf(struct output *out, int worker)
+{
+  return &out->worker_bufs[worker < 0 ? out->num_workers : worker];
+}
+
+unsigned long output_reserve(struct output *out)
+{
+  pthread_mutex_lock(&out->order_mutex);
+  while (out->reserved - out->next_seq >= out->window)
+  {
+    pthread_cond_wait(&out->order_cond, &out->order_mutex);
+  }
+  unsigned long seq = out->reserved++;
+  pthread_mutex_unlock(&out->order_mutex);
+  return seq;
+}
+
+void output_commit(struct output *out, unsigned long seq, struct output_buf *b)
+{
+  pthread_mutex_lock(&out->order_mutex);
+
+  unsigned long slot = seq % out->window;
+  out->pending[slot] = *b;
+  out->ready[slot] = 1;
+  b->head = b->tail = NULL;
+  b->len = 0;
+
+  if (seq == out->next_seq)
+  {
+    // Move this and every consecutive committed job onto the staging
+    // buffer, and write that once it is large enough.
+    struct output_buf *staged = &out->staged;
+    for (slot = out->next_seq % out->window; out->ready[slot];
+         slot = out->next_seq % out->window)
+    {
+      struct output_buf *p = &out->pending[slot];
+      if (p->len > 0)
+      {
+        if (staged->tail == NULL)
+        {
+          staged->head = p->head;
+        }
+        else
+        {
+          staged->tail->next = p->head;
+        }
+        staged->tail = p->tail;
+        staged->len += p->len;
+      }
+      else
+      {
+        output_buf_free(p);
+      }
+      p->head = p->tail = NULL;
+      p->len = 0;
+      out->ready[slot] = 0;
+      out->next_seq++;
+    }
+
+    output_maybe_flush(out, staged);
+    pthread_cond_broadcast(&out->order_cond);
+  }
+
+  pthread_mutex_unlock(&out->order_mutex);
+}
@@ -0,0 +1,110 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// A buffer is written out once it holds this many bytes.
+#define OUTPUT_FLUSH_SIZE (256 * 1024)
+
+// Size of the blocks a buffer is made of.
+#define OUTPUT_BLOCK_SIZE (64 * 1024)
+
+struct output_block
+{
+  struct output_block *next;
+  size_t len, cap;
+  char data[];
+};
+
+/*
+ * output_buf
+ *
+ * Text waiting to be written: a chain of blocks, so appending never
+ * moves what is already there and the whole buffer goes out in a single
+ * writev().  Start from `struct output_buf b = {0};`.
+ */
+struct output_buf
+{
+  struct output_block *head, *tail;
+  size_t len;
+};
+
+/*
+ * output
+ *
+ * The output stage shared by the workers of a pool.  Each worker
+ * appends to its own buffer, which is written out with writev() once
+ * it is large enough, so workers do not contend on a stream lock per
+ * line and only a few system calls are made per megabyte.  Writes are
+ * serialised, and always consist of whole buffers, so lines are never
+ * torn.
+ *
+ * In ordered mode, each job's output is collected in a buffer of its
+ * own and committed under a sequence number handed out by
+ * output_reserve().  A reorder buffer writes committed output strictly
+ * in sequence order; the producer is held back while 'window' jobs are
+ * outstanding, which bounds the amount of output held in memory.
+ */
+struct output
+{
+  int fd;
+  int error;                      /* a write failed */
+  pthread_mutex_t write_mutex;
+
+  int num_workers;
+  struct output_buf *worker_bufs; /* num_workers + 1 (last: other threads) */
+
+  // Ordered mode only.
+  int ordered;
+  pthread_mutex_t order_mutex;
+  pthread_cond_t order_cond;
+  unsigned long window;
+  unsigned long next_seq;         /* next sequence number to write */
+  unsigned long reserved;         /* sequence numbers handed out */
+  struct output_buf *pending;     /* window slots, indexed by seq % window */
+  char *ready;
+  struct output_buf staged;       /* written in order, not yet flushed */
+};
+
+// Append data to a buffer.  Returns non-zero on allocation failure.
+int output_buf_write(struct output_buf *b, const char *data, size_t len);
+
+// Append formatted text to a buffer.  Returns non-zero on failure.
+int output_buf_printf(struct output_buf *b, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+// Discard the contents of a buffer.
+void output_buf_free(struct output_buf *b);
+
+// Initialise an output stage writing to 'fd' for a pool of
+// 'num_workers' workers.  If 'window' is non-zero, output is ordered
+// (see above).  Returns non-zero on error.
+int output_init(struct output *out, int fd, int num_workers, unsigned long window);
+
+// Write out every worker buffer and free the output stage.  Must only
+// be called once all jobs have finished.  Returns non-zero if any
+// write failed.
+int output_destroy(struct output *out);
+
+// The buffer of the given worker, as returned by
+// thread_pool_worker_id(); -1 gives a buffer for a thread outside the
+// pool (at most one such thread may use it).
+struct output_buf *output_worker_buf(struct output *out, int worker);
+
+// Write out a worker buffer if it has reached OUTPUT_FLUSH_SIZE.
+void output_maybe_flush(struct output *out, struct output_buf *b);
+
+// Write out a buffer now and empty it.
+void output_flush(struct output *out, struct output_buf *b);
+
+// Ordered mode: take the next sequence number, blocking while 'window'
+// jobs are still waiting to be written.
+unsigned long output_reserve(struct output *out);
+
+// Ordered mode: hand over the output of job 'seq' (which may be empty);
+// 'b' is left empty.  Every reserved number must be committed exactly
+// once, or the output stops at it.
+void output_commit(struct output *out, unsigned long seq, struct output_buf *b);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "path_filter.h"
+
+static void add_glob(const char ***globs, size_t *n, const char *glob)
+{
+  const char **bigger = realloc(*globs, (*n + 1) * sizeof(char *));
+  if (bigger == NULL)
+  {
+    err(1, "failed to store %s", glob);
+  }
+  bigger[(*n)++] = glob;
+  *globs = bigger;
+}
+
+// A number of bytes, optionally followed by k, M or G.
+static off_t parse_size(const char *arg)
+{
+  char *end;
+  unsigned long long v = strtoull(arg, &end, 10);
+  int shift = 0;
+  switch (*end)
+  {
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  case 'M':
+    shift = 20;
+    break;
+  case 'G':
+    shift = 30;
+    break;
+  }
+  if (*arg == '-' || end == arg || end[shift != 0] != '\0'
+      || v > (unsigned long long)INT64_MAX >> shift)
+  {
+    errx(1, "invalid size: %s", arg);
+  }
+  return (off_t)(v << shift);
+}
+
+static time_t parse_seconds(const char *arg)
+{
+  char *end;
+  unsigned long long v = strtoull(arg, &end, 10);
+  if (*arg == '-' || end == arg || *end != '\0' || v > (unsigned long long)INT32_MAX)
+  {
+    errx(1, "invalid number of seconds: %s", arg);
+  }
+  return (time_t)v;
+}
+
+int path_filter_option(struct path_filter *f, int opt, const char *arg)
+{
+  switch (opt)
+  {
+  case PATH_FILTER_INCLUDE:
+    add_glob(&f->include, &f->ninclude, arg);
+    return 0;
+  case PATH_FILTER_EXCLUDE:
+    add_glob(&f->exclude, &f->nexclude, arg);
+    return 0;
+  case PATH_FILTER_EXCLUDE_DIR:
+    add_glob(&f->exclude_dir, &f->nexclude_dir, arg);
+    return 0;
+  case PATH_FILTER_MIN_SIZE:
+    f->min_size = parse_size(arg);
+    return 0;
+  case PATH_FILTER_MAX_SIZE:
+    f->max_size = parse_size(arg);
+    f->has_max_size = 1;
+    return 0;
+  case PATH_FILTER_MAX_AGE:
+    f->min_mtime = time(NULL) - parse_seconds(arg);
+    return 0;
+  case PATH_FILTER_MIN_AGE:
+    f->max_mtime = time(NULL) - parse_seconds(arg);
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+static const char *base_name(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  return slash == NULL ? path : slash + 1;
+}
+
+static int any_match(const char *const *globs, size_t n, const char *name)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    if (fnmatch(globs[i], name, 0) == 0)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int path_filter_file(const struct path_filter *f, const char *path,
+                     const struct stat *st)
+{
+  // The cheap tests on the stat() come first.
+  if (st->st_size < f->min_size || (f->has_max_size && st->st_size > f->max_size))
+  {
+    return 0;
+  }
+  if ((f->min_mtime != 0 && st->st_mtime < f->min_mtime)
+      || (f->max_mtime != 0 && st->st_mtime > f->max_mtime))
+  {
+    return 0;
+  }
+  if (f->ninclude == 0 && f->nexclude == 0)
+  {
+    return 1;
+  }
+
+  const char *name = base_name(path);
+  return (f->ninclude == 0 || any_match(f->include, f->ninclude, name))
+         && !any_match(f->exclude, f->nexclude, name);
+}
+
+int path_filter_dir(const struct path_filter *f, const char *path)
+{
+  return f->nexclude_dir == 0 || !any_match(f->exclude_dir, f->nexclude_dir, base_name(path));
+}
+
+void path_filter_free(struct path_filter *f)
+{
+  free(f->include);
+  free(f->exclude);
+  free(f->exclude_dir);
+  memset(f, 0, sizeof(struct path_filter));
+}
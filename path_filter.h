@@ -0,0 +1,69 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Option codes of the filter's long options, above any character so
+// they cannot clash with a tool's short options.
+#define PATH_FILTER_INCLUDE     0x100
+#define PATH_FILTER_EXCLUDE     0x101
+#define PATH_FILTER_EXCLUDE_DIR 0x102
+#define PATH_FILTER_MIN_SIZE    0x103
+#define PATH_FILTER_MAX_SIZE    0x104
+#define PATH_FILTER_MAX_AGE     0x105
+#define PATH_FILTER_MIN_AGE     0x106
+
+// Entries for a tool's getopt_long() table.
+#define PATH_FILTER_LONG_OPTIONS                                      \
+  {"include", required_argument, NULL, PATH_FILTER_INCLUDE},          \
+  {"exclude", required_argument, NULL, PATH_FILTER_EXCLUDE},          \
+  {"exclude-dir", required_argument, NULL, PATH_FILTER_EXCLUDE_DIR},  \
+  {"min-size", required_argument, NULL, PATH_FILTER_MIN_SIZE},        \
+  {"max-size", required_argument, NULL, PATH_FILTER_MAX_SIZE},        \
+  {"max-age", required_argument, NULL, PATH_FILTER_MAX_AGE},          \
+  {"min-age", required_argument, NULL, PATH_FILTER_MIN_AGE}
+
+#define PATH_FILTER_USAGE "[--include GLOB] [--exclude GLOB] [--exclude-dir GLOB] " \
+  "[--min-size BYTES] [--max-size BYTES] [--max-age SECONDS] [--min-age SECONDS]"
+
+/*
+ * path_filter
+ *
+ * Which files a traversal hands on, decided from the directory entry
+ * and its stat() alone, so that nothing filtered out is ever opened.
+ * A file is kept if its name matches one of the --include globs (if
+ * there are any) and none of the --exclude globs, as with fnmatch(),
+ * and if its size and modification time are within bounds.  A
+ * directory whose name matches an --exclude-dir glob is not entered at
+ * all.  Start from `struct path_filter f = {0};`, which keeps
+ * everything, and fill it in with path_filter_option().
+ */
+struct path_filter
+{
+  const char **include, **exclude, **exclude_dir;
+  size_t ninclude, nexclude, nexclude_dir;
+  off_t min_size, max_size;      /* max_size only if has_max_size */
+  time_t min_mtime, max_mtime;   /* 0 for no bound */
+  int has_max_size;
+};
+
+// Apply the filter option 'opt' (one of PATH_FILTER_*) with argument
+// 'arg', which is not copied.  Returns non-zero if 'opt' is not a
+// filter option.  Exits if the argument is invalid.
+int path_filter_option(struct path_filter *f, int opt, const char *arg);
+
+// Non-zero if the file at 'path' (whose last component is matched
+// against the globs) with status 'st' is to be searched.
+int path_filter_file(const struct path_filter *f, const char *path,
+                     const struct stat *st);
+
+// Non-zero if the directory at 'path' is to be entered.
+int path_filter_dir(const struct path_filter *f, const char *path);
+
+// Free the lists of globs (not the globs themselves).
+void path_filter_free(struct path_filter *f);
+
+#endif
@@ -0,0 +1,1378 @@
+// Setting _GNU_SOURCE is necessary for memrchr() on GNU/Linux
+// systems.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "regex_dfa.h"
+
+// As in ac, transitions hold the offset of the target state's row, with
+// this bit set if the target state reports a pattern.  Row 0 is never
+// used, so a 0 transition means "not computed yet".
+#define REGEX_MATCH ((uint32_t)1 << 31)
+
+// Bounds on what a pattern may ask for.
+#define REGEX_DUP_MAX 1000
+#define REGEX_DEPTH_MAX 1000
+#define REGEX_NFA_MAX (1 << 20)
+
+// ---- Parsing -----------------------------------------------------------
+
+enum node_kind
+{
+  NODE_SET,     /* one byte out of 'set' */
+  NODE_BOL,     /* ^ */
+  NODE_EOL,     /* $ */
+  NODE_EMPTY,
+  NODE_CAT,     /* the children in sequence */
+  NODE_ALT,     /* any one child */
+  NODE_REPEAT,  /* the child min..max times (max -1 for no limit) */
+};
+
+// Children are kept in a list (first .. last, linked both ways), so
+// long sequences and alternations need no deep recursion.
+struct node
+{
+  enum node_kind kind;
+  int first, last, prev, next;
+  int min, max;
+  uint64_t set[4];
+};
+
+struct parser
+{
+  const unsigned char *p;
+  int icase;
+  int depth;
+  struct node *nodes;
+  size_t n, cap;
+  const char *error;
+};
+
+static int set_has(const uint64_t *set, unsigned c)
+{
+  return (set[c / 64] >> (c % 64)) & 1;
+}
+
+static void set_add(uint64_t *set, unsigned c)
+{
+  set[c / 64] |= (uint64_t)1 << (c % 64);
+}
+
+static void set_add_range(uint64_t *set, unsigned lo, unsigned hi)
+{
+  for (unsigned c = lo; c <= hi; c++)
+  {
+    set_add(set, c);
+  }
+}
+
+static int is_upper(unsigned c)
+{
+  return c >= 'A' && c <= 'Z';
+}
+
+// Make letters in the set match either case (if asked to), and keep
+// newlines out of it: they end lines rather than match.
+static void set_finish(struct parser *ps, uint64_t *set)
+{
+  if (ps->icase)
+  {
+    for (unsigned c = 'A'; c <= 'Z'; c++)
+    {
+      if (set_has(set, c) || set_has(set, c + 32))
+      {
+        set_add(set, c);
+        set_add(set, c + 32);
+      }
+    }
+  }
+  set[0] &= ~((uint64_t)1 << '\n');
+}
+
+static int node_new(struct parser *ps, enum node_kind kind)
+{
+  if (ps->n == ps->cap)
+  {
+    size_t cap = ps->cap == 0 ? 64 : ps->cap * 2;
+    struct node *bigger = realloc(ps->nodes, cap * sizeof(struct node));
+    if (bigger == NULL)
+    {
+      ps->error = NULL;
+      return -1;
+    }
+    ps->nodes = bigger;
+    ps->cap = cap;
+  }
+  struct node *n = &ps->nodes[ps->n];
+  memset(n, 0, sizeof(struct node));
+  n->kind = kind;
+  n->first = n->last = n->prev = n->next = -1;
+  return (int)ps->n++;
+}
+
+static int fail(struct parser *ps, const char *error)
+{
+  ps->error = error;
+  return -1;
+}
+
+// Append 'child' to the children of 'parent'.
+static void node_append(struct parser *ps, int parent, int child)
+{
+  struct node *p = &ps->nodes[parent];
+  if (p->last < 0)
+  {
+    p->first = child;
+  }
+  else
+  {
+    ps->nodes[p->last].next = child;
+    ps->nodes[child].prev = p->last;
+  }
+  p->last = child;
+}
+
+static int node_byte(struct parser *ps, unsigned char c)
+{
+  int n = node_new(ps, NODE_SET);
+  if (n >= 0)
+  {
+    set_add(ps->nodes[n].set, c);
+    set_finish(ps, ps->nodes[n].set);
+  }
+  return n;
+}
+
+// Add the bytes of the escape \c (one of w W s S d D) to 'set'.
+// Returns non-zero if c is not one of those.
+static int escape_class(unsigned char c, uint64_t *set)
+{
+  uint64_t tmp[4] = {0};
+  switch (c | 32)
+  {
+  case 'w':
+    set_add_range(tmp, 'a', 'z');
+    set_add_range(tmp, 'A', 'Z');
+    set_add_range(tmp, '0', '9');
+    set_add(tmp, '_');
+    break;
+  case 's':
+    set_add_range(tmp, '\t', '\r');
+    set_add(tmp, ' ');
+    break;
+  case 'd':
+    set_add_range(tmp, '0', '9');
+    break;
+  default:
+    return -1;
+  }
+  for (int i = 0; i < 4; i++)
+  {
+    set[i] |= is_upper(c) ? ~tmp[i] : tmp[i];
+  }
+  return 0;
+}
+
+// Add the bytes of the bracket class [:name:] to 'set'.  Returns
+// non-zero if there is no such class.
+static int named_class(const char *name, size_t len, uint64_t *set)
+{
+  static const struct
+  {
+    const char *name;
+    const char *ranges;  /* pairs of first and last byte */
+  } classes[] = {
+    {"alpha", "azAZ"},
+    {"digit", "09"},
+    {"alnum", "azAZ09"},
+    {"upper", "AZ"},
+    {"lower", "az"},
+    {"space", "\t\r  "},
+    {"blank", "\t\t  "},
+    {"punct", "!/:@[`{~"},
+    {"print", " ~"},
+    {"graph", "!~"},
+    {"cntrl", "\001\037\177\177"},
+    {"xdigit", "09afAF"},
+  };
+
+  for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+  {
+    if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0)
+    {
+      for (const char *r = classes[i].ranges; *r != '\0'; r += 2)
+      {
+        set_add_range(set, (unsigned char)r[0], (unsigned char)r[1]);
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// A bracket expression, after the '['.
+static int parse_bracket(struct parser *ps)
+{
+  int n = node_new(ps, NODE_SET);
+  if (n < 0)
+  {
+    return -1;
+  }
+  uint64_t set[4] = {0};
+
+  int negate = *ps->p == '^';
+  ps->p += negate;
+
+  for (int first = 1;; first = 0)
+  {
+    unsigned char c = *ps->p;
+    if (c == '\0')
+    {
+      return fail(ps, "unmatched [");
+    }
+    if (c == ']' && !first)
+    {
+      ps->p++;
+      break;
+    }
+
+    if (c == '[' && ps->p[1] == ':')
+    {
+      const char *name = (const char *)ps->p + 2;
+      const char *close = strstr(name, ":]");
+      if (close == NULL || named_class(name, (size_t)(close - name), set) != 0)
+      {
+        return fail(ps, "invalid character class");
+      }
+      ps->p = (const unsigned char *)close + 2;
+      continue;
+    }
+
+    ps->p++;
+    if (*ps->p == '-' && ps->p[1] != ']' && ps->p[1] != '\0')
+    {
+      unsigned char hi = ps->p[1];
+      if (hi < c)
+      {
+        return fail(ps, "invalid range");
+      }
+      set_add_range(set, c, hi);
+      ps->p += 2;
+    }
+    else
+    {
+      set_add(set, c);
+    }
+  }
+
+  if (ps->icase)
+  {
+    set_finish(ps, set);
+  }
+  for (int i = 0; i < 4; i++)
+  {
+    ps->nodes[n].set[i] = negate ? ~set[i] : set[i];
+  }
+  set_finish(ps, ps->nodes[n].set);
+  return n;
+}
+
+static int parse_alt(struct parser *ps);
+
+static int parse_atom(struct parser *ps)
+{
+  unsigned char c = *ps->p++;
+  int n;
+
+  switch (c)
+  {
+  case '(':
+    if (++ps->depth > REGEX_DEPTH_MAX)
+    {
+      return fail(ps, "parentheses nested too deeply");
+    }
+    n = parse_alt(ps);
+    if (n < 0)
+    {
+      return -1;
+    }
+    if (*ps->p != ')')
+    {
+      return fail(ps, "unmatched (");
+    }
+    ps->p++;
+    ps->depth--;
+    return n;
+  case '[':
+    return parse_bracket(ps);
+  case '.':
+    n = node_new(ps, NODE_SET);
+    if (n >= 0)
+    {
+      memset(ps->nodes[n].set, 0xff, sizeof(ps->nodes[n].set));
+      set_finish(ps, ps->nodes[n].set);
+    }
+    return n;
+  case '^':
+    return node_new(ps, NODE_BOL);
+  case '$':
+    return node_new(ps, NODE_EOL);
+  case '\\':
+    c = *ps->p++;
+    if (c == '\0')
+    {
+      return fail(ps, "trailing backslash");
+    }
+    if (c >= '1' && c <= '9')
+    {
+      return fail(ps, "back-references are not supported");
+    }
+    if (strchr("bB<>`'", c) != NULL)
+    {
+      return fail(ps, "unsupported escape");
+    }
+    n = node_new(ps, NODE_SET);
+    if (n >= 0)
+    {
+      if (escape_class(c, ps->nodes[n].set) != 0)
+      {
+        set_add(ps->nodes[n].set, c);
+      }
+      set_finish(ps, ps->nodes[n].set);
+    }
+    return n;
+  default:
+    // Including a '*', '+', '?' or '{' with nothing to repeat, and a
+    // ')' outside parentheses, which like GNU grep we take literally.
+    return node_byte(ps, c);
+  }
+}
+
+// Parse the interval {m}, {m,}, {,n} or {m,n} at ps->p.  Returns 1 if
+// there is one, 0 if the '{' is to be taken literally, and -1 on error.
+static int parse_interval(struct parser *ps, int *min, int *max)
+{
+  const unsigned char *p = ps->p + 1;
+  long lo = 0, hi;
+  int digits = 0;
+
+  for (; *p >= '0' && *p <= '9'; p++, digits++)
+  {
+    lo = lo * 10 + (*p - '0');
+    if (lo > REGEX_DUP_MAX)
+    {
+      return fail(ps, "repetition count too large");
+    }
+  }
+  if (*p == ',')
+  {
+    p++;
+    if (*p >= '0' && *p <= '9')
+    {
+      for (hi = 0; *p >= '0' && *p <= '9'; p++, digits++)
+      {
+        hi = hi * 10 + (*p - '0');
+        if (hi > REGEX_DUP_MAX)
+        {
+          return fail(ps, "repetition count too large");
+        }
+      }
+    }
+    else
+    {
+      hi = -1;
+    }
+  }
+  else
+  {
+    hi = lo;
+  }
+
+  if (*p != '}' || digits == 0)
+  {
+    return 0;
+  }
+  if (hi >= 0 && hi < lo)
+  {
+    return fail(ps, "invalid repetition count");
+  }
+  ps->p = p + 1;
+  *min = (int)lo;
+  *max = (int)hi;
+  return 1;
+}
+
+static int parse_repeat(struct parser *ps)
+{
+  int n = parse_atom(ps);
+
+  while (n >= 0)
+  {
+    int min, max;
+    switch (*ps->p)
+    {
+    case '*':
+      min = 0;
+      max = -1;
+      ps->p++;
+      break;
+    case '+':
+      min = 1;
+      max = -1;
+      ps->p++;
+      break;
+    case '?':
+      min = 0;
+      max = 1;
+      ps->p++;
+      break;
+    case '{':
+    {
+      int r = parse_interval(ps, &min, &max);
+      if (r < 0)
+      {
+        return -1;
+      }
+      if (r == 0)
+      {
+        return n;
+      }
+    }
+    break;
+    default:
+      return n;
+    }
+
+    int rep = node_new(ps, NODE_REPEAT);
+    if (rep < 0)
+    {
+      return -1;
+    }
+    ps->nodes[rep].first = ps->nodes[rep].last = n;
+    ps->nodes[rep].min = min;
+    ps->nodes[rep].max = max;
+    n = rep;
+  }
+  return n;
+}
+
+static int parse_cat(struct parser *ps)
+{
+  int cat = node_new(ps, NODE_CAT);
+  if (cat < 0)
+  {
+    return -1;
+  }
+  while (*ps->p != '\0' && *ps->p != '|' && !(*ps->p == ')' && ps->depth > 0))
+  {
+    int n = parse_repeat(ps);
+    if (n < 0)
+    {
+      return -1;
+    }
+    node_append(ps, cat, n);
+  }
+  return cat;
+}
+
+static int parse_alt(struct parser *ps)
+{
+  int alt = node_new(ps, NODE_ALT);
+  if (alt < 0)
+  {
+    return -1;
+  }
+  for (;;)
+  {
+    int n = parse_cat(ps);
+    if (n < 0)
+    {
+      return -1;
+    }
+    node_append(ps, alt, n);
+    if (*ps->p != '|')
+    {
+      return alt;
+    }
+    ps->p++;
+  }
+}
+
+// A pattern without metacharacters.
+static int parse_literal(struct parser *ps)
+{
+  int cat = node_new(ps, NODE_CAT);
+  for (; cat >= 0 && *ps->p != '\0'; ps->p++)
+  {
+    int n = node_byte(ps, *ps->p);
+    if (n < 0)
+    {
+      return -1;
+    }
+    node_append(ps, cat, n);
+  }
+  return cat;
+}
+
+// ---- Required literals -------------------------------------------------
+
+// What is known about the strings a node matches: a prefix and a suffix
+// they all share, a substring they all contain, and whether they are all
+// the same string (which is then in all three).
+struct lit
+{
+  int exact;
+  size_t plen, slen, blen;
+  unsigned char pre[REGEX_DFA_LITERAL_MAX];
+  unsigned char suf[REGEX_DFA_LITERAL_MAX];
+  unsigned char best[REGEX_DFA_LITERAL_MAX];
+};
+
+static void lit_exact(struct lit *l, const unsigned char *s, size_t len)
+{
+  l->exact = 1;
+  l->plen = l->slen = l->blen = len;
+  memcpy(l->pre, s, len);
+  memcpy(l->suf, s, len);
+  memcpy(l->best, s, len);
+}
+
+static void lit_none(struct lit *l)
+{
+  l->exact = 0;
+  l->plen = l->slen = l->blen = 0;
+}
+
+static void lit_consider(struct lit *l, const unsigned char *s, size_t len)
+{
+  if (len > l->blen)
+  {
+    memcpy(l->best, s, len);
+    l->blen = len;
+  }
+}
+
+// Join a[0..alen) and b[0..blen) into out, keeping the start (or with
+// 'tail' the end) if it is too long.  Returns the length.
+static size_t lit_join(unsigned char *out, const unsigned char *a, size_t alen,
+                       const unsigned char *b, size_t blen, int tail)
+{
+  unsigned char tmp[2 * REGEX_DFA_LITERAL_MAX];
+  memcpy(tmp, a, alen);
+  memcpy(tmp + alen, b, blen);
+  size_t len = alen + blen, skip = 0;
+  if (len > REGEX_DFA_LITERAL_MAX)
+  {
+    skip = tail ? len - REGEX_DFA_LITERAL_MAX : 0;
+    len = REGEX_DFA_LITERAL_MAX;
+  }
+  memcpy(out, tmp + skip, len);
+  return len;
+}
+
+// 'acc' followed by 'r'.
+static void lit_cat(struct lit *acc, const struct lit *r)
+{
+  unsigned char join[REGEX_DFA_LITERAL_MAX];
+  size_t jlen = lit_join(join, acc->suf, acc->slen, r->pre, r->plen, 0);
+
+  int exact = acc->exact && r->exact && acc->plen + r->plen <= REGEX_DFA_LITERAL_MAX;
+  if (acc->exact)
+  {
+    acc->plen = lit_join(acc->pre, acc->pre, acc->plen, r->pre, r->plen, 0);
+  }
+  if (r->exact)
+  {
+    acc->slen = lit_join(acc->suf, acc->suf, acc->slen, r->suf, r->slen, 1);
+  }
+  else
+  {
+    memcpy(acc->suf, r->suf, r->slen);
+    acc->slen = r->slen;
+  }
+  acc->exact = exact;
+
+  lit_consider(acc, r->best, r->blen);
+  lit_consider(acc, join, jlen);
+  lit_consider(acc, acc->pre, acc->plen);
+  lit_consider(acc, acc->suf, acc->slen);
+}
+
+static void node_lit(const struct parser *ps, int n, struct lit *l)
+{
+  const struct node *node = &ps->nodes[n];
+  unsigned char c = 0;
+  int count = 0;
+
+  switch (node->kind)
+  {
+  case NODE_SET:
+    for (unsigned b = 0; b < 256 && count < 2; b++)
+    {
+      if (set_has(node->set, b))
+      {
+        c = (unsigned char)b;
+        count++;
+      }
+    }
+    if (count == 1)
+    {
+      lit_exact(l, &c, 1);
+    }
+    else
+    {
+      lit_none(l);
+    }
+    break;
+  case NODE_BOL:
+  case NODE_EOL:
+  case NODE_EMPTY:
+    lit_exact(l, (const unsigned char *)"", 0);
+    break;
+  case NODE_CAT:
+  {
+    lit_exact(l, (const unsigned char *)"", 0);
+    struct lit child;
+    for (int i = node->first; i >= 0; i = ps->nodes[i].next)
+    {
+      node_lit(ps, i, &child);
+      lit_cat(l, &child);
+    }
+  }
+  break;
+  case NODE_ALT:
+    if (node->first == node->last)
+    {
+      node_lit(ps, node->first, l);
+    }
+    else
+    {
+      lit_none(l);
+    }
+    break;
+  case NODE_REPEAT:
+    node_lit(ps, node->first, l);
+    if (node->min == 0)
+    {
+      lit_none(l);
+    }
+    else if (node->min != 1 || node->max != 1)
+    {
+      l->exact = 0;
+    }
+    break;
+  }
+}
+
+// ---- NFA ---------------------------------------------------------------
+
+enum nfa_kind
+{
+  NFA_BYTES,  /* consumes a byte in sets[arg] */
+  NFA_BOL,    /* continues at out at the start of a line */
+  NFA_EOL,    /* continues at out at the end of a line */
+  NFA_SPLIT,  /* continues at both out and out1 */
+  NFA_MATCH,  /* pattern arg has matched */
+  NFA_LINE_START,  /* marks the sets before the first byte of a line */
+};
+
+// Anchors that hold at a position, as passed to set_close().
+#define ANCHOR_BOL 1
+#define ANCHOR_EOL 2
+
+struct nfa_state
+{
+  enum nfa_kind kind;
+  int out, out1;
+  int arg;
+};
+
+// A set of NFA states that can be cleared in constant time.
+struct state_set
+{
+  int *dense, *sparse;
+  size_t n;
+};
+
+struct regex_nfa
+{
+  struct nfa_state *states;
+  size_t n, cap;
+  uint64_t (*sets)[4];
+  size_t nsets, setcap;
+  int root;                /* where every pattern starts */
+  int line_start;          /* the NFA_LINE_START state */
+  unsigned char rep[256];  /* a byte of each column */
+  size_t nbytes;           /* columns, one per class of bytes */
+
+  // Scratch space for computing transitions, used under the mutex.
+  struct state_set cur;
+  int *stack;
+  int *sorted;
+};
+
+static int nfa_new(struct regex_nfa *nfa, enum nfa_kind kind, int out, int out1,
+                   int arg)
+{
+  if (nfa->n == nfa->cap)
+  {
+    if (nfa->cap >= REGEX_NFA_MAX)
+    {
+      return -2;
+    }
+    size_t cap = nfa->cap == 0 ? 256 : nfa->cap * 2;
+    struct nfa_state *bigger = realloc(nfa->states, cap * sizeof(struct nfa_state));
+    if (bigger == NULL)
+    {
+      return -1;
+    }
+    nfa->states = bigger;
+    nfa->cap = cap;
+  }
+  nfa->states[nfa->n] = (struct nfa_state){kind, out, out1, arg};
+  return (int)nfa->n++;
+}
+
+static int nfa_set(struct regex_nfa *nfa, const uint64_t *set, int out)
+{
+  if (nfa->nsets == nfa->setcap)
+  {
+    size_t cap = nfa->setcap == 0 ? 64 : nfa->setcap * 2;
+    uint64_t (*bigger)[4] = realloc(nfa->sets, cap * sizeof(nfa->sets[0]));
+    if (bigger == NULL)
+    {
+      return -1;
+    }
+    nfa->sets = bigger;
+    nfa->setcap = cap;
+  }
+  memcpy(nfa->sets[nfa->nsets], set, sizeof(nfa->sets[0]));
+  return nfa_new(nfa, NFA_BYTES, out, -1, (int)nfa->nsets++);
+}
+
+// Build the states for node n, continuing at 'next' once it has matched,
+// working backwards.  Returns the state to start at, -1 if memory ran
+// out, or -2 if the NFA grew too large.
+static int nfa_build(struct regex_nfa *nfa, const struct parser *ps, int n, int next)
+{
+  const struct node *node = &ps->nodes[n];
+  int s;
+
+  switch (node->kind)
+  {
+  case NODE_SET:
+    return nfa_set(nfa, node->set, next);
+  case NODE_BOL:
+    return nfa_new(nfa, NFA_BOL, next, -1, 0);
+  case NODE_EOL:
+    return nfa_new(nfa, NFA_EOL, next, -1, 0);
+  case NODE_EMPTY:
+    return next;
+  case NODE_CAT:
+    // From the last child, each continuing at the one after it.
+    for (int i = node->last; i >= 0; i = ps->nodes[i].prev)
+    {
+      if ((next = nfa_build(nfa, ps, i, next)) < 0)
+      {
+        return next;
+      }
+    }
+    return next;
+  case NODE_ALT:
+    s = -1;
+    for (int i = node->first; i >= 0; i = ps->nodes[i].next)
+    {
+      int branch = nfa_build(nfa, ps, i, next);
+      if (branch < 0)
+      {
+        return branch;
+      }
+      s = s < 0 ? branch : nfa_new(nfa, NFA_SPLIT, branch, s, 0);
+      if (s < 0)
+      {
+        return s;
+      }
+    }
+    return s;
+  case NODE_REPEAT:
+    if (node->max < 0)
+    {
+      // A loop: the split either goes round the child again or leaves.
+      if ((s = nfa_new(nfa, NFA_SPLIT, -1, next, 0)) < 0)
+      {
+        return s;
+      }
+      int body = nfa_build(nfa, ps, node->first, s);
+      if (body < 0)
+      {
+        return body;
+      }
+      nfa->states[s].out = body;
+      next = s;
+    }
+    else
+    {
+      for (int i = node->min; i < node->max; i++)
+      {
+        int body = nfa_build(nfa, ps, node->first, next);
+        if (body < 0 || (next = nfa_new(nfa, NFA_SPLIT, body, next, 0)) < 0)
+        {
+          return body < 0 ? body : next;
+        }
+      }
+    }
+    for (int i = 0; i < node->min; i++)
+    {
+      if ((next = nfa_build(nfa, ps, node->first, next)) < 0)
+      {
+        return next;
+      }
+    }
+    return next;
+  }
+  return -1;
+}
+
+// Split the bytes into columns such that every byte set in the NFA, and
+// the newline, contains either all or none of the bytes of a column.
+static void nfa_columns(struct regex_nfa *nfa, unsigned char *classes)
+{
+  uint64_t newline[4] = {0};
+  set_add(newline, '\n');
+
+  memset(classes, 0, 256);
+  size_t n = 1;
+  for (size_t i = 0; i <= nfa->nsets; i++)
+  {
+    const uint64_t *set = i < nfa->nsets ? nfa->sets[i] : newline;
+    int map[256][2];
+    memset(map, -1, sizeof(map));
+    size_t m = 0;
+    for (unsigned b = 0; b < 256; b++)
+    {
+      int *to = &map[classes[b]][set_has(set, b)];
+      if (*to < 0)
+      {
+        *to = (int)m++;
+      }
+      classes[b] = (unsigned char)*to;
+    }
+    n = m;
+    if (n == 256)
+    {
+      break;
+    }
+  }
+
+  for (unsigned b = 0; b < 256; b++)
+  {
+    nfa->rep[classes[b]] = (unsigned char)b;
+  }
+  nfa->nbytes = n;
+}
+
+static int nfa_consumes(const struct regex_nfa *nfa, const struct nfa_state *st,
+                        size_t column)
+{
+  return st->kind == NFA_BYTES && set_has(nfa->sets[st->arg], nfa->rep[column]);
+}
+
+static int set_contains(const struct state_set *set, int s)
+{
+  return (size_t)set->sparse[s] < set->n && set->dense[set->sparse[s]] == s;
+}
+
+// Add state s and everything reachable from it without consuming input,
+// where the 'anchors' hold.  Anchors are zero-width, so a run of them
+// such as "^^" or "(c$)$" is crossed in one go.
+static void set_close(const struct regex_nfa *nfa, struct state_set *set, int s,
+                      int *stack, int anchors)
+{
+  size_t top = 0;
+  stack[top++] = s;
+  while (top > 0)
+  {
+    s = stack[--top];
+    if (set_contains(set, s))
+    {
+      continue;
+    }
+    set->sparse[s] = (int)set->n;
+    set->dense[set->n++] = s;
+    const struct nfa_state *st = &nfa->states[s];
+    if (st->kind == NFA_SPLIT)
+    {
+      stack[top++] = st->out1;
+      stack[top++] = st->out;
+    }
+    else if ((st->kind == NFA_BOL && (anchors & ANCHOR_BOL))
+             || (st->kind == NFA_EOL && (anchors & ANCHOR_EOL)))
+    {
+      stack[top++] = st->out;
+    }
+  }
+}
+
+// The states reached from in[0..n) by consuming a byte of 'column'.  A
+// new match may start at the next position too.
+static void nfa_step(const struct regex_nfa *nfa, const int *in, size_t n,
+                     size_t column, struct state_set *out, int *stack)
+{
+  out->n = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    const struct nfa_state *st = &nfa->states[in[i]];
+    if (nfa_consumes(nfa, st, column))
+    {
+      set_close(nfa, out, st->out, stack, 0);
+    }
+  }
+  set_close(nfa, out, nfa->root, stack, 0);
+}
+
+// The states in[0..n) reach at the end of a line, where '$' holds, and
+// so does '^' if no byte of the line has been consumed.
+static void nfa_end_line(const struct regex_nfa *nfa, const int *in, size_t n,
+                         struct state_set *out, int *stack)
+{
+  int anchors = ANCHOR_EOL;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (in[i] == nfa->line_start)
+    {
+      anchors |= ANCHOR_BOL;
+    }
+  }
+  out->n = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    set_close(nfa, out, in[i], stack, anchors);
+  }
+}
+
+// The pattern a set of states reports, or -1.
+static int nfa_accept(const struct regex_nfa *nfa, const int *states, size_t n)
+{
+  int accept = -1;
+  for (size_t i = 0; i < n; i++)
+  {
+    const struct nfa_state *st = &nfa->states[states[i]];
+    if (st->kind == NFA_MATCH && (accept < 0 || st->arg < accept))
+    {
+      accept = st->arg;
+    }
+  }
+  return accept;
+}
+
+static int state_set_init(struct state_set *set, size_t n)
+{
+  set->dense = malloc(n * sizeof(int));
+  set->sparse = calloc(n, sizeof(int));
+  set->n = 0;
+  return set->dense == NULL || set->sparse == NULL ? -1 : 0;
+}
+
+static void state_set_free(struct state_set *set)
+{
+  free(set->dense);
+  free(set->sparse);
+}
+
+// ---- Lazy DFA ----------------------------------------------------------
+
+static int compare_int(const void *a, const void *b)
+{
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static size_t hash_states(const int *states, size_t n)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < n; i++)
+  {
+    h = (h ^ (uint64_t)states[i]) * 1099511628211ULL;
+  }
+  return (size_t)(h ^ (h >> 29));
+}
+
+// The DFA state for the NFA states in nfa->cur, created if needed.
+// Returns its number, or 0 if the cache is full.  Exits if memory runs
+// out.  Called under the mutex.
+static uint32_t dfa_state(struct regex_dfa *re)
+{
+  struct regex_nfa *nfa = re->nfa;
+
+  // Split states lead only to states in the set, so only the others
+  // tell sets apart.
+  size_t n = 0;
+  for (size_t i = 0; i < nfa->cur.n; i++)
+  {
+    int s = nfa->cur.dense[i];
+    if (nfa->states[s].kind != NFA_SPLIT)
+    {
+      nfa->sorted[n++] = s;
+    }
+  }
+  qsort(nfa->sorted, n, sizeof(int), compare_int);
+
+  size_t mask = 2 * REGEX_DFA_MAX_STATES - 1;
+  size_t h = hash_states(nfa->sorted, n) & mask;
+  for (; re->table[h] != 0; h = (h + 1) & mask)
+  {
+    const int *set = re->sets[re->table[h]];
+    if ((size_t)set[0] == n && memcmp(set + 1, nfa->sorted, n * sizeof(int)) == 0)
+    {
+      return re->table[h];
+    }
+  }
+
+  if (re->nstates == REGEX_DFA_MAX_STATES)
+  {
+    return 0;
+  }
+  int *set = malloc((n + 1) * sizeof(int));
+  if (set == NULL)
+  {
+    err(1, "failed to allocate DFA state");
+  }
+  set[0] = (int)n;
+  memcpy(set + 1, nfa->sorted, n * sizeof(int));
+
+  uint32_t id = (uint32_t)re->nstates++;
+  re->sets[id] = set;
+  re->accept[id] = nfa_accept(nfa, set + 1, n);
+  re->table[h] = id;
+  return id;
+}
+
+// Compute, store and return the transition from the state whose row is
+// 'row' on 'column'.  A newline ends the line (a match if a pattern
+// ends with it) and starts the next.  Returns 0 if the cache is full.
+static uint32_t dfa_transition(struct regex_dfa *re, uint32_t row, size_t column)
+{
+  struct regex_nfa *nfa = re->nfa;
+  size_t newline = re->classes['\n'];
+
+  pthread_mutex_lock(&re->mutex);
+
+  uint32_t v = re->trans[row + column];
+  if (v == 0)
+  {
+    const int *set = re->sets[row / re->nclasses];
+    if (column == newline)
+    {
+      nfa_end_line(nfa, set + 1, (size_t)set[0], &nfa->cur, nfa->stack);
+    }
+    else
+    {
+      nfa_step(nfa, set + 1, (size_t)set[0], column, &nfa->cur, nfa->stack);
+    }
+    uint32_t id = dfa_state(re);
+    if (id != 0)
+    {
+      if (re->accept[id] >= 0)
+      {
+        v = id * (uint32_t)re->nclasses | REGEX_MATCH;
+      }
+      else
+      {
+        v = column == newline ? re->start : id * (uint32_t)re->nclasses;
+      }
+      __atomic_store_n(&re->trans[row + column], v, __ATOMIC_RELEASE);
+    }
+  }
+
+  pthread_mutex_unlock(&re->mutex);
+  return v;
+}
+
+// Match the rest of buf[..len) from 'p' by simulating the NFA, starting
+// in the states of DFA state 'id', once the cache is full.
+static const char *nfa_find(struct regex_dfa *re, uint32_t id, const char *buf,
+                            const char *p, size_t len, int *pattern)
+{
+  const struct regex_nfa *nfa = re->nfa;
+  struct state_set a, b;
+  int *stack = malloc((2 * nfa->n + 2) * sizeof(int));
+  if (stack == NULL || state_set_init(&a, nfa->n) != 0 || state_set_init(&b, nfa->n) != 0)
+  {
+    err(1, "failed to allocate NFA simulation");
+  }
+
+  pthread_mutex_lock(&re->mutex);
+  const int *set = re->sets[id];
+  const int *start = re->sets[re->start / re->nclasses];
+  memcpy(a.dense, set + 1, (size_t)set[0] * sizeof(int));
+  a.n = (size_t)set[0];
+  pthread_mutex_unlock(&re->mutex);
+
+  const char *end = buf + len, *found = NULL;
+  struct state_set *cur = &a, *next = &b;
+  for (; p < end || (p == end && len > 0 && end[-1] != '\n'); p++)
+  {
+    int eol = p == end || *p == '\n';
+    if (eol)
+    {
+      nfa_end_line(nfa, cur->dense, cur->n, next, stack);
+    }
+    else
+    {
+      nfa_step(nfa, cur->dense, cur->n, re->classes[(unsigned char)*p], next, stack);
+    }
+    struct state_set *tmp = cur;
+    cur = next;
+    next = tmp;
+
+    if ((*pattern = nfa_accept(nfa, cur->dense, cur->n)) >= 0)
+    {
+      found = p < end ? p : end - 1;
+      break;
+    }
+    if (eol)
+    {
+      // Sets of the DFA never change once made.
+      memcpy(cur->dense, start + 1, (size_t)start[0] * sizeof(int));
+      cur->n = (size_t)start[0];
+    }
+  }
+
+  free(stack);
+  state_set_free(&a);
+  state_set_free(&b);
+  return found;
+}
+
+// Run the DFA over buf[0..len).
+static const char *dfa_find(struct regex_dfa *re, const char *buf, size_t len,
+                            int *pattern)
+{
+  const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+  const uint32_t *trans = re->trans;
+  uint32_t s = re->start, v;
+
+  if (re->accept[s / re->nclasses] >= 0)
+  {
+    // The empty string matches at the start of every line.
+    *pattern = re->accept[s / re->nclasses];
+    return buf;
+  }
+
+  for (; p < end; p++)
+  {
+    size_t column = re->classes[*p];
+    v = __atomic_load_n(&trans[s + column], __ATOMIC_ACQUIRE);
+    if (v == 0 && (v = dfa_transition(re, s, column)) == 0)
+    {
+      return nfa_find(re, s / (uint32_t)re->nclasses, buf, (const char *)p, len, pattern);
+    }
+    if (v & REGEX_MATCH)
+    {
+      *pattern = re->accept[(v & ~REGEX_MATCH) / re->nclasses];
+      return (const char *)p;
+    }
+    s = v;
+  }
+
+  // The last line has no newline, but still ends.
+  if (len > 0 && end[-1] != '\n')
+  {
+    size_t column = re->classes['\n'];
+    v = __atomic_load_n(&trans[s + column], __ATOMIC_ACQUIRE);
+    if (v == 0 && (v = dfa_transition(re, s, column)) == 0)
+    {
+      return nfa_find(re, s / (uint32_t)re->nclasses, buf, (const char *)end, len, pattern);
+    }
+    if (v & REGEX_MATCH)
+    {
+      *pattern = re->accept[(v & ~REGEX_MATCH) / re->nclasses];
+      return (const char *)end - 1;
+    }
+  }
+  return NULL;
+}
+
+// ---- Interface ---------------------------------------------------------
+
+static int regex_dfa_compile(struct regex_dfa *re, const char *const *patterns, size_t n,
+                             int flags)
+{
+  struct regex_nfa *nfa = re->nfa;
+  struct parser ps = {0};
+  ps.icase = (flags & REGEX_DFA_ICASE) != 0;
+
+  int root = -1, r = 0;
+  for (size_t i = 0; i < n && r == 0; i++)
+  {
+    ps.p = (const unsigned char *)patterns[i];
+    ps.n = 0;
+    ps.depth = 0;
+    int ast = flags & REGEX_DFA_LITERAL ? parse_literal(&ps) : parse_alt(&ps);
+    if (ast < 0)
+    {
+      re->error = ps.error;
+      re->error_pattern = i;
+      r = -1;
+      break;
+    }
+
+    if (n == 1)
+    {
+      struct lit l;
+      node_lit(&ps, ast, &l);
+      memcpy(re->literal, l.best, l.blen);
+      re->literal[l.blen] = '\0';
+    }
+
+    int match = nfa_new(nfa, NFA_MATCH, -1, -1, (int)i);
+    int start = match < 0 ? match : nfa_build(nfa, &ps, ast, match);
+    if (start >= 0 && root >= 0)
+    {
+      start = nfa_new(nfa, NFA_SPLIT, root, start, 0);
+    }
+    if (start < 0)
+    {
+      re->error = start == -2 ? "pattern too large" : NULL;
+      re->error_pattern = i;
+      r = -1;
+    }
+    root = start;
+  }
+  free(ps.nodes);
+
+  if (r == 0 && root < 0)
+  {
+    // No patterns: a state that never consumes anything.
+    uint64_t none[4] = {0};
+    if ((root = nfa_set(nfa, none, -1)) < 0)
+    {
+      r = -1;
+    }
+  }
+  nfa->root = root;
+  if (r == 0 && (nfa->line_start = nfa_new(nfa, NFA_LINE_START, -1, -1, 0)) < 0)
+  {
+    r = -1;
+  }
+  return r;
+}
+
+int regex_dfa_init(struct regex_dfa *re, const char *const *patterns, size_t n,
+                   int flags)
+{
+  memset(re, 0, sizeof(struct regex_dfa));
+  re->npatterns = n;
+  re->nfa = calloc(1, sizeof(struct regex_nfa));
+  if (re->nfa == NULL)
+  {
+    return -1;
+  }
+  if (regex_dfa_compile(re, patterns, n, flags) != 0)
+  {
+    const char *error = re->error;
+    size_t error_pattern = re->error_pattern;
+    regex_dfa_destroy(re);
+    re->error = error;
+    re->error_pattern = error_pattern;
+    return -1;
+  }
+
+  struct regex_nfa *nfa = re->nfa;
+  nfa_columns(nfa, re->classes);
+  re->nclasses = nfa->nbytes;
+
+  pthread_mutex_init(&re->mutex, NULL);
+  re->trans = calloc(REGEX_DFA_MAX_STATES * re->nclasses, sizeof(uint32_t));
+  re->accept = malloc(REGEX_DFA_MAX_STATES * sizeof(int));
+  re->sets = calloc(REGEX_DFA_MAX_STATES, sizeof(int *));
+  re->table = calloc(2 * REGEX_DFA_MAX_STATES, sizeof(uint32_t));
+  nfa->stack = malloc((2 * nfa->n + 2) * sizeof(int));
+  nfa->sorted = malloc(nfa->n * sizeof(int));
+  if (re->trans == NULL || re->accept == NULL || re->sets == NULL || re->table == NULL
+      || nfa->stack == NULL || nfa->sorted == NULL || state_set_init(&nfa->cur, nfa->n) != 0)
+  {
+    regex_dfa_destroy(re);
+    return -1;
+  }
+
+  // State 0 is a placeholder, so that no transition is 0.  The start of
+  // a line is where any pattern may start, and where '^' holds.
+  re->nstates = 1;
+  nfa->cur.n = 0;
+  set_close(nfa, &nfa->cur, nfa->root, nfa->stack, ANCHOR_BOL);
+  set_close(nfa, &nfa->cur, nfa->line_start, nfa->stack, 0);
+  re->start = dfa_state(re) * (uint32_t)re->nclasses;
+
+  // A literal is worth searching for first unless it is a single common
+  // byte, which would hand most lines to the DFA anyway.
+  size_t literal_len = strlen(re->literal);
+  memsearch_init(&re->prefilter, re->literal, literal_len);
+  re->use_prefilter = literal_len >= 2 || (literal_len == 1 && re->prefilter.rare);
+  return 0;
+}
+
+void regex_dfa_destroy(struct regex_dfa *re)
+{
+  if (re->nfa == NULL)
+  {
+    return;
+  }
+  if (re->trans != NULL)
+  {
+    pthread_mutex_destroy(&re->mutex);
+  }
+  for (size_t i = 0; re->sets != NULL && i < re->nstates; i++)
+  {
+    free(re->sets[i]);
+  }
+  free(re->trans);
+  free(re->accept);
+  free(re->sets);
+  free(re->table);
+  free(re->nfa->states);
+  free(re->nfa->sets);
+  free(re->nfa->stack);
+  free(re->nfa->sorted);
+  state_set_free(&re->nfa->cur);
+  free(re->nfa);
+  memset(re, 0, sizeof(struct regex_dfa));
+}
+
+const char *regex_dfa_find(struct regex_dfa *re, const char *buf, size_t len,
+                           int *pattern)
+{
+  if (!re->use_prefilter)
+  {
+    return dfa_find(re, buf, len, pattern);
+  }
+
+  // Only lines containing the literal can match.
+  const char *pos = buf, *end = buf + len;
+  while (pos < end)
+  {
+    const char *hit = memsearch_find(&re->prefilter, pos, (size_t)(end - pos));
+    if (hit == NULL)
+    {
+      return NULL;
+    }
+    const char *line = memrchr(pos, '\n', (size_t)(hit - pos));
+    line = line == NULL ? pos : line + 1;
+    const char *line_end = memchr(hit, '\n', (size_t)(end - hit));
+    line_end = line_end == NULL ? end : line_end + 1;
+
+    const char *found = dfa_find(re, line, (size_t)(line_end - line), pattern);
+    if (found != NULL)
+    {
+      return found;
+    }
+    pos = line_end;
+  }
+  return NULL;
+}
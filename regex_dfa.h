@@ -0,0 +1,84 @@
+#ifndef REGEX_DFA_H
+#define REGEX_DFA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "memsearch.h"
+
+// Flags for regex_dfa_init().  With REGEX_DFA_LITERAL the patterns are
+// plain strings, which combined with REGEX_DFA_ICASE gives
+// case-insensitive literal matching.
+#define REGEX_DFA_ICASE   1  /* ASCII letters match either case */
+#define REGEX_DFA_LITERAL 2  /* no metacharacters */
+
+// Longest required literal that is extracted for the prefilter.
+#define REGEX_DFA_LITERAL_MAX 64
+
+// DFA states kept before the cache is full.  Lines that need more are
+// finished by simulating the NFA directly.
+#define REGEX_DFA_MAX_STATES 8192
+
+struct regex_nfa;
+
+/*
+ * regex_dfa
+ *
+ * A set of POSIX extended regular expressions (as in grep -E: . [] ()
+ * | * + ? {m,n} ^ $, plus \w \s \d and their negations) matched
+ * against whole buffers of lines.  The patterns are compiled to one
+ * NFA, and the DFA equivalent to it is built lazily while matching: a
+ * state's transition is computed (under a lock) the first time it is
+ * taken, and from then on costs one table lookup per byte, as in ac.
+ * Bytes that no pattern tells apart share a column.  A newline is a
+ * transition like any other, back to the start of a line, so a buffer
+ * is matched in a single pass without splitting it into lines.
+ *
+ * If every match of a single pattern must contain a literal string, it
+ * is searched for with memsearch first, and the DFA only runs on the
+ * lines that contain it.
+ *
+ * Initialise with regex_dfa_init(); the struct may then be shared
+ * between threads.
+ */
+struct regex_dfa
+{
+  unsigned char classes[256];  /* byte -> column */
+  size_t nclasses;             /* columns, one per class of bytes */
+  struct regex_nfa *nfa;
+  size_t npatterns;
+
+  pthread_mutex_t mutex;       /* guards everything below but trans */
+  uint32_t *trans;             /* REGEX_DFA_MAX_STATES * nclasses (see .c) */
+  int *accept;                 /* pattern reported by each state, or -1 */
+  int **sets;                  /* NFA states of each DFA state */
+  uint32_t *table;             /* hash of sets -> DFA state */
+  size_t nstates;
+  uint32_t start;              /* row of the state at the start of a line */
+
+  char literal[REGEX_DFA_LITERAL_MAX + 1];  /* required in every match */
+  struct memsearch prefilter;
+  int use_prefilter;
+
+  const char *error;           /* why regex_dfa_init() failed */
+  size_t error_pattern;        /* and in which pattern */
+};
+
+// Compile patterns[0..n), which are not referenced afterwards.  Returns
+// 0 on success.  On failure, re->error describes the problem (or is
+// NULL if memory ran out) and re->error_pattern is the index of the
+// pattern at fault.
+int regex_dfa_init(struct regex_dfa *re, const char *const *patterns, size_t n,
+                   int flags);
+
+// Free the memory of a compiled set of patterns.
+void regex_dfa_destroy(struct regex_dfa *re);
+
+// Return a pointer into the first line of buf[0..len) that contains a
+// match of any pattern, or NULL, and store the index of the pattern
+// found in *pattern.  Exits if memory runs out.
+const char *regex_dfa_find(struct regex_dfa *re, const char *buf, size_t len,
+                           int *pattern);
+
+#endif
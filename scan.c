@@ -0,0 +1,472 @@
+// Setting _GNU_SOURCE is necessary for memrchr() on GNU/Linux
+// systems.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "scan.h"
+
+// Block size of the read() fallback.  The buffer grows beyond this if a
+// single line does not fit.
+#define SCAN_BLOCK_SIZE (1024 * 1024)
+
+// Lines are matched one at a time, so a pattern can only end in a
+// newline, never contain one.
+static int can_match(const char *pattern, size_t len)
+{
+  const char *nl = memchr(pattern, '\n', len);
+  return nl == NULL || nl == pattern + len - 1;
+}
+
+void matcher_init(struct matcher *m, const char *needle)
+{
+  size_t len = strlen(needle);
+  memsearch_init(&m->search, needle, len);
+  m->ac = NULL;
+  m->re = NULL;
+  m->patterns = NULL;
+  m->npatterns = 1;
+  m->never = !can_match(needle, len);
+  m->binary = SCAN_BINARY_TEXT;
+}
+
+int matcher_init_many(struct matcher *m, const char *const *patterns, size_t n)
+{
+  if (n == 1)
+  {
+    matcher_init(m, patterns[0]);
+    m->patterns = patterns;
+    return 0;
+  }
+
+  const char **usable = malloc((n > 0 ? n : 1) * sizeof(char *));
+  struct ac *ac = malloc(sizeof(struct ac));
+  if (usable == NULL || ac == NULL)
+  {
+    free(usable);
+    free(ac);
+    return -1;
+  }
+
+  int never = 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    usable[i] = can_match(patterns[i], strlen(patterns[i])) ? patterns[i] : NULL;
+    never = never && usable[i] == NULL;
+  }
+
+  int r = ac_init(ac, usable, n);
+  free(usable);
+  if (r != 0)
+  {
+    free(ac);
+    return -1;
+  }
+
+  memsearch_init(&m->search, "", 0);
+  m->ac = ac;
+  m->re = NULL;
+  m->patterns = patterns;
+  m->npatterns = n;
+  m->never = never;
+  m->binary = SCAN_BINARY_TEXT;
+  return 0;
+}
+
+int matcher_init_regex(struct matcher *m, const char *const *patterns, size_t n,
+                       int flags)
+{
+  // Plain strings that match in one case only are searched for directly.
+  if (flags == REGEX_DFA_LITERAL)
+  {
+    if (matcher_init_many(m, patterns, n) != 0)
+    {
+      warnx("failed to build matcher for %zu patterns", n);
+      return -1;
+    }
+    return 0;
+  }
+
+  struct regex_dfa *re = malloc(sizeof(struct regex_dfa));
+  if (re == NULL || regex_dfa_init(re, patterns, n, flags) != 0)
+  {
+    if (re != NULL && re->error != NULL)
+    {
+      warnx("invalid pattern '%s': %s", patterns[re->error_pattern], re->error);
+    }
+    else
+    {
+      warnx("failed to build matcher for %zu patterns", n);
+    }
+    free(re);
+    return -1;
+  }
+
+  memsearch_init(&m->search, "", 0);
+  m->ac = NULL;
+  m->re = re;
+  m->patterns = patterns;
+  m->npatterns = n;
+  m->never = 0;
+  m->binary = SCAN_BINARY_TEXT;
+  return 0;
+}
+
+void matcher_destroy(struct matcher *m)
+{
+  if (m->ac != NULL)
+  {
+    ac_destroy(m->ac);
+    free(m->ac);
+    m->ac = NULL;
+  }
+  if (m->re != NULL)
+  {
+    regex_dfa_destroy(m->re);
+    free(m->re);
+    m->re = NULL;
+  }
+}
+
+const char *matcher_find(const struct matcher *m, const char *buf, size_t len,
+                         int *pattern)
+{
+  if (m->never || len == 0)
+  {
+    return NULL;
+  }
+  if (m->re != NULL)
+  {
+    return regex_dfa_find(m->re, buf, len, pattern);
+  }
+  if (m->ac != NULL)
+  {
+    return ac_find(m->ac, buf, len, pattern);
+  }
+  *pattern = 0;
+  return memsearch_find(&m->search, buf, len);
+}
+
+int pattern_list_add(struct pattern_list *l, const char *pattern)
+{
+  if (l->n == l->cap)
+  {
+    size_t cap = l->cap == 0 ? 16 : l->cap * 2;
+    char **bigger = realloc(l->patterns, cap * sizeof(char *));
+    if (bigger == NULL)
+    {
+      return -1;
+    }
+    l->patterns = bigger;
+    l->cap = cap;
+  }
+
+  char *copy = strdup(pattern);
+  if (copy == NULL)
+  {
+    return -1;
+  }
+  l->patterns[l->n++] = copy;
+  return 0;
+}
+
+int pattern_list_read(struct pattern_list *l, const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    warn("failed to open %s", path);
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t n;
+  int r = 0;
+
+  while ((n = getline(&line, &linecap, f)) != -1)
+  {
+    if (n > 0 && line[n - 1] == '\n')
+    {
+      line[n - 1] = '\0';
+    }
+    if (pattern_list_add(l, line) != 0)
+    {
+      warn("failed to store pattern from %s", path);
+      r = -1;
+      break;
+    }
+  }
+
+  if (r == 0 && ferror(f))
+  {
+    warn("failed to read %s", path);
+    r = -1;
+  }
+
+  free(line);
+  fclose(f);
+  return r;
+}
+
+void pattern_list_free(struct pattern_list *l)
+{
+  for (size_t i = 0; i < l->n; i++)
+  {
+    free(l->patterns[i]);
+  }
+  free(l->patterns);
+  l->patterns = NULL;
+  l->n = l->cap = 0;
+}
+
+size_t count_newlines(const char *buf, size_t len)
+{
+  return memsearch_count_byte(buf, len, '\n');
+}
+
+int scan_buffer(const struct matcher *m, const char *buf, size_t len,
+                unsigned long lineno, scan_line_fn fn, void *ctx)
+{
+  const char *pos = buf;
+  const char *end = buf + len;
+
+  while (pos < end)
+  {
+    int pattern;
+    const char *hit = matcher_find(m, pos, (size_t)(end - pos), &pattern);
+    if (hit == NULL)
+    {
+      break;
+    }
+
+    // Find the boundaries of the line containing the hit, and catch up
+    // on the line count since the previous match.
+    const char *line = memrchr(pos, '\n', (size_t)(hit - pos));
+    line = line == NULL ? pos : line + 1;
+    lineno += count_newlines(pos, (size_t)(line - pos));
+
+    const char *line_end = memchr(hit, '\n', (size_t)(end - hit));
+    line_end = line_end == NULL ? end : line_end + 1;
+
+    if (fn(ctx, lineno, pattern, line, (size_t)(line_end - line)) != 0)
+    {
+      return 1;
+    }
+
+    lineno++;
+    pos = line_end;
+  }
+
+  return 0;
+}
+
+int scan_looks_binary(const char *buf, size_t len)
+{
+  return memchr(buf, '\0', len < SCAN_BINARY_PROBE ? len : SCAN_BINARY_PROBE) != NULL;
+}
+
+// The callback of a binary file searched with SCAN_BINARY_REPORT.
+struct binary_report
+{
+  scan_line_fn fn;
+  void *ctx;
+};
+
+// scan_line_fn passing a match on without its line.
+static int report_binary(void *ctx, unsigned long lineno, int pattern,
+                         const char *line, size_t len)
+{
+  struct binary_report *b = ctx;
+  (void)line;
+  (void)len;
+  return b->fn(b->ctx, lineno, pattern, NULL, 0);
+}
+
+int scan_whole(const struct matcher *m, const char *buf, size_t len,
+               scan_line_fn fn, void *ctx)
+{
+  if (m->binary == SCAN_BINARY_TEXT || !scan_looks_binary(buf, len))
+  {
+    return scan_buffer(m, buf, len, 1, fn, ctx);
+  }
+  if (m->binary == SCAN_BINARY_SKIP)
+  {
+    return 0;
+  }
+  struct binary_report b = {fn, ctx};
+  return scan_buffer(m, buf, len, 1, report_binary, &b);
+}
+
+// read() fallback: scan the complete lines of each block, carrying a
+// partial last line over to the next block.  Whether the file is binary
+// is decided from the first block.
+static int scan_fd(const struct matcher *m, const char *path, int fd,
+                   scan_line_fn fn, void *ctx)
+{
+  size_t cap = SCAN_BLOCK_SIZE;
+  char *buf = malloc(cap);
+  if (buf == NULL)
+  {
+    warn("failed to allocate buffer for %s", path);
+    return -1;
+  }
+
+  size_t used = 0;
+  unsigned long lineno = 1;
+  int r = 0;
+  int first = 1;
+  struct binary_report b = {fn, ctx};
+
+  for (;;)
+  {
+    if (used == cap)
+    {
+      char *bigger = realloc(buf, cap * 2);
+      if (bigger == NULL)
+      {
+        warn("failed to grow buffer for %s", path);
+        r = -1;
+        break;
+      }
+      buf = bigger;
+      cap *= 2;
+    }
+
+    ssize_t n = read(fd, buf + used, cap - used);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      warn("failed to read %s", path);
+      r = -1;
+      break;
+    }
+
+    if (n == 0)
+    {
+      // EOF: whatever is left is the last line.
+      r = scan_buffer(m, buf, used, lineno, fn, ctx);
+      break;
+    }
+
+    size_t scanned = used;
+    used += (size_t)n;
+
+    if (first && m->binary != SCAN_BINARY_TEXT && scan_looks_binary(buf, used))
+    {
+      if (m->binary == SCAN_BINARY_SKIP)
+      {
+        break;
+      }
+      fn = report_binary;
+      ctx = &b;
+    }
+    first = 0;
+
+    const char *last_nl = memrchr(buf + scanned, '\n', (size_t)n);
+    if (last_nl == NULL)
+    {
+      continue;
+    }
+
+    size_t complete = (size_t)(last_nl - buf) + 1;
+    if ((r = scan_buffer(m, buf, complete, lineno, fn, ctx)) != 0)
+    {
+      break;
+    }
+    lineno += count_newlines(buf, complete);
+    memmove(buf, buf + complete, used - complete);
+    used -= complete;
+  }
+
+  free(buf);
+  return r;
+}
+
+// Map the file open on 'fd'.  Returns 0 on success, 1 if it cannot be
+// mapped.
+static int map_fd(struct scan_map *map, int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+  {
+    // Empty regular files end up here too, which is what we want for
+    // files like those in /proc that report a size of zero.
+    return 1;
+  }
+
+  void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    return 1;
+  }
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  map->data = data;
+  map->len = (size_t)st.st_size;
+  return 0;
+}
+
+int scan_map_open(struct scan_map *map, const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    warn("failed to open %s", path);
+    return -1;
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  int r = map_fd(map, fd);
+  close(fd);
+  return r;
+}
+
+void scan_map_close(struct scan_map *map)
+{
+  munmap((void *)map->data, map->len);
+  map->data = NULL;
+  map->len = 0;
+}
+
+int scan_file(const struct matcher *m, const char *path,
+              scan_line_fn fn, void *ctx)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    warn("failed to open %s", path);
+    return -1;
+  }
+
+  int r;
+  struct scan_map map;
+  if (map_fd(&map, fd) == 0)
+  {
+    r = scan_whole(m, map.data, map.len, fn, ctx);
+    scan_map_close(&map);
+  }
+  else
+  {
+    r = scan_fd(m, path, fd, fn, ctx);
+  }
+
+  close(fd);
+  return r;
+}
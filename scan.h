@@ -0,0 +1,172 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+#include "memsearch.h"
+#include "aho_corasick.h"
+#include "regex_dfa.h"
+
+// Bytes at the start of a file that are looked at to tell whether it is
+// binary.
+#define SCAN_BINARY_PROBE 32768
+
+// What is done with binary files, as chosen by grep's -a and -I
+// options: search them like text, report whether they match instead of
+// printing lines (see scan_line_fn), or skip them.
+enum scan_binary
+{
+  SCAN_BINARY_TEXT,
+  SCAN_BINARY_REPORT,
+  SCAN_BINARY_SKIP,
+};
+
+/*
+ * matcher
+ *
+ * What a line has to contain to be reported: one needle, any of a list
+ * of patterns, or a match of any of a list of regular expressions.
+ * Built once by the caller (e.g. `struct matcher m;
+ * matcher_init(&m, needle);`) and then shared read-only by all scanning
+ * threads.  Binary files are searched as text unless the caller sets
+ * 'binary' after initialising it.
+ */
+struct matcher
+{
+  struct memsearch search;  /* single needle */
+  struct ac *ac;            /* several patterns, or NULL */
+  struct regex_dfa *re;     /* regular expressions or -i, or NULL */
+  const char *const *patterns;
+  size_t npatterns;
+  int never;                /* no pattern can match within a line */
+  enum scan_binary binary;  /* by scan_whole() and scan_file() */
+};
+
+/*
+ * pattern_list
+ *
+ * A growable list of patterns, as collected from -e and -f options.
+ * Start from `struct pattern_list l = {0};`.
+ */
+struct pattern_list
+{
+  char **patterns;
+  size_t n, cap;
+};
+
+/*
+ * scan_map
+ *
+ * A read-only memory mapping of a whole regular file.
+ */
+struct scan_map
+{
+  const char *data;
+  size_t len;
+};
+
+// What is reported about the files searched, as chosen by grep's -c, -l
+// and -q options: every matching line, the number of them, the names of
+// the files that have any, or nothing but whether any file matched.
+enum scan_mode
+{
+  SCAN_LINES,
+  SCAN_COUNT,
+  SCAN_LIST,
+  SCAN_QUIET,
+};
+
+// Non-zero once a file in which 'count' (at least one) matching lines
+// have been found need not be searched further: after the first with
+// SCAN_LIST and SCAN_QUIET, otherwise after 'max' (grep's -m; 0 for no
+// limit).
+static inline int scan_enough(enum scan_mode mode, unsigned long count,
+                              unsigned long max)
+{
+  return mode == SCAN_LIST || mode == SCAN_QUIET || (max != 0 && count >= max);
+}
+
+// Called for every matching line.  'line' is not NUL-terminated; it
+// includes the trailing '\n' unless it is the last line of the data.
+// 'lineno' is 1-based and 'pattern' is the index of the pattern found
+// in the line (always 0 for a single needle).  In a binary file
+// searched with SCAN_BINARY_REPORT, 'line' is NULL and 'len' 0.  Return
+// non-zero to stop scanning.
+typedef int (*scan_line_fn)(void *ctx, unsigned long lineno, int pattern,
+                            const char *line, size_t len);
+
+// Initialise a matcher for lines containing 'needle'.  The needle is
+// not copied.
+void matcher_init(struct matcher *m, const char *needle);
+
+// Initialise a matcher for lines containing any of patterns[0..n),
+// which are not copied.  Patterns that contain a newline before their
+// end can never match a line and are ignored.  Returns non-zero on
+// allocation failure.
+int matcher_init_many(struct matcher *m, const char *const *patterns, size_t n);
+
+// Initialise a matcher for lines matching any of the regular
+// expressions patterns[0..n), or with REGEX_DFA_LITERAL in 'flags',
+// containing any of the strings; REGEX_DFA_ICASE ignores case.
+// Returns -1 (after a warning) if a pattern is invalid or memory runs
+// out.
+int matcher_init_regex(struct matcher *m, const char *const *patterns, size_t n,
+                       int flags);
+
+// Free the memory of a matcher.
+void matcher_destroy(struct matcher *m);
+
+// Return a pointer into the first line of buf[0..len) that matches, or
+// NULL if there is none.  The index of the pattern found is stored in
+// *pattern.
+const char *matcher_find(const struct matcher *m, const char *buf, size_t len,
+                         int *pattern);
+
+// Append a copy of 'pattern'.  Returns non-zero on allocation failure.
+int pattern_list_add(struct pattern_list *l, const char *pattern);
+
+// Append every line of the file at 'path' (without its newline), as
+// grep -f does.  Returns -1 (after a warning) on error.
+int pattern_list_read(struct pattern_list *l, const char *path);
+
+// Free the patterns and the list.
+void pattern_list_free(struct pattern_list *l);
+
+// Number of '\n' bytes in buf[0..len).
+size_t count_newlines(const char *buf, size_t len);
+
+// Report every matching line in buf[0..len), whose first line has
+// number 'lineno'.  Line boundaries are only computed around matches.
+// Returns non-zero if 'fn' asked to stop.
+int scan_buffer(const struct matcher *m, const char *buf, size_t len,
+                unsigned long lineno, scan_line_fn fn, void *ctx);
+
+// Non-zero if buf[0..len) looks like the start of a binary file: it has
+// a NUL byte among its first SCAN_BINARY_PROBE bytes, which text in any
+// ASCII-compatible encoding never does.
+int scan_looks_binary(const char *buf, size_t len);
+
+// Like scan_buffer() from line 1, for the whole contents of a file:
+// binary files are handled as m->binary says.
+int scan_whole(const struct matcher *m, const char *buf, size_t len,
+               scan_line_fn fn, void *ctx);
+
+// Map the file at 'path' (advised for sequential access).  Returns 0 on
+// success, -1 (after a warning) if the file cannot be opened, and 1 if
+// it cannot be mapped (not a regular file, empty, or mmap() failed), in
+// which case scan_file() still reads it.
+int scan_map_open(struct scan_map *map, const char *path);
+
+// Unmap a file mapped by scan_map_open().
+void scan_map_close(struct scan_map *map);
+
+// Report every matching line of the file at 'path'.  Regular files are
+// memory-mapped and searched as a whole; anything that cannot be mapped
+// (pipes, special files, files whose size is not known up front) is
+// read() in blocks instead, and is binary if its first block is.
+// Returns -1 (after a warning) if the file cannot be opened or read, 1
+// if 'fn' asked to stop, otherwise 0.
+int scan_file(const struct matcher *m, const char *path,
+              scan_line_fn fn, void *ctx);
+
+#endif
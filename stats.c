@@ -0,0 +1,312 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+#include "job_queue.h"
+
+int stats_enabled = 0;
+
+// Every registered thread, newest first.  Entries are never freed, so
+// they can be read after their thread has exited.
+static __thread struct thread_stats *self = NULL;
+static struct thread_stats *all_threads = NULL;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t start_ns;
+
+// The periodic reporter.  'stop' is protected by report_mutex.
+static unsigned report_interval_ms = 0;
+static pthread_t reporter;
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t report_cond;
+static int report_stop = 0;
+
+// Totals over all threads.
+struct stats_totals
+{
+  uint64_t jobs, files, bytes;
+  uint64_t busy_ns, alive_ns;
+};
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline void stat_add(uint64_t *c, uint64_t n)
+{
+  __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stat_load(const uint64_t *c)
+{
+  return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+// The counters of the calling thread, registered as 'id' if new.
+static struct thread_stats *thread_stats(int id)
+{
+  if (self == NULL)
+  {
+    struct thread_stats *t = calloc(1, sizeof(struct thread_stats));
+    if (t == NULL)
+    {
+      return NULL;
+    }
+    t->id = id;
+    t->start_ns = now_ns();
+    pthread_mutex_lock(&threads_mutex);
+    t->next = all_threads;
+    all_threads = t;
+    pthread_mutex_unlock(&threads_mutex);
+    self = t;
+  }
+  return self;
+}
+
+void stats_thread_begin(int id)
+{
+  if (stats_enabled)
+  {
+    (void)thread_stats(id);
+  }
+}
+
+void stats_thread_end(void)
+{
+  if (stats_enabled && self != NULL)
+  {
+    __atomic_store_n(&self->end_ns, now_ns(), __ATOMIC_RELAXED);
+  }
+}
+
+uint64_t stats_job_begin(void)
+{
+  return stats_enabled ? now_ns() : 0;
+}
+
+void stats_job_end(uint64_t start)
+{
+  struct thread_stats *t;
+  if (start == 0 || (t = thread_stats(-1)) == NULL)
+  {
+    return;
+  }
+  stat_add(&t->jobs, 1);
+  stat_add(&t->busy_ns, now_ns() - start);
+}
+
+void stats_count_slow(uint64_t files, uint64_t bytes)
+{
+  struct thread_stats *t = thread_stats(-1);
+  if (t != NULL)
+  {
+    stat_add(&t->files, files);
+    stat_add(&t->bytes, bytes);
+  }
+}
+
+// How long a thread has been alive, as of 'now'.
+static uint64_t alive_ns(const struct thread_stats *t, uint64_t now)
+{
+  uint64_t end = __atomic_load_n(&t->end_ns, __ATOMIC_RELAXED);
+  return (end != 0 ? end : now) - t->start_ns;
+}
+
+static void collect(struct stats_totals *s, uint64_t now)
+{
+  memset(s, 0, sizeof(*s));
+  pthread_mutex_lock(&threads_mutex);
+  for (struct thread_stats *t = all_threads; t != NULL; t = t->next)
+  {
+    s->jobs += stat_load(&t->jobs);
+    s->files += stat_load(&t->files);
+    s->bytes += stat_load(&t->bytes);
+    s->busy_ns += stat_load(&t->busy_ns);
+    s->alive_ns += alive_ns(t, now);
+  }
+  pthread_mutex_unlock(&threads_mutex);
+}
+
+static double seconds(uint64_t ns)
+{
+  return (double)ns / 1e9;
+}
+
+static void print_json(void)
+{
+  uint64_t now = now_ns();
+  struct stats_totals s;
+  struct job_queue_stats q;
+  collect(&s, now);
+  job_queue_stats_collect(&q);
+
+  double elapsed = seconds(now - start_ns);
+  fprintf(stderr,
+          "{\"elapsed_s\":%.3f,\"jobs\":%llu,\"files\":%llu,\"bytes\":%llu,"
+          "\"files_per_s\":%.1f,\"mb_per_s\":%.2f,\"busy\":%.3f,"
+          "\"queue\":{\"pushes\":%llu,\"pops\":%llu,\"push_waits\":%llu,"
+          "\"push_wait_s\":%.3f,\"pop_waits\":%llu,\"pop_wait_s\":%.3f,\"peak\":%llu,"
+          "\"grows\":%llu,\"shrinks\":%llu}}\n",
+          elapsed, (unsigned long long)s.jobs, (unsigned long long)s.files,
+          (unsigned long long)s.bytes, (double)s.files / elapsed,
+          (double)s.bytes / elapsed / 1e6,
+          s.alive_ns > 0 ? (double)s.busy_ns / (double)s.alive_ns : 0.0,
+          (unsigned long long)q.pushes, (unsigned long long)q.pops,
+          (unsigned long long)q.push_waits, seconds(q.push_wait_ns),
+          (unsigned long long)q.pop_waits, seconds(q.pop_wait_ns),
+          (unsigned long long)q.peak, (unsigned long long)q.grows,
+          (unsigned long long)q.shrinks);
+}
+
+static void *reporter_thread(void *arg)
+{
+  (void)arg;
+
+  pthread_mutex_lock(&report_mutex);
+  while (!report_stop)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)report_interval_ms * 1000000u;
+    deadline.tv_sec += (time_t)(ns / 1000000000u);
+    deadline.tv_nsec = (long)(ns % 1000000000u);
+
+    while (!report_stop &&
+           pthread_cond_timedwait(&report_cond, &report_mutex, &deadline) != ETIMEDOUT)
+    {
+    }
+    if (!report_stop)
+    {
+      print_json();
+    }
+  }
+  pthread_mutex_unlock(&report_mutex);
+  return NULL;
+}
+
+int stats_enable(unsigned interval_ms)
+{
+  stats_enabled = 1;
+  job_queue_stats_enable();
+  start_ns = now_ns();
+
+  if (interval_ms == 0)
+  {
+    return 0;
+  }
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&report_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  report_interval_ms = interval_ms;
+  if (pthread_create(&reporter, NULL, reporter_thread, NULL) != 0)
+  {
+    report_interval_ms = 0;
+    pthread_cond_destroy(&report_cond);
+    return -1;
+  }
+  return 0;
+}
+
+static int by_id(const void *a, const void *b)
+{
+  const struct thread_stats *x = *(const struct thread_stats *const *)a;
+  const struct thread_stats *y = *(const struct thread_stats *const *)b;
+  // Workers in order, then the other threads.
+  unsigned ix = (unsigned)x->id, iy = (unsigned)y->id;
+  return ix < iy ? -1 : ix > iy;
+}
+
+void stats_finish(void)
+{
+  if (!stats_enabled)
+  {
+    return;
+  }
+
+  if (report_interval_ms != 0)
+  {
+    pthread_mutex_lock(&report_mutex);
+    report_stop = 1;
+    pthread_cond_signal(&report_cond);
+    pthread_mutex_unlock(&report_mutex);
+    pthread_join(reporter, NULL);
+    pthread_cond_destroy(&report_cond);
+    report_interval_ms = 0;
+  }
+
+  uint64_t now = now_ns();
+  double elapsed = seconds(now - start_ns);
+  struct stats_totals s;
+  struct job_queue_stats q;
+  collect(&s, now);
+  job_queue_stats_collect(&q);
+
+  fflush(stdout);
+  fprintf(stderr, "stats: %.3f s, %llu jobs, %llu files (%.1f files/s), %.1f MB (%.1f MB/s)\n",
+          elapsed, (unsigned long long)s.jobs, (unsigned long long)s.files,
+          (double)s.files / elapsed, (double)s.bytes / 1e6,
+          (double)s.bytes / elapsed / 1e6);
+  fprintf(stderr, "stats: queue: %llu pushes, %llu pops, peak %llu queued "
+          "(grew %llu, shrank %llu times); pushes waited %llu times (%.3f s), "
+          "pops waited %llu times (%.3f s)\n",
+          (unsigned long long)q.pushes, (unsigned long long)q.pops,
+          (unsigned long long)q.peak, (unsigned long long)q.grows,
+          (unsigned long long)q.shrinks, (unsigned long long)q.push_waits,
+          seconds(q.push_wait_ns), (unsigned long long)q.pop_waits,
+          seconds(q.pop_wait_ns));
+
+  pthread_mutex_lock(&threads_mutex);
+  size_t n = 0;
+  for (struct thread_stats *t = all_threads; t != NULL; t = t->next)
+  {
+    n++;
+  }
+  struct thread_stats **threads = malloc((n > 0 ? n : 1) * sizeof(struct thread_stats *));
+  if (threads != NULL)
+  {
+    n = 0;
+    for (struct thread_stats *t = all_threads; t != NULL; t = t->next)
+    {
+      threads[n++] = t;
+    }
+    qsort(threads, n, sizeof(struct thread_stats *), by_id);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      const struct thread_stats *t = threads[i];
+      uint64_t alive = alive_ns(t, now);
+      uint64_t idle = alive > t->busy_ns ? alive - t->busy_ns : 0;
+      char name[32];
+      if (t->id >= 0)
+      {
+        snprintf(name, sizeof(name), "worker %d", t->id);
+      }
+      else
+      {
+        snprintf(name, sizeof(name), "other");
+      }
+      fprintf(stderr, "stats: %s: %llu jobs, %llu files, %.1f MB, busy %.3f s (%.0f%%), idle %.3f s\n",
+              name, (unsigned long long)t->jobs, (unsigned long long)t->files,
+              (double)t->bytes / 1e6, seconds(t->busy_ns),
+              alive > 0 ? 100.0 * (double)t->busy_ns / (double)alive : 0.0,
+              seconds(idle));
+    }
+    free(threads);
+  }
+  pthread_mutex_unlock(&threads_mutex);
+}
@@ -0,0 +1,62 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// Counters of one thread (a pool worker, a fibs worker, or the main
+// thread of a single-threaded tool).  Only the thread itself writes
+// them.  Times are in nanoseconds.
+struct thread_stats
+{
+  int id;                   /* worker number, or -1 */
+  uint64_t jobs, files, bytes;
+  uint64_t busy_ns;         /* time spent running jobs */
+  uint64_t start_ns, end_ns; /* end_ns is 0 while the thread runs */
+  struct thread_stats *next;
+};
+
+/*
+ * stats
+ *
+ * Optional run statistics (--stats): what every worker did and how
+ * much of its time it was busy, and (see job_queue_stats_enable()) how
+ * often and how long producers and consumers waited on job queues.
+ * Counting is off unless stats_enable() was called, and when on only
+ * touches counters private to the calling thread.  A summary is
+ * printed to stderr at the end, and optionally a JSON line with the
+ * totals so far every 'interval' milliseconds.
+ */
+extern int stats_enabled;
+
+// Turn counting on (also for job queues) and start the clock.  If
+// 'interval_ms' is not 0, a thread prints a JSON line to stderr at that
+// interval.  Call before starting any workers.  Returns non-zero if the
+// reporter thread cannot be started.
+int stats_enable(unsigned interval_ms);
+
+// Register the calling thread as worker 'id' (or -1 for a thread that
+// is not a worker), and mark it as finished.  Threads that count
+// without registering are registered as -1 on first use.
+void stats_thread_begin(int id);
+void stats_thread_end(void);
+
+// Time a job: stats_job_begin() returns the start time, which is
+// passed to stats_job_end().
+uint64_t stats_job_begin(void);
+void stats_job_end(uint64_t start);
+
+// Count files processed and bytes read by the calling thread.
+void stats_count_slow(uint64_t files, uint64_t bytes);
+static inline void stats_count(uint64_t files, uint64_t bytes)
+{
+  if (stats_enabled)
+  {
+    stats_count_slow(files, bytes);
+  }
+}
+
+// Stop the periodic reporter and print the summary to stderr.  Call
+// once all workers have finished.  Does nothing if counting is off.
+void stats_finish(void);
+
+#endif
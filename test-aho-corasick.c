@@ -0,0 +1,139 @@
+// Tests of the Aho-Corasick matcher against a naive search with the
+// documented semantics: the match that ends first wins, then the
+// longest pattern ending there, then the lowest index among equal
+// patterns.  Pattern sets are random (including duplicates, patterns
+// inside other patterns, NULL entries and high bytes), and so are the
+// texts searched, which also contain NUL bytes.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aho_corasick.h"
+#include "test.h"
+
+#define TRIALS 3000
+#define MAX_PATTERNS 40
+#define MAX_PATTERN 12
+#define MAX_TEXT 400
+
+// Bytes of the patterns; texts may also contain NUL.
+static const char *const alphabets[] = {"ab", "abc", "a\xe9\xff"};
+
+static char random_byte(uint64_t *rng, int alphabet)
+{
+  if (alphabet == 3)
+  {
+    return (char)(1 + test_below(rng, 255));
+  }
+  const char *a = alphabets[alphabet];
+  return a[test_below(rng, (unsigned)strlen(a))];
+}
+
+static const char *find_naive(char *const *patterns, size_t n, const char *buf,
+                              size_t len, int *pattern)
+{
+  for (size_t end = 1; end <= len; end++)
+  {
+    size_t best_len = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (patterns[i] == NULL)
+      {
+        continue;
+      }
+      size_t plen = strlen(patterns[i]);
+      if (plen > best_len && plen <= end && memcmp(buf + end - plen, patterns[i], plen) == 0)
+      {
+        best_len = plen;
+        *pattern = (int)i;
+      }
+    }
+    if (best_len > 0)
+    {
+      return buf + end - best_len;
+    }
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  uint64_t rng = 0xda942042e4dd58b5ULL;
+  char *patterns[MAX_PATTERNS];
+  char text[MAX_TEXT];
+
+  for (int trial = 0; trial < TRIALS; trial++)
+  {
+    int alphabet = (int)test_below(&rng, 4);
+    size_t n = 1 + test_below(&rng, trial % 10 == 0 ? MAX_PATTERNS : 6);
+    for (size_t i = 0; i < n; i++)
+    {
+      if (test_below(&rng, 10) == 0)
+      {
+        patterns[i] = NULL;
+        continue;
+      }
+      patterns[i] = malloc(MAX_PATTERN + 1);
+      CHECK(patterns[i] != NULL);
+      if (i > 0 && patterns[i - 1] != NULL && test_below(&rng, 5) == 0)
+      {
+        // A duplicate, or a part of the previous pattern.
+        size_t plen = strlen(patterns[i - 1]);
+        size_t start = test_below(&rng, (unsigned)plen);
+        size_t sub = 1 + test_below(&rng, (unsigned)(plen - start));
+        if (test_below(&rng, 2))
+        {
+          start = 0;
+          sub = plen;
+        }
+        memcpy(patterns[i], patterns[i - 1] + start, sub);
+        patterns[i][sub] = '\0';
+        continue;
+      }
+      size_t plen = 1 + test_below(&rng, test_below(&rng, 4) == 0 ? MAX_PATTERN : 4);
+      for (size_t j = 0; j < plen; j++)
+      {
+        patterns[i][j] = random_byte(&rng, alphabet);
+      }
+      patterns[i][plen] = '\0';
+    }
+
+    struct ac ac;
+    CHECK(ac_init(&ac, (const char *const *)patterns, n) == 0);
+
+    size_t len = test_below(&rng, MAX_TEXT + 1);
+    for (size_t i = 0; i < len; i++)
+    {
+      text[i] = test_below(&rng, 50) == 0 ? '\0' : random_byte(&rng, alphabet);
+    }
+
+    // Search from the start, then on from just after each match, as a
+    // caller listing all matches would.
+    for (size_t from = 0; from <= len;)
+    {
+      int want_pattern = -1, got_pattern = -1;
+      const char *want = find_naive(patterns, n, text + from, len - from, &want_pattern);
+      const char *got = ac_find(&ac, text + from, len - from, &got_pattern);
+      if (got != want || (want != NULL && got_pattern != want_pattern))
+      {
+        errx(1, "trial %d: %zu patterns, text of %zu bytes from %zu: "
+             "found pattern %d at %td, expected pattern %d at %td", trial, n, len, from,
+             got_pattern, got == NULL ? (ptrdiff_t)-1 : got - text,
+             want_pattern, want == NULL ? (ptrdiff_t)-1 : want - text);
+      }
+      if (want == NULL)
+      {
+        break;
+      }
+      from = (size_t)(want - text) + 1;
+    }
+
+    ac_destroy(&ac);
+    for (size_t i = 0; i < n; i++)
+    {
+      free(patterns[i]);
+    }
+  }
+  return 0;
+}
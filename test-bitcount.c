@@ -0,0 +1,83 @@
+// Tests of count_bits() against a byte-at-a-time reference, for random
+// and constant buffers of many lengths (below, around and well above
+// the sizes the vector loops take) at every alignment.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bitcount.h"
+#include "test.h"
+
+#define ALIGNMENTS 64
+#define MAX_LEN (1 << 20)
+
+static void count_naive(const unsigned char *buf, size_t len, uint64_t counts[8])
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    for (int bit = 0; bit < 8; bit++)
+    {
+      counts[bit] += (buf[i] >> bit) & 1;
+    }
+  }
+}
+
+// count_bits() adds to what is already in counts[], like the reference.
+static void check(const unsigned char *buf, size_t len)
+{
+  uint64_t want[8], got[8];
+  for (int bit = 0; bit < 8; bit++)
+  {
+    want[bit] = got[bit] = (uint64_t)bit * 1000;
+  }
+  count_naive(buf, len, want);
+  count_bits(buf, len, got);
+  if (memcmp(want, got, sizeof(want)) != 0)
+  {
+    errx(1, "wrong counts for %zu bytes at alignment %zu", len,
+         (size_t)((uintptr_t)buf % ALIGNMENTS));
+  }
+}
+
+int main(void)
+{
+  uint64_t rng = 0x2545f4914f6cdd1dULL;
+  unsigned char *mem = malloc(MAX_LEN + 2 * ALIGNMENTS);
+  CHECK(mem != NULL);
+  unsigned char *base = mem + (ALIGNMENTS - (uintptr_t)mem % ALIGNMENTS);
+
+  for (size_t i = 0; i < MAX_LEN + ALIGNMENTS; i++)
+  {
+    base[i] = (unsigned char)test_rand(&rng);
+  }
+
+  // Every length up to a few vector blocks, at every alignment.
+  for (size_t len = 0; len <= 1100; len++)
+  {
+    for (size_t align = 0; align < ALIGNMENTS; align += len < 300 ? 1 : 13)
+    {
+      check(base + align, len);
+    }
+  }
+
+  // Random lengths, up to large buffers.
+  for (int trial = 0; trial < 200; trial++)
+  {
+    size_t len = test_rand(&rng) % (trial < 150 ? 70000 : MAX_LEN);
+    check(base + test_below(&rng, ALIGNMENTS), len);
+  }
+
+  // Constant buffers, where every count is the length or zero; large
+  // enough to catch counters that saturate.
+  memset(base, 0xff, MAX_LEN);
+  check(base, MAX_LEN);
+  check(base + 1, MAX_LEN - 1);
+  memset(base, 0, MAX_LEN);
+  check(base, MAX_LEN);
+  memset(base, 0x81, MAX_LEN);
+  check(base + 3, MAX_LEN - 5);
+
+  free(mem);
+  return 0;
+}
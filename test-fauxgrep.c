@@ -0,0 +1,183 @@
+// End-to-end tests of the line numbers fauxgrep and fauxgrep-mt print.
+// A file of lines of random length, some containing the needle, is
+// searched by fauxgrep (which reads it in blocks) and by fauxgrep-mt
+// with chunk sizes from a single byte up to more than the file, so
+// that chunk boundaries fall everywhere relative to lines and matches.
+// The output must list exactly the matching lines, numbered from the
+// start of the file, in order; the counts of -c and the limit of -m
+// must hold across chunks too.  Run from the directory holding the
+// programs, after building them.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define LINES 40000
+#define MAX_LINE 150
+#define NEEDLE "needle"
+
+static char path[] = "/tmp/test-fauxgrep.XXXXXX";
+
+// The expected output of a plain search, line by line.
+static char *expected;
+static size_t expected_len;
+static unsigned long nmatches;
+
+static void append(char **buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+  if (*len + n + 1 > *cap)
+  {
+    *cap = (*len + n + 1) * 2;
+    *buf = realloc(*buf, *cap);
+    CHECK(*buf != NULL);
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+  (*buf)[*len] = '\0';
+}
+
+// Write the test file, and the output expected for it.
+static void make_file(void)
+{
+  uint64_t rng = 0xbb67ae8584caa73bULL;
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  FILE *f = fdopen(fd, "w");
+  CHECK(f != NULL);
+
+  size_t cap = 0;
+  char line[MAX_LINE + sizeof(NEEDLE) + 1], prefix[64 + sizeof(path)];
+  for (unsigned long lineno = 1; lineno <= LINES; lineno++)
+  {
+    // Mostly short lines, with the odd empty or long one.
+    size_t len = test_below(&rng, 10) == 0 ? test_below(&rng, MAX_LINE) : test_below(&rng, 30);
+    for (size_t i = 0; i < len; i++)
+    {
+      line[i] = (char)('a' + test_below(&rng, 26));
+    }
+    if (test_below(&rng, 8) == 0)
+    {
+      size_t at = test_below(&rng, (unsigned)len + 1);
+      memmove(line + at + strlen(NEEDLE), line + at, len - at);
+      memcpy(line + at, NEEDLE, strlen(NEEDLE));
+      len += strlen(NEEDLE);
+    }
+    if (lineno == LINES)
+    {
+      // The last line matches, and has no newline.
+      memcpy(line, NEEDLE, strlen(NEEDLE));
+      len = strlen(NEEDLE);
+    }
+    line[len] = '\0';
+
+    fwrite(line, 1, len, f);
+    if (lineno < LINES)
+    {
+      fputc('\n', f);
+    }
+    if (strstr(line, NEEDLE) != NULL)
+    {
+      int n = snprintf(prefix, sizeof(prefix), "%s:%lu: ", path, lineno);
+      append(&expected, &expected_len, &cap, prefix, (size_t)n);
+      append(&expected, &expected_len, &cap, line, len);
+      // Lines are printed as they are, so the last one without a
+      // newline, as the greps always have.
+      if (lineno < LINES)
+      {
+        append(&expected, &expected_len, &cap, "\n", 1);
+      }
+      nmatches++;
+    }
+  }
+  CHECK(fclose(f) == 0);
+}
+
+// The standard output of running 'command' on the test file.
+static char *run(const char *command)
+{
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "%s %s", command, path);
+  FILE *p = popen(cmd, "r");
+  CHECK(p != NULL);
+
+  char *out = NULL, buf[65536];
+  size_t len = 0, cap = 0, n;
+  append(&out, &len, &cap, "", 0);
+  while ((n = fread(buf, 1, sizeof(buf), p)) > 0)
+  {
+    append(&out, &len, &cap, buf, n);
+  }
+  if (pclose(p) != 0)
+  {
+    errx(1, "%s failed", cmd);
+  }
+  return out;
+}
+
+static void check_output(const char *command, const char *want)
+{
+  char *got = run(command);
+  if (strcmp(got, want) != 0)
+  {
+    // Point at the first line that differs.
+    size_t i = 0, line = 1;
+    for (; got[i] == want[i]; i++)
+    {
+      line += got[i] == '\n';
+    }
+    errx(1, "%s: output differs from the expected at line %zu", command, line);
+  }
+  free(got);
+}
+
+int main(void)
+{
+  static const size_t chunk_sizes[] = {1, 37, 4096, 65537, 1 << 20};
+  char command[256], want[64 + sizeof(path)];
+
+  make_file();
+  printf("  %lu matching lines of %d\n", nmatches, LINES);
+
+  check_output("./fauxgrep " NEEDLE, expected);
+  check_output("./fauxgrep-mt " NEEDLE, expected);
+  check_output("./fauxgrep-mt --io-uring " NEEDLE, expected);
+
+  for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++)
+  {
+    size_t size = chunk_sizes[i];
+    printf("  fauxgrep-mt --chunk-size %zu\n", size);
+    snprintf(command, sizeof(command), "./fauxgrep-mt -n 4 --chunk-size %zu " NEEDLE, size);
+    check_output(command, expected);
+    snprintf(command, sizeof(command),
+             "./fauxgrep-mt -n 3 --lock-free --sorted --chunk-size %zu " NEEDLE, size);
+    check_output(command, expected);
+
+    snprintf(command, sizeof(command), "./fauxgrep-mt -n 4 -c --chunk-size %zu " NEEDLE, size);
+    snprintf(want, sizeof(want), "%s:%lu\n", path, nmatches);
+    check_output(command, want);
+
+    // The first 100 matches, wherever the chunks that found them are.
+    const char *end = expected;
+    for (int m = 0; m < 100; m++)
+    {
+      end = strchr(end, '\n') + 1;
+    }
+    char *first = strndup(expected, (size_t)(end - expected));
+    CHECK(first != NULL);
+    snprintf(command, sizeof(command), "./fauxgrep-mt -n 4 -m 100 --chunk-size %zu " NEEDLE,
+             size);
+    check_output(command, first);
+    free(first);
+  }
+
+  unlink(path);
+  free(expected);
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Tests of fib_decimal() against Fibonacci numbers built up by plain
+// decimal addition: every n up to a few thousand (covering the switch
+// from 128-bit arithmetic to big numbers), ranges around the indices
+// the memo starts remembering, and scattered large n.  The wanted n
+// are asked for without a memo, in random order with one (so later
+// answers come from remembered or nearby pairs), with a memo too small
+// to remember much, and from several threads sharing a memo.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fibonacci.h"
+#include "test.h"
+
+#define NMAX 30000
+#define THREADS 4
+
+// The wanted n, and the reference digits of F(n) for each.
+static uint32_t *wanted;
+static size_t nwanted;
+static char **reference;
+
+static void want(uint64_t n)
+{
+  if (n <= NMAX && reference[n] == NULL)
+  {
+    reference[n] = "";
+    wanted[nwanted++] = (uint32_t)n;
+  }
+}
+
+// Decimal digits of a number held in base 10^9 limbs, least
+// significant first.
+static char *limbs_decimal(const uint32_t *d, size_t len)
+{
+  while (len > 1 && d[len - 1] == 0)
+  {
+    len--;
+  }
+  char *s = malloc(9 * len + 2);
+  CHECK(s != NULL);
+  int n = sprintf(s, "%u", d[len - 1]);
+  for (size_t i = len - 1; i-- > 0;)
+  {
+    n += sprintf(s + n, "%09u", d[i]);
+  }
+  return s;
+}
+
+// Walk F(0), F(1), ... up to F(NMAX) by additions, keeping the digits
+// of the wanted ones.
+static void make_reference(void)
+{
+  size_t cap = NMAX / 40 + 2;
+  uint32_t *a = calloc(cap, sizeof(uint32_t)), *b = calloc(cap, sizeof(uint32_t));
+  CHECK(a != NULL && b != NULL);
+  size_t len = 1;
+  b[0] = 1;
+
+  for (uint64_t n = 0; n <= NMAX; n++)
+  {
+    // a = F(n), b = F(n + 1).
+    if (reference[n] != NULL)
+    {
+      reference[n] = limbs_decimal(a, len);
+    }
+    uint32_t carry = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+      uint32_t sum = a[i] + b[i] + carry;
+      carry = sum >= 1000000000;
+      a[i] = b[i];
+      b[i] = carry ? sum - 1000000000 : sum;
+    }
+    if (carry)
+    {
+      CHECK(len < cap);
+      a[len] = 0;
+      b[len++] = 1;
+    }
+  }
+  free(a);
+  free(b);
+}
+
+// Ask for F(n) with a small buffer, which only the shorter numbers fit.
+static void check(struct fib_memo *memo, uint64_t n)
+{
+  char buf[64];
+  char *s = fib_decimal(memo, n, buf, sizeof(buf));
+  size_t len = strlen(reference[n]);
+  CHECK((s == buf) == (len < sizeof(buf)));
+  if (strcmp(s, reference[n]) != 0)
+  {
+    errx(1, "F(%llu) is wrong", (unsigned long long)n);
+  }
+  if (s != buf)
+  {
+    free(s);
+  }
+}
+
+static void shuffle(uint32_t *v, size_t n, uint64_t *rng)
+{
+  for (size_t i = n; i > 1; i--)
+  {
+    size_t j = test_rand(rng) % i;
+    uint32_t tmp = v[i - 1];
+    v[i - 1] = v[j];
+    v[j] = tmp;
+  }
+}
+
+struct worker
+{
+  struct fib_memo *memo;
+  uint64_t rng;
+};
+
+static void *worker_main(void *arg)
+{
+  struct worker *w = arg;
+  uint32_t *order = malloc(nwanted * sizeof(uint32_t));
+  CHECK(order != NULL);
+  memcpy(order, wanted, nwanted * sizeof(uint32_t));
+  shuffle(order, nwanted, &w->rng);
+  for (size_t i = 0; i < nwanted; i++)
+  {
+    check(w->memo, order[i]);
+  }
+  free(order);
+  return NULL;
+}
+
+int main(void)
+{
+  uint64_t rng = 0x853c49e6748fea9bULL;
+  wanted = malloc((NMAX + 1) * sizeof(uint32_t));
+  reference = calloc(NMAX + 1, sizeof(char *));
+  CHECK(wanted != NULL && reference != NULL);
+
+  for (uint64_t n = 0; n <= 2500; n++)
+  {
+    want(n);
+  }
+  for (uint64_t n = FIB_MEMO_MIN - 2 * FIB_STEP_MAX; n <= FIB_MEMO_MIN + 2 * FIB_STEP_MAX; n++)
+  {
+    want(n);
+  }
+  for (int i = 0; i < 40; i++)
+  {
+    uint64_t center = FIB_MEMO_MIN + test_rand(&rng) % (NMAX - FIB_MEMO_MIN - FIB_STEP_MAX);
+    want(center);
+    want(center + 1);
+    want(center - 1);
+    want(center + 1 + test_rand(&rng) % (2 * FIB_STEP_MAX));
+    want(center - 1 - test_rand(&rng) % (2 * FIB_STEP_MAX));
+    want(center * 2);
+    want(center * 2 + 1);
+  }
+  want(NMAX);
+  make_reference();
+
+  printf("  %zu numbers without a memo\n", nwanted);
+  for (size_t i = 0; i < nwanted; i++)
+  {
+    check(NULL, wanted[i]);
+  }
+
+  struct fib_memo memo;
+  printf("  in random order, with a memo\n");
+  CHECK(fib_memo_init(&memo, 0) == 0);
+  struct worker w = {&memo, rng};
+  worker_main(&w);
+  worker_main(&w);
+  fib_memo_destroy(&memo);
+
+  printf("  with a memo that fills up\n");
+  CHECK(fib_memo_init(&memo, 1 << 16) == 0);
+  worker_main(&w);
+  fib_memo_destroy(&memo);
+
+  printf("  from %d threads sharing a memo\n", THREADS);
+  CHECK(fib_memo_init(&memo, 0) == 0);
+  pthread_t t[THREADS];
+  struct worker workers[THREADS];
+  for (int i = 0; i < THREADS; i++)
+  {
+    workers[i] = (struct worker){&memo, rng + (uint64_t)i + 1};
+    CHECK(pthread_create(&t[i], NULL, worker_main, &workers[i]) == 0);
+  }
+  for (int i = 0; i < THREADS; i++)
+  {
+    pthread_join(t[i], NULL);
+  }
+  fib_memo_destroy(&memo);
+
+  for (size_t i = 0; i < nwanted; i++)
+  {
+    free(reference[wanted[i]]);
+  }
+  free(reference);
+  free(wanted);
+  return 0;
+}
@@ -0,0 +1,297 @@
+// Tests of hist_cache over several runs on one cache file, using made-up
+// file metadata: results come back after a reopen, any change to a
+// file's key makes it miss, new versions of a file are appended until
+// stale entries outnumber live ones and the file is compacted, an
+// explicit compaction keeps only what this run used, invalid and
+// truncated files are replaced, and additions from several threads
+// all arrive.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "hist_cache.h"
+#include "test.h"
+
+// The cache file starts with a 16-byte header.
+#define HEADER_SIZE 16
+#define ENTRY_SIZE sizeof(struct hist_cache_entry)
+
+#define FILES 10
+#define THREADS 4
+#define THREAD_FILES 1000
+
+static char dir[] = "/tmp/test-hist-cache.XXXXXX";
+static char path[sizeof(dir) + 16];
+
+// Metadata of version 'version' of file 'ino'.
+static void make_stat(struct stat *st, int ino, int version)
+{
+  memset(st, 0, sizeof(struct stat));
+  st->st_dev = 1;
+  st->st_ino = (ino_t)ino;
+  st->st_size = 1000 + ino;
+  st->st_mtim.tv_sec = 1000000000 + version;
+  st->st_mtim.tv_nsec = 500;
+  st->st_ctim.tv_sec = 1000000000 + version;
+  st->st_ctim.tv_nsec = 700;
+}
+
+// The histogram cached for that version.
+static void make_bits(int64_t bits[8], int ino, int version)
+{
+  for (int b = 0; b < 8; b++)
+  {
+    bits[b] = (int64_t)ino * 1000 + version * 10 + b;
+  }
+}
+
+static void add(struct hist_cache *c, int ino, int version)
+{
+  struct stat st;
+  struct hist_cache_key key;
+  int64_t bits[8];
+  make_stat(&st, ino, version);
+  hist_cache_key_init(&key, &st);
+  make_bits(bits, ino, version);
+  hist_cache_add(c, &key, bits);
+}
+
+// Whether version 'version' of file 'ino' is a hit, checking that a hit
+// adds the right counts to what was already there.
+static int hit(struct hist_cache *c, int ino, int version)
+{
+  struct stat st;
+  int64_t bits[8], want[8];
+  make_stat(&st, ino, version);
+  make_bits(want, ino, version);
+  for (int b = 0; b < 8; b++)
+  {
+    bits[b] = 3;
+    want[b] += 3;
+  }
+  if (!hist_cache_lookup(c, &st, bits))
+  {
+    return 0;
+  }
+  CHECK(memcmp(bits, want, sizeof(bits)) == 0);
+  return 1;
+}
+
+static off_t file_size(void)
+{
+  struct stat st;
+  CHECK(stat(path, &st) == 0);
+  return st.st_size;
+}
+
+static off_t entries_size(size_t n)
+{
+  return (off_t)(HEADER_SIZE + n * ENTRY_SIZE);
+}
+
+// Run f with stderr sent to /dev/null, for expected warnings.
+static int quietly(int (*f)(struct hist_cache *, const char *), struct hist_cache *c)
+{
+  fflush(stderr);
+  int saved = dup(2), null = open("/dev/null", O_WRONLY);
+  CHECK(saved >= 0 && null >= 0);
+  dup2(null, 2);
+  int r = f(c, path);
+  fflush(stderr);
+  dup2(saved, 2);
+  close(saved);
+  close(null);
+  return r;
+}
+
+static void write_file(const char *data, size_t len, int append)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+  CHECK(fd >= 0);
+  CHECK(write(fd, data, len) == (ssize_t)len);
+  close(fd);
+}
+
+struct adder
+{
+  struct hist_cache *c;
+  int first;
+};
+
+static void *adder_main(void *arg)
+{
+  struct adder *a = arg;
+  for (int i = 0; i < THREAD_FILES; i++)
+  {
+    CHECK(!hit(a->c, a->first + i, 0));
+    add(a->c, a->first + i, 0);
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  struct hist_cache c;
+  struct stat st;
+  int64_t bits[8];
+
+  CHECK(mkdtemp(dir) != NULL);
+  snprintf(path, sizeof(path), "%s/cache", dir);
+
+  // A new cache is empty, and written on close.
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(!hit(&c, i, 0));
+    add(&c, i, 0);
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(FILES));
+
+  // Reopened, every file hits, but not if anything in its key changed.
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(hit(&c, i, 0));
+    CHECK(!hit(&c, i, 1));
+  }
+  make_stat(&st, 0, 0);
+  st.st_size++;
+  CHECK(!hist_cache_lookup(&c, &st, bits));
+  make_stat(&st, 0, 0);
+  st.st_mtim.tv_nsec++;
+  CHECK(!hist_cache_lookup(&c, &st, bits));
+  make_stat(&st, 0, 0);
+  st.st_ctim.tv_nsec++;
+  CHECK(!hist_cache_lookup(&c, &st, bits));
+  make_stat(&st, 0, 0);
+  st.st_dev++;
+  CHECK(!hist_cache_lookup(&c, &st, bits));
+  make_stat(&st, FILES, 0);
+  CHECK(!hist_cache_lookup(&c, &st, bits));
+
+  // New versions of some files are appended, and replace the old ones.
+  for (int i = 0; i < 4; i++)
+  {
+    add(&c, i, 1);
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(FILES + 4));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(hit(&c, i, i < 4 ? 1 : 0));
+    CHECK(!hit(&c, i, i < 4 ? 0 : 1));
+  }
+  for (int i = 0; i < 6; i++)
+  {
+    add(&c, i, 2);
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  // 10 stale entries, 10 live ones: still appended.
+  CHECK(file_size() == entries_size(FILES + 4 + 6));
+
+  // Once stale entries outnumber live ones, the file is compacted.
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(hit(&c, i, i < 6 ? 2 : 0));
+    add(&c, i, 3);
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(FILES));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(hit(&c, i, 3));
+    CHECK(!hit(&c, i, 2));
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(FILES));
+
+  // An explicit compaction keeps only what was looked up or added.
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < 5; i++)
+  {
+    CHECK(hit(&c, i, 3));
+  }
+  add(&c, 100, 0);
+  CHECK(hist_cache_close(&c, 1) == 0);
+  CHECK(file_size() == entries_size(6));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < FILES; i++)
+  {
+    CHECK(hit(&c, i, 3) == (i < 5));
+  }
+  CHECK(hit(&c, 100, 0));
+
+  // A partial entry at the end (from a run that died while appending)
+  // is dropped by rewriting the file, keeping the rest.
+  CHECK(hist_cache_close(&c, 0) == 0);
+  write_file("partial", 7, 1);
+  CHECK(hist_cache_open(&c, path) == 0);
+  for (int i = 0; i < 5; i++)
+  {
+    CHECK(hit(&c, i, 3));
+  }
+  add(&c, 101, 0);
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(7));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  CHECK(hit(&c, 0, 3));
+  CHECK(hit(&c, 101, 0));
+  CHECK(hist_cache_close(&c, 0) == 0);
+
+  // A file that is not a cache is ignored, then replaced.
+  write_file("not a histogram cache at all", 28, 0);
+  CHECK(quietly(hist_cache_open, &c) == 0);
+  CHECK(!hit(&c, 0, 3));
+  add(&c, 0, 4);
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(1));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  CHECK(hit(&c, 0, 4));
+  CHECK(hist_cache_close(&c, 0) == 0);
+
+  // Lookups and additions from several threads.
+  CHECK(hist_cache_open(&c, path) == 0);
+  pthread_t t[THREADS];
+  struct adder a[THREADS];
+  for (int i = 0; i < THREADS; i++)
+  {
+    a[i] = (struct adder){&c, 1000 + i * THREAD_FILES};
+    CHECK(pthread_create(&t[i], NULL, adder_main, &a[i]) == 0);
+  }
+  for (int i = 0; i < THREADS; i++)
+  {
+    pthread_join(t[i], NULL);
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+  CHECK(file_size() == entries_size(1 + THREADS * THREAD_FILES));
+
+  CHECK(hist_cache_open(&c, path) == 0);
+  CHECK(hit(&c, 0, 4));
+  for (int i = 0; i < THREADS * THREAD_FILES; i++)
+  {
+    CHECK(hit(&c, 1000 + i, 0));
+  }
+  CHECK(hist_cache_close(&c, 0) == 0);
+
+  unlink(path);
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,448 @@
+// Tests of job_queue, for both queue kinds: FIFO order of single and
+// batched pushes and pops, every element arriving exactly once with
+// several producers and consumers, the adaptive ring of a locked queue
+// growing and shrinking, and destroying a queue while consumers are
+// blocked in (or still spinning on) it.
+
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "job_queue.h"
+#include "test.h"
+
+#define ITEMS 20000
+#define BATCH 7
+#define THREADS 4
+
+static const enum job_queue_kind kinds[] = {JOB_QUEUE_LOCKED, JOB_QUEUE_LOCKFREE};
+
+static const char *kind_name(enum job_queue_kind kind)
+{
+  return kind == JOB_QUEUE_LOCKED ? "locked" : "lock-free";
+}
+
+static void sleep_us(long us)
+{
+  struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+// Elements are 1 + producer * ITEMS + i, so that no element is NULL and
+// each one tells which producer pushed it, and in what order.
+static void *element(int producer, int i)
+{
+  return (void *)(uintptr_t)(1 + (uintptr_t)producer * ITEMS + (uintptr_t)i);
+}
+
+// Single-threaded: what goes in comes out in the same order, whether
+// pushed and popped one at a time or in batches, across many turns of
+// a small ring.
+static void test_fifo(enum job_queue_kind kind)
+{
+  struct job_queue q;
+  void *buf[BATCH];
+  CHECK(job_queue_init_kind(&q, 5, kind) == 0);
+
+  int pushed = 0, popped = 0;
+  for (int round = 0; round < 1000; round++)
+  {
+    int n = 1 + round % 4;
+    if (round % 2 == 0)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        CHECK(job_queue_push(&q, element(0, pushed++)) == 0);
+      }
+    }
+    else
+    {
+      for (int i = 0; i < n; i++)
+      {
+        buf[i] = element(0, pushed++);
+      }
+      CHECK(job_queue_push_many(&q, buf, n) == n);
+    }
+
+    if (round % 3 == 0)
+    {
+      while (popped < pushed)
+      {
+        void *data;
+        CHECK(job_queue_pop(&q, &data) == 0);
+        CHECK(data == element(0, popped++));
+      }
+    }
+    else
+    {
+      while (popped < pushed)
+      {
+        int got = job_queue_pop_many(&q, buf, BATCH);
+        CHECK(got >= 1 && got <= pushed - popped);
+        for (int i = 0; i < got; i++)
+        {
+          CHECK(buf[i] == element(0, popped++));
+        }
+      }
+    }
+  }
+
+  // try_push fills the ring, then refuses.
+  int room = 0;
+  while (job_queue_try_push(&q, element(0, room)) == 0)
+  {
+    room++;
+    CHECK(room <= 5);
+  }
+  CHECK(room == 5);
+  for (int i = 0; i < room; i++)
+  {
+    void *data;
+    CHECK(job_queue_pop(&q, &data) == 0);
+    CHECK(data == element(0, i));
+  }
+
+  CHECK(job_queue_destroy(&q) == 0);
+}
+
+struct producer
+{
+  struct job_queue *q;
+  int id;
+  int batch;
+};
+
+struct consumer
+{
+  struct job_queue *q;
+  int batch;
+  int *seen;      /* per element: times popped (atomic) */
+  int *last;      /* per producer: last index seen by this consumer */
+  int count;
+};
+
+static void *producer_main(void *arg)
+{
+  struct producer *p = arg;
+  void *buf[BATCH];
+
+  for (int i = 0; i < ITEMS;)
+  {
+    int n = 0;
+    while (n < p->batch && i < ITEMS)
+    {
+      buf[n++] = element(p->id, i++);
+    }
+    if (p->batch == 1 ? job_queue_push(p->q, buf[0]) != 0
+                      : job_queue_push_many(p->q, buf, n) != n)
+    {
+      errx(1, "push failed");
+    }
+  }
+  return NULL;
+}
+
+static void *consumer_main(void *arg)
+{
+  struct consumer *c = arg;
+  void *buf[BATCH];
+
+  for (;;)
+  {
+    int n = c->batch == 1 ? (job_queue_pop(c->q, buf) == 0 ? 1 : -1)
+                          : job_queue_pop_many(c->q, buf, c->batch);
+    if (n < 0)
+    {
+      return NULL;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      uintptr_t v = (uintptr_t)buf[i] - 1;
+      int producer = (int)(v / ITEMS), index = (int)(v % ITEMS);
+      CHECK(producer < THREADS);
+      __atomic_add_fetch(&c->seen[v], 1, __ATOMIC_RELAXED);
+
+      // Elements of one producer come out in the order it pushed them.
+      CHECK(index > c->last[producer]);
+      c->last[producer] = index;
+      c->count++;
+    }
+  }
+}
+
+// Several producers and consumers: every element arrives exactly once,
+// and each consumer sees the elements of a producer in order.
+static void test_threads(enum job_queue_kind kind, int capacity, int batch)
+{
+  struct job_queue q;
+  pthread_t producers[THREADS], consumers[THREADS];
+  struct producer p[THREADS];
+  struct consumer c[THREADS];
+  int *seen = calloc(THREADS * ITEMS, sizeof(int));
+  CHECK(seen != NULL);
+  CHECK(job_queue_init_kind(&q, capacity, kind) == 0);
+
+  for (int i = 0; i < THREADS; i++)
+  {
+    c[i] = (struct consumer){&q, batch, seen, calloc(THREADS, sizeof(int)), 0};
+    CHECK(c[i].last != NULL);
+    for (int j = 0; j < THREADS; j++)
+    {
+      c[i].last[j] = -1;
+    }
+    CHECK(pthread_create(&consumers[i], NULL, consumer_main, &c[i]) == 0);
+  }
+  for (int i = 0; i < THREADS; i++)
+  {
+    p[i] = (struct producer){&q, i, batch};
+    CHECK(pthread_create(&producers[i], NULL, producer_main, &p[i]) == 0);
+  }
+
+  for (int i = 0; i < THREADS; i++)
+  {
+    pthread_join(producers[i], NULL);
+  }
+  CHECK(job_queue_destroy(&q) == 0);
+
+  int total = 0;
+  for (int i = 0; i < THREADS; i++)
+  {
+    pthread_join(consumers[i], NULL);
+    total += c[i].count;
+    free(c[i].last);
+  }
+  CHECK(total == THREADS * ITEMS);
+  for (int i = 0; i < THREADS * ITEMS; i++)
+  {
+    CHECK(seen[i] == 1);
+  }
+  free(seen);
+}
+
+static int queue_capacity(struct job_queue *q)
+{
+  pthread_mutex_lock(&q->mutex);
+  int capacity = q->capacity;
+  pthread_mutex_unlock(&q->mutex);
+  return capacity;
+}
+
+static void *pop_one_main(void *arg)
+{
+  void *data;
+  CHECK(job_queue_pop(arg, &data) == 0);
+  CHECK(data == element(0, 0));
+  return NULL;
+}
+
+// A locked queue with a larger maximum capacity grows when a push finds
+// it full after a consumer ran dry, and not otherwise; it shrinks back
+// after a stretch of pops that kept it at most a quarter full.
+static void test_adaptive(void)
+{
+  struct job_queue q;
+  void *data;
+
+  CHECK(job_queue_init_kind(&q, 4, JOB_QUEUE_LOCKFREE) == 0);
+  CHECK(job_queue_set_max_capacity(&q, 64) != 0);
+  CHECK(job_queue_destroy(&q) == 0);
+
+  CHECK(job_queue_init_kind(&q, 4, JOB_QUEUE_LOCKED) == 0);
+  CHECK(job_queue_set_max_capacity(&q, 2) != 0);
+  CHECK(job_queue_set_max_capacity(&q, 16) == 0);
+
+  // Without a starved consumer a full ring does not grow.
+  for (int i = 0; i < 4; i++)
+  {
+    CHECK(job_queue_push(&q, element(0, i)) == 0);
+  }
+  CHECK(job_queue_try_push(&q, element(0, 4)) != 0);
+  CHECK(queue_capacity(&q) == 4);
+  for (int i = 0; i < 4; i++)
+  {
+    CHECK(job_queue_pop(&q, &data) == 0);
+    CHECK(data == element(0, i));
+  }
+
+  // Let a consumer block on the empty queue.
+  pthread_t t;
+  CHECK(pthread_create(&t, NULL, pop_one_main, &q) == 0);
+  for (;;)
+  {
+    pthread_mutex_lock(&q.mutex);
+    int starved = q.starved;
+    pthread_mutex_unlock(&q.mutex);
+    if (starved)
+    {
+      break;
+    }
+    sleep_us(100);
+  }
+  CHECK(job_queue_push(&q, element(0, 0)) == 0);
+  pthread_join(t, NULL);
+
+  // Now the ring doubles instead of blocking, once, keeping the order
+  // of the elements (which start part-way round the ring).
+  for (int i = 0; i < 5; i++)
+  {
+    CHECK(job_queue_push(&q, element(0, i)) == 0);
+  }
+  CHECK(queue_capacity(&q) == 8);
+  for (int i = 5; i < 8; i++)
+  {
+    CHECK(job_queue_push(&q, element(0, i)) == 0);
+  }
+  CHECK(job_queue_try_push(&q, element(0, 8)) != 0);
+  CHECK(queue_capacity(&q) == 8);
+  for (int i = 0; i < 8; i++)
+  {
+    CHECK(job_queue_pop(&q, &data) == 0);
+    CHECK(data == element(0, i));
+  }
+  CHECK(queue_capacity(&q) == 8);
+
+  // A ring's worth of pops that never found more than one element
+  // halves it, but not below the initial capacity.
+  for (int i = 0; i < 32; i++)
+  {
+    CHECK(job_queue_push(&q, element(0, i)) == 0);
+    CHECK(job_queue_pop(&q, &data) == 0);
+    CHECK(data == element(0, i));
+  }
+  CHECK(queue_capacity(&q) == 4);
+
+  // Lowering the maximum below the current capacity shrinks the ring
+  // if the elements fit.  (No other thread uses the queue, so it is
+  // safe to pretend a consumer ran dry to grow it first.)
+  q.starved = 1;
+  for (int i = 0; i < 5; i++)
+  {
+    CHECK(job_queue_push(&q, element(0, i)) == 0);
+  }
+  CHECK(queue_capacity(&q) == 8);
+  CHECK(job_queue_pop(&q, &data) == 0);
+  CHECK(job_queue_set_max_capacity(&q, 4) == 0);
+  CHECK(queue_capacity(&q) == 4);
+  for (int i = 1; i < 5; i++)
+  {
+    CHECK(job_queue_pop(&q, &data) == 0);
+    CHECK(data == element(0, i));
+  }
+
+  CHECK(job_queue_destroy(&q) == 0);
+}
+
+struct drainer
+{
+  struct job_queue *q;
+  int batch;
+  int count;
+};
+
+static void *drainer_main(void *arg)
+{
+  struct drainer *d = arg;
+  void *buf[BATCH];
+  int n;
+
+  while ((n = d->batch == 1 ? (job_queue_pop(d->q, buf) == 0 ? 1 : -1)
+                            : job_queue_pop_many(d->q, buf, d->batch)) > 0)
+  {
+    d->count += n;
+  }
+  return NULL;
+}
+
+// Threads currently inside a queue operation.
+static int threads_inside(struct job_queue *q)
+{
+  int n = 0;
+  for (int i = 0; i < JOB_QUEUE_GATE_STRIPES; i++)
+  {
+    n += __atomic_load_n(&q->gate[i].users, __ATOMIC_SEQ_CST);
+  }
+  return n;
+}
+
+// Destroy a queue while consumers wait on it, at various points: as
+// soon as they are all inside it (lock-free consumers are then still
+// spinning on the empty ring), and once they may have parked.  Destroy
+// must wait for the elements to be taken, make every consumer return an
+// error, and not return while any of them is still inside the queue:
+// the queue is overwritten and freed as soon as it does.
+static void test_destroy(enum job_queue_kind kind)
+{
+  for (int it = 0; it < 300; it++)
+  {
+    struct job_queue *q = malloc(sizeof(struct job_queue));
+    CHECK(q != NULL);
+    CHECK(job_queue_init_kind(q, 4, kind) == 0);
+
+    pthread_t t[THREADS];
+    struct drainer d[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+      d[i] = (struct drainer){q, i % 2 == 0 ? 1 : BATCH, 0};
+      CHECK(pthread_create(&t[i], NULL, drainer_main, &d[i]) == 0);
+    }
+
+    int pushed = it % 7;
+    for (int i = 0; i < pushed; i++)
+    {
+      CHECK(job_queue_push(q, element(0, i)) == 0);
+    }
+    while (threads_inside(q) < THREADS)
+    {
+      sched_yield();
+    }
+    switch (it % 3)
+    {
+    case 0:
+      break;
+    case 1:
+      sched_yield();
+      break;
+    case 2:
+      sleep_us(1000);
+      break;
+    }
+
+    CHECK(job_queue_destroy(q) == 0);
+    memset(q, 0xa5, sizeof(struct job_queue));
+    free(q);
+
+    int popped = 0;
+    for (int i = 0; i < THREADS; i++)
+    {
+      pthread_join(t[i], NULL);
+      popped += d[i].count;
+    }
+    CHECK(popped == pushed);
+  }
+}
+
+int main(void)
+{
+  for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+  {
+    printf("  %s: order\n", kind_name(kinds[k]));
+    test_fifo(kinds[k]);
+    printf("  %s: producers and consumers\n", kind_name(kinds[k]));
+    test_threads(kinds[k], 3, 1);
+    test_threads(kinds[k], 3, BATCH);
+    test_threads(kinds[k], 64, BATCH);
+    printf("  %s: destroy with waiting consumers\n", kind_name(kinds[k]));
+    test_destroy(kinds[k]);
+  }
+  printf("  locked: adaptive capacity\n");
+  test_adaptive();
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Tests of memsearch against memmem(), for every implementation the CPU
+// supports: random haystacks and needles over small alphabets (so that
+// the two-byte filter often passes and verification decides), at every
+// alignment, and with the haystack ending right at an unmapped page or
+// starting right after one, so that reading a byte outside the buffer
+// crashes the test.  memsearch_count_byte() is checked the same way.
+
+// Setting _GNU_SOURCE is necessary for memmem() on GNU/Linux systems.
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memsearch.h"
+#include "test.h"
+
+#define TRIALS 5000
+#define MAX_HAY 300
+#define ALIGNMENTS 64
+
+static const int impls[] = {MEMSEARCH_SCALAR, MEMSEARCH_SSE2, MEMSEARCH_AVX2};
+static const char *const impl_names[] = {"scalar", "sse2", "avx2"};
+
+// The bytes haystacks and needles are made of.  'Z' and '\0' are rare
+// enough for the memchr() skip; the last alphabet is every byte.
+static const char *const alphabets[] = {"ab", "abc\n", "aZ", "a\0b"};
+static const size_t alphabet_lens[] = {2, 4, 2, 3, 256};
+
+// Memory with an unmapped page on either side of 'len' usable bytes.
+struct guarded
+{
+  char *map, *data, *end;
+  size_t map_len;
+};
+
+static void guarded_init(struct guarded *g, size_t len)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t data_len = (len + page - 1) / page * page;
+  g->map_len = data_len + 2 * page;
+  g->map = mmap(NULL, g->map_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(g->map != MAP_FAILED);
+  g->data = g->map + page;
+  g->end = g->data + data_len;
+  CHECK(mprotect(g->data, data_len, PROT_READ | PROT_WRITE) == 0);
+}
+
+static void guarded_destroy(struct guarded *g)
+{
+  munmap(g->map, g->map_len);
+}
+
+static char random_byte(uint64_t *rng, int alphabet)
+{
+  if (alphabet == 4)
+  {
+    return (char)test_below(rng, 256);
+  }
+  return alphabets[alphabet][test_below(rng, (unsigned)alphabet_lens[alphabet])];
+}
+
+static size_t count_naive(const char *buf, size_t len, unsigned char c)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    n += (unsigned char)buf[i] == c;
+  }
+  return n;
+}
+
+// Search hay[0..len) (wherever it has been copied to) with every
+// implementation.
+static void check_at(const struct memsearch *searches, const char *const *names,
+                     int nsearches, const char *needle, size_t nlen,
+                     const char *hay, size_t len, unsigned char c)
+{
+  const char *want = memmem(hay, len, needle, nlen);
+  for (int i = 0; i < nsearches; i++)
+  {
+    const char *got = memsearch_find(&searches[i], hay, len);
+    if (got != want)
+    {
+      errx(1, "%s: needle of %zu bytes in %zu bytes at alignment %zu: "
+           "found at %td, expected %td", names[i], nlen, len,
+           (size_t)((uintptr_t)hay % ALIGNMENTS),
+           got == NULL ? (ptrdiff_t)-1 : got - hay,
+           want == NULL ? (ptrdiff_t)-1 : want - hay);
+    }
+  }
+  CHECK(memsearch_count_byte(hay, len, c) == count_naive(hay, len, c));
+}
+
+int main(void)
+{
+  uint64_t rng = 0x9e3779b97f4a7c15ULL;
+  struct guarded g;
+  guarded_init(&g, MAX_HAY + 2 * ALIGNMENTS);
+
+  struct memsearch searches[3];
+  const char *names[3];
+  char hay[MAX_HAY], needle[MAX_HAY];
+
+  for (int trial = 0; trial < TRIALS; trial++)
+  {
+    int alphabet = (int)test_below(&rng, 5);
+    size_t len = test_below(&rng, 8) == 0 ? test_below(&rng, 8)
+                                          : test_below(&rng, MAX_HAY + 1);
+    for (size_t i = 0; i < len; i++)
+    {
+      hay[i] = random_byte(&rng, alphabet);
+    }
+
+    // Mostly short needles; taken from the haystack half of the time,
+    // including a needle that ends at its last byte.
+    size_t nlen = test_below(&rng, 4) == 0 ? test_below(&rng, 70) : test_below(&rng, 12);
+    switch (test_below(&rng, 4))
+    {
+    case 0:
+    case 1:
+      for (size_t i = 0; i < nlen; i++)
+      {
+        needle[i] = random_byte(&rng, alphabet);
+      }
+      break;
+    case 2:
+      nlen = nlen > len ? len : nlen;
+      memcpy(needle, hay + test_below(&rng, (unsigned)(len - nlen + 1)), nlen);
+      break;
+    case 3:
+      // The end of the haystack, with a changed last byte half of the
+      // time, so a match is only cut off by the end of the buffer.
+      nlen = nlen > len ? len : nlen;
+      memcpy(needle, hay + len - nlen, nlen);
+      if (nlen > 0 && test_below(&rng, 2))
+      {
+        needle[nlen - 1] ^= 1;
+      }
+      break;
+    }
+
+    int nsearches = 0;
+    for (int i = 0; i < 3; i++)
+    {
+      if (memsearch_init_impl(&searches[nsearches], needle, nlen, impls[i]) == 0)
+      {
+        names[nsearches++] = impl_names[i];
+      }
+      else if (trial == 0)
+      {
+        printf("  %s: not supported by this CPU\n", impl_names[i]);
+      }
+    }
+    CHECK(nsearches >= 1);
+    unsigned char c = (unsigned char)random_byte(&rng, alphabet);
+
+    for (size_t align = 0; align < ALIGNMENTS; align++)
+    {
+      char *at = g.data + align;
+      memcpy(at, hay, len);
+      check_at(searches, names, nsearches, needle, nlen, at, len, c);
+
+      at = g.end - len - align;
+      memcpy(at, hay, len);
+      check_at(searches, names, nsearches, needle, nlen, at, len, c);
+    }
+  }
+
+  guarded_destroy(&g);
+  return 0;
+}
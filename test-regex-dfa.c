@@ -0,0 +1,381 @@
+// Tests of regex_dfa against the C library's POSIX extended regular
+// expressions (regcomp() with REG_EXTENDED), applied line by line.
+// Random patterns use the syntax both share: literals, '.', bracket
+// expressions, groups, alternation, the repetition operators, and
+// anchors.  They are matched against random lines, with and without
+// ignoring case, one to three patterns at a time, and as literal
+// strings.  One pattern needs more DFA states than the cache holds, to
+// test finishing lines by simulating the NFA.  Runs of anchors, which
+// the C library gets wrong when repeated, are also checked against
+// fixed results from grep -E.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+#include <sys/types.h>
+
+#include "regex_dfa.h"
+#include "test.h"
+
+#define TRIALS 4000
+#define MAX_REGEX 256
+#define MAX_TEXT 512
+#define MAX_LINES 32
+
+struct gen
+{
+  uint64_t rng;
+  char *p, *end;
+  int anchored;  /* an anchor was emitted */
+};
+
+static void emit(struct gen *g, const char *s)
+{
+  size_t len = strlen(s);
+  CHECK(g->p + len < g->end);
+  memcpy(g->p, s, len + 1);
+  g->p += len;
+}
+
+static void gen_alt(struct gen *g, int depth);
+
+// Room left for the pattern, which stops it growing.
+static int room(const struct gen *g, int bytes)
+{
+  return g->end - g->p > bytes;
+}
+
+static void gen_atom(struct gen *g, int depth)
+{
+  static const char *const atoms[] = {
+    "a", "b", "c", "A", ".", "[ab]", "[^a]", "[a-c]", "[[:upper:]c]", "\\.", "\\w",
+  };
+  if (depth < 3 && room(g, 128) && test_below(&g->rng, 5) == 0)
+  {
+    emit(g, "(");
+    gen_alt(g, depth + 1);
+    emit(g, ")");
+    return;
+  }
+  // Mostly plain letters, so that lines often match.
+  unsigned n = sizeof(atoms) / sizeof(atoms[0]);
+  emit(g, atoms[test_below(&g->rng, 3) ? test_below(&g->rng, 3) : test_below(&g->rng, n)]);
+}
+
+static void gen_piece(struct gen *g, int depth)
+{
+  static const char *const repeats[] = {
+    "*", "+", "?", "{2}", "{0,1}", "{1,}", "{1,3}", "{0,2}",
+  };
+  // Anchors may go anywhere, even repeated or nested ("^^a", "(c$)$"),
+  // but nothing holding one is repeated: the C library gets that wrong
+  // (it finds "(b$){2}" in "bb").
+  if (test_below(&g->rng, 12) == 0)
+  {
+    emit(g, test_below(&g->rng, 2) ? "^" : "$");
+    g->anchored = 1;
+    return;
+  }
+  int anchored = g->anchored;
+  g->anchored = 0;
+  gen_atom(g, depth);
+  int repeat = !g->anchored && test_below(&g->rng, 4) == 0;
+  g->anchored |= anchored;
+  if (repeat)
+  {
+    emit(g, repeats[test_below(&g->rng, sizeof(repeats) / sizeof(repeats[0]))]);
+  }
+}
+
+// Anchors mostly begin or end a whole pattern's branches.
+static void gen_branch(struct gen *g, int depth)
+{
+  if (depth == 0 && test_below(&g->rng, 3) == 0)
+  {
+    emit(g, "^");
+    g->anchored = 1;
+  }
+  for (unsigned i = 1 + test_below(&g->rng, 4); i > 0 && room(g, 32); i--)
+  {
+    gen_piece(g, depth);
+  }
+  if (depth == 0 && test_below(&g->rng, 3) == 0)
+  {
+    emit(g, "$");
+    g->anchored = 1;
+  }
+}
+
+static void gen_alt(struct gen *g, int depth)
+{
+  gen_branch(g, depth);
+  while (room(g, 64) && test_below(&g->rng, 4) == 0)
+  {
+    emit(g, "|");
+    gen_branch(g, depth);
+  }
+}
+
+// Random lines of a few letters, so that short patterns often match.
+static size_t gen_text(uint64_t *rng, char *text, const char *alphabet, unsigned max_line)
+{
+  size_t len = 0, n = strlen(alphabet);
+  for (unsigned lines = 1 + test_below(rng, MAX_LINES); lines > 0; lines--)
+  {
+    for (unsigned i = test_below(rng, max_line + 1); i > 0 && len < MAX_TEXT - 1; i--)
+    {
+      text[len++] = alphabet[test_below(rng, (unsigned)n)];
+    }
+    if (len == MAX_TEXT - 1)
+    {
+      break;
+    }
+    text[len++] = '\n';
+  }
+  // The last line need not end in a newline.
+  if (len > 1 && test_below(rng, 2))
+  {
+    len--;
+  }
+  return len;
+}
+
+// Whether line[0..len) matches the compiled pattern.
+static int line_matches(const regex_t *re, const char *line, size_t len)
+{
+  char buf[MAX_TEXT + 1];
+  memcpy(buf, line, len);
+  buf[len] = '\0';
+  return regexec(re, buf, 0, NULL, 0) == 0;
+}
+
+// Check regex_dfa_find() on text[0..len) against regexec() on each
+// line: it must point into the first line some pattern matches, and
+// report a pattern that matches that line.
+static void check(const char *const *patterns, size_t n, int flags, const char *text,
+                  size_t len)
+{
+  regex_t ref[3];
+  struct regex_dfa re;
+  CHECK(n <= 3);
+  for (size_t i = 0; i < n; i++)
+  {
+    int cflags = REG_EXTENDED | REG_NOSUB | (flags & REGEX_DFA_ICASE ? REG_ICASE : 0);
+    if (regcomp(&ref[i], patterns[i], cflags) != 0)
+    {
+      errx(1, "regcomp() rejects %s", patterns[i]);
+    }
+  }
+  if (regex_dfa_init(&re, patterns, n, flags) != 0)
+  {
+    errx(1, "regex_dfa_init() rejects %s: %s", patterns[re.error_pattern],
+         re.error != NULL ? re.error : "out of memory");
+  }
+
+  // The expected line.
+  const char *line = text, *end = text + len, *want = NULL;
+  size_t want_line = 0;
+  for (; line < end && want == NULL; want_line++)
+  {
+    const char *eol = memchr(line, '\n', (size_t)(end - line));
+    eol = eol == NULL ? end : eol;
+    for (size_t i = 0; i < n && want == NULL; i++)
+    {
+      if (line_matches(&ref[i], line, (size_t)(eol - line)))
+      {
+        want = line;
+      }
+    }
+    line = eol + 1;
+  }
+
+  int pattern = -1;
+  const char *got = regex_dfa_find(&re, text, len, &pattern);
+  size_t got_line = 0;
+  for (const char *p = text; got != NULL && p < got; p++)
+  {
+    got_line += *p == '\n';
+  }
+  if ((got == NULL) != (want == NULL) || (got != NULL && got_line + 1 != want_line))
+  {
+    errx(1, "pattern %s%s%s%s%s (flags %d): found line %zd, expected %zd in:\n%.*s",
+         patterns[0], n > 1 ? " " : "", n > 1 ? patterns[1] : "", n > 2 ? " " : "",
+         n > 2 ? patterns[2] : "", flags, got == NULL ? (ssize_t)-1 : (ssize_t)got_line,
+         want == NULL ? (ssize_t)-1 : (ssize_t)want_line - 1, (int)len, text);
+  }
+  if (got != NULL)
+  {
+    CHECK(pattern >= 0 && (size_t)pattern < n);
+    const char *eol = memchr(want, '\n', (size_t)(end - want));
+    CHECK(line_matches(&ref[pattern], want, (size_t)((eol == NULL ? end : eol) - want)));
+  }
+
+  regex_dfa_destroy(&re);
+  for (size_t i = 0; i < n; i++)
+  {
+    regfree(&ref[i]);
+  }
+}
+
+// Escape the metacharacters of s into out, for the reference.
+static void escape(const char *s, char *out)
+{
+  for (; *s != '\0'; s++)
+  {
+    if (strchr(".[]()|*+?{}^$\\", *s) != NULL)
+    {
+      *out++ = '\\';
+    }
+    *out++ = *s;
+  }
+  *out = '\0';
+}
+
+// Anchors are zero-width: a run of them, repeated or nested in groups,
+// holds at one position.  The lines of anchor_text each pattern must
+// find, as grep -E finds them.
+static const char anchor_text[] = "abc\n\nab\nc\na";
+static const struct
+{
+  const char *pattern;
+  const char *lines;
+} anchor_cases[] = {
+  {"^^a", "1 3 5"},      {"c$$", "1 4"},          {"^(^a)", "1 3 5"},
+  {"(c$)$", "1 4"},      {"((^))a", "1 3 5"},     {"(^^)(a)", "1 3 5"},
+  {"c($)($)", "1 4"},    {"$^", "2"},             {"^$^$", "2"},
+  {"(^|b)c", "1 4"},     {"a($|b)", "1 3 5"},     {"(^a|b)+", "1 3 5"},
+  {"(^a)+b", "1 3"},     {"(a|^)*b", "1 3"},      {"(b$){2}", ""},
+  {"x*^a", "1 3 5"},     {"a$x*", "5"},           {"a^", ""},
+  {"$a", ""},            {"(^a$|^$)", "2 5"},     {"^(c|$)$", "2 4"},
+};
+
+// The numbers of the lines of text[0..len) that the patterns match,
+// found by searching again after each matching line.
+static void matching_lines(struct regex_dfa *re, const char *text, size_t len, char *out)
+{
+  const char *from = text, *end = text + len;
+  int pattern;
+  *out = '\0';
+  while (from < end)
+  {
+    const char *found = regex_dfa_find(re, from, (size_t)(end - from), &pattern);
+    if (found == NULL)
+    {
+      break;
+    }
+    size_t line = 1;
+    for (const char *p = text; p < found; p++)
+    {
+      line += *p == '\n';
+    }
+    out += sprintf(out, "%s%zu", from == text ? "" : " ", line);
+    const char *eol = memchr(found, '\n', (size_t)(end - found));
+    from = eol == NULL ? end : eol + 1;
+  }
+}
+
+int main(void)
+{
+  struct gen g = {0x6a09e667f3bcc909ULL, NULL, NULL, 0};
+  char regexes[3][MAX_REGEX];
+  const char *patterns[3];
+  char text[MAX_TEXT];
+
+  for (size_t i = 0; i < sizeof(anchor_cases) / sizeof(anchor_cases[0]); i++)
+  {
+    struct regex_dfa re;
+    char lines[64];
+    CHECK(regex_dfa_init(&re, &anchor_cases[i].pattern, 1, 0) == 0);
+    matching_lines(&re, anchor_text, strlen(anchor_text), lines);
+    if (strcmp(lines, anchor_cases[i].lines) != 0)
+    {
+      errx(1, "pattern %s: found lines \"%s\", expected \"%s\"", anchor_cases[i].pattern,
+           lines, anchor_cases[i].lines);
+    }
+    regex_dfa_destroy(&re);
+  }
+
+  for (int trial = 0; trial < TRIALS; trial++)
+  {
+    size_t n = test_below(&g.rng, 4) == 0 ? 2 + test_below(&g.rng, 2) : 1;
+    for (size_t i = 0; i < n; i++)
+    {
+      g.p = regexes[i];
+      g.end = regexes[i] + MAX_REGEX;
+      gen_alt(&g, 0);
+      patterns[i] = regexes[i];
+    }
+    size_t len = gen_text(&g.rng, text, trial % 2 ? "ab" : "aabbcA.", 8);
+    check(patterns, n, 0, text, len);
+    check(patterns, n, REGEX_DFA_ICASE, text, len);
+  }
+
+  // Literal patterns, with metacharacters that must not be special.
+  static const char *const literals[] = {"a.b", "(a)", "a|b", "a*", "[a]", "^a", "b$", "A"};
+  char escaped[3][MAX_REGEX];
+  for (int trial = 0; trial < TRIALS / 4; trial++)
+  {
+    size_t n = 1 + test_below(&g.rng, 3);
+    for (size_t i = 0; i < n; i++)
+    {
+      patterns[i] = literals[test_below(&g.rng, sizeof(literals) / sizeof(literals[0]))];
+      escape(patterns[i], escaped[i]);
+    }
+    size_t len = gen_text(&g.rng, text, "ab.()|*[]^$A", 6);
+    for (int icase = 0; icase <= REGEX_DFA_ICASE; icase++)
+    {
+      struct regex_dfa re;
+      const char *refs[3] = {escaped[0], escaped[1], escaped[2]};
+      CHECK(regex_dfa_init(&re, patterns, n, REGEX_DFA_LITERAL | icase) == 0);
+      int pattern;
+      const char *got = regex_dfa_find(&re, text, len, &pattern);
+      regex_dfa_destroy(&re);
+
+      // The same search, with the metacharacters escaped.
+      CHECK(regex_dfa_init(&re, refs, n, icase) == 0);
+      const char *want = regex_dfa_find(&re, text, len, &pattern);
+      regex_dfa_destroy(&re);
+      CHECK(got == want);
+      check(refs, n, icase, text, len);
+    }
+  }
+
+  // The 14th byte from the end of a line is an 'a': 2^14 DFA states,
+  // more than fit in the cache, so that later lines are finished by
+  // simulating the NFA.  Every matching line is found in turn.
+  static char big[1 << 16];
+  size_t len = 0;
+  while (len + 62 < sizeof(big))
+  {
+    for (int i = 0; i < 60; i++)
+    {
+      big[len++] = test_below(&g.rng, 2) ? 'a' : 'b';
+    }
+    big[len++] = '\n';
+  }
+  regex_t ref;
+  struct regex_dfa re;
+  patterns[0] = "a[ab]{13}$";
+  CHECK(regcomp(&ref, patterns[0], REG_EXTENDED | REG_NOSUB) == 0);
+  CHECK(regex_dfa_init(&re, patterns, 1, 0) == 0);
+  const char *line = big, *from = big, *end = big + len;
+  while (line < end)
+  {
+    const char *eol = memchr(line, '\n', (size_t)(end - line));
+    if (line_matches(&ref, line, (size_t)(eol - line)))
+    {
+      int pattern;
+      const char *got = regex_dfa_find(&re, from, (size_t)(end - from), &pattern);
+      CHECK(got >= line && got <= eol);
+      from = eol + 1;
+    }
+    line = eol + 1;
+  }
+  int pattern;
+  CHECK(regex_dfa_find(&re, from, (size_t)(end - from), &pattern) == NULL);
+  CHECK(re.nstates == REGEX_DFA_MAX_STATES);
+  regex_dfa_destroy(&re);
+  regfree(&ref);
+  return 0;
+}
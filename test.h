@@ -0,0 +1,42 @@
+#ifndef TEST_H
+#define TEST_H
+
+// Helpers shared by the test programs run by 'make test'.  A test
+// program exits with status 0 if every check passed, and otherwise
+// stops at the first failed check with a message naming it.
+
+#include <stdint.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#define CHECK(cond)                                                     \
+  do                                                                    \
+  {                                                                     \
+    if (!(cond))                                                        \
+    {                                                                   \
+      errx(1, "%s:%d: check failed: %s", __FILE__, __LINE__, #cond);    \
+    }                                                                   \
+  } while (0)
+
+// A small deterministic pseudo-random generator (xorshift64*), so that
+// a failure can be reproduced.  Not thread-safe; give every thread its
+// own state.
+static inline uint64_t test_rand(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 2685821657736338717ULL;
+}
+
+// A pseudo-random number in [0, n).
+static inline unsigned test_below(uint64_t *state, unsigned n)
+{
+  return (unsigned)(test_rand(state) % n);
+}
+
+#endif
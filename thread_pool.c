@@ -0,0 +1,519 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "thread_pool.h"
+#include "stats.h"
+
+// Initial number of slots in a worker's deque.
+#define WS_INITIAL_SIZE 64
+
+// Returned by ws_steal() when it lost a race with another thread.
+#define WS_ABORT ((struct thread_pool_job *)-1)
+
+// The worker running on this thread, if any.
+static __thread struct thread_pool_worker *current_worker = NULL;
+
+// Work-stealing deque.
+//
+// This follows "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+
+static struct ws_array *ws_array_new(long size)
+{
+  struct ws_array *a = malloc(sizeof(struct ws_array) +
+                              sizeof(struct thread_pool_job *) * (size_t)size);
+  if (a == NULL)
+  {
+    return NULL;
+  }
+  a->size = size;
+  a->retired = NULL;
+  return a;
+}
+
+static int ws_init(struct ws_deque *d)
+{
+  d->top = 0;
+  d->bottom = 0;
+  d->array = ws_array_new(WS_INITIAL_SIZE);
+  return d->array == NULL ? -1 : 0;
+}
+
+static void ws_destroy(struct ws_deque *d)
+{
+  struct ws_array *a = d->array;
+  while (a != NULL)
+  {
+    struct ws_array *next = a->retired;
+    free(a);
+    a = next;
+  }
+  d->array = NULL;
+}
+
+static inline struct thread_pool_job **ws_slot(struct ws_array *a, long i)
+{
+  return &a->buf[i & (a->size - 1)];
+}
+
+// Owner only.  Returns non-zero if the deque could not grow.
+static int ws_push(struct ws_deque *d, struct thread_pool_job *job)
+{
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+  if (b - t > a->size - 1)
+  {
+    struct ws_array *bigger = ws_array_new(a->size * 2);
+    if (bigger == NULL)
+    {
+      return -1;
+    }
+    for (long i = t; i < b; i++)
+    {
+      *ws_slot(bigger, i) = __atomic_load_n(ws_slot(a, i), __ATOMIC_RELAXED);
+    }
+    bigger->retired = a;
+    __atomic_store_n(&d->array, bigger, __ATOMIC_RELEASE);
+    a = bigger;
+  }
+
+  __atomic_store_n(ws_slot(a, b), job, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Owner only.  Returns NULL if the deque is empty.
+static struct thread_pool_job *ws_take(struct ws_deque *d)
+{
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+  struct thread_pool_job *job = NULL;
+  if (t <= b)
+  {
+    job = __atomic_load_n(ws_slot(a, b), __ATOMIC_RELAXED);
+    if (t == b)
+    {
+      // Last element: race against thieves for it.
+      if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      {
+        job = NULL;
+      }
+      __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  }
+  else
+  {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return job;
+}
+
+// Any thread.  Returns NULL if empty, WS_ABORT if it lost a race.
+static struct thread_pool_job *ws_steal(struct ws_deque *d)
+{
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+  if (t >= b)
+  {
+    return NULL;
+  }
+
+  struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+  struct thread_pool_job *job = __atomic_load_n(ws_slot(a, t), __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+  {
+    return WS_ABORT;
+  }
+  return job;
+}
+
+// Pool.
+
+// Try every other worker's deque once, starting at a random victim.
+// Retries a victim while it reports a lost race.
+static struct thread_pool_job *steal_any(struct thread_pool_worker *self)
+{
+  struct thread_pool *pool = self->pool;
+  int n = pool->num_workers;
+
+  // xorshift32
+  self->rng ^= self->rng << 13;
+  self->rng ^= self->rng >> 17;
+  self->rng ^= self->rng << 5;
+  int start = (int)(self->rng % (unsigned)n);
+
+  for (int i = 0; i < n; i++)
+  {
+    struct thread_pool_worker *victim = &pool->workers[(start + i) % n];
+    if (victim == self)
+    {
+      continue;
+    }
+
+    struct thread_pool_job *job;
+    while ((job = ws_steal(&victim->deque)) == WS_ABORT)
+    {
+    }
+    if (job != NULL)
+    {
+      return job;
+    }
+  }
+  return NULL;
+}
+
+static void job_finished(struct thread_pool *pool, long n)
+{
+  if (__atomic_sub_fetch(&pool->pending, n, __ATOMIC_ACQ_REL) == 0)
+  {
+    pthread_mutex_lock(&pool->done_mutex);
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->done_mutex);
+  }
+}
+
+// Run a job, giving its record back first so that the chunk it came
+// from can be released as early as possible.
+static void run_job(struct thread_pool *pool, struct thread_pool_job *job)
+{
+  thread_pool_fn fn = job->fn;
+  void *arg = job->arg;
+  arena_free(job);
+
+  uint64_t start = stats_job_begin();
+  fn(pool, arg);
+  stats_job_end(start);
+  job_finished(pool, 1);
+}
+
+static void *worker_main(void *arg)
+{
+  struct thread_pool_worker *self = arg;
+  struct thread_pool *pool = self->pool;
+
+  current_worker = self;
+  stats_thread_begin(self->id);
+
+  for (;;)
+  {
+    struct thread_pool_job *job = ws_take(&self->deque);
+
+    if (job == NULL)
+    {
+      job = steal_any(self);
+    }
+
+    if (job == NULL)
+    {
+      // Announce that we are about to block before the final sweep, so
+      // that a worker pushing local work either sees us idle (and
+      // sends a token) or has its push seen by our sweep.
+      __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+      job = steal_any(self);
+      while (job == NULL)
+      {
+        void *data;
+        if (job_queue_pop(&pool->injection, &data) != 0)
+        {
+          // Injection queue destroyed: the pool is shutting down.
+          __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+          current_worker = NULL;
+          stats_thread_end();
+          return NULL;
+        }
+        if (data != NULL)
+        {
+          job = data;
+          break;
+        }
+        // Wake-up token: someone pushed local work.
+        __atomic_sub_fetch(&pool->tokens, 1, __ATOMIC_SEQ_CST);
+        job = steal_any(self);
+      }
+      __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+    }
+
+    run_job(pool, job);
+  }
+}
+
+int thread_pool_init(struct thread_pool *pool, int num_workers,
+                     int capacity, enum job_queue_kind kind)
+{
+  if (pool == NULL || num_workers <= 0)
+  {
+    return -1;
+  }
+
+  pool->num_workers = num_workers;
+  pool->idle = 0;
+  pool->tokens = 0;
+  pool->pending = 0;
+  pool->cancelled = 0;
+
+  if (job_queue_init_kind(&pool->injection, capacity, kind) != 0)
+  {
+    return -1;
+  }
+
+  if (pthread_mutex_init(&pool->done_mutex, NULL) != 0)
+  {
+    job_queue_destroy(&pool->injection);
+    return -1;
+  }
+
+  if (pthread_cond_init(&pool->done, NULL) != 0)
+  {
+    pthread_mutex_destroy(&pool->done_mutex);
+    job_queue_destroy(&pool->injection);
+    return -1;
+  }
+
+  if (pthread_mutex_init(&pool->external_mutex, NULL) != 0)
+  {
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->done_mutex);
+    job_queue_destroy(&pool->injection);
+    return -1;
+  }
+  arena_init(&pool->external_jobs, 0);
+
+  pool->workers = calloc((size_t)num_workers, sizeof(struct thread_pool_worker));
+  if (pool->workers == NULL)
+  {
+    pthread_mutex_destroy(&pool->external_mutex);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->done_mutex);
+    job_queue_destroy(&pool->injection);
+    return -1;
+  }
+
+  // Set up every deque before any worker can try to steal from it.
+  for (int i = 0; i < num_workers; i++)
+  {
+    struct thread_pool_worker *w = &pool->workers[i];
+    w->pool = pool;
+    w->id = i;
+    w->rng = 2463534242u + (unsigned)i * 2654435761u;
+    arena_init(&w->jobs, 0);
+    if (ws_init(&w->deque) != 0)
+    {
+      for (int j = 0; j < i; j++)
+      {
+        ws_destroy(&pool->workers[j].deque);
+      }
+      free(pool->workers);
+      pthread_mutex_destroy(&pool->external_mutex);
+      pthread_cond_destroy(&pool->done);
+      pthread_mutex_destroy(&pool->done_mutex);
+      job_queue_destroy(&pool->injection);
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < num_workers; i++)
+  {
+    if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0)
+    {
+      // Shut down the workers that did start.
+      job_queue_destroy(&pool->injection);
+      for (int j = 0; j < i; j++)
+      {
+        pthread_join(pool->workers[j].thread, NULL);
+      }
+      for (int j = 0; j < num_workers; j++)
+      {
+        ws_destroy(&pool->workers[j].deque);
+      }
+      free(pool->workers);
+      pthread_mutex_destroy(&pool->external_mutex);
+      pthread_cond_destroy(&pool->done);
+      pthread_mutex_destroy(&pool->done_mutex);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Push a job onto the current worker's deque and make sure an idle
+// worker, if any, gets a chance to steal it.
+static int submit_local(struct thread_pool *pool, struct thread_pool_worker *w,
+                        struct thread_pool_job *job)
+{
+  if (ws_push(&w->deque, job) != 0)
+  {
+    return -1;
+  }
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  int idle = __atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST);
+  if (idle > __atomic_load_n(&pool->tokens, __ATOMIC_SEQ_CST))
+  {
+    __atomic_add_fetch(&pool->tokens, 1, __ATOMIC_SEQ_CST);
+    if (job_queue_try_push(&pool->injection, NULL) != 0)
+    {
+      // Queue full: the blocked workers have other wake-ups coming.
+      __atomic_sub_fetch(&pool->tokens, 1, __ATOMIC_SEQ_CST);
+    }
+  }
+  return 0;
+}
+
+int thread_pool_submit(struct thread_pool *pool, thread_pool_fn fn, void *arg)
+{
+  return thread_pool_submit_many(pool, fn, &arg, 1) == 1 ? 0 : -1;
+}
+
+// Submit up to SUBMIT_BATCH jobs.
+#define SUBMIT_BATCH 64
+
+static int submit_batch(struct thread_pool *pool, thread_pool_fn fn,
+                        void **args, int n)
+{
+  struct thread_pool_worker *w = current_worker;
+  int local = w != NULL && w->pool == pool;
+
+  // A worker allocates from its own arena; other threads share one.
+  struct thread_pool_job *jobs[SUBMIT_BATCH];
+  struct arena *a = local ? &w->jobs : &pool->external_jobs;
+  if (!local)
+  {
+    pthread_mutex_lock(&pool->external_mutex);
+  }
+  int made = 0;
+  while (made < n)
+  {
+    jobs[made] = arena_alloc(a, sizeof(struct thread_pool_job));
+    if (jobs[made] == NULL)
+    {
+      break;
+    }
+    jobs[made]->fn = fn;
+    jobs[made]->arg = args[made];
+    made++;
+  }
+  if (!local)
+  {
+    pthread_mutex_unlock(&pool->external_mutex);
+  }
+
+  __atomic_add_fetch(&pool->pending, made, __ATOMIC_SEQ_CST);
+
+  int submitted = 0;
+  if (local)
+  {
+    while (submitted < made && submit_local(pool, w, jobs[submitted]) == 0)
+    {
+      submitted++;
+    }
+  }
+  else
+  {
+    submitted = job_queue_push_many(&pool->injection, (void **)jobs, made);
+    if (submitted < 0)
+    {
+      submitted = 0;
+    }
+  }
+
+  for (int i = submitted; i < made; i++)
+  {
+    arena_free(jobs[i]);
+  }
+  if (submitted < made)
+  {
+    job_finished(pool, made - submitted);
+  }
+  return submitted;
+}
+
+int thread_pool_submit_many(struct thread_pool *pool, thread_pool_fn fn,
+                            void **args, int n)
+{
+  if (pool == NULL || fn == NULL || args == NULL || n <= 0)
+  {
+    return 0;
+  }
+
+  int submitted = 0;
+  while (submitted < n)
+  {
+    int batch = n - submitted < SUBMIT_BATCH ? n - submitted : SUBMIT_BATCH;
+    int r = submit_batch(pool, fn, &args[submitted], batch);
+    submitted += r;
+    if (r < batch)
+    {
+      break;
+    }
+  }
+  return submitted;
+}
+
+void thread_pool_cancel(struct thread_pool *pool)
+{
+  __atomic_store_n(&pool->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+void thread_pool_wait(struct thread_pool *pool)
+{
+  pthread_mutex_lock(&pool->done_mutex);
+  while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+  {
+    pthread_cond_wait(&pool->done, &pool->done_mutex);
+  }
+  pthread_mutex_unlock(&pool->done_mutex);
+}
+
+int thread_pool_destroy(struct thread_pool *pool)
+{
+  if (pool == NULL)
+  {
+    return -1;
+  }
+
+  thread_pool_wait(pool);
+
+  // Blocked workers see the injection queue die and exit.
+  int r = job_queue_destroy(&pool->injection);
+
+  for (int i = 0; i < pool->num_workers; i++)
+  {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < pool->num_workers; i++)
+  {
+    ws_destroy(&pool->workers[i].deque);
+    arena_destroy(&pool->workers[i].jobs);
+  }
+  free(pool->workers);
+  pool->workers = NULL;
+  arena_destroy(&pool->external_jobs);
+
+  pthread_mutex_destroy(&pool->external_mutex);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->done_mutex);
+  return r;
+}
+
+int thread_pool_worker_id(struct thread_pool *pool)
+{
+  struct thread_pool_worker *w = current_worker;
+  if (w == NULL || w->pool != pool)
+  {
+    return -1;
+  }
+  return w->id;
+}
@@ -0,0 +1,131 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+#include "job_queue.h"
+#include "arena.h"
+
+struct thread_pool;
+
+// A job is a function and its argument.  Jobs may submit further jobs
+// (subjobs) to the pool they run in.
+typedef void (*thread_pool_fn)(struct thread_pool *pool, void *arg);
+
+struct thread_pool_job
+{
+  thread_pool_fn fn;
+  void *arg;
+};
+
+// Backing array of a work-stealing deque.  'size' is a power of two.
+struct ws_array
+{
+  long size;
+  struct ws_array *retired;  /* previous (smaller) array, freed at destroy */
+  struct thread_pool_job *buf[];
+};
+
+/*
+ * ws_deque
+ *
+ * Chase-Lev work-stealing deque.  The owning worker pushes and takes
+ * jobs at the bottom; other workers steal from the top.  The array
+ * grows when full; old arrays are kept until the deque is destroyed
+ * since thieves may still be reading them.
+ */
+struct ws_deque
+{
+  char pad_top[JOB_QUEUE_CACHE_LINE];
+  long top;
+  char pad_bottom[JOB_QUEUE_CACHE_LINE];
+  long bottom;
+  struct ws_array *array;
+  char pad_end[JOB_QUEUE_CACHE_LINE];
+};
+
+struct thread_pool_worker
+{
+  struct thread_pool *pool;
+  int id;
+  unsigned rng;              /* victim selection */
+  pthread_t thread;
+  struct arena jobs;         /* records of the jobs this worker submits */
+  struct ws_deque deque;
+};
+
+/*
+ * thread_pool
+ *
+ * Like struct job_queue the struct is not opaque, so the caller can
+ * allocate it (e.g. `struct thread_pool pool;`) before calling
+ * thread_pool_init().
+ *
+ * Jobs submitted from outside the pool go through 'injection', a
+ * regular job_queue, so producers get the usual back-pressure.  Jobs
+ * submitted by a running job go onto the submitting worker's own deque,
+ * from which idle workers steal.  Workers with nothing to take or steal
+ * block on the injection queue; a worker that pushes local work while
+ * others are blocked wakes one with a NULL token on the injection queue.
+ *
+ * Job records come from the arena of the submitting worker, or from
+ * 'external_jobs' (taken once per batch under 'external_mutex') for
+ * other threads, and whichever worker runs a job frees its record.
+ */
+struct thread_pool
+{
+  struct job_queue injection;
+  struct thread_pool_worker *workers;
+  int num_workers;
+
+  int idle;                  /* workers blocked on the injection queue */
+  int tokens;                /* wake-up tokens in the injection queue */
+  long pending;              /* jobs submitted but not yet finished */
+  int cancelled;             /* see thread_pool_cancel() */
+
+  pthread_mutex_t external_mutex;
+  struct arena external_jobs;
+
+  pthread_mutex_t done_mutex;
+  pthread_cond_t done;       /* signalled when 'pending' drops to zero */
+};
+
+// Initialise a pool with 'num_workers' threads.  'capacity' and 'kind'
+// configure the injection queue.  Returns non-zero on error.
+int thread_pool_init(struct thread_pool *pool, int num_workers,
+                     int capacity, enum job_queue_kind kind);
+
+// Submit a job.  From inside a job the new job goes onto the current
+// worker's deque; from any other thread it is pushed onto the injection
+// queue, blocking while that is full.  Returns non-zero on error.
+int thread_pool_submit(struct thread_pool *pool, thread_pool_fn fn, void *arg);
+
+// Submit 'n' jobs running 'fn' on args[0..n-1], using a single batched
+// push when called from outside the pool.  Returns the number of jobs
+// submitted; the caller still owns the arguments of the rest.
+int thread_pool_submit_many(struct thread_pool *pool, thread_pool_fn fn,
+                            void **args, int n);
+
+// Ask the jobs of the pool to stop early.  Queued jobs still run, so
+// each can release what it owns, but jobs that check
+// thread_pool_cancelled() skip their work, and should not submit more.
+void thread_pool_cancel(struct thread_pool *pool);
+
+// Non-zero once thread_pool_cancel() has been called.
+static inline int thread_pool_cancelled(struct thread_pool *pool)
+{
+  return __atomic_load_n(&pool->cancelled, __ATOMIC_RELAXED);
+}
+
+// Block until every submitted job (including subjobs) has finished.
+void thread_pool_wait(struct thread_pool *pool);
+
+// Wait for all jobs, then stop and join the workers and free the pool.
+// Returns non-zero on error.
+int thread_pool_destroy(struct thread_pool *pool);
+
+// Index (0..num_workers-1) of the worker running the calling thread,
+// or -1 if the caller is not one of this pool's workers.
+int thread_pool_worker_id(struct thread_pool *pool);
+
+#endif
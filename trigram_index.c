@@ -0,0 +1,623 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "trigram_index.h"
+
+// Layout of an index file:
+//
+//   struct trigram_header
+//   struct trigram_stamp files[nfiles]
+//   struct trigram_entry trigrams[ntrigrams]  (sorted by trigram)
+//   unsigned char postings[postings_len]
+//
+// A posting list is the ascending file numbers containing the trigram,
+// stored as the differences between consecutive numbers in LEB128
+// varints, so the lists of common trigrams take about a byte per file.
+
+#define TRIGRAM_MAGIC "FGINDEX\n"
+#define TRIGRAM_VERSION 1
+
+// Trigrams are 24-bit numbers.
+#define NTRIGRAMS (1 << 24)
+
+struct trigram_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t stamp_size;   /* sizeof(struct trigram_stamp) */
+  uint64_t nfiles;
+  uint64_t ntrigrams;
+  uint64_t postings_len;
+};
+
+struct trigram_entry
+{
+  uint32_t trigram;
+  uint32_t nfiles;
+  uint64_t offset;       /* of its posting list in postings[] */
+};
+
+static unsigned char fold(unsigned char c)
+{
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+void trigram_stamp_init(struct trigram_stamp *stamp, const struct stat *st)
+{
+  memset(stamp, 0, sizeof(struct trigram_stamp));
+  stamp->dev = (uint64_t)st->st_dev;
+  stamp->ino = (uint64_t)st->st_ino;
+  stamp->size = (int64_t)st->st_size;
+  stamp->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+  stamp->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+  stamp->ctime_sec = (int64_t)st->st_ctim.tv_sec;
+  stamp->ctime_nsec = (int64_t)st->st_ctim.tv_nsec;
+}
+
+int trigram_builder_init(struct trigram_builder *b)
+{
+  memset(b, 0, sizeof(struct trigram_builder));
+  b->seen = calloc(NTRIGRAMS / 64, sizeof(uint64_t));
+  b->present = malloc(NTRIGRAMS * sizeof(uint32_t));
+  if (b->seen == NULL || b->present == NULL)
+  {
+    trigram_builder_free(b);
+    return -1;
+  }
+  return 0;
+}
+
+void trigram_builder_free(struct trigram_builder *b)
+{
+  free(b->seen);
+  free(b->present);
+  free(b->files);
+  free(b->pairs);
+  memset(b, 0, sizeof(struct trigram_builder));
+}
+
+int trigram_builder_add(struct trigram_builder *b, const struct stat *st,
+                        const char *data, size_t len)
+{
+  if (b->nfiles == UINT32_MAX)
+  {
+    return -1;
+  }
+  if (b->nfiles == b->files_cap)
+  {
+    size_t cap = b->files_cap == 0 ? 1024 : 2 * b->files_cap;
+    struct trigram_stamp *files = realloc(b->files, cap * sizeof(struct trigram_stamp));
+    if (files == NULL)
+    {
+      return -1;
+    }
+    b->files = files;
+    b->files_cap = cap;
+  }
+
+  // Collect the distinct trigrams of the file.  Trigrams spanning a
+  // newline are left out: no line can contain them.
+  const unsigned char *u = (const unsigned char *)data;
+  size_t npresent = 0;
+  uint32_t t = 0;
+  size_t run = 0;  /* bytes since the last newline, up to 3 */
+  for (size_t i = 0; i < len; i++)
+  {
+    if (u[i] == '\n')
+    {
+      run = 0;
+      continue;
+    }
+    t = (t << 8 | fold(u[i])) & (NTRIGRAMS - 1);
+    if (run < 2)
+    {
+      run++;
+      continue;
+    }
+    uint64_t bit = (uint64_t)1 << (t & 63);
+    if (!(b->seen[t >> 6] & bit))
+    {
+      b->seen[t >> 6] |= bit;
+      b->present[npresent++] = t;
+    }
+  }
+
+  int ret = 0;
+  if (b->npairs + npresent > b->pairs_cap)
+  {
+    size_t cap = b->pairs_cap == 0 ? 65536 : b->pairs_cap;
+    while (cap < b->npairs + npresent)
+    {
+      cap *= 2;
+    }
+    uint64_t *pairs = realloc(b->pairs, cap * sizeof(uint64_t));
+    if (pairs == NULL)
+    {
+      ret = -1;
+    }
+    else
+    {
+      b->pairs = pairs;
+      b->pairs_cap = cap;
+    }
+  }
+
+  for (size_t i = 0; i < npresent; i++)
+  {
+    t = b->present[i];
+    b->seen[t >> 6] = 0;
+    if (ret == 0)
+    {
+      b->pairs[b->npairs++] = (uint64_t)t << 32 | b->nfiles;
+    }
+  }
+
+  if (ret == 0)
+  {
+    trigram_stamp_init(&b->files[b->nfiles++], st);
+  }
+  return ret;
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Append 'v' to out as a varint, returning the number of bytes used.
+static size_t put_varint(unsigned char *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char)v;
+  return n;
+}
+
+// Write all of buf[0..len) to 'f'.  Returns non-zero on error.
+static int put(FILE *f, const void *buf, size_t len)
+{
+  return len > 0 && fwrite(buf, 1, len, f) != len;
+}
+
+int trigram_builder_write(struct trigram_builder *b, const char *path)
+{
+  qsort(b->pairs, b->npairs, sizeof(uint64_t), compare_pairs);
+
+  // Turn the sorted pairs into the trigram table and the postings.
+  // The postings take at most five bytes per pair.
+  size_t ntrigrams = 0;
+  for (size_t i = 0; i < b->npairs; i++)
+  {
+    if (i == 0 || b->pairs[i] >> 32 != b->pairs[i - 1] >> 32)
+    {
+      ntrigrams++;
+    }
+  }
+  struct trigram_entry *trigrams = malloc((ntrigrams > 0 ? ntrigrams : 1) * sizeof(struct trigram_entry));
+  unsigned char *postings = malloc(b->npairs * 5 + 1);
+  if (trigrams == NULL || postings == NULL)
+  {
+    free(trigrams);
+    free(postings);
+    warnx("out of memory writing index %s", path);
+    return -1;
+  }
+
+  size_t t = 0;
+  size_t len = 0;
+  uint32_t prev = 0;
+  for (size_t i = 0; i < b->npairs; i++)
+  {
+    uint32_t trigram = (uint32_t)(b->pairs[i] >> 32);
+    uint32_t file = (uint32_t)b->pairs[i];
+    if (i == 0 || trigram != trigrams[t - 1].trigram)
+    {
+      trigrams[t].trigram = trigram;
+      trigrams[t].nfiles = 0;
+      trigrams[t].offset = len;
+      t++;
+      prev = 0;
+    }
+    len += put_varint(postings + len, file - prev);
+    prev = file;
+    trigrams[t - 1].nfiles++;
+  }
+
+  struct trigram_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRIGRAM_MAGIC, sizeof(header.magic));
+  header.version = TRIGRAM_VERSION;
+  header.stamp_size = sizeof(struct trigram_stamp);
+  header.nfiles = b->nfiles;
+  header.ntrigrams = ntrigrams;
+  header.postings_len = len;
+
+  // Write to a temporary file and rename it into place, so a search
+  // running meanwhile sees either the old or the new index.
+  size_t pathlen = strlen(path);
+  char *tmp = malloc(pathlen + sizeof(".tmp"));
+  int ret = -1;
+  if (tmp != NULL)
+  {
+    memcpy(tmp, path, pathlen);
+    memcpy(tmp + pathlen, ".tmp", sizeof(".tmp"));
+    FILE *f = fopen(tmp, "w");
+    if (f != NULL)
+    {
+      int failed = put(f, &header, sizeof(header))
+                   || put(f, b->files, b->nfiles * sizeof(struct trigram_stamp))
+                   || put(f, trigrams, ntrigrams * sizeof(struct trigram_entry))
+                   || put(f, postings, len);
+      if (fclose(f) == 0 && !failed && rename(tmp, path) == 0)
+      {
+        ret = 0;
+      }
+      else
+      {
+        unlink(tmp);
+      }
+    }
+  }
+  if (ret != 0)
+  {
+    warn("failed to write index %s", path);
+  }
+
+  free(tmp);
+  free(trigrams);
+  free(postings);
+  return ret;
+}
+
+static size_t hash_file(uint64_t dev, uint64_t ino)
+{
+  // splitmix64 finaliser.
+  uint64_t h = ino * 0x9e3779b97f4a7c15ULL ^ dev;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return (size_t)(h ^ (h >> 31));
+}
+
+// The table slot for the file with the given dev/inode: either the one
+// holding it or the empty one where it would go.
+static uint32_t *find_slot(const struct trigram_index *idx, uint64_t dev, uint64_t ino)
+{
+  size_t i = hash_file(dev, ino) & idx->table_mask;
+  while (idx->table[i] != 0)
+  {
+    const struct trigram_stamp *s = &idx->files[idx->table[i] - 1];
+    if (s->dev == dev && s->ino == ino)
+    {
+      break;
+    }
+    i = (i + 1) & idx->table_mask;
+  }
+  return &idx->table[i];
+}
+
+int trigram_index_open(struct trigram_index *idx, const char *path)
+{
+  memset(idx, 0, sizeof(struct trigram_index));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    warn("failed to open index %s", path);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return -1;
+  }
+
+  struct trigram_header header;
+  if ((size_t)st.st_size < sizeof(header))
+  {
+    close(fd);
+    warnx("%s is not a fauxgrep index", path);
+    return -1;
+  }
+
+  idx->map_len = (size_t)st.st_size;
+  idx->map = mmap(NULL, idx->map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (idx->map == MAP_FAILED)
+  {
+    idx->map = NULL;
+    warn("failed to map index %s", path);
+    return -1;
+  }
+
+  // Check that the sections fit in the file before trusting them.
+  memcpy(&header, idx->map, sizeof(header));
+  size_t left = idx->map_len - sizeof(header);
+  if (memcmp(header.magic, TRIGRAM_MAGIC, sizeof(header.magic)) != 0
+      || header.version != TRIGRAM_VERSION
+      || header.stamp_size != sizeof(struct trigram_stamp)
+      || header.nfiles > UINT32_MAX - 1
+      || header.nfiles > left / sizeof(struct trigram_stamp)
+      || header.ntrigrams > (left - header.nfiles * sizeof(struct trigram_stamp)) / sizeof(struct trigram_entry)
+      || header.postings_len != left - header.nfiles * sizeof(struct trigram_stamp)
+                                     - header.ntrigrams * sizeof(struct trigram_entry))
+  {
+    warnx("%s is not a fauxgrep index", path);
+    trigram_index_close(idx);
+    return -1;
+  }
+
+  const char *p = (const char *)idx->map + sizeof(header);
+  idx->files = (const struct trigram_stamp *)p;
+  idx->nfiles = header.nfiles;
+  p += idx->nfiles * sizeof(struct trigram_stamp);
+  idx->trigrams = (const struct trigram_entry *)p;
+  idx->ntrigrams = header.ntrigrams;
+  p += idx->ntrigrams * sizeof(struct trigram_entry);
+  idx->postings = (const unsigned char *)p;
+  idx->postings_len = header.postings_len;
+
+  size_t table_size = 16;
+  while (table_size < 2 * idx->nfiles)
+  {
+    table_size *= 2;
+  }
+  idx->table = calloc(table_size, sizeof(uint32_t));
+  if (idx->table == NULL)
+  {
+    warnx("out of memory reading index %s", path);
+    trigram_index_close(idx);
+    return -1;
+  }
+  idx->table_mask = table_size - 1;
+
+  // If a file was indexed twice (e.g. through a symbolic link), its
+  // first entry is used.
+  for (size_t i = 0; i < idx->nfiles; i++)
+  {
+    uint32_t *slot = find_slot(idx, idx->files[i].dev, idx->files[i].ino);
+    if (*slot == 0)
+    {
+      *slot = (uint32_t)i + 1;
+    }
+  }
+  return 0;
+}
+
+void trigram_index_close(struct trigram_index *idx)
+{
+  if (idx->map != NULL)
+  {
+    munmap(idx->map, idx->map_len);
+  }
+  free(idx->table);
+  free(idx->selected);
+  memset(idx, 0, sizeof(struct trigram_index));
+}
+
+static const struct trigram_entry *find_trigram(const struct trigram_index *idx, uint32_t t)
+{
+  size_t lo = 0;
+  size_t hi = idx->ntrigrams;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->trigrams[mid].trigram < t)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo < idx->ntrigrams && idx->trigrams[lo].trigram == t ? &idx->trigrams[lo] : NULL;
+}
+
+// Decode the posting list of 'e' into files[0..e->nfiles).  Returns
+// non-zero if it is corrupt.
+static int decode(const struct trigram_index *idx, const struct trigram_entry *e,
+                  uint32_t *files)
+{
+  size_t pos = e->offset;
+  uint32_t file = 0;
+  for (uint32_t i = 0; i < e->nfiles; i++)
+  {
+    uint32_t delta = 0;
+    for (int shift = 0;; shift += 7)
+    {
+      if (pos >= idx->postings_len || shift > 28)
+      {
+        return -1;
+      }
+      unsigned char c = idx->postings[pos++];
+      delta |= (uint32_t)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+      {
+        break;
+      }
+    }
+    file += delta;
+    if (file >= idx->nfiles)
+    {
+      return -1;
+    }
+    files[i] = file;
+  }
+  return 0;
+}
+
+// Select the files containing every trigram of pattern[0..len), whose
+// length is at least 3.  Returns non-zero on allocation failure.
+static int select_pattern(struct trigram_index *idx, const unsigned char *pattern,
+                          size_t len)
+{
+  // Start from the rarest trigram, and intersect the list of files with
+  // that of each other trigram in turn.
+  size_t ntri = 0;
+  const struct trigram_entry **entries = malloc(len * sizeof(*entries));
+  if (entries == NULL)
+  {
+    return -1;
+  }
+
+  size_t rarest = 0;
+  for (size_t i = 0; i + 3 <= len; i++)
+  {
+    if (pattern[i] == '\n' || pattern[i + 1] == '\n' || pattern[i + 2] == '\n')
+    {
+      continue;
+    }
+    uint32_t t = (uint32_t)fold(pattern[i]) << 16 | (uint32_t)fold(pattern[i + 1]) << 8
+                 | fold(pattern[i + 2]);
+    const struct trigram_entry *e = find_trigram(idx, t);
+    if (e == NULL)
+    {
+      // No indexed file can match.
+      free(entries);
+      return 0;
+    }
+    if (ntri == 0 || e->nfiles < entries[rarest]->nfiles)
+    {
+      rarest = ntri;
+    }
+    entries[ntri++] = e;
+  }
+
+  if (ntri == 0)
+  {
+    // Only trigrams spanning a newline; leave it to the scanner.
+    free(entries);
+    memset(idx->selected, 0xff, (idx->nfiles + 63) / 64 * sizeof(uint64_t));
+    return 0;
+  }
+
+  uint32_t *files = malloc((entries[rarest]->nfiles + 1) * sizeof(uint32_t));
+  uint32_t *other = malloc((idx->nfiles + 1) * sizeof(uint32_t));
+  if (files == NULL || other == NULL)
+  {
+    free(files);
+    free(other);
+    free(entries);
+    return -1;
+  }
+
+  // A corrupt posting list selects everything, which is always safe.
+  int corrupt = decode(idx, entries[rarest], files);
+  size_t nfiles = entries[rarest]->nfiles;
+  for (size_t i = 0; !corrupt && i < ntri && nfiles > 0; i++)
+  {
+    if (i == rarest)
+    {
+      continue;
+    }
+    corrupt = decode(idx, entries[i], other);
+    size_t a = 0, b = 0, n = 0;
+    while (a < nfiles && b < entries[i]->nfiles)
+    {
+      if (files[a] < other[b])
+      {
+        a++;
+      }
+      else if (files[a] > other[b])
+      {
+        b++;
+      }
+      else
+      {
+        files[n++] = files[a];
+        a++;
+        b++;
+      }
+    }
+    nfiles = n;
+  }
+
+  if (corrupt)
+  {
+    memset(idx->selected, 0xff, (idx->nfiles + 63) / 64 * sizeof(uint64_t));
+  }
+  else
+  {
+    for (size_t i = 0; i < nfiles; i++)
+    {
+      idx->selected[files[i] >> 6] |= (uint64_t)1 << (files[i] & 63);
+    }
+  }
+
+  free(files);
+  free(other);
+  free(entries);
+  return 0;
+}
+
+int trigram_index_select(struct trigram_index *idx,
+                         const char *const *patterns, size_t n)
+{
+  free(idx->selected);
+  idx->selected = calloc((idx->nfiles + 63) / 64 + 1, sizeof(uint64_t));
+  if (idx->selected == NULL)
+  {
+    return -1;
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    if (patterns[i] == NULL)
+    {
+      continue;
+    }
+    size_t len = strlen(patterns[i]);
+    if (len < 3)
+    {
+      // Too short to have a trigram: every file may match.
+      free(idx->selected);
+      idx->selected = NULL;
+      return 0;
+    }
+    if (select_pattern(idx, (const unsigned char *)patterns[i], len) != 0)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int trigram_index_may_match(const struct trigram_index *idx, const struct stat *st)
+{
+  if (idx->selected == NULL)
+  {
+    return 1;
+  }
+
+  struct trigram_stamp stamp;
+  trigram_stamp_init(&stamp, st);
+  uint32_t i = *find_slot(idx, stamp.dev, stamp.ino);
+  if (i == 0 || memcmp(&idx->files[i - 1], &stamp, sizeof(stamp)) != 0)
+  {
+    // Not indexed, or changed since: it has to be searched.
+    return 1;
+  }
+  i--;
+  return (idx->selected[i >> 6] >> (i & 63)) & 1;
+}
@@ -0,0 +1,99 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Identifies one version of an indexed file.  A file whose stamp no
+// longer matches its stat() is stale and must be searched.
+struct trigram_stamp
+{
+  uint64_t dev, ino;
+  int64_t size;
+  int64_t mtime_sec, mtime_nsec;
+  int64_t ctime_sec, ctime_nsec;
+};
+
+/*
+ * trigram_builder
+ *
+ * Collects the trigrams (three consecutive bytes within a line, with
+ * ASCII letters folded to lower case) of a set of files and writes
+ * them out as an index: for every trigram, a posting list of the files
+ * containing it.
+ */
+struct trigram_builder
+{
+  uint64_t *seen;              /* bitmap of trigrams in the current file */
+  uint32_t *present;           /* the same trigrams, as a list */
+  struct trigram_stamp *files;
+  size_t nfiles, files_cap;
+  uint64_t *pairs;             /* trigram << 32 | file number */
+  size_t npairs, pairs_cap;
+};
+
+/*
+ * trigram_index
+ *
+ * A trigram index written by trigram_builder_write(), memory-mapped for
+ * querying.  trigram_index_select() marks the indexed files that may
+ * contain a match for a set of patterns: those containing every
+ * trigram of at least one of them.  trigram_index_may_match() then
+ * tells, from a stat() of a file found while walking, whether it can
+ * be skipped: only files that are indexed, unchanged since, and not
+ * selected are.  Files that are new or have changed are always
+ * searched, so results are the same as without the index.
+ *
+ * After trigram_index_select(), the struct is read-only and may be
+ * shared between threads.
+ */
+struct trigram_index
+{
+  void *map;
+  size_t map_len;
+  const struct trigram_stamp *files;
+  size_t nfiles;
+  const struct trigram_entry *trigrams;
+  size_t ntrigrams;
+  const unsigned char *postings;
+  size_t postings_len;
+  uint32_t *table;             /* dev/inode hash: file number + 1, or 0 */
+  size_t table_mask;
+  uint64_t *selected;          /* bitmap of files, or NULL for all */
+};
+
+// Fill in the stamp of the file described by 'st'.
+void trigram_stamp_init(struct trigram_stamp *stamp, const struct stat *st);
+
+// Start an empty index.  Returns non-zero on allocation failure.
+int trigram_builder_init(struct trigram_builder *b);
+
+// Add the file described by 'st', whose contents are data[0..len).
+// Returns non-zero on allocation failure.
+int trigram_builder_add(struct trigram_builder *b, const struct stat *st,
+                        const char *data, size_t len);
+
+// Write the index to 'path'.  Returns non-zero (after a warning) on
+// error.
+int trigram_builder_write(struct trigram_builder *b, const char *path);
+
+// Free the memory of a builder.
+void trigram_builder_free(struct trigram_builder *b);
+
+// Map the index at 'path'.  Returns non-zero (after a warning) if it
+// cannot be read or is not a valid index.
+int trigram_index_open(struct trigram_index *idx, const char *path);
+
+// Select the files that may contain any of patterns[0..n).  NULL
+// entries are skipped.  Returns non-zero on allocation failure.
+int trigram_index_select(struct trigram_index *idx,
+                         const char *const *patterns, size_t n);
+
+// Whether the file described by 'st' has to be searched.
+int trigram_index_may_match(const struct trigram_index *idx, const struct stat *st);
+
+// Unmap the index and free its memory.
+void trigram_index_close(struct trigram_index *idx);
+
+#endif
@@ -0,0 +1,629 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+// err.h contains various nonstandard BSD extensions, but they are
+// very handy.
+#include <err.h>
+
+#include "uring_reader.h"
+
+// user_data of the eventfd poll that wakes the ring thread.  Other
+// requests carry a pointer to their struct uring_op.
+#define WAKEUP_DATA 0
+
+// Largest single read; longer blocks are read in several.
+#define MAX_READ (1u << 30)
+
+enum uring_op_kind
+{
+  OP_OPEN,
+  OP_READ
+};
+
+struct uring_op
+{
+  enum uring_op_kind kind;
+};
+
+struct uring_file
+{
+  struct uring_op op;         /* OP_OPEN */
+  struct uring_reader *r;
+  struct uring_file *next;    /* in the pending or active list */
+  void *ctx;
+  off_t size;
+  off_t next_offset;          /* of the next block to read */
+  int fd;
+  int issued;                 /* every read has been started */
+  int reads;                  /* reads in the ring (ring thread only) */
+  int refs;                   /* ring thread + blocks with the pool (atomic) */
+  int error;
+  char path[];
+};
+
+struct uring_read
+{
+  struct uring_op op;         /* OP_READ */
+  struct uring_file *file;
+  unsigned char *buf;
+  size_t len;
+  size_t done;                /* bytes read so far */
+  off_t offset;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+// Check that the kernel supports every operation used here.
+static int probe(int fd)
+{
+  size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *p = calloc(1, len);
+  if (p == NULL)
+  {
+    return -1;
+  }
+
+  int ret = -1;
+  if (sys_register(fd, IORING_REGISTER_PROBE, p, 256) == 0)
+  {
+    static const int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_POLL_ADD};
+    ret = 0;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+      if (ops[i] > p->last_op || !(p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+      {
+        ret = -1;
+      }
+    }
+  }
+  free(p);
+  return ret;
+}
+
+// Map the rings of r->ring_fd.
+static int map_rings(struct uring_reader *r, const struct io_uring_params *p)
+{
+  r->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  r->cq_ring_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (r->cq_ring_len > r->sq_ring_len)
+    {
+      r->sq_ring_len = r->cq_ring_len;
+    }
+    r->cq_ring_len = r->sq_ring_len;
+  }
+
+  r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring == MAP_FAILED)
+  {
+    r->sq_ring = NULL;
+    return -1;
+  }
+
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+  {
+    r->cq_ring = r->sq_ring;
+  }
+  else
+  {
+    r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring == MAP_FAILED)
+    {
+      r->cq_ring = NULL;
+      return -1;
+    }
+  }
+
+  r->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED)
+  {
+    r->sqes = NULL;
+    return -1;
+  }
+
+  char *sq = r->sq_ring;
+  char *cq = r->cq_ring;
+  r->sq_head = (unsigned *)(sq + p->sq_off.head);
+  r->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p->sq_off.array);
+  r->cq_head = (unsigned *)(cq + p->cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+  return 0;
+}
+
+static void unmap_rings(struct uring_reader *r)
+{
+  if (r->sqes != NULL)
+  {
+    munmap(r->sqes, r->sqes_len);
+  }
+  if (r->cq_ring != NULL && r->cq_ring != r->sq_ring)
+  {
+    munmap(r->cq_ring, r->cq_ring_len);
+  }
+  if (r->sq_ring != NULL)
+  {
+    munmap(r->sq_ring, r->sq_ring_len);
+  }
+}
+
+// Claim the next submission queue entry.  There is always room: at
+// most 'depth' requests and the wakeup poll are ever in the ring.
+static struct io_uring_sqe *get_sqe(struct uring_reader *r)
+{
+  unsigned tail = *r->sq_tail;
+  unsigned index = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[index] = index;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->queued++;
+  return sqe;
+}
+
+static void arm_wakeup(struct uring_reader *r)
+{
+  struct io_uring_sqe *sqe = get_sqe(r);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = r->event_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = WAKEUP_DATA;
+}
+
+static void queue_open(struct uring_reader *r, struct uring_file *f)
+{
+  struct io_uring_sqe *sqe = get_sqe(r);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)f->path;
+  sqe->open_flags = O_RDONLY | O_CLOEXEC;
+  sqe->user_data = (uint64_t)(uintptr_t)&f->op;
+  r->inflight++;
+  r->open_files++;
+}
+
+// Queue the read of what is left of a block.
+static void queue_read(struct uring_reader *r, struct uring_read *rd)
+{
+  struct io_uring_sqe *sqe = get_sqe(r);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = rd->file->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(rd->buf + rd->done);
+  size_t len = rd->len - rd->done;
+  sqe->len = (unsigned)(len > MAX_READ ? MAX_READ : len);
+  sqe->off = (uint64_t)(rd->offset + (off_t)rd->done);
+  sqe->user_data = (uint64_t)(uintptr_t)&rd->op;
+  r->inflight++;
+}
+
+// Wake the ring thread if it is waiting.  Caller holds r->mutex.
+static void wake(struct uring_reader *r)
+{
+  if (r->sleeping)
+  {
+    r->sleeping = 0;
+    uint64_t one = 1;
+    (void)!write(r->event_fd, &one, sizeof(one));
+  }
+}
+
+// Pool job: call done_fn for a file and free it.
+static void finish_file(struct thread_pool *pool, void *arg)
+{
+  struct uring_file *f = arg;
+  f->r->done_fn(pool, f->ctx, f->error);
+  free(f);
+}
+
+// Drop a reference to a file.  The last one finishes it, on a pool
+// worker.
+static void file_unref(struct thread_pool *pool, struct uring_file *f)
+{
+  if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0)
+  {
+    return;
+  }
+  if (thread_pool_worker_id(pool) >= 0
+      || thread_pool_submit(pool, finish_file, f) != 0)
+  {
+    finish_file(pool, f);
+  }
+}
+
+// Close a file once all of its reads are done and drop the ring
+// thread's reference.  Ring thread only.
+static void maybe_close(struct uring_reader *r, struct uring_file *f)
+{
+  if (!f->issued || f->reads > 0)
+  {
+    return;
+  }
+  if (f->fd >= 0)
+  {
+    close(f->fd);
+    f->fd = -1;
+  }
+  r->open_files--;
+  file_unref(r->pool, f);
+}
+
+// Return a block buffer and its share of the budget.
+static void release_block(struct uring_reader *r, unsigned char *buf, size_t len)
+{
+  pthread_mutex_lock(&r->mutex);
+  r->bytes -= len;
+  wake(r);
+  pthread_mutex_unlock(&r->mutex);
+
+  if (len == r->block_size)
+  {
+    buf_pool_put(r->bufs, buf);
+  }
+  else
+  {
+    free(buf);
+  }
+}
+
+// Pool job: process one block.
+static void deliver(struct thread_pool *pool, void *arg)
+{
+  struct uring_read *rd = arg;
+  struct uring_file *f = rd->file;
+  struct uring_reader *r = f->r;
+
+  if (rd->done > 0)
+  {
+    r->block_fn(pool, f->ctx, rd->buf, rd->done, rd->offset);
+  }
+  release_block(r, rd->buf, rd->len);
+  free(rd);
+  file_unref(pool, f);
+}
+
+// Start reads of the active files, in order, while there is room in the
+// ring and in the budget.  Ring thread only; caller holds r->mutex (for
+// the budget).
+static void start_reads(struct uring_reader *r)
+{
+  while (r->active_head != NULL && r->inflight < r->depth)
+  {
+    struct uring_file *f = r->active_head;
+    size_t len = r->block_size;
+    if ((off_t)len > f->size - f->next_offset)
+    {
+      len = (size_t)(f->size - f->next_offset);
+    }
+
+    if (f->error || len == 0)
+    {
+      r->active_head = f->next;
+      f->issued = 1;
+      maybe_close(r, f);
+      continue;
+    }
+
+    // One block is always allowed, so a block larger than the budget
+    // still gets read.
+    if (r->bytes > 0 && r->bytes + len > URING_READER_MAX_BYTES)
+    {
+      break;
+    }
+
+    struct uring_read *rd = malloc(sizeof(struct uring_read));
+    unsigned char *buf = len == r->block_size ? buf_pool_get(r->bufs) : malloc(len);
+    if (rd == NULL || buf == NULL)
+    {
+      free(rd);
+      free(buf);
+      warnx("out of memory reading %s", f->path);
+      f->error = 1;
+      continue;
+    }
+
+    rd->op.kind = OP_READ;
+    rd->file = f;
+    rd->buf = buf;
+    rd->len = len;
+    rd->done = 0;
+    rd->offset = f->next_offset;
+    f->next_offset += (off_t)len;
+    f->reads++;
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+    r->bytes += len;
+    queue_read(r, rd);
+
+    if (f->next_offset >= f->size)
+    {
+      r->active_head = f->next;
+      f->issued = 1;
+    }
+  }
+}
+
+static void activate(struct uring_reader *r, struct uring_file *f)
+{
+  f->next = NULL;
+  if (r->active_head == NULL)
+  {
+    r->active_head = f;
+  }
+  else
+  {
+    r->active_tail->next = f;
+  }
+  r->active_tail = f;
+}
+
+// Handle one completion.  Ring thread only.
+static void complete(struct uring_reader *r, uint64_t data, int res)
+{
+  if (data == WAKEUP_DATA)
+  {
+    uint64_t count;
+    (void)!read(r->event_fd, &count, sizeof(count));
+    arm_wakeup(r);
+    return;
+  }
+
+  r->inflight--;
+  struct uring_op *op = (struct uring_op *)(uintptr_t)data;
+
+  if (op->kind == OP_OPEN)
+  {
+    struct uring_file *f = (struct uring_file *)op;
+    if (res < 0)
+    {
+      fflush(stdout);
+      warnx("failed to open %s: %s", f->path, strerror(-res));
+      f->error = 1;
+      f->issued = 1;
+      maybe_close(r, f);
+      return;
+    }
+    f->fd = res;
+    activate(r, f);
+    return;
+  }
+
+  struct uring_read *rd = (struct uring_read *)op;
+  struct uring_file *f = rd->file;
+  if (res == -EINTR || res == -EAGAIN)
+  {
+    queue_read(r, rd);
+    return;
+  }
+  if (res < 0)
+  {
+    fflush(stdout);
+    warnx("failed to read %s: %s", f->path, strerror(-res));
+    f->error = 1;
+    rd->done = 0;
+  }
+  else
+  {
+    rd->done += (size_t)res;
+    if (res > 0 && rd->done < rd->len)
+    {
+      // Short read: ask for the rest.
+      queue_read(r, rd);
+      return;
+    }
+  }
+
+  // The block is complete (or the file ended early, or failed).
+  f->reads--;
+  if (thread_pool_submit(r->pool, deliver, rd) != 0)
+  {
+    deliver(r->pool, rd);
+  }
+  maybe_close(r, f);
+}
+
+static void *ring_thread(void *arg)
+{
+  struct uring_reader *r = arg;
+
+  for (;;)
+  {
+    // Reads first: files they finish free up room for opens.
+    pthread_mutex_lock(&r->mutex);
+    start_reads(r);
+    struct uring_file *dropped = NULL;
+    while (r->pending_head != NULL && r->inflight < r->depth && r->open_files < r->depth)
+    {
+      struct uring_file *f = r->pending_head;
+      r->pending_head = f->next;
+      if (thread_pool_cancelled(r->pool))
+      {
+        f->next = dropped;
+        dropped = f;
+        continue;
+      }
+      queue_open(r, f);
+    }
+
+    int done = r->finishing && r->pending_head == NULL && r->active_head == NULL
+               && r->inflight == 0;
+    if (!done && r->queued == 0)
+    {
+      r->sleeping = 1;
+    }
+    pthread_mutex_unlock(&r->mutex);
+
+    // Files of a cancelled pool are finished without being read.  That
+    // may block on the pool, so not under the mutex.
+    while (dropped != NULL)
+    {
+      struct uring_file *f = dropped;
+      dropped = f->next;
+      file_unref(r->pool, f);
+    }
+    if (done)
+    {
+      break;
+    }
+
+    // Submit what was queued; if nothing was, wait for a completion
+    // (possibly the wakeup).
+    int n = sys_enter(r->ring_fd, r->queued, r->queued == 0 ? 1 : 0,
+                      IORING_ENTER_GETEVENTS);
+    if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      err(1, "io_uring_enter() failed");
+    }
+    if (n > 0)
+    {
+      r->queued -= (unsigned)n;
+    }
+
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+      const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      uint64_t data = cqe->user_data;
+      int res = cqe->res;
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      complete(r, data, res);
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    r->sleeping = 0;
+    pthread_mutex_unlock(&r->mutex);
+  }
+  return NULL;
+}
+
+int uring_reader_init(struct uring_reader *r, struct thread_pool *pool,
+                      unsigned depth, struct buf_pool *bufs,
+                      uring_block_fn block_fn, uring_done_fn done_fn)
+{
+  memset(r, 0, sizeof(struct uring_reader));
+  r->pool = pool;
+  r->block_fn = block_fn;
+  r->done_fn = done_fn;
+  r->block_size = bufs->size;
+  r->bufs = bufs;
+  r->depth = depth > 0 ? depth : 1;
+  r->event_fd = -1;
+  pthread_mutex_init(&r->mutex, NULL);
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  r->ring_fd = sys_setup(r->depth + 1, &p);
+  if (r->ring_fd < 0)
+  {
+    pthread_mutex_destroy(&r->mutex);
+    return -1;
+  }
+
+  r->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (probe(r->ring_fd) != 0 || r->event_fd < 0 || map_rings(r, &p) != 0)
+  {
+    uring_reader_destroy(r);
+    return -1;
+  }
+
+  arm_wakeup(r);
+  if (pthread_create(&r->thread, NULL, ring_thread, r) != 0)
+  {
+    uring_reader_destroy(r);
+    return -1;
+  }
+  return 0;
+}
+
+int uring_reader_submit(struct uring_reader *r, const char *path, off_t size,
+                        void *ctx)
+{
+  size_t pathlen = strlen(path);
+  struct uring_file *f = malloc(sizeof(struct uring_file) + pathlen + 1);
+  if (f == NULL)
+  {
+    return -1;
+  }
+  f->op.kind = OP_OPEN;
+  f->r = r;
+  f->next = NULL;
+  f->ctx = ctx;
+  f->size = size;
+  f->next_offset = 0;
+  f->fd = -1;
+  f->issued = 0;
+  f->reads = 0;
+  f->refs = 1;
+  f->error = 0;
+  memcpy(f->path, path, pathlen + 1);
+
+  pthread_mutex_lock(&r->mutex);
+  if (r->pending_head == NULL)
+  {
+    r->pending_head = f;
+  }
+  else
+  {
+    r->pending_tail->next = f;
+  }
+  r->pending_tail = f;
+  wake(r);
+  pthread_mutex_unlock(&r->mutex);
+  return 0;
+}
+
+void uring_reader_finish(struct uring_reader *r)
+{
+  pthread_mutex_lock(&r->mutex);
+  r->finishing = 1;
+  r->sleeping = 1;
+  wake(r);
+  pthread_mutex_unlock(&r->mutex);
+  pthread_join(r->thread, NULL);
+}
+
+void uring_reader_destroy(struct uring_reader *r)
+{
+  pthread_mutex_destroy(&r->mutex);
+  unmap_rings(r);
+  if (r->event_fd >= 0)
+  {
+    close(r->event_fd);
+  }
+  close(r->ring_fd);
+}
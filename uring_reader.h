@@ -0,0 +1,110 @@
+#ifndef URING_READER_H
+#define URING_READER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "thread_pool.h"
+#include "buf_pool.h"
+
+// Default number of operations kept in flight.
+#define URING_READER_DEFAULT_DEPTH 256
+
+// Bytes of blocks read (or being read) but not yet processed, beyond
+// which no further reads are started.
+#define URING_READER_MAX_BYTES (64 * 1024 * 1024)
+
+// Called on a pool worker for every block of a file that has been read.
+// 'buf' is only valid until the function returns.
+typedef void (*uring_block_fn)(struct thread_pool *pool, void *ctx,
+                               const unsigned char *buf, size_t len, off_t offset);
+
+// Called on a pool worker once every block of a file has been
+// processed.  'error' is non-zero (and a warning has been printed) if
+// the file could not be opened or read in full.
+typedef void (*uring_done_fn)(struct thread_pool *pool, void *ctx, int error);
+
+struct uring_file;
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * uring_reader
+ *
+ * Reads files with io_uring, for storage where the latency of each
+ * request, rather than CPU time, bounds throughput.  A thread of its
+ * own keeps up to 'depth' openat() and read() requests in flight, and
+ * hands every block that has been read to the pool as a job, so a few
+ * workers can keep a deep device queue busy.  A file is read in blocks
+ * the size of the buffers of 'bufs', each read as soon as there is room
+ * in the ring and in the URING_READER_MAX_BYTES budget; a file no
+ * larger than that arrives as a single block.  Full blocks are read
+ * into buffers of the pool, which may be shared with other readers;
+ * shorter ones are allocated to fit.  The ring is driven through the
+ * raw system calls, so no library is needed.
+ *
+ * Files not yet opened when the pool is cancelled (thread_pool_cancel())
+ * are not read at all: done_fn is called without any blocks.
+ *
+ * Files may be submitted from any thread, including pool workers
+ * (submission never blocks).  Shut down in this order: wait for
+ * whatever submits files (e.g. thread_pool_wait()), then
+ * uring_reader_finish(), thread_pool_destroy(), uring_reader_destroy().
+ */
+struct uring_reader
+{
+  struct thread_pool *pool;
+  uring_block_fn block_fn;
+  uring_done_fn done_fn;
+  size_t block_size;
+  unsigned depth;
+
+  int ring_fd;
+  int event_fd;               /* wakes the ring thread */
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  // Ring thread only.
+  pthread_t thread;
+  unsigned inflight;          /* requests in the ring, not counting the wakeup */
+  unsigned queued;            /* requests not yet passed to the kernel */
+  unsigned open_files;
+  struct uring_file *active_head, *active_tail;  /* open, reads left */
+
+  // Protected by 'mutex'.
+  pthread_mutex_t mutex;
+  struct uring_file *pending_head, *pending_tail;
+  int finishing;              /* no more files will be submitted */
+  int sleeping;               /* the ring thread waits for a wakeup */
+  size_t bytes;               /* see URING_READER_MAX_BYTES */
+  struct buf_pool *bufs;
+};
+
+// Set up a reader feeding 'pool' and start its thread.  Returns
+// non-zero if io_uring (with openat and read) is not available, in
+// which case the caller should read files itself.
+int uring_reader_init(struct uring_reader *r, struct thread_pool *pool,
+                      unsigned depth, struct buf_pool *bufs,
+                      uring_block_fn block_fn, uring_done_fn done_fn);
+
+// Queue 'size' bytes of the file at 'path' for reading.  The path is
+// copied.  Returns non-zero on allocation failure, in which case no
+// callback will be made for 'ctx'.
+int uring_reader_submit(struct uring_reader *r, const char *path, off_t size,
+                        void *ctx);
+
+// Declare that no more files will be submitted, and wait until every
+// file has been read and handed to the pool.
+void uring_reader_finish(struct uring_reader *r);
+
+// Free the reader.  The pool must have finished all its jobs.  'bufs'
+// is left to the caller.
+void uring_reader_destroy(struct uring_reader *r);
+
+#endif
@@ -0,0 +1,284 @@
+// Setting _DEFAULT_SOURCE is necessary to activate visibility of
+// certain header file contents on GNU/Linux systems.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+#include "walk.h"
+
+// Size of the getdents64() buffer.
+#define DENTS_BUF_SIZE (32 * 1024)
+
+// Directory jobs keep the fd opened by their parent (so the open is an
+// openat() relative to it) as long as fewer than this many are held;
+// beyond that they reopen their directory by path when they run.
+#define MAX_HELD_FDS 256
+
+// Layout of the records returned by getdents64().
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// A directory to traverse.  Directory jobs reference their parent so
+// that cycles can be detected by comparing against every ancestor.
+struct walk_dir
+{
+  struct walk *walk;
+  struct walk_dir *parent;
+  int refs;
+  int fd;               /* already open, or -1 */
+  dev_t dev;
+  ino_t ino;
+  char path[];
+};
+
+static struct walk_dir *walk_dir_new(struct walk *walk, struct walk_dir *parent,
+                                     const char *path, size_t pathlen,
+                                     const char *name, const struct stat *st)
+{
+  size_t namelen = name == NULL ? 0 : strlen(name);
+  struct walk_dir *dir = malloc(sizeof(struct walk_dir) + pathlen + 1 + namelen + 1);
+  if (dir == NULL)
+  {
+    return NULL;
+  }
+
+  memcpy(dir->path, path, pathlen);
+  if (name != NULL)
+  {
+    dir->path[pathlen++] = '/';
+    memcpy(dir->path + pathlen, name, namelen);
+    pathlen += namelen;
+  }
+  dir->path[pathlen] = '\0';
+
+  dir->walk = walk;
+  dir->parent = parent;
+  dir->refs = 1;
+  dir->fd = -1;
+  dir->dev = st->st_dev;
+  dir->ino = st->st_ino;
+  if (parent != NULL)
+  {
+    __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+  }
+  return dir;
+}
+
+static void walk_dir_release(struct walk_dir *dir)
+{
+  while (dir != NULL && __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    struct walk_dir *parent = dir->parent;
+    free(dir);
+    dir = parent;
+  }
+}
+
+// True if (dev, ino) is 'dir' or one of its ancestors (FTS_DC).
+static int walk_is_cycle(const struct walk_dir *dir, const struct stat *st)
+{
+  for (; dir != NULL; dir = dir->parent)
+  {
+    if (dir->dev == st->st_dev && dir->ino == st->st_ino)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void walk_dir_run(struct thread_pool *pool, void *arg);
+
+// Hand a subdirectory of 'parent' to the pool.
+static void walk_submit_dir(struct thread_pool *pool, struct walk_dir *parent,
+                            int parent_fd, size_t pathlen, const char *name,
+                            const struct stat *st)
+{
+  struct walk *walk = parent->walk;
+  struct walk_dir *dir = walk_dir_new(walk, parent, parent->path, pathlen, name, st);
+  if (dir == NULL)
+  {
+    return;
+  }
+
+  if (__atomic_add_fetch(&walk->open_fds, 1, __ATOMIC_RELAXED) <= MAX_HELD_FDS)
+  {
+    dir->fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (dir->fd < 0)
+  {
+    __atomic_sub_fetch(&walk->open_fds, 1, __ATOMIC_RELAXED);
+  }
+
+  if (thread_pool_submit(pool, walk_dir_run, dir) != 0)
+  {
+    if (dir->fd >= 0)
+    {
+      close(dir->fd);
+      __atomic_sub_fetch(&walk->open_fds, 1, __ATOMIC_RELAXED);
+    }
+    walk_dir_release(dir);
+  }
+}
+
+// Pool job: read one directory, report its files and submit its
+// subdirectories.
+static void walk_dir_run(struct thread_pool *pool, void *arg)
+{
+  struct walk_dir *dir = arg;
+  struct walk *walk = dir->walk;
+
+  int fd = dir->fd;
+  if (fd >= 0)
+  {
+    __atomic_sub_fetch(&walk->open_fds, 1, __ATOMIC_RELAXED);
+  }
+  if (thread_pool_cancelled(pool))
+  {
+    // The rest of the walk is not wanted.
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    walk_dir_release(dir);
+    return;
+  }
+  if (fd < 0)
+  {
+    fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+
+  if (fd < 0)
+  {
+    // Unreadable directory (FTS_DNR): skipped, as by the fts loops.
+    walk_dir_release(dir);
+    return;
+  }
+
+  // Children are named "path/name", except that a trailing '/' on the
+  // path is not doubled (as fts does).
+  size_t pathlen = strlen(dir->path);
+  if (pathlen > 0 && dir->path[pathlen - 1] == '/')
+  {
+    pathlen--;
+  }
+
+  char *buf = malloc(DENTS_BUF_SIZE);
+  char *child = NULL;
+  size_t child_cap = 0;
+
+  for (;;)
+  {
+    long n = buf == NULL || thread_pool_cancelled(pool)
+                 ? -1 : syscall(SYS_getdents64, fd, buf, DENTS_BUF_SIZE);
+    if (n <= 0)
+    {
+      break;
+    }
+
+    for (long off = 0; off < n;)
+    {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+      off += d->d_reclen;
+
+      const char *name = d->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      {
+        continue;
+      }
+
+      // FTS_LOGICAL: stat every entry, following symlinks.  Entries
+      // that cannot be stat'ed (e.g. dangling links) are skipped.
+      struct stat st;
+      if (fstatat(fd, name, &st, 0) != 0)
+      {
+        continue;
+      }
+
+      if (S_ISDIR(st.st_mode))
+      {
+        if (!walk_is_cycle(dir, &st)
+            && (walk->dir_fn == NULL || walk->dir_fn(name, walk->ctx)))
+        {
+          walk_submit_dir(pool, dir, fd, pathlen, name, &st);
+        }
+      }
+      else if (S_ISREG(st.st_mode))
+      {
+        size_t need = pathlen + 1 + strlen(name) + 1;
+        if (need > child_cap)
+        {
+          char *bigger = realloc(child, need * 2);
+          if (bigger == NULL)
+          {
+            continue;
+          }
+          child = bigger;
+          child_cap = need * 2;
+        }
+        memcpy(child, dir->path, pathlen);
+        child[pathlen] = '/';
+        strcpy(child + pathlen + 1, name);
+        walk->fn(pool, child, &st, walk->ctx);
+      }
+    }
+  }
+
+  free(child);
+  free(buf);
+  close(fd);
+  walk_dir_release(dir);
+}
+
+int walk_parallel(struct walk *walk, struct thread_pool *pool,
+                  char *const *paths, walk_file_fn fn, walk_dir_fn dir_fn,
+                  void *ctx)
+{
+  if (walk == NULL || pool == NULL || paths == NULL || fn == NULL)
+  {
+    return -1;
+  }
+
+  walk->fn = fn;
+  walk->dir_fn = dir_fn;
+  walk->ctx = ctx;
+  walk->open_fds = 0;
+
+  for (char *const *path = paths; *path != NULL; path++)
+  {
+    struct stat st;
+    if (stat(*path, &st) != 0)
+    {
+      continue;
+    }
+
+    if (S_ISREG(st.st_mode))
+    {
+      fn(pool, *path, &st, ctx);
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+      struct walk_dir *dir = walk_dir_new(walk, NULL, *path, strlen(*path), NULL, &st);
+      if (dir != NULL && thread_pool_submit(pool, walk_dir_run, dir) != 0)
+      {
+        walk_dir_release(dir);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "thread_pool.h"
+
+// Called once for every regular file found, with the same path fts
+// would have produced and the stat() of the file (symlinks followed).
+// Runs on a pool worker (or on the caller of walk_parallel() for root
+// paths that are files), so it must be thread-safe; typically it just
+// submits a job for the file.
+typedef void (*walk_file_fn)(struct thread_pool *pool, const char *path,
+                             const struct stat *st, void *ctx);
+
+// Called for every subdirectory found below the roots, with its name
+// (the last component only) before it is opened; returns zero to prune
+// it and everything under it.  Must be thread-safe, like walk_file_fn.
+typedef int (*walk_dir_fn)(const char *name, void *ctx);
+
+/*
+ * walk
+ *
+ * Parallel directory traversal.  Each directory becomes a pool job that
+ * reads its entries with getdents64(), stats them relative to the
+ * directory fd, reports regular files and submits subdirectories as new
+ * jobs.  Like fts with FTS_LOGICAL, symbolic links are followed and a
+ * directory that is its own ancestor (same dev/inode) is not entered.
+ * Once the pool is cancelled (thread_pool_cancel()), directories not
+ * yet read are skipped.
+ *
+ * The caller allocates the struct and keeps it alive until the pool
+ * has finished (thread_pool_wait() or thread_pool_destroy()).
+ */
+struct walk
+{
+  walk_file_fn fn;
+  walk_dir_fn dir_fn;   /* NULL to enter every directory */
+  void *ctx;
+  int open_fds;   /* directory fds held by queued directory jobs */
+};
+
+// Start walking 'paths' (a NULL-terminated array, as for fts_open()) on
+// 'pool', entering the subdirectories 'dir_fn' (if not NULL) accepts.  Returns once the roots have been handed out; the walk is
+// complete when the pool has no more pending jobs.  Returns non-zero on
+// error.
+int walk_parallel(struct walk *walk, struct thread_pool *pool,
+                  char *const *paths, walk_file_fn fn, walk_dir_fn dir_fn,
+                  void *ctx);
+
+#endif